@@ -21,12 +21,17 @@
 
 enum
 {
-  /* pick a number small enough for common tracker software:
+  /* pick a number small enough for common http tracker software:
    *  - ocelot has no upper bound
    *  - opentracker has an upper bound of 64
-   *  - udp protocol has an upper bound of 74
    *  - xbtt has no upper bound */
-  TR_MULTISCRAPE_MAX = 64
+  TR_MULTISCRAPE_MAX_HTTP = 64,
+
+  /* the udp protocol fits 74 info_hashes into a single scrape packet */
+  TR_MULTISCRAPE_MAX_UDP = 74,
+
+  /* the size of the arrays in tr_scrape_request and tr_scrape_response */
+  TR_MULTISCRAPE_MAX = TR_MULTISCRAPE_MAX_UDP
 };
 
 typedef struct
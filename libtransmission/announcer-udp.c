@@ -9,7 +9,8 @@
 #define __LIBTRANSMISSION_ANNOUNCER_MODULE__
 
 #include <errno.h> /* errno, EAFNOSUPPORT */
-#include <string.h> /* memcpy (), memset () */
+#include <stdlib.h> /* atoi () */
+#include <string.h> /* memcpy (), memset (), strrchr () */
 
 #include <event2/buffer.h>
 #include <event2/dns.h>
@@ -20,11 +21,13 @@
 #include "announcer-common.h"
 #include "crypto-utils.h" /* tr_rand_buffer () */
 #include "log.h"
+#include "net.h"
 #include "peer-io.h"
 #include "peer-mgr.h" /* tr_peerMgrCompactToPex () */
 #include "ptrarray.h"
 #include "tr-udp.h"
 #include "utils.h"
+#include "variant.h"
 
 #define dbgmsg(name, ...) \
   do \
@@ -133,7 +136,18 @@ is_tau_response_message (tau_action_t action, size_t msglen)
 
 enum
 {
-    TAU_REQUEST_TTL = 60
+    /* how long we wait for a response, from when the request was sent */
+    TAU_REQUEST_TTL = 60,
+
+    /* how long a request may wait to be sent while we're pacing them */
+    TAU_QUEUED_REQUEST_TTL = (60 * 5),
+
+    /* how many requests we send to a single tracker per second,
+       so that a burst of startup announces doesn't get us banned */
+    TAU_MAX_REQUESTS_PER_SEC = 25,
+
+    /* how long a DNS lookup is trusted */
+    TAU_ADDR_TTL_SECS = (60 * 60)
 };
 
 /****
@@ -441,6 +455,10 @@ struct tau_tracker
 
     time_t close_at;
 
+    /* rate-limiting: how many requests were sent during pace_second */
+    time_t pace_second;
+    int pace_count;
+
     tr_ptrArray announces;
     tr_ptrArray scrapes;
 };
@@ -508,7 +526,7 @@ tau_tracker_on_dns (int errcode, struct evutil_addrinfo *addr, void * vtracker)
     {
         dbgmsg (tracker->key, "DNS lookup succeeded");
         tracker->addr = addr;
-        tracker->addr_expiration_time = tr_time () + (60*60); /* one hour */
+        tracker->addr_expiration_time = tr_time () + TAU_ADDR_TTL_SECS;
         tau_tracker_upkeep (tracker);
     }
 }
@@ -529,6 +547,12 @@ tau_tracker_send_request (struct tau_tracker  * tracker,
     evbuffer_free (buf);
 }
 
+static bool
+tau_tracker_can_send (const struct tau_tracker * tracker)
+{
+    return tracker->pace_count < TAU_MAX_REQUESTS_PER_SEC;
+}
+
 static void
 tau_tracker_send_reqs (struct tau_tracker * tracker)
 {
@@ -541,12 +565,19 @@ tau_tracker_send_reqs (struct tau_tracker * tracker)
     assert (tracker->addr != NULL);
     assert (tracker->connection_expiration_time > now);
 
+    if (tracker->pace_second != now) {
+        tracker->pace_second = now;
+        tracker->pace_count = 0;
+    }
+
+    /* anything left unsent is picked up by the next upkeep */
     reqs = &tracker->announces;
-    for (i=0, n=tr_ptrArraySize (reqs); i<n; ++i) {
+    for (i=0, n=tr_ptrArraySize (reqs); i<n && tau_tracker_can_send (tracker); ++i) {
         struct tau_announce_request * req = tr_ptrArrayNth (reqs, i);
         if (!req->sent_at) {
             dbgmsg (tracker->key, "sending announce req %p", (void*)req);
             req->sent_at = now;
+            ++tracker->pace_count;
             tau_tracker_send_request (tracker, req->payload, req->payload_len);
             if (req->callback == NULL) {
                 tau_announce_request_free (req);
@@ -558,11 +589,12 @@ tau_tracker_send_reqs (struct tau_tracker * tracker)
     }
 
     reqs = &tracker->scrapes;
-    for (i=0, n=tr_ptrArraySize (reqs); i<n; ++i) {
+    for (i=0, n=tr_ptrArraySize (reqs); i<n && tau_tracker_can_send (tracker); ++i) {
         struct tau_scrape_request * req = tr_ptrArrayNth (reqs, i);
         if (!req->sent_at) {
             dbgmsg (tracker->key, "sending scrape req %p", (void*)req);
             req->sent_at = now;
+            ++tracker->pace_count;
             tau_tracker_send_request (tracker, req->payload, req->payload_len);
             if (req->callback == NULL) {
                 tau_scrape_request_free (req);
@@ -609,6 +641,15 @@ on_tracker_connection_response (struct tau_tracker  * tracker,
     tau_tracker_upkeep (tracker);
 }
 
+static bool
+tau_request_is_expired (time_t created_at, time_t sent_at, time_t now)
+{
+    if (sent_at)
+        return sent_at + TAU_REQUEST_TTL < now;
+
+    return created_at + TAU_QUEUED_REQUEST_TTL < now;
+}
+
 static void
 tau_tracker_timeout_reqs (struct tau_tracker * tracker)
 {
@@ -625,7 +666,7 @@ tau_tracker_timeout_reqs (struct tau_tracker * tracker)
     reqs = &tracker->announces;
     for (i=0, n=tr_ptrArraySize (reqs); i<n; ++i) {
         struct tau_announce_request * req = tr_ptrArrayNth (reqs, i);
-        if (cancel_all || (req->created_at + TAU_REQUEST_TTL < now)) {
+        if (cancel_all || tau_request_is_expired (req->created_at, req->sent_at, now)) {
             dbgmsg (tracker->key, "timeout announce req %p", (void*)req);
             tau_announce_request_fail (req, false, true, NULL);
             tau_announce_request_free (req);
@@ -638,7 +679,7 @@ tau_tracker_timeout_reqs (struct tau_tracker * tracker)
     reqs = &tracker->scrapes;
     for (i=0, n=tr_ptrArraySize (reqs); i<n; ++i) {
         struct tau_scrape_request * req = tr_ptrArrayNth (reqs, i);
-        if (cancel_all || (req->created_at + TAU_REQUEST_TTL < now)) {
+        if (cancel_all || tau_request_is_expired (req->created_at, req->sent_at, now)) {
             dbgmsg (tracker->key, "timeout scrape req %p", (void*)req);
             tau_scrape_request_fail (req, false, true, NULL);
             tau_scrape_request_free (req);
@@ -736,6 +777,143 @@ struct tr_announcer_udp
     tr_session * session;
 };
 
+/* takes ownership of key and host */
+static struct tau_tracker *
+tau_tracker_new (struct tr_announcer_udp * tau, char * key, char * host, int port)
+{
+    struct tau_tracker * tracker = tr_new0 (struct tau_tracker, 1);
+    tracker->session = tau->session;
+    tracker->key = key;
+    tracker->host = host;
+    tracker->port = port;
+    tracker->scrapes = TR_PTR_ARRAY_INIT;
+    tracker->announces = TR_PTR_ARRAY_INIT;
+    tr_ptrArrayAppend (&tau->trackers, tracker);
+    dbgmsg (tracker->key, "New tau_tracker created");
+    return tracker;
+}
+
+/****
+*****  Remember trackers' addresses and connection IDs between sessions
+*****  so that a restart doesn't have to repeat all the DNS lookups and
+*****  connection handshakes before the first announces can go out.
+****/
+
+static char*
+tau_get_cache_filename (const tr_session * session)
+{
+    return tr_buildPath (session->configDir, "udp-trackers.json", NULL);
+}
+
+static void
+tau_load_cache (struct tr_announcer_udp * tau)
+{
+    tr_variant top;
+    char * filename = tau_get_cache_filename (tau->session);
+
+    if (tr_variantFromFile (&top, TR_VARIANT_FMT_JSON, filename, NULL))
+    {
+        size_t i;
+        tr_quark key;
+        tr_variant * d;
+        const time_t now = tr_time ();
+
+        for (i=0; tr_variantDictChild (&top, i, &key, &d); ++i)
+        {
+            int64_t i64;
+            const char * str;
+            const char * port_str;
+            struct evutil_addrinfo hints;
+            struct evutil_addrinfo * addr = NULL;
+            struct tau_tracker * tracker;
+            const char * tracker_key = tr_quark_get_string (key, NULL);
+
+            if (!tr_variantDictFindInt (d, TR_KEY_address_expires, &i64) || (i64 <= now))
+                continue;
+            if (!tr_variantDictFindStr (d, TR_KEY_address, &str, NULL))
+                continue;
+            if ((port_str = strrchr (tracker_key, ':')) == NULL)
+                continue;
+
+            memset (&hints, 0, sizeof (hints));
+            hints.ai_family = AF_UNSPEC;
+            hints.ai_socktype = SOCK_DGRAM;
+            hints.ai_protocol = IPPROTO_UDP;
+            hints.ai_flags = EVUTIL_AI_NUMERICHOST;
+            if (evutil_getaddrinfo (str, NULL, &hints, &addr) != 0)
+                continue;
+
+            tracker = tau_tracker_new (tau, tr_strdup (tracker_key),
+                                       tr_strndup (tracker_key, port_str - tracker_key),
+                                       atoi (port_str + 1));
+            tracker->addr = addr;
+            tracker->addr_expiration_time = i64;
+
+            /* connection IDs are short-lived, so this only helps quick restarts */
+            if (tr_variantDictFindInt (d, TR_KEY_connection_expires, &i64) && (i64 > now)
+                && (i64 <= now + TAU_CONNECTION_TTL_SECS))
+            {
+                int64_t connection_id;
+
+                if (tr_variantDictFindInt (d, TR_KEY_connection_id, &connection_id))
+                {
+                    tracker->connection_id = (tau_connection_t) connection_id;
+                    tracker->connection_expiration_time = i64;
+                }
+            }
+
+            dbgmsg (tracker->key, "Loaded cached address %s", str);
+        }
+
+        tr_variantFree (&top);
+    }
+
+    tr_free (filename);
+}
+
+static void
+tau_save_cache (const struct tr_announcer_udp * tau)
+{
+    int i;
+    tr_variant top;
+    const time_t now = tr_time ();
+    const int n = tr_ptrArraySize (&tau->trackers);
+    char * filename = tau_get_cache_filename (tau->session);
+
+    tr_variantInitDict (&top, n);
+
+    for (i=0; i<n; ++i)
+    {
+        tr_port port;
+        tr_address addr;
+        tr_variant * d;
+        const struct tau_tracker * tracker = tr_ptrArrayNth ((tr_ptrArray*)&tau->trackers, i);
+
+        if ((tracker->addr == NULL) || (tracker->addr_expiration_time <= now))
+            continue;
+        if (!tr_address_from_sockaddr_storage (&addr, &port, (const struct sockaddr_storage*) tracker->addr->ai_addr))
+            continue;
+
+        d = tr_variantDictAddDict (&top, tr_quark_new (tracker->key, TR_BAD_SIZE), 4);
+        tr_variantDictAddStr (d, TR_KEY_address, tr_address_to_string (&addr));
+        tr_variantDictAddInt (d, TR_KEY_address_expires, tracker->addr_expiration_time);
+
+        if (tracker->connection_expiration_time > now)
+        {
+            tr_variantDictAddInt (d, TR_KEY_connection_id, (int64_t) tracker->connection_id);
+            tr_variantDictAddInt (d, TR_KEY_connection_expires, tracker->connection_expiration_time);
+        }
+    }
+
+    tr_variantToFile (&top, TR_VARIANT_FMT_JSON, filename);
+    tr_variantFree (&top);
+    tr_free (filename);
+}
+
+/****
+*****
+****/
+
 static struct tr_announcer_udp*
 announcer_udp_get (tr_session * session)
 {
@@ -748,6 +926,7 @@ announcer_udp_get (tr_session * session)
     tau->trackers = TR_PTR_ARRAY_INIT;
     tau->session = session;
     session->announcer_udp = tau;
+    tau_load_cache (tau);
     return tau;
 }
 
@@ -775,15 +954,7 @@ tau_session_get_tracker (struct tr_announcer_udp * tau, const char * url)
     /* if we don't have a match, build a new tracker */
     if (tracker == NULL)
     {
-        tracker = tr_new0 (struct tau_tracker, 1);
-        tracker->session = tau->session;
-        tracker->key = key;
-        tracker->host = host;
-        tracker->port = port;
-        tracker->scrapes = TR_PTR_ARRAY_INIT;
-        tracker->announces = TR_PTR_ARRAY_INIT;
-        tr_ptrArrayAppend (&tau->trackers, tracker);
-        dbgmsg (tracker->key, "New tau_tracker created");
+        tracker = tau_tracker_new (tau, key, host, port);
     }
     else
     {
@@ -851,6 +1022,10 @@ tr_tracker_udp_start_shutdown (tr_session * session)
     if (tau != NULL)
     {
         int i, n;
+
+        /* save before the trackers start dropping their addresses */
+        tau_save_cache (tau);
+
         for (i=0, n=tr_ptrArraySize (&tau->trackers); i<n; ++i)
         {
             struct tau_tracker * tracker = tr_ptrArrayNth (&tau->trackers, i);
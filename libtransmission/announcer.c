@@ -133,12 +133,48 @@ compareStops (const void * va, const void * vb)
 ****
 ***/
 
+/* how quickly a tracker host has been answering our announces.
+ * this is kept per-host so that all the torrents using it can share it */
+typedef struct
+{
+    /* same format as tr_tracker.key */
+    char * key;
+
+    int latencyMsec;
+}
+tr_tracker_host;
+
+static int
+compareTrackerHosts (const void * va, const void * vb)
+{
+    const tr_tracker_host * a = va;
+    const tr_tracker_host * b = vb;
+
+    return strcmp (a->key, b->key);
+}
+
+static void
+trackerHostFree (void * vhost)
+{
+    tr_tracker_host * host = vhost;
+
+    tr_free (host->key);
+    tr_free (host);
+}
+
 /**
  * "global" (per-tr_session) fields
  */
 typedef struct tr_announcer
 {
     tr_ptrArray stops; /* tr_announce_request */
+    tr_ptrArray hosts; /* tr_tracker_host, sorted by key */
+
+    /* tiers with an announce or scrape pending,
+     * as a min-heap sorted by tr_tier.dueAt */
+    struct tr_tier ** schedule;
+    int schedule_count;
+    int schedule_alloc;
 
     tr_session * session;
     struct event * upkeepTimer;
@@ -166,6 +202,7 @@ tr_announcerInit (tr_session * session)
 
     a = tr_new0 (tr_announcer, 1);
     a->stops = TR_PTR_ARRAY_INIT;
+    a->hosts = TR_PTR_ARRAY_INIT;
     a->key = tr_rand_int (INT_MAX);
     a->session = session;
     a->slotsAvailable = MAX_CONCURRENT_TASKS;
@@ -190,6 +227,8 @@ tr_announcerClose (tr_session * session)
     announcer->upkeepTimer = NULL;
 
     tr_ptrArrayDestruct (&announcer->stops, NULL);
+    tr_ptrArrayDestruct (&announcer->hosts, trackerHostFree);
+    tr_free (announcer->schedule);
 
     session->announcer = NULL;
     tr_free (announcer);
@@ -311,6 +350,11 @@ typedef struct tr_tier
 
     char lastAnnounceStr[128];
     char lastScrapeStr[128];
+
+    /* when this tier next needs attention, and its place in
+     * tr_announcer.schedule (or -1 if it's not scheduled) */
+    time_t dueAt;
+    int scheduleIndex;
 }
 tr_tier;
 
@@ -350,11 +394,173 @@ tierConstruct (tr_tier * tier, tr_torrent * tor)
     tier->announceMinIntervalSec = DEFAULT_ANNOUNCE_MIN_INTERVAL_SEC;
     tier->scrapeAt = get_next_scrape_time (tor->session, tier, tr_rand_int_weak (180));
     tier->tor = tor;
+    tier->scheduleIndex = -1;
+}
+
+/***
+****  SCHEDULE
+****
+****  Rather than walking every torrent's tiers each upkeep, keep the
+****  tiers that have work pending in a min-heap sorted by when that
+****  work comes due. Anything that changes a tier's announce or scrape
+****  state must call tierReschedule () afterwards.
+***/
+
+/* returns the earliest time that tierNeedsToAnnounce () or
+ * tierNeedsToScrape () could be true, or 0 if neither can be */
+static time_t
+tierGetDueTime (const tr_tier * tier)
+{
+    time_t due = 0;
+
+    if (!tier->isAnnouncing
+        && !tier->isScraping
+        && (tier->announceAt != 0)
+        && (tier->announce_event_count > 0))
+        due = tier->announceAt;
+
+    if (!tier->isScraping
+        && (tier->scrapeAt != 0)
+        && (tier->currentTracker != NULL)
+        && (tier->currentTracker->scrape != NULL)
+        && (!due || (tier->scrapeAt < due)))
+        due = tier->scrapeAt;
+
+    return due;
+}
+
+static void
+scheduleSwap (tr_announcer * announcer, int i, int j)
+{
+    tr_tier * tmp = announcer->schedule[i];
+    announcer->schedule[i] = announcer->schedule[j];
+    announcer->schedule[j] = tmp;
+    announcer->schedule[i]->scheduleIndex = i;
+    announcer->schedule[j]->scheduleIndex = j;
+}
+
+static void
+scheduleSiftUp (tr_announcer * announcer, int i)
+{
+    while (i > 0)
+    {
+        const int parent = (i - 1) / 2;
+
+        if (announcer->schedule[parent]->dueAt <= announcer->schedule[i]->dueAt)
+            break;
+
+        scheduleSwap (announcer, i, parent);
+        i = parent;
+    }
+}
+
+static void
+scheduleSiftDown (tr_announcer * announcer, int i)
+{
+    for (;;)
+    {
+        int min = i;
+        const int left = (i * 2) + 1;
+        const int right = left + 1;
+
+        if ((left < announcer->schedule_count)
+            && (announcer->schedule[left]->dueAt < announcer->schedule[min]->dueAt))
+            min = left;
+
+        if ((right < announcer->schedule_count)
+            && (announcer->schedule[right]->dueAt < announcer->schedule[min]->dueAt))
+            min = right;
+
+        if (min == i)
+            break;
+
+        scheduleSwap (announcer, i, min);
+        i = min;
+    }
+}
+
+static void
+tierUnschedule (tr_announcer * announcer, tr_tier * tier)
+{
+    const int i = tier->scheduleIndex;
+
+    if (i < 0)
+        return;
+
+    assert (announcer->schedule[i] == tier);
+    tier->scheduleIndex = -1;
+
+    if (i != --announcer->schedule_count)
+    {
+        tr_tier * last = announcer->schedule[announcer->schedule_count];
+        announcer->schedule[i] = last;
+        last->scheduleIndex = i;
+        scheduleSiftUp (announcer, i);
+        scheduleSiftDown (announcer, last->scheduleIndex);
+    }
 }
 
+static void
+tierReschedule (tr_tier * tier)
+{
+    tr_announcer * announcer = tier->tor->session->announcer;
+    const time_t due = tierGetDueTime (tier);
+
+    if (announcer == NULL)
+        return;
+
+    if (due == 0)
+    {
+        tierUnschedule (announcer, tier);
+    }
+    else if (tier->scheduleIndex < 0)
+    {
+        if (announcer->schedule_alloc <= announcer->schedule_count)
+        {
+            announcer->schedule_alloc = MAX (announcer->schedule_alloc * 2, 64);
+            announcer->schedule = tr_renew (tr_tier*, announcer->schedule, announcer->schedule_alloc);
+        }
+
+        tier->dueAt = due;
+        tier->scheduleIndex = announcer->schedule_count++;
+        announcer->schedule[tier->scheduleIndex] = tier;
+        scheduleSiftUp (announcer, tier->scheduleIndex);
+    }
+    else if (tier->dueAt != due)
+    {
+        tier->dueAt = due;
+        scheduleSiftUp (announcer, tier->scheduleIndex);
+        scheduleSiftDown (announcer, tier->scheduleIndex);
+    }
+}
+
+/* pops the next tier whose work is due, or returns NULL if there isn't one */
+static tr_tier *
+schedulePopDue (tr_announcer * announcer, time_t now)
+{
+    tr_tier * tier = NULL;
+
+    if ((announcer->schedule_count > 0) && (announcer->schedule[0]->dueAt <= now))
+    {
+        tier = announcer->schedule[0];
+        tierUnschedule (announcer, tier);
+    }
+
+    return tier;
+}
+
+/***
+****
+***/
+
 static void
 tierDestruct (tr_tier * tier)
 {
+    tr_announcer * announcer = tier->tor->session->announcer;
+
+    if (announcer != NULL)
+        tierUnschedule (announcer, tier);
+
     tr_free (tier->announce_events);
 }
 
@@ -690,6 +896,7 @@ tr_announcerAddTorrent (tr_torrent           * tor,
                         tr_tracker_callback    callback,
                         void                 * callbackData)
 {
+    int i;
     tr_torrent_tiers * tiers;
 
     assert (tr_isTorrent (tor));
@@ -700,6 +907,9 @@ tr_announcerAddTorrent (tr_torrent           * tor,
 
     addTorrentToTier (tiers, tor);
 
+    for (i=0; i<tiers->tier_count; ++i)
+        tierReschedule (&tiers->tiers[i]);
+
     return tiers;
 }
 
@@ -827,6 +1037,8 @@ tier_announce_event_push (tr_tier            * tier,
 
     dbgmsg_tier_announce_queue (tier);
     dbgmsg (tier, "announcing in %d seconds", (int)difftime (announceAt,tr_time ()));
+
+    tierReschedule (tier);
 }
 
 static tr_announce_event
@@ -974,6 +1186,7 @@ struct announce_data
 {
     int tierId;
     time_t timeSent;
+    uint64_t timeSentMsec;
     tr_announce_event event;
     tr_session * session;
 
@@ -981,6 +1194,31 @@ struct announce_data
     bool isRunningOnSuccess;
 };
 
+static tr_tracker_host *
+getHost (const tr_announcer * announcer, const char * key)
+{
+    tr_tracker_host tmp;
+
+    tmp.key = (char*) key;
+
+    return tr_ptrArrayFindSorted ((tr_ptrArray*)&announcer->hosts, &tmp, compareTrackerHosts);
+}
+
+static void
+setHostLatency (tr_announcer * announcer, const char * key, int latencyMsec)
+{
+    tr_tracker_host * host = getHost (announcer, key);
+
+    if (host == NULL)
+    {
+        host = tr_new0 (tr_tracker_host, 1);
+        host->key = tr_strdup (key);
+        tr_ptrArrayInsertSorted (&announcer->hosts, host, compareTrackerHosts);
+    }
+
+    host->latencyMsec = latencyMsec;
+}
+
 static void
 on_announce_error (tr_tier * tier, const char * err, tr_announce_event e)
 {
@@ -1048,6 +1286,10 @@ on_announce_done (const tr_announce_response  * response,
                       response->errmsg ? response->errmsg : "none",
                       response->warning ? response->warning : "none");
 
+        if (response->did_connect && !response->did_timeout && (tier->currentTracker != NULL))
+            setHostLatency (announcer, tier->currentTracker->key,
+                            (int)(tr_time_msec () - data->timeSentMsec));
+
         tier->lastAnnounceTime = now;
         tier->lastAnnounceTimedOut = response->did_timeout;
         tier->lastAnnounceSucceeded = false;
@@ -1180,6 +1422,8 @@ on_announce_done (const tr_announce_response  * response,
                 tier_announce_event_push (tier, TR_ANNOUNCE_EVENT_NONE, now + i);
             }
         }
+
+        tierReschedule (tier);
     }
 
     tr_free (data);
@@ -1249,11 +1493,13 @@ tierAnnounce (tr_announcer * announcer, tr_tier * tier)
     data->tierId = tier->key;
     data->isRunningOnSuccess = tor->isRunning;
     data->timeSent = now;
+    data->timeSentMsec = tr_time_msec ();
     data->event = announce_event;
 
     tier->isAnnouncing = true;
     tier->lastAnnounceStartTime = now;
     --announcer->slotsAvailable;
+    tierReschedule (tier);
 
     announce_request_delegate (announcer, req, on_announce_done, data);
 }
@@ -1382,6 +1628,8 @@ on_scrape_done (const tr_scrape_response * response, void * vsession)
                         tracker->consecutiveFailures = 0;
                     }
                 }
+
+                tierReschedule (tier);
             }
         }
     }
@@ -1406,6 +1654,15 @@ scrape_request_delegate (tr_announcer             * announcer,
         tr_logAddError ("Unsupported url: %s", request->url);
 }
 
+static int
+get_multiscrape_max (const char * url)
+{
+    if (memcmp (url, "udp://", 6) == 0)
+        return TR_MULTISCRAPE_MAX_UDP;
+
+    return TR_MULTISCRAPE_MAX_HTTP;
+}
+
 static void
 multiscrape (tr_announcer * announcer, tr_ptrArray * tiers)
 {
@@ -1429,7 +1686,7 @@ multiscrape (tr_announcer * announcer, tr_ptrArray * tiers)
         {
             tr_scrape_request * req = &requests[j];
 
-            if (req->info_hash_count >= TR_MULTISCRAPE_MAX)
+            if (req->info_hash_count >= get_multiscrape_max (req->url))
                 continue;
             if (tr_strcmp0 (req->url, url) != 0)
                 continue;
@@ -1516,7 +1773,8 @@ announceMore (tr_announcer * announcer)
 {
     int i;
     int n;
-    tr_torrent * tor;
+    tr_tier * tier;
+    tr_ptrArray dueTiers = TR_PTR_ARRAY_INIT;
     tr_ptrArray announceMe = TR_PTR_ARRAY_INIT;
     tr_ptrArray scrapeMe = TR_PTR_ARRAY_INIT;
     const time_t now = tr_time ();
@@ -1527,16 +1785,12 @@ announceMore (tr_announcer * announcer)
         return;
 
     /* build a list of tiers that need to be announced */
-    tor = NULL;
-    while ((tor = tr_torrentNext (announcer->session, tor))) {
-        struct tr_torrent_tiers * tt = tor->tiers;
-        for (i=0; tt && i<tt->tier_count; ++i) {
-            tr_tier * tier = &tt->tiers[i];
-            if (tierNeedsToAnnounce (tier, now))
-                tr_ptrArrayAppend (&announceMe, tier);
-            else if (tierNeedsToScrape (tier, now))
-                tr_ptrArrayAppend (&scrapeMe, tier);
-        }
+    while ((tier = schedulePopDue (announcer, now))) {
+        tr_ptrArrayAppend (&dueTiers, tier);
+        if (tierNeedsToAnnounce (tier, now))
+            tr_ptrArrayAppend (&announceMe, tier);
+        else if (tierNeedsToScrape (tier, now))
+            tr_ptrArrayAppend (&scrapeMe, tier);
     }
 
     /* if there are more tiers than slots available, prioritize */
@@ -1547,7 +1801,7 @@ announceMore (tr_announcer * announcer)
     /* announce some */
     n = MIN (tr_ptrArraySize (&announceMe), announcer->slotsAvailable);
     for (i=0; i<n; ++i) {
-        tr_tier * tier = tr_ptrArrayNth (&announceMe, i);
+        tier = tr_ptrArrayNth (&announceMe, i);
         tr_logAddTorDbg (tier->tor, "%s", "Announcing to tracker");
         dbgmsg (tier, "announcing tier %d of %d", i, n);
         tierAnnounce (announcer, tier);
@@ -1556,9 +1810,14 @@ announceMore (tr_announcer * announcer)
     /* scrape some */
     multiscrape (announcer, &scrapeMe);
 
+    /* anything that didn't get a slot goes back into the schedule */
+    for (i=0, n=tr_ptrArraySize (&dueTiers); i<n; ++i)
+        tierReschedule (tr_ptrArrayNth (&dueTiers, i));
+
     /* cleanup */
     tr_ptrArrayDestruct (&scrapeMe, NULL);
     tr_ptrArrayDestruct (&announceMe, NULL);
+    tr_ptrArrayDestruct (&dueTiers, NULL);
 }
 
 static void
@@ -1578,8 +1837,9 @@ onUpkeepTimer (evutil_socket_t foo UNUSED, short bar UNUSED, void * vannouncer)
     if (!is_closing)
         announceMore (announcer);
 
-    /* TAU upkeep */
-    if (announcer->tauUpkeepAt <= now) {
+    /* TAU upkeep. Run it every time while requests are pending
+       so that ones held back by rate-limiting go out promptly */
+    if ((announcer->tauUpkeepAt <= now) || !tr_tracker_udp_is_idle (session)) {
         announcer->tauUpkeepAt = now + TAU_UPKEEP_INTERVAL_SECS;
         tr_tracker_udp_upkeep (session);
     }
@@ -1602,6 +1862,7 @@ tr_announcerStats (const tr_torrent * torrent, int * setmeTrackerCount)
     tr_tracker_stat * ret;
     struct tr_torrent_tiers * tt;
     const time_t now = tr_time ();
+    const tr_announcer * announcer = torrent->session->announcer;
 
     assert (tr_isTorrent (torrent));
 
@@ -1619,9 +1880,11 @@ tr_announcerStats (const tr_torrent * torrent, int * setmeTrackerCount)
         for (j=0; j<tier->tracker_count; ++j)
         {
             const tr_tracker * const tracker = &tier->trackers[j];
+            const tr_tracker_host * host = announcer ? getHost (announcer, tracker->key) : NULL;
             tr_tracker_stat * st = &ret[out++];
 
             st->id = tracker->id;
+            st->hostLatencyMsec = host ? host->latencyMsec : -1;
             tr_strlcpy (st->host, tracker->key, sizeof (st->host));
             tr_strlcpy (st->announce, tracker->announce, sizeof (st->announce));
             st->tier = i;
@@ -1719,6 +1982,7 @@ copy_tier_attributes_impl (struct tr_tier * tgt, int trackerIndex, const tr_tier
 
     /* ...fix the fields that can't be cleanly bitwise-copied */
     tgt->wasCopied = true;
+    tgt->scheduleIndex = keep.scheduleIndex;
     tgt->trackers = keep.trackers;
     tgt->tracker_count = keep.tracker_count;
     tgt->announce_events = tr_memdup (src->announce_events, sizeof (tr_announce_event) * src->announce_event_count);
@@ -1775,6 +2039,9 @@ tr_announcerResetTorrent (tr_announcer * announcer UNUSED, tr_torrent * tor)
             if (!tt->tiers[i].wasCopied)
                 tier_announce_event_push (&tt->tiers[i], TR_ANNOUNCE_EVENT_STARTED, now);
 
+    for (i=0; i<tt->tier_count; ++i)
+        tierReschedule (&tt->tiers[i]);
+
     /* cleanup */
     tiersDestruct (&old);
 }
@@ -329,8 +329,8 @@ bandwidthClamp (const tr_bandwidth  * b,
               if (now == 0)
                 now = tr_time_msec ();
 
-              current = tr_bandwidthGetRawSpeed_Bps (b, now, TR_DOWN);
-              desired = tr_bandwidthGetDesiredSpeed_Bps (b, TR_DOWN);
+              current = tr_bandwidthGetRawSpeed_Bps (b, now, dir);
+              desired = tr_bandwidthGetDesiredSpeed_Bps (b, dir);
               r = desired >= 1 ? current / desired : 0;
 
                    if (r > 1.0) byteCount = 0;
@@ -72,6 +72,10 @@ struct tr_band
  *   Its children are per-torrent bandwidth objects owned by tr_torrent.
  *   Underneath those are per-peer bandwidth objects owned by tr_peer.
  *
+ *   Torrents can optionally be placed in a named bandwidth group, whose
+ *   bandwidth object sits between the session's and the torrents'. This
+ *   lets a set of torrents share one speed limit and priority.
+ *
  *   tr_session also owns a tr_handshake's bandwidths, so that the handshake
  *   I/O can be counted in the global raw totals. When the handshake is done,
  *   the bandwidth's ownership passes to a tr_peer.
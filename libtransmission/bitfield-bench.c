@@ -0,0 +1,231 @@
+/*
+ * This file Copyright (C) 2016 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+/* Times the bitfield counting and intersection paths against the
+   byte-table code they replace. The interest test is also timed against
+   the old isPeerInteresting () loop, which tested one piece at a time.
+   Not run as part of the test suite. */
+
+#include <inttypes.h> /* PRIu64 */
+#include <stdio.h>
+
+#include "transmission.h"
+#include "crypto-utils.h"
+#include "bitfield.h"
+#include "utils.h" /* tr_time_msec () */
+
+enum
+{
+  BIT_COUNT = 1 << 16,
+  ROUNDS = 2000
+};
+
+/***
+****  The byte-at-a-time counting that bitfield.c used before
+***/
+
+static const int8_t trueBitCount[256] =
+{
+  0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+  1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5,
+  1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5,
+  2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
+  1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5,
+  2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
+  2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
+  3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7,
+  1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5,
+  2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
+  2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
+  3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7,
+  2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
+  3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7,
+  3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7,
+  4, 5, 5, 6, 5, 6, 6, 7, 5, 6, 6, 7, 6, 7, 7, 8
+};
+
+static size_t
+old_count_range (const tr_bitfield * b, size_t begin, size_t end)
+{
+  size_t ret = 0;
+  const size_t first_byte = begin >> 3u;
+  const size_t last_byte = (end - 1) >> 3u;
+
+  if (!b->bit_count)
+    return 0;
+
+  if (first_byte >= b->alloc_count)
+    return 0;
+
+  if (first_byte == last_byte)
+    {
+      int i;
+      uint8_t val = b->bits[first_byte];
+
+      i = begin - (first_byte * 8);
+      val <<= i;
+      val >>= i;
+      i = (last_byte+1)*8 - end;
+      val >>= i;
+      val <<= i;
+
+      ret += trueBitCount[val];
+    }
+  else
+    {
+      size_t i;
+      uint8_t val;
+      const size_t walk_end = MIN (b->alloc_count, last_byte);
+
+      /* first byte */
+      i = begin - (first_byte * 8);
+      val = b->bits[first_byte];
+      val <<= i;
+      val >>= i;
+      ret += trueBitCount[val];
+
+      /* middle bytes */
+      for (i=first_byte+1; i<walk_end; ++i)
+        ret += trueBitCount[b->bits[i]];
+
+      /* last byte */
+      if (last_byte < b->alloc_count)
+        {
+          i = (last_byte+1)*8 - end;
+          val = b->bits[last_byte];
+          val >>= i;
+          val <<= i;
+          ret += trueBitCount[val];
+        }
+    }
+
+  return ret;
+}
+
+static size_t
+old_count_intersection (const tr_bitfield * a, const tr_bitfield * b)
+{
+  size_t i;
+  size_t ret = 0;
+  const size_t n = MIN (a->alloc_count, b->alloc_count);
+
+  for (i=0; i<n; ++i)
+    ret += trueBitCount[a->bits[i] & b->bits[i]];
+
+  return ret;
+}
+
+static bool
+old_intersects (const tr_bitfield * a, const tr_bitfield * b)
+{
+  size_t i;
+  const size_t n = MIN (a->alloc_count, b->alloc_count);
+
+  for (i=0; i<n; ++i)
+    if (a->bits[i] & b->bits[i])
+      return true;
+
+  return false;
+}
+
+/***
+****
+***/
+
+static void
+fill_random (tr_bitfield * b, size_t bit_count, int percent)
+{
+  size_t i;
+
+  tr_bitfieldConstruct (b, bit_count);
+  for (i=0; i<bit_count; ++i)
+    if (tr_rand_int_weak (100) < percent)
+      tr_bitfieldAdd (b, i);
+}
+
+static void
+report (const char * name, uint64_t start, uint64_t sum)
+{
+  const uint64_t msec = tr_time_msec () - start;
+
+  printf ("%-28s %6" PRIu64 " msec  (%" PRIu64 ")\n", name, msec, sum);
+}
+
+int
+main (void)
+{
+  int round;
+  size_t i;
+  uint64_t sum;
+  uint64_t start;
+  tr_bitfield a;
+  tr_bitfield b;
+
+  fill_random (&a, BIT_COUNT, 50);
+  fill_random (&b, BIT_COUNT, 1);
+
+  printf ("%d bits, %d rounds\n", BIT_COUNT, ROUNDS);
+
+  /* counting a range */
+  sum = 0;
+  start = tr_time_msec ();
+  for (round=0; round<ROUNDS; ++round)
+    sum += old_count_range (&a, round & 1, BIT_COUNT - 1 + (round & 1));
+  report ("count range, byte table", start, sum);
+
+  sum = 0;
+  start = tr_time_msec ();
+  for (round=0; round<ROUNDS; ++round)
+    sum += tr_bitfieldCountRange (&a, round & 1, BIT_COUNT - 1 + (round & 1));
+  report ("count range", start, sum);
+
+  /* counting an intersection */
+  sum = 0;
+  start = tr_time_msec ();
+  for (round=0; round<ROUNDS; ++round)
+    sum += old_count_intersection (&a, &b);
+  report ("intersection, byte table", start, sum);
+
+  sum = 0;
+  start = tr_time_msec ();
+  for (round=0; round<ROUNDS; ++round)
+    sum += tr_bitfieldCountIntersection (&a, &b);
+  report ("intersection", start, sum);
+
+  /* the interest test: is there any overlap at all? */
+  tr_bitfieldRemRange (&b, 0, BIT_COUNT);
+  tr_bitfieldAdd (&b, BIT_COUNT - 1);
+  tr_bitfieldRem (&a, BIT_COUNT - 1);
+
+  sum = 0;
+  start = tr_time_msec ();
+  for (round=0; round<ROUNDS; ++round)
+    for (i=0; i<BIT_COUNT; ++i)
+      if (tr_bitfieldHas (&a, i) && tr_bitfieldHas (&b, i))
+        {
+          ++sum;
+          break;
+        }
+  report ("intersects, piece by piece", start, sum);
+
+  sum = 0;
+  start = tr_time_msec ();
+  for (round=0; round<ROUNDS; ++round)
+    sum += old_intersects (&a, &b);
+  report ("intersects, byte by byte", start, sum);
+
+  sum = 0;
+  start = tr_time_msec ();
+  for (round=0; round<ROUNDS; ++round)
+    sum += tr_bitfieldIntersects (&a, &b);
+  report ("intersects", start, sum);
+
+  tr_bitfieldDestruct (&b);
+  tr_bitfieldDestruct (&a);
+  return 0;
+}
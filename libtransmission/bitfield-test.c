@@ -56,6 +56,72 @@ test_bitfield_count_range (void)
   return 0;
 }
 
+static int
+test_bitfield_intersection (void)
+{
+  size_t i;
+  size_t n;
+  size_t count;
+  const size_t bitCount = 1 + tr_rand_int_weak (1000);
+  tr_bitfield a;
+  tr_bitfield b;
+
+  /* generate two random bitfields */
+  tr_bitfieldConstruct (&a, bitCount);
+  tr_bitfieldConstruct (&b, bitCount);
+  for (i=0, n=tr_rand_int_weak (bitCount); i<n; ++i)
+    tr_bitfieldAdd (&a, tr_rand_int_weak (bitCount));
+  for (i=0, n=tr_rand_int_weak (bitCount); i<n; ++i)
+    tr_bitfieldAdd (&b, tr_rand_int_weak (bitCount));
+
+  /* compare against a bit-by-bit walk */
+  count = 0;
+  for (i=0; i<bitCount; ++i)
+    if (tr_bitfieldHas (&a, i) && tr_bitfieldHas (&b, i))
+      ++count;
+  check_uint_eq (count, tr_bitfieldCountIntersection (&a, &b));
+  check_uint_eq (count, tr_bitfieldCountIntersection (&b, &a));
+  check (tr_bitfieldIntersects (&a, &b) == (count != 0));
+  check (tr_bitfieldIntersects (&b, &a) == (count != 0));
+
+  /* a & ~b, against a bit-by-bit walk */
+  {
+    tr_bitfield c = TR_BITFIELD_INIT;
+
+    tr_bitfieldConstruct (&c, bitCount);
+    for (i=0; i<bitCount; ++i)
+      if (tr_bitfieldHas (&a, i))
+        tr_bitfieldAdd (&c, i);
+    tr_bitfieldAndNot (&c, &b);
+    for (i=0; i<bitCount; ++i)
+      check (tr_bitfieldHas (&c, i) == (tr_bitfieldHas (&a, i) && !tr_bitfieldHas (&b, i)));
+    check_uint_eq (tr_bitfieldCountTrueBits (&a) - count, tr_bitfieldCountTrueBits (&c));
+
+    /* with have-all on either side */
+    tr_bitfieldSetHasAll (&c);
+    tr_bitfieldAndNot (&c, &a);
+    check_uint_eq (bitCount - tr_bitfieldCountTrueBits (&a), tr_bitfieldCountTrueBits (&c));
+    tr_bitfieldSetHasAll (&c);
+    tr_bitfieldAndNot (&a, &c);
+    check (tr_bitfieldHasNone (&a));
+
+    tr_bitfieldDestruct (&c);
+  }
+
+  /* the special cases */
+  tr_bitfieldSetHasAll (&b);
+  check_uint_eq (tr_bitfieldCountTrueBits (&a), tr_bitfieldCountIntersection (&a, &b));
+  check (tr_bitfieldIntersects (&a, &b) == !tr_bitfieldHasNone (&a));
+  tr_bitfieldSetHasNone (&b);
+  check_uint_eq (0, tr_bitfieldCountIntersection (&a, &b));
+  check (!tr_bitfieldIntersects (&a, &b));
+
+  /* cleanup */
+  tr_bitfieldDestruct (&b);
+  tr_bitfieldDestruct (&a);
+  return 0;
+}
+
 static int
 test_bitfields (void)
 {
@@ -198,5 +264,10 @@ main (void)
     if ((ret = test_bitfield_count_range ()))
       return ret;
 
+  /* bitfield intersection */
+  for (l=0; l<10000; ++l)
+    if ((ret = test_bitfield_intersection ()))
+      return ret;
+
   return 0;
 }
@@ -19,38 +19,130 @@ const tr_bitfield TR_BITFIELD_INIT = { NULL, 0, 0, 0, false, false };
 *****
 ****/
 
-static const int8_t trueBitCount[256] =
-{
-  0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
-  1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5,
-  1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5,
-  2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
-  1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5,
-  2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
-  2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
-  3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7,
-  1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5,
-  2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
-  2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
-  3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7,
-  2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
-  3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7,
-  3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7,
-  4, 5, 5, 6, 5, 6, 6, 7, 5, 6, 6, 7, 6, 7, 7, 8
-};
+/* Count the set bits in a byte array eight bytes at a time.
+   The bit order inside each word doesn't matter for a population count,
+   so the bytes are loaded in host order and the tail is zero-padded. */
 
-static size_t
-countArray (const tr_bitfield * b)
+static inline size_t
+popcount64 (uint64_t v)
+{
+#if defined (__GNUC__) || defined (__clang__)
+  return __builtin_popcountll (v);
+#else
+  v = v - ((v >> 1) & UINT64_C (0x5555555555555555));
+  v = (v & UINT64_C (0x3333333333333333)) + ((v >> 2) & UINT64_C (0x3333333333333333));
+  v = (v + (v >> 4)) & UINT64_C (0x0f0f0f0f0f0f0f0f);
+  return (size_t) ((v * UINT64_C (0x0101010101010101)) >> 56);
+#endif
+}
+
+static inline uint64_t
+load64 (const uint8_t * bytes)
+{
+  uint64_t v;
+  memcpy (&v, bytes, sizeof (v));
+  return v;
+}
+
+static inline void
+store64 (uint8_t * bytes, uint64_t v)
+{
+  memcpy (bytes, &v, sizeof (v));
+}
+
+static inline uint64_t
+loadTail (const uint8_t * bytes, size_t n)
+{
+  uint64_t v = 0;
+  assert (n < sizeof (v));
+  memcpy (&v, bytes, n);
+  return v;
+}
+
+static inline size_t
+countBytesInline (const uint8_t * bytes, size_t n)
+{
+  size_t ret = 0;
+  size_t i = 0;
+
+  for (; i + 32 <= n; i += 32)
+    ret += popcount64 (load64 (bytes + i))
+         + popcount64 (load64 (bytes + i + 8))
+         + popcount64 (load64 (bytes + i + 16))
+         + popcount64 (load64 (bytes + i + 24));
+
+  for (; i + 8 <= n; i += 8)
+    ret += popcount64 (load64 (bytes + i));
+
+  if (i < n)
+    ret += popcount64 (loadTail (bytes + i, n - i));
+
+  return ret;
+}
+
+static inline size_t
+countAndBytesInline (const uint8_t * a, const uint8_t * b, size_t n)
 {
   size_t ret = 0;
-  size_t i = b->alloc_count;
+  size_t i = 0;
+
+  for (; i + 8 <= n; i += 8)
+    ret += popcount64 (load64 (a + i) & load64 (b + i));
 
-  while (i > 0)
-    ret += trueBitCount[b->bits[--i]];
+  if (i < n)
+    ret += popcount64 (loadTail (a + i, n - i) & loadTail (b + i, n - i));
 
   return ret;
 }
 
+/* Without -mpopcnt the builtin becomes a libgcc call, so on x86 build a
+   second copy that uses the POPCNT instruction and pick one at runtime. */
+#if (defined (__x86_64__) || defined (__i386__)) \
+    && ((defined (__GNUC__) && __GNUC__ >= 5) || defined (__clang__)) \
+    && !defined (__POPCNT__)
+ #define TR_BITFIELD_POPCNT_DISPATCH
+
+__attribute__ ((target ("popcnt"))) static size_t
+countBytesPopcnt (const uint8_t * bytes, size_t n)
+{
+  return countBytesInline (bytes, n);
+}
+
+__attribute__ ((target ("popcnt"))) static size_t
+countAndBytesPopcnt (const uint8_t * a, const uint8_t * b, size_t n)
+{
+  return countAndBytesInline (a, b, n);
+}
+#endif
+
+static size_t
+countBytes (const uint8_t * bytes, size_t n)
+{
+#ifdef TR_BITFIELD_POPCNT_DISPATCH
+  if (__builtin_cpu_supports ("popcnt"))
+    return countBytesPopcnt (bytes, n);
+#endif
+
+  return countBytesInline (bytes, n);
+}
+
+static size_t
+countAndBytes (const uint8_t * a, const uint8_t * b, size_t n)
+{
+#ifdef TR_BITFIELD_POPCNT_DISPATCH
+  if (__builtin_cpu_supports ("popcnt"))
+    return countAndBytesPopcnt (a, b, n);
+#endif
+
+  return countAndBytesInline (a, b, n);
+}
+
+static size_t
+countArray (const tr_bitfield * b)
+{
+  return countBytes (b->bits, b->alloc_count);
+}
+
 static size_t
 countRange (const tr_bitfield * b, size_t begin, size_t end)
 {
@@ -79,7 +171,7 @@ countRange (const tr_bitfield * b, size_t begin, size_t end)
       val >>= i;
       val <<= i;
 
-      ret += trueBitCount[val];
+      ret += popcount64 (val);
     }
   else
     {
@@ -92,11 +184,11 @@ countRange (const tr_bitfield * b, size_t begin, size_t end)
       val = b->bits[first_byte];
       val <<= i;
       val >>= i;
-      ret += trueBitCount[val];
+      ret += popcount64 (val);
 
       /* middle bytes */
-      for (i=first_byte+1; i<walk_end; ++i)
-        ret += trueBitCount[b->bits[i]];
+      if (first_byte + 1 < walk_end)
+        ret += countBytes (b->bits + first_byte + 1, walk_end - (first_byte + 1));
 
       /* last byte */
       if (last_byte < b->alloc_count)
@@ -105,7 +197,7 @@ countRange (const tr_bitfield * b, size_t begin, size_t end)
           val = b->bits[last_byte];
           val >>= i;
           val <<= i;
-          ret += trueBitCount[val];
+          ret += popcount64 (val);
         }
     }
 
@@ -140,6 +232,42 @@ tr_bitfieldHas (const tr_bitfield * b, size_t n)
   return (b->bits[n>>3u] << (n & 7u) & 0x80) != 0;
 }
 
+size_t
+tr_bitfieldCountIntersection (const tr_bitfield * a, const tr_bitfield * b)
+{
+  if (tr_bitfieldHasNone (a) || tr_bitfieldHasNone (b))
+    return 0;
+
+  if (tr_bitfieldHasAll (a))
+    return b->true_count;
+
+  if (tr_bitfieldHasAll (b))
+    return a->true_count;
+
+  return countAndBytes (a->bits, b->bits, MIN (a->alloc_count, b->alloc_count));
+}
+
+bool
+tr_bitfieldIntersects (const tr_bitfield * a, const tr_bitfield * b)
+{
+  size_t i;
+  size_t n;
+
+  if (tr_bitfieldHasNone (a) || tr_bitfieldHasNone (b))
+    return false;
+
+  if (tr_bitfieldHasAll (a) || tr_bitfieldHasAll (b))
+    return true;
+
+  n = MIN (a->alloc_count, b->alloc_count);
+
+  for (i=0; i+8<=n; i+=8)
+    if (load64 (a->bits + i) & load64 (b->bits + i))
+      return true;
+
+  return i < n && (loadTail (a->bits + i, n - i) & loadTail (b->bits + i, n - i)) != 0;
+}
+
 /***
 ****
 ***/
@@ -481,3 +609,35 @@ tr_bitfieldRemRange (tr_bitfield * b, size_t begin, size_t end)
 
   tr_bitfieldDecTrueCount (b, diff);
 }
+
+/* Clears every bit in b that's also set in a */
+void
+tr_bitfieldAndNot (tr_bitfield * b, const tr_bitfield * a)
+{
+  size_t i;
+  size_t n;
+
+  if (tr_bitfieldHasNone (b) || tr_bitfieldHasNone (a))
+    return;
+
+  if (tr_bitfieldHasAll (a))
+    {
+      tr_bitfieldSetHasNone (b);
+      return;
+    }
+
+  /* a have-all with no known size can't be spelled out bit by bit */
+  if (tr_bitfieldHasAll (b) && !b->bit_count)
+    return;
+
+  tr_bitfieldEnsureBitsAlloced (b, b->bit_count);
+  n = MIN (b->alloc_count, a->alloc_count);
+
+  for (i=0; i+8<=n; i+=8)
+    store64 (b->bits + i, load64 (b->bits + i) & ~load64 (a->bits + i));
+
+  for (; i<n; ++i)
+    b->bits[i] &= ~a->bits[i];
+
+  tr_bitfieldRebuildTrueCount (b);
+}
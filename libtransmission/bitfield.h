@@ -47,6 +47,9 @@ void   tr_bitfieldAddRange   (tr_bitfield*, size_t begin, size_t end);
 
 void   tr_bitfieldRemRange   (tr_bitfield*, size_t begin, size_t end);
 
+/** @brief clear every bit in b that's also set in a */
+void   tr_bitfieldAndNot     (tr_bitfield * b, const tr_bitfield * a);
+
 /***
 ****  life cycle
 ***/
@@ -95,3 +98,9 @@ tr_bitfieldHasNone (const tr_bitfield * b)
 
 bool tr_bitfieldHas (const tr_bitfield * b, size_t n);
 
+/** @brief the number of bits set in both bitfields */
+size_t  tr_bitfieldCountIntersection (const tr_bitfield * a, const tr_bitfield * b);
+
+/** @brief true if any bit is set in both bitfields */
+bool    tr_bitfieldIntersects (const tr_bitfield * a, const tr_bitfield * b);
+
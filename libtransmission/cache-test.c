@@ -0,0 +1,102 @@
+/*
+ * This file Copyright (C) 2016 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <string.h> /* memset () */
+
+#include <event2/buffer.h>
+
+#include "transmission.h"
+#include "cache.h"
+#include "torrent.h"
+#include "trevent.h" /* tr_runInEventThread () */
+#include "utils.h"
+
+#include "libtransmission-test.h"
+
+#define MAX_HOT 8
+
+struct test_hot_pieces_data
+{
+  tr_torrent * tor;
+  int n[4];
+  tr_piece_index_t hot[4][MAX_HOT];
+  bool done;
+};
+
+/* the cache is only used from the libtransmission thread */
+static void
+test_hot_pieces_threadfunc (void * vdata)
+{
+  struct test_hot_pieces_data * data = vdata;
+  tr_torrent * tor = data->tor;
+  tr_cache * cache = tr_cacheNew (1024 * 1024);
+  uint8_t * block = tr_new0 (uint8_t, tor->blockSize);
+  struct evbuffer * buf = evbuffer_new ();
+
+  data->n[0] = tr_cacheGetHotPieces (cache, tor, data->hot[0], MAX_HOT);
+
+  /* reading from disk makes a piece hot */
+  tr_cacheReadBlock (cache, tor, 2, 0, tor->blockSize, block);
+  data->n[1] = tr_cacheGetHotPieces (cache, tor, data->hot[1], MAX_HOT);
+
+  /* pieces with blocks in the cache come first, then the newest reads */
+  evbuffer_add (buf, block, tor->blockSize);
+  tr_cacheWriteBlock (cache, tor, 0, 0, tor->blockSize, buf);
+  tr_cacheReadBlock (cache, tor, 1, 0, tor->blockSize, block);
+  data->n[2] = tr_cacheGetHotPieces (cache, tor, data->hot[2], MAX_HOT);
+
+  /* but no more than we asked for */
+  data->n[3] = tr_cacheGetHotPieces (cache, tor, data->hot[3], 1);
+
+  evbuffer_free (buf);
+  tr_free (block);
+  tr_cacheFlushTorrent (cache, tor);
+  tr_cacheFree (cache);
+  data->done = true;
+}
+
+static int
+test_hot_pieces (void)
+{
+  tr_session * session = libttest_session_init (NULL);
+  tr_torrent * tor = libttest_zero_torrent_init (session);
+  struct test_hot_pieces_data data;
+
+  libttest_zero_torrent_populate (tor, true);
+
+  memset (&data, 0, sizeof (data));
+  data.tor = tor;
+  tr_runInEventThread (session, test_hot_pieces_threadfunc, &data);
+  while (!data.done)
+    tr_wait_msec (10);
+
+  check_int_eq (0, data.n[0]);
+
+  check_int_eq (1, data.n[1]);
+  check_uint_eq (2, data.hot[1][0]);
+
+  check_int_eq (3, data.n[2]);
+  check_uint_eq (0, data.hot[2][0]);
+  check_uint_eq (1, data.hot[2][1]);
+  check_uint_eq (2, data.hot[2][2]);
+
+  check_int_eq (1, data.n[3]);
+  check_uint_eq (0, data.hot[3][0]);
+
+  tr_torrentRemove (tor, false, NULL);
+  libttest_session_close (session);
+  return 0;
+}
+
+int
+main (void)
+{
+  const testFunc tests[] = { test_hot_pieces };
+
+  return runTests (tests, NUM_TESTS (tests));
+}
@@ -12,6 +12,7 @@
 
 #include "transmission.h"
 #include "cache.h"
+#include "crypto-utils.h" /* tr_sha1_init (), tr_sha1_update (), tr_sha1_final () */
 #include "inout.h"
 #include "log.h"
 #include "peer-common.h" /* MAX_BLOCK_SIZE */
@@ -48,12 +49,43 @@ struct cache_block
   struct evbuffer * evbuf;
 };
 
+/* a SHA1 context that's been fed a piece's leading blocks as they arrived,
+   so that checking the finished piece doesn't have to read them back */
+struct piece_hash
+{
+  int tor_id;
+  tr_piece_index_t piece;
+  uint32_t hashed_bytes;
+  uint64_t last_used;
+  tr_sha1_ctx_t sha;
+};
+
+/* don't let abandoned pieces pile up hash contexts without bound.
+   when full, the least-recently-fed context makes room for a new one */
+#define MAX_PIECE_HASHES 1024
+
+/* a piece that was recently read from disk */
+struct recent_read
+{
+  int tor_id;
+  tr_piece_index_t piece;
+};
+
+/* how many recently-read pieces to remember */
+#define MAX_RECENT_READS 64
+
 struct tr_cache
 {
   tr_ptrArray blocks;
+  tr_ptrArray piece_hashes;
+  uint64_t piece_hash_clock;
   int max_blocks;
   size_t max_bytes;
 
+  /* ring buffer; recent_read_count is the number of reads ever noted */
+  struct recent_read recent_reads[MAX_RECENT_READS];
+  size_t recent_read_count;
+
   size_t disk_writes;
   size_t disk_write_bytes;
   size_t cache_writes;
@@ -268,11 +300,74 @@ tr_cacheGetLimit (const tr_cache * cache)
   return cache->max_bytes;
 }
 
+/***
+****
+***/
+
+static void
+freePieceHash (struct piece_hash * ph)
+{
+  tr_sha1_final (ph->sha, NULL);
+  tr_free (ph);
+}
+
+static int
+piece_hash_compare (const void * va, const void * vb)
+{
+  const struct piece_hash * a = va;
+  const struct piece_hash * b = vb;
+
+  if (a->tor_id != b->tor_id)
+    return a->tor_id < b->tor_id ? -1 : 1;
+
+  if (a->piece != b->piece)
+    return a->piece < b->piece ? -1 : 1;
+
+  return 0;
+}
+
+static int
+findPieceHashPos (tr_cache * cache, const tr_torrent * tor, tr_piece_index_t piece, bool * exact)
+{
+  struct piece_hash key;
+  key.tor_id = tor->uniqueId;
+  key.piece = piece;
+  return tr_ptrArrayLowerBound (&cache->piece_hashes, &key, piece_hash_compare, exact);
+}
+
+static void
+removePieceHash (tr_cache * cache, int pos)
+{
+  freePieceHash (tr_ptrArrayNth (&cache->piece_hashes, pos));
+  tr_ptrArrayRemove (&cache->piece_hashes, pos);
+}
+
+static void
+evictOldestPieceHash (tr_cache * cache)
+{
+  int i;
+  int oldest = 0;
+  const int n = tr_ptrArraySize (&cache->piece_hashes);
+  struct piece_hash * const * hashes = (struct piece_hash * const *) tr_ptrArrayBase (&cache->piece_hashes);
+
+  for (i=1; i<n; ++i)
+    if (hashes[i]->last_used < hashes[oldest]->last_used)
+      oldest = i;
+
+  if (n > 0)
+    removePieceHash (cache, oldest);
+}
+
+/***
+****
+***/
+
 tr_cache *
 tr_cacheNew (int64_t max_bytes)
 {
   tr_cache * cache = tr_new0 (tr_cache, 1);
   cache->blocks = TR_PTR_ARRAY_INIT;
+  cache->piece_hashes = TR_PTR_ARRAY_INIT;
   cache->max_bytes = max_bytes;
   cache->max_blocks = getMaxBlocks (max_bytes);
   return cache;
@@ -283,6 +378,7 @@ tr_cacheFree (tr_cache * cache)
 {
   assert (tr_ptrArrayEmpty (&cache->blocks));
   tr_ptrArrayDestruct (&cache->blocks, NULL);
+  tr_ptrArrayDestruct (&cache->piece_hashes, (PtrArrayForeachFunc)freePieceHash);
   tr_free (cache);
 }
 
@@ -320,6 +416,109 @@ findBlock (tr_cache           * cache,
   return tr_ptrArrayFindSorted (&cache->blocks, &key, cache_block_compare);
 }
 
+static int
+findBlockPos (tr_cache * cache, tr_torrent * torrent, tr_piece_index_t block)
+{
+  struct cache_block key;
+  key.tor = torrent;
+  key.block = block;
+  return tr_ptrArrayLowerBound (&cache->blocks, &key, cache_block_compare, NULL);
+}
+
+static void
+hashBlock (tr_sha1_ctx_t sha, struct evbuffer * evbuf)
+{
+  int i;
+  const int n = evbuffer_peek (evbuf, -1, NULL, NULL, 0);
+  struct evbuffer_iovec * vecs = tr_new (struct evbuffer_iovec, n);
+
+  evbuffer_peek (evbuf, -1, NULL, vecs, n);
+  for (i=0; i<n; ++i)
+    tr_sha1_update (sha, vecs[i].iov_base, vecs[i].iov_len);
+
+  tr_free (vecs);
+}
+
+/* advance the piece's incremental hash over any cached blocks
+   that now continue where it left off */
+static void
+updatePieceHash (tr_cache         * cache,
+                 tr_torrent       * torrent,
+                 tr_piece_index_t   piece,
+                 uint32_t           offset)
+{
+  bool exact;
+  struct piece_hash * ph = NULL;
+  const uint32_t piece_size = tr_torPieceCountBytes (torrent, piece);
+  int pos = findPieceHashPos (cache, torrent, piece, &exact);
+
+  if (exact)
+    {
+      ph = tr_ptrArrayNth (&cache->piece_hashes, pos);
+
+      /* data we've already hashed got overwritten; start over */
+      if (offset < ph->hashed_bytes)
+        {
+          removePieceHash (cache, pos);
+          ph = NULL;
+        }
+    }
+
+  if (ph == NULL)
+    {
+      if (offset != 0)
+        return;
+
+      if (tr_ptrArraySize (&cache->piece_hashes) >= MAX_PIECE_HASHES)
+        {
+          evictOldestPieceHash (cache);
+          pos = findPieceHashPos (cache, torrent, piece, &exact);
+        }
+
+      ph = tr_new (struct piece_hash, 1);
+      ph->tor_id = torrent->uniqueId;
+      ph->piece = piece;
+      ph->hashed_bytes = 0;
+      ph->sha = tr_sha1_init ();
+      tr_ptrArrayInsert (&cache->piece_hashes, ph, pos);
+    }
+
+  ph->last_used = ++cache->piece_hash_clock;
+
+  while (ph->hashed_bytes < piece_size)
+    {
+      const struct cache_block * cb = findBlock (cache, torrent, piece, ph->hashed_bytes);
+
+      if (cb == NULL || cb->piece != piece || cb->offset != ph->hashed_bytes)
+        break;
+
+      hashBlock (ph->sha, cb->evbuf);
+      ph->hashed_bytes += cb->length;
+    }
+}
+
+bool
+tr_cacheTakePieceHash (tr_cache          * cache,
+                       tr_torrent        * torrent,
+                       tr_piece_index_t    piece,
+                       tr_sha1_ctx_t     * setme_sha,
+                       uint32_t          * setme_hashed_bytes)
+{
+  bool exact;
+  struct piece_hash * ph;
+  const int pos = findPieceHashPos (cache, torrent, piece, &exact);
+
+  if (!exact)
+    return false;
+
+  ph = tr_ptrArrayNth (&cache->piece_hashes, pos);
+  tr_ptrArrayRemove (&cache->piece_hashes, pos);
+  *setme_sha = ph->sha;
+  *setme_hashed_bytes = ph->hashed_bytes;
+  tr_free (ph);
+  return true;
+}
+
 int
 tr_cacheWriteBlock (tr_cache         * cache,
                     tr_torrent       * torrent,
@@ -353,9 +552,29 @@ tr_cacheWriteBlock (tr_cache         * cache,
   cache->cache_writes++;
   cache->cache_write_bytes += cb->length;
 
+  updatePieceHash (cache, torrent, piece, offset);
+
   return cacheTrim (cache);
 }
 
+static void
+noteRecentRead (tr_cache * cache, const tr_torrent * torrent, tr_piece_index_t piece)
+{
+  struct recent_read * r;
+
+  /* reads of the same piece usually come in runs */
+  if (cache->recent_read_count > 0)
+    {
+      r = &cache->recent_reads[(cache->recent_read_count - 1) % MAX_RECENT_READS];
+      if (r->tor_id == torrent->uniqueId && r->piece == piece)
+        return;
+    }
+
+  r = &cache->recent_reads[cache->recent_read_count++ % MAX_RECENT_READS];
+  r->tor_id = torrent->uniqueId;
+  r->piece = piece;
+}
+
 int
 tr_cacheReadBlock (tr_cache         * cache,
                    tr_torrent       * torrent,
@@ -369,8 +588,8 @@ tr_cacheReadBlock (tr_cache         * cache,
 
   if (cb)
     evbuffer_copyout (cb->evbuf, setme, len);
-  else
-    err = tr_ioRead (torrent, piece, offset, len, setme);
+  else if (!(err = tr_ioRead (torrent, piece, offset, len, setme)))
+    noteRecentRead (cache, torrent, piece);
 
   return err;
 }
@@ -385,25 +604,75 @@ tr_cachePrefetchBlock (tr_cache         * cache,
   int err = 0;
   struct cache_block * cb = findBlock (cache, torrent, piece, offset);
 
-  if (cb == NULL)
-    err = tr_ioPrefetch (torrent, piece, offset, len);
+  if (cb == NULL && !(err = tr_ioPrefetch (torrent, piece, offset, len)))
+    noteRecentRead (cache, torrent, piece);
 
   return err;
 }
 
-/***
-****
-***/
+bool
+tr_cacheHasBlock (tr_cache         * cache,
+                  tr_torrent       * torrent,
+                  tr_piece_index_t   piece,
+                  uint32_t           offset)
+{
+  return findBlock (cache, torrent, piece, offset) != NULL;
+}
 
-static int
-findBlockPos (tr_cache * cache, tr_torrent * torrent, tr_piece_index_t block)
+static bool
+hasPiece (const tr_piece_index_t * pieces, int n, tr_piece_index_t piece)
 {
-  struct cache_block key;
-  key.tor = torrent;
-  key.block = block;
-  return tr_ptrArrayLowerBound (&cache->blocks, &key, cache_block_compare, NULL);
+  int i;
+
+  for (i=0; i<n; ++i)
+    if (pieces[i] == piece)
+      return true;
+
+  return false;
+}
+
+int
+tr_cacheGetHotPieces (tr_cache         * cache,
+                      tr_torrent       * torrent,
+                      tr_piece_index_t * setme,
+                      int                max)
+{
+  size_t i;
+  int pos;
+  int n = 0;
+  const size_t recent_count = MIN (cache->recent_read_count, MAX_RECENT_READS);
+
+  /* pieces with blocks in the cache. they're sorted by block,
+     so each piece's blocks are next to each other */
+  for (pos=findBlockPos (cache, torrent, 0); n<max && pos<tr_ptrArraySize (&cache->blocks); ++pos)
+    {
+      const struct cache_block * b = tr_ptrArrayNth (&cache->blocks, pos);
+
+      if (b->tor != torrent)
+        break;
+
+      if ((n == 0 || setme[n-1] != b->piece) && tr_torrentPieceIsComplete (torrent, b->piece))
+        setme[n++] = b->piece;
+    }
+
+  /* pieces read from disk, newest first */
+  for (i=1; n<max && i<=recent_count; ++i)
+    {
+      const struct recent_read * r = &cache->recent_reads[(cache->recent_read_count - i) % MAX_RECENT_READS];
+
+      if (r->tor_id == torrent->uniqueId
+          && tr_torrentPieceIsComplete (torrent, r->piece)
+          && !hasPiece (setme, n, r->piece))
+        setme[n++] = r->piece;
+    }
+
+  return n;
 }
 
+/***
+****
+***/
+
 int tr_cacheFlushDone (tr_cache * cache)
 {
   int err = 0;
@@ -459,7 +728,20 @@ int
 tr_cacheFlushTorrent (tr_cache * cache, tr_torrent * torrent)
 {
   int err = 0;
+  bool exact;
   const int pos = findBlockPos (cache, torrent, 0);
+  const int hash_pos = findPieceHashPos (cache, torrent, 0, &exact);
+
+  /* forget any partially-hashed pieces */
+  while (hash_pos < tr_ptrArraySize (&cache->piece_hashes))
+    {
+      const struct piece_hash * ph = tr_ptrArrayNth (&cache->piece_hashes, hash_pos);
+
+      if (ph->tor_id != torrent->uniqueId)
+        break;
+
+      removePieceHash (cache, hash_pos);
+    }
 
   /* flush out all the blocks in that torrent */
   while (!err && (pos < tr_ptrArraySize (&cache->blocks)))
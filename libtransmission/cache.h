@@ -12,6 +12,8 @@
 
 #pragma once
 
+#include "crypto-utils.h" /* tr_sha1_ctx_t */
+
 struct evbuffer;
 
 typedef struct tr_cache tr_cache;
@@ -52,6 +54,33 @@ int tr_cachePrefetchBlock (tr_cache         * cache,
                            uint32_t           offset,
                            uint32_t           len);
 
+bool tr_cacheHasBlock (tr_cache         * cache,
+                       tr_torrent       * torrent,
+                       tr_piece_index_t   piece,
+                       uint32_t           offset);
+
+/**
+ * Find up to max of the torrent's complete pieces that are cheap to read
+ * right now: first those with blocks in the cache, then those most
+ * recently read or prefetched from disk, which are likely still in the
+ * OS' page cache. Returns how many pieces were stored in setme.
+ */
+int tr_cacheGetHotPieces (tr_cache         * cache,
+                          tr_torrent       * torrent,
+                          tr_piece_index_t * setme,
+                          int                max);
+
+/**
+ * If the leading blocks of this piece were hashed as they were written,
+ * hand the caller that SHA1 context and the number of bytes it covers.
+ * The caller owns the context and must finalize it.
+ */
+bool tr_cacheTakePieceHash (tr_cache          * cache,
+                            tr_torrent        * torrent,
+                            tr_piece_index_t    piece,
+                            tr_sha1_ctx_t     * setme_sha,
+                            uint32_t          * setme_hashed_bytes);
+
 /***
 ****
 ***/
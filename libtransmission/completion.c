@@ -10,6 +10,7 @@
 
 #include "transmission.h"
 #include "completion.h"
+#include "inout.h" /* tr_ioFindFileLocation () */
 #include "torrent.h"
 #include "utils.h"
 
@@ -17,19 +18,95 @@
 ****
 ***/
 
+static uint64_t
+countPieceBytes (const tr_completion * cp, tr_piece_index_t piece)
+{
+  return tr_torPieceCountBytes (cp->tor, piece) - tr_cpMissingBytesInPiece (cp, piece);
+}
+
+static uint64_t
+countFileBytes (const tr_completion * cp, tr_file_index_t index)
+{
+  uint64_t total = 0;
+  const tr_torrent * tor = cp->tor;
+  const tr_file * f = &tor->info.files[index];
+
+  if (f->length)
+    {
+      tr_block_index_t first;
+      tr_block_index_t last;
+      tr_torGetFileBlockRange (tor, index, &first, &last);
+
+      if (first == last)
+        {
+          if (tr_cpBlockIsComplete (cp, first))
+            total = f->length;
+        }
+      else
+        {
+          /* the first block */
+          if (tr_cpBlockIsComplete (cp, first))
+            total += tor->blockSize - (f->offset % tor->blockSize);
+
+          /* the middle blocks */
+          if (first + 1 < last)
+            {
+              uint64_t u = tr_bitfieldCountRange (&cp->blockBitfield, first+1, last);
+              u *= tor->blockSize;
+              total += u;
+            }
+
+          /* the last block */
+          if (tr_cpBlockIsComplete (cp, last))
+            total += (f->offset + f->length) - ((uint64_t)tor->blockSize * last);
+        }
+    }
+
+  return total;
+}
+
+/* recalculate the running totals from scratch */
+static void
+tr_cpRecount (tr_completion * cp)
+{
+  tr_piece_index_t p;
+  tr_file_index_t f;
+  const tr_torrent * tor = cp->tor;
+  const tr_info * inf = &tor->info;
+
+  cp->sizeWhenDone = 0;
+  cp->haveValid = 0;
+
+  for (p=0; p<inf->pieceCount; ++p)
+    {
+      const uint64_t pieceSize = tr_torPieceCountBytes (tor, p);
+      const uint64_t have = countPieceBytes (cp, p);
+
+      cp->sizeWhenDone += inf->pieces[p].dnd ? have : pieceSize;
+      if (have == pieceSize)
+        cp->haveValid += pieceSize;
+    }
+
+  for (f=0; f<inf->fileCount; ++f)
+    cp->fileBytes[f] = countFileBytes (cp, f);
+
+  assert (cp->sizeWhenDone <= inf->totalSize);
+  assert (cp->sizeWhenDone >= cp->sizeNow);
+}
+
 static void
 tr_cpReset (tr_completion * cp)
 {
   cp->sizeNow = 0;
-  cp->sizeWhenDoneIsDirty = true;
-  cp->haveValidIsDirty = true;
   tr_bitfieldSetHasNone (&cp->blockBitfield);
+  tr_cpRecount (cp);
 }
 
 void
 tr_cpConstruct (tr_completion * cp, tr_torrent * tor)
 {
   cp->tor = tor;
+  cp->fileBytes = tr_new0 (uint64_t, tor->info.fileCount);
   tr_bitfieldConstruct (&cp->blockBitfield, tor->blockCount);
   tr_cpReset (cp);
 }
@@ -37,8 +114,6 @@ tr_cpConstruct (tr_completion * cp, tr_torrent * tor)
 void
 tr_cpBlockInit (tr_completion * cp, const tr_bitfield * b)
 {
-  tr_cpReset (cp);
-
   /* set blockBitfield */
   tr_bitfieldSetFromBitfield (&cp->blockBitfield, b);
 
@@ -50,6 +125,37 @@ tr_cpBlockInit (tr_completion * cp, const tr_bitfield * b)
     cp->sizeNow -= (cp->tor->blockSize - cp->tor->lastBlockSize);
 
   assert (cp->sizeNow <= cp->tor->info.totalSize);
+
+  tr_cpRecount (cp);
+}
+
+/* add or subtract a block's bytes from the files it overlaps */
+static void
+updateFileBytes (tr_completion * cp, tr_block_index_t block, bool add)
+{
+  tr_file_index_t i;
+  uint64_t unused;
+  const tr_torrent * tor = cp->tor;
+  const tr_piece_index_t piece = tr_torBlockPiece (tor, block);
+  const uint64_t begin = (uint64_t)block * tor->blockSize;
+  const uint64_t end = begin + tr_torBlockCountBytes (tor, block);
+
+  tr_ioFindFileLocation (tor, piece, begin - (uint64_t)piece * tor->info.pieceSize, &i, &unused);
+
+  for (; i<tor->info.fileCount && tor->info.files[i].offset < end; ++i)
+    {
+      const tr_file * f = &tor->info.files[i];
+      const uint64_t lo = MAX (begin, f->offset);
+      const uint64_t hi = MIN (end, f->offset + f->length);
+
+      if (hi > lo)
+        {
+          if (add)
+            cp->fileBytes[i] += hi - lo;
+          else
+            cp->fileBytes[i] -= hi - lo;
+        }
+    }
 }
 
 /***
@@ -76,18 +182,43 @@ tr_cpPieceRem (tr_completion *  cp, tr_piece_index_t piece)
 {
   tr_block_index_t i, f, l;
   const tr_torrent * tor = cp->tor;
+  const uint64_t have = countPieceBytes (cp, piece);
 
   tr_torGetPieceBlockRange (cp->tor, piece, &f, &l);
 
   for (i=f; i<=l; ++i)
     if (tr_cpBlockIsComplete (cp, i))
-      cp->sizeNow -= tr_torBlockCountBytes (tor, i);
+      {
+        cp->sizeNow -= tr_torBlockCountBytes (tor, i);
+        updateFileBytes (cp, i, false);
+      }
+
+  if (have == tr_torPieceCountBytes (tor, piece))
+    cp->haveValid -= have;
+  if (tor->info.pieces[piece].dnd)
+    cp->sizeWhenDone -= have;
 
-  cp->haveValidIsDirty = true;
-  cp->sizeWhenDoneIsDirty = true;
   tr_bitfieldRemRange (&cp->blockBitfield, f, l+1);
 }
 
+void
+tr_cpSetPieceDND (tr_completion * cp, tr_piece_index_t piece, bool dnd)
+{
+  tr_piece * p = &cp->tor->info.pieces[piece];
+
+  if (!p->dnd != !dnd)
+    {
+      const uint64_t missing = tr_cpMissingBytesInPiece (cp, piece);
+
+      p->dnd = dnd;
+
+      if (dnd)
+        cp->sizeWhenDone -= missing;
+      else
+        cp->sizeWhenDone += missing;
+    }
+}
+
 void
 tr_cpPieceAdd (tr_completion * cp, tr_piece_index_t piece)
 {
@@ -107,11 +238,16 @@ tr_cpBlockAdd (tr_completion * cp, tr_block_index_t block)
     {
       const tr_piece_index_t piece = tr_torBlockPiece (cp->tor, block);
 
+      const uint32_t blockSize = tr_torBlockCountBytes (tor, block);
+
       tr_bitfieldAdd (&cp->blockBitfield, block);
-      cp->sizeNow += tr_torBlockCountBytes (tor, block);
+      cp->sizeNow += blockSize;
+      updateFileBytes (cp, block, true);
 
-      cp->haveValidIsDirty = true;
-      cp->sizeWhenDoneIsDirty |= tor->info.pieces[piece].dnd;
+      if (tor->info.pieces[piece].dnd)
+        cp->sizeWhenDone += blockSize;
+      if (tr_cpPieceIsComplete (cp, piece))
+        cp->haveValid += tr_torPieceCountBytes (tor, piece);
     }
 }
 
@@ -119,81 +255,6 @@ tr_cpBlockAdd (tr_completion * cp, tr_block_index_t block)
 ****
 ***/
 
-uint64_t
-tr_cpHaveValid (const tr_completion * ccp)
-{
-  if (ccp->haveValidIsDirty)
-    {
-      tr_piece_index_t i;
-      uint64_t size = 0;
-      tr_completion * cp = (tr_completion *) ccp; /* mutable */
-      const tr_torrent * tor = ccp->tor;
-      const tr_info * info = &tor->info;
-
-      for (i=0; i<info->pieceCount; ++i)
-        if (tr_cpPieceIsComplete (ccp, i))
-          size += tr_torPieceCountBytes (tor, i);
-
-      cp->haveValidLazy = size;
-      cp->haveValidIsDirty = false;
-    }
-
-  return ccp->haveValidLazy;
-}
-
-uint64_t
-tr_cpSizeWhenDone (const tr_completion * ccp)
-{
-  if (ccp->sizeWhenDoneIsDirty)
-    {
-      uint64_t size = 0;
-      const tr_torrent * tor = ccp->tor;
-      const tr_info * inf = tr_torrentInfo (tor);
-      tr_completion * cp = (tr_completion *) ccp; /* mutable */
-
-      if (tr_cpHasAll (ccp))
-        {
-          size = inf->totalSize;
-        }
-      else
-        {
-          tr_piece_index_t p;
-
-          for (p=0; p<inf->pieceCount; ++p)
-            {
-              uint64_t n = 0;
-              const uint64_t pieceSize = tr_torPieceCountBytes (tor, p);
-
-              if (!inf->pieces[p].dnd)
-                {
-                  n = pieceSize;
-                }
-              else
-                {
-                  tr_block_index_t f, l;
-                  tr_torGetPieceBlockRange (cp->tor, p, &f, &l);
-
-                  n = tr_bitfieldCountRange (&cp->blockBitfield, f, l+1);
-                  n *= cp->tor->blockSize;
-                  if (l == (cp->tor->blockCount-1) && tr_bitfieldHas (&cp->blockBitfield, l))
-                    n -= (cp->tor->blockSize - cp->tor->lastBlockSize);
-                }
-
-              assert (n <= tr_torPieceCountBytes (tor, p));
-              size += n;
-            }
-        }
-
-      assert (size <= inf->totalSize);
-      assert (size >= cp->sizeNow);
-
-      cp->sizeWhenDoneLazy = size;
-      cp->sizeWhenDoneIsDirty = false;
-    }
-
-  return ccp->sizeWhenDoneLazy;
-}
-
 uint64_t
 tr_cpLeftUntilDone (const tr_completion * cp)
 {
@@ -275,16 +336,7 @@ tr_cpMissingBytesInPiece (const tr_completion * cp, tr_piece_index_t piece)
 bool
 tr_cpFileIsComplete (const tr_completion * cp, tr_file_index_t i)
 {
-  if (cp->tor->info.files[i].length == 0)
-    {
-      return true;
-    }
-  else
-    {
-      tr_block_index_t f, l;
-      tr_torGetFileBlockRange (cp->tor, i, &f, &l);
-      return tr_bitfieldCountRange (&cp->blockBitfield, f, l+1) == (l+1-f);
-    }
+  return cp->fileBytes[i] == cp->tor->info.files[i].length;
 }
 
 void *
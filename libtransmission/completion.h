@@ -23,23 +23,17 @@ typedef struct tr_completion
   tr_bitfield blockBitfield;
 
   /* number of bytes we'll have when done downloading. [0..info.totalSize]
-     DON'T access this directly; it's a lazy field.
-     use tr_cpSizeWhenDone () instead! */
-  uint64_t sizeWhenDoneLazy;
+     kept up to date as blocks arrive and pieces' DND flags change. */
+  uint64_t sizeWhenDone;
 
-  /* whether or not sizeWhenDone needs to be recalculated */
-  bool sizeWhenDoneIsDirty;
-
-  /* number of bytes we'll have when done downloading. [0..info.totalSize]
-     DON'T access this directly; it's a lazy field.
-     use tr_cpHaveValid () instead! */
-  uint64_t haveValidLazy;
-
-  /* whether or not haveValidLazy needs to be recalculated */
-  bool haveValidIsDirty;
+  /* number of bytes in complete pieces. [0..sizeNow] */
+  uint64_t haveValid;
 
   /* number of bytes we want or have now. [0..sizeWhenDone] */
   uint64_t sizeNow;
+
+  /* for each file, the number of its bytes that are in completed blocks */
+  uint64_t * fileBytes;
 }
 tr_completion;
 
@@ -55,6 +49,7 @@ static inline void
 tr_cpDestruct (tr_completion * cp)
 {
   tr_bitfieldDestruct (&cp->blockBitfield);
+  tr_free (cp->fileBytes);
 }
 
 /**
@@ -67,9 +62,17 @@ double            tr_cpPercentDone (const tr_completion * cp);
 
 tr_completeness   tr_cpGetStatus (const tr_completion *);
 
-uint64_t          tr_cpHaveValid (const tr_completion *);
+static inline uint64_t
+tr_cpHaveValid (const tr_completion * cp)
+{
+  return cp->haveValid;
+}
 
-uint64_t          tr_cpSizeWhenDone (const tr_completion *);
+static inline uint64_t
+tr_cpSizeWhenDone (const tr_completion * cp)
+{
+  return cp->sizeWhenDone;
+}
 
 uint64_t          tr_cpLeftUntilDone (const tr_completion *);
 
@@ -104,6 +107,9 @@ void    tr_cpPieceAdd (tr_completion * cp, tr_piece_index_t i);
 
 void    tr_cpPieceRem (tr_completion * cp, tr_piece_index_t i);
 
+/* set a piece's DND flag, updating sizeWhenDone to match */
+void    tr_cpSetPieceDND (tr_completion * cp, tr_piece_index_t i, bool dnd);
+
 size_t  tr_cpMissingBlocksInPiece (const tr_completion *, tr_piece_index_t);
 
 size_t  tr_cpMissingBytesInPiece (const tr_completion *, tr_piece_index_t);
@@ -130,13 +136,13 @@ tr_cpBlockIsComplete (const tr_completion * cp, tr_block_index_t i)
 ****  Misc
 ***/
 
+static inline uint64_t
+tr_cpFileBytesCompleted (const tr_completion * cp, tr_file_index_t i)
+{
+  return cp->fileBytes[i];
+}
+
 bool  tr_cpFileIsComplete (const tr_completion * cp, tr_file_index_t);
 
 void* tr_cpCreatePieceBitfield (const tr_completion * cp, size_t * byte_count);
 
-static inline void
-tr_cpInvalidateDND (tr_completion * cp)
-{
-  cp->sizeWhenDoneIsDirty = true;
-}
-
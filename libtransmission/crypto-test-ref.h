@@ -32,6 +32,14 @@
 #define tr_cryptoEncryptInit tr_cryptoEncryptInit_
 #define tr_cryptoEncrypt tr_cryptoEncrypt_
 #define tr_cryptoSecretKeySha1 tr_cryptoSecretKeySha1_
+#define tr_dh_pool tr_dh_pool_
+#define tr_dh_pool_stats tr_dh_pool_stats_
+#define tr_cryptoSetKeyPool tr_cryptoSetKeyPool_
+#define tr_dhPoolNew tr_dhPoolNew_
+#define tr_dhPoolFree tr_dhPoolFree_
+#define tr_dhPoolSetSize tr_dhPoolSetSize_
+#define tr_dhPoolGetSize tr_dhPoolGetSize_
+#define tr_dhPoolGetStats tr_dhPoolGetStats_
 #define tr_sha1 tr_sha1_
 #define tr_sha1_init tr_sha1_init_
 #define tr_sha1_update tr_sha1_update_
@@ -89,6 +97,14 @@
 #undef tr_cryptoEncryptInit
 #undef tr_cryptoEncrypt
 #undef tr_cryptoSecretKeySha1
+#undef tr_dh_pool
+#undef tr_dh_pool_stats
+#undef tr_cryptoSetKeyPool
+#undef tr_dhPoolNew
+#undef tr_dhPoolFree
+#undef tr_dhPoolSetSize
+#undef tr_dhPoolGetSize
+#undef tr_dhPoolGetStats
 #undef tr_sha1
 #undef tr_sha1_init
 #undef tr_sha1_update
@@ -9,9 +9,12 @@
 #include <assert.h>
 #include <string.h> /* memcpy (), memmove (), memset () */
 
+#include <event2/util.h> /* struct timeval */
+
 #include "transmission.h"
 #include "crypto.h"
 #include "crypto-utils.h"
+#include "platform.h" /* tr_lock, tr_thread */
 #include "utils.h"
 
 /**
@@ -39,17 +42,230 @@ static const uint8_t dh_G[] = { 2 };
 ***
 **/
 
+static uint64_t
+getUsec (void)
+{
+  struct timeval tv;
+
+  tr_gettimeofday (&tv);
+  return (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static tr_dh_ctx_t
+makeKey (uint8_t * public_key)
+{
+  size_t public_key_length;
+  tr_dh_ctx_t dh = tr_dh_new (dh_P, sizeof (dh_P), dh_G, sizeof (dh_G));
+
+  if (dh != NULL && !tr_dh_make_key (dh, DH_PRIVKEY_LEN, public_key, &public_key_length))
+    {
+      tr_dh_free (dh);
+      dh = NULL;
+    }
+
+  assert (dh == NULL || public_key_length == KEY_LEN);
+  return dh;
+}
+
+/***
+****  DH key pool
+****
+****  Generating a keypair is the costliest part of an MSE handshake.
+****  A worker thread keeps the pool topped up so that a burst of
+****  incoming connections doesn't stall the libtransmission thread.
+***/
+
+struct tr_dh_key
+{
+  tr_dh_ctx_t  dh;
+  uint8_t      publicKey[KEY_LEN];
+};
+
+struct tr_dh_pool
+{
+  tr_lock           * lock;
+
+  /* the worker thread, or NULL if it's not running */
+  tr_thread         * thread;
+
+  struct tr_dh_key  * keys;
+  int                 keyCount;
+  int                 size;
+
+  tr_dh_pool_stats    stats;
+};
+
+static void
+dhPoolThreadFunc (void * vpool)
+{
+  tr_dh_pool * pool = vpool;
+
+  tr_lockLock (pool->lock);
+
+  while (pool->keyCount < pool->size)
+    {
+      struct tr_dh_key key;
+
+      tr_lockUnlock (pool->lock);
+      key.dh = makeKey (key.publicKey);
+      tr_lockLock (pool->lock);
+
+      if (key.dh == NULL)
+        break;
+
+      if (pool->keyCount < pool->size)
+        {
+          pool->keys[pool->keyCount++] = key;
+          ++pool->stats.keysPooled;
+        }
+      else /* the pool shrank while we were busy */
+        {
+          tr_dh_free (key.dh);
+        }
+    }
+
+  pool->thread = NULL;
+  tr_lockUnlock (pool->lock);
+}
+
+/* start refilling once the pool's half empty, so that a steady
+ * trickle of handshakes doesn't start a new thread for each one */
+static void
+dhPoolMaybeRefill (tr_dh_pool * pool)
+{
+  assert (tr_lockHave (pool->lock));
+
+  if ((pool->thread == NULL) && (pool->keyCount <= pool->size / 2)
+                             && (pool->keyCount < pool->size))
+    pool->thread = tr_threadNew (dhPoolThreadFunc, pool);
+}
+
+static bool
+dhPoolTake (tr_dh_pool * pool, tr_dh_ctx_t * setme_dh, uint8_t * setme_public_key)
+{
+  bool found;
+
+  tr_lockLock (pool->lock);
+
+  if ((found = pool->keyCount > 0))
+    {
+      const struct tr_dh_key * key = &pool->keys[--pool->keyCount];
+      *setme_dh = key->dh;
+      memcpy (setme_public_key, key->publicKey, KEY_LEN);
+      ++pool->stats.keysFromPool;
+    }
+
+  dhPoolMaybeRefill (pool);
+  tr_lockUnlock (pool->lock);
+  return found;
+}
+
+static void
+dhPoolCountInlineKey (tr_dh_pool * pool, uint64_t usec)
+{
+  tr_lockLock (pool->lock);
+  ++pool->stats.keysGeneratedInline;
+  pool->stats.keygenUsec += usec;
+  tr_lockUnlock (pool->lock);
+}
+
+static void
+dhPoolCountSecret (tr_dh_pool * pool, uint64_t usec)
+{
+  tr_lockLock (pool->lock);
+  pool->stats.secretUsec += usec;
+  tr_lockUnlock (pool->lock);
+}
+
+tr_dh_pool *
+tr_dhPoolNew (int size)
+{
+  tr_dh_pool * pool = tr_new0 (tr_dh_pool, 1);
+
+  pool->lock = tr_lockNew ();
+  tr_dhPoolSetSize (pool, size);
+  return pool;
+}
+
+void
+tr_dhPoolFree (tr_dh_pool * pool)
+{
+  int i;
+
+  if (pool == NULL)
+    return;
+
+  /* tell the worker to stop, then wait for it to notice */
+  tr_lockLock (pool->lock);
+  pool->size = 0;
+  while (pool->thread != NULL)
+    {
+      tr_lockUnlock (pool->lock);
+      tr_wait_msec (10);
+      tr_lockLock (pool->lock);
+    }
+  tr_lockUnlock (pool->lock);
+
+  for (i=0; i<pool->keyCount; ++i)
+    tr_dh_free (pool->keys[i].dh);
+  tr_free (pool->keys);
+  tr_lockFree (pool->lock);
+  tr_free (pool);
+}
+
+void
+tr_dhPoolSetSize (tr_dh_pool * pool, int size)
+{
+  size = MAX (0, size);
+
+  tr_lockLock (pool->lock);
+
+  while (pool->keyCount > size)
+    tr_dh_free (pool->keys[--pool->keyCount].dh);
+
+  pool->keys = tr_renew (struct tr_dh_key, pool->keys, size);
+  pool->size = size;
+  dhPoolMaybeRefill (pool);
+
+  tr_lockUnlock (pool->lock);
+}
+
+int
+tr_dhPoolGetSize (const tr_dh_pool * pool)
+{
+  return pool->size;
+}
+
+void
+tr_dhPoolGetStats (const tr_dh_pool * pool, tr_dh_pool_stats * setme)
+{
+  tr_lockLock (pool->lock);
+  *setme = pool->stats;
+  setme->size = pool->size;
+  setme->available = pool->keyCount;
+  tr_lockUnlock (pool->lock);
+}
+
+/**
+***
+**/
+
 static void
 ensureKeyExists (tr_crypto * crypto)
 {
   if (crypto->dh == NULL)
     {
-      size_t public_key_length;
+      tr_dh_pool * pool = crypto->keyPool;
+
+      if ((pool == NULL) || !dhPoolTake (pool, &crypto->dh, crypto->myPublicKey))
+        {
+          const uint64_t begin = getUsec ();
 
-      crypto->dh = tr_dh_new (dh_P, sizeof (dh_P), dh_G, sizeof (dh_G));
-      tr_dh_make_key (crypto->dh, DH_PRIVKEY_LEN, crypto->myPublicKey, &public_key_length);
+          crypto->dh = makeKey (crypto->myPublicKey);
 
-      assert (public_key_length == KEY_LEN);
+          if (pool != NULL)
+            dhPoolCountInlineKey (pool, getUsec () - begin);
+        }
     }
 }
 
@@ -62,6 +278,12 @@ tr_cryptoConstruct (tr_crypto * crypto, const uint8_t * torrentHash, bool isInco
   tr_cryptoSetTorrentHash (crypto, torrentHash);
 }
 
+void
+tr_cryptoSetKeyPool (tr_crypto * crypto, tr_dh_pool * pool)
+{
+  crypto->keyPool = pool;
+}
+
 void
 tr_cryptoDestruct (tr_crypto * crypto)
 {
@@ -79,8 +301,18 @@ bool
 tr_cryptoComputeSecret (tr_crypto *     crypto,
                         const uint8_t * peerPublicKey)
 {
+  uint64_t begin;
+
   ensureKeyExists (crypto);
+  if (crypto->dh == NULL)
+    return false;
+
+  begin = getUsec ();
   crypto->mySecret = tr_dh_agree (crypto->dh, peerPublicKey, KEY_LEN);
+
+  if (crypto->keyPool != NULL)
+    dhPoolCountSecret (crypto->keyPool, getUsec () - begin);
+
   return crypto->mySecret != NULL;
 }
 
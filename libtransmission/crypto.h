@@ -28,6 +28,28 @@ enum
   KEY_LEN = 96
 };
 
+/** @brief Opaque pool of DH keypairs generated ahead of time in a worker thread */
+typedef struct tr_dh_pool tr_dh_pool;
+
+/** @brief Counters kept by a tr_dh_pool */
+typedef struct tr_dh_pool_stats
+{
+    /* how many keypairs the pool tries to keep ready */
+    int       size;
+    /* how many are ready right now */
+    int       available;
+    /* keypairs generated by the worker thread */
+    uint64_t  keysPooled;
+    /* keypairs handed out to handshakes */
+    uint64_t  keysFromPool;
+    /* keypairs handshakes had to generate because the pool was empty */
+    uint64_t  keysGeneratedInline;
+    /* time handshakes spent generating keypairs and shared secrets */
+    uint64_t  keygenUsec;
+    uint64_t  secretUsec;
+}
+tr_dh_pool_stats;
+
 /** @brief Holds state information for encrypted peer communications */
 typedef struct
 {
@@ -39,6 +61,7 @@ typedef struct
     uint8_t         torrentHash[SHA_DIGEST_LENGTH];
     bool            isIncoming;
     bool            torrentHashIsSet;
+    tr_dh_pool    * keyPool;
 }
 tr_crypto;
 
@@ -48,6 +71,9 @@ void tr_cryptoConstruct (tr_crypto * crypto, const uint8_t * torrentHash, bool i
 /** @brief destruct an existing tr_crypto object */
 void tr_cryptoDestruct (tr_crypto * crypto);
 
+/** @brief take our DH keypair from this pool, if it has one ready */
+void tr_cryptoSetKeyPool (tr_crypto * crypto, tr_dh_pool * pool);
+
 
 void tr_cryptoSetTorrentHash (tr_crypto * crypto, const uint8_t * torrentHash);
 
@@ -82,6 +108,18 @@ bool           tr_cryptoSecretKeySha1 (const tr_crypto * crypto,
                                        size_t            append_data_size,
                                        uint8_t         * hash);
 
+/** @brief create a pool that keeps `size' DH keypairs ready; 0 disables it */
+tr_dh_pool * tr_dhPoolNew (int size);
+
+/** @brief stop the pool's worker thread and free its keypairs */
+void tr_dhPoolFree (tr_dh_pool * pool);
+
+void tr_dhPoolSetSize (tr_dh_pool * pool, int size);
+
+int  tr_dhPoolGetSize (const tr_dh_pool * pool);
+
+void tr_dhPoolGetStats (const tr_dh_pool * pool, tr_dh_pool_stats * setme);
+
 /* @} */
 
 #endif
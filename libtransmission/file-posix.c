@@ -698,6 +698,65 @@ tr_sys_file_write_at (tr_sys_file_t    handle,
   return ret;
 }
 
+bool
+tr_sys_file_copy (tr_sys_file_t    in,
+                  tr_sys_file_t    out,
+                  uint64_t         size,
+                  uint64_t       * bytes_copied,
+                  tr_error      ** error)
+{
+  bool ret = false;
+  uint64_t bytes_read = 0;
+  const size_t buflen = MIN (size, 1024 * 128); /* 128 KiB buffer */
+  char * buf;
+
+  assert (in != TR_BAD_SYS_FILE);
+  assert (out != TR_BAD_SYS_FILE);
+
+#ifdef HAVE_COPY_FILE_RANGE
+  {
+    const ssize_t my_bytes_copied = copy_file_range (in, NULL, out, NULL, size, 0);
+
+    if (my_bytes_copied != -1)
+      {
+        if (bytes_copied != NULL)
+          *bytes_copied = my_bytes_copied;
+        return true;
+      }
+
+    /* fall back to read () and write () if the kernel can't do it */
+    if (errno != ENOSYS && errno != EXDEV && errno != EINVAL && errno != EOPNOTSUPP)
+      {
+        set_system_error (error, errno);
+        return false;
+      }
+  }
+#endif
+
+  buf = tr_valloc (MAX (buflen, 1));
+
+  if (tr_sys_file_read (in, buf, buflen, &bytes_read, error))
+    {
+      uint64_t bytes_written = 0;
+
+      ret = true;
+
+      while (ret && bytes_written < bytes_read)
+        {
+          uint64_t n = 0;
+
+          ret = tr_sys_file_write (out, buf + bytes_written, bytes_read - bytes_written, &n, error);
+          bytes_written += n;
+        }
+    }
+
+  if (ret && bytes_copied != NULL)
+    *bytes_copied = bytes_read;
+
+  tr_free (buf);
+  return ret;
+}
+
 bool
 tr_sys_file_flush (tr_sys_file_t    handle,
                    tr_error      ** error)
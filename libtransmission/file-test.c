@@ -1136,6 +1136,103 @@ test_file_read_write_seek (void)
   return 0;
 }
 
+static int
+test_file_copy (void)
+{
+  char * const test_dir = create_test_dir (__FUNCTION__);
+  tr_error * err = NULL;
+  char * path1;
+  char * path2;
+  tr_sys_file_t in;
+  tr_sys_file_t out;
+  uint64_t n;
+  char buf[100];
+#ifndef _WIN32
+  int pipefd[2];
+#endif
+
+  path1 = tr_buildPath (test_dir, "a", NULL);
+  path2 = tr_buildPath (test_dir, "b", NULL);
+
+  libtest_create_file_with_string_contents (path1, "0123456789");
+
+  in = tr_sys_file_open (path1, TR_SYS_FILE_READ, 0, NULL);
+  out = tr_sys_file_open (path2, TR_SYS_FILE_READ | TR_SYS_FILE_WRITE | TR_SYS_FILE_CREATE, 0600, NULL);
+
+  /* copies stop at the size we ask for */
+  check (tr_sys_file_copy (in, out, 4, &n, &err));
+  check (err == NULL);
+  check_uint_eq (4, n);
+
+  /* ...or at the end of the input */
+  check (tr_sys_file_copy (in, out, sizeof (buf), &n, &err));
+  check (err == NULL);
+  check_uint_eq (6, n);
+
+  check (tr_sys_file_copy (in, out, sizeof (buf), &n, &err));
+  check (err == NULL);
+  check_uint_eq (0, n);
+
+  /* both files' positions were moved along */
+  check (tr_sys_file_seek (in, 0, TR_SEEK_CUR, &n, &err));
+  check_uint_eq (10, n);
+  check (tr_sys_file_seek (out, 0, TR_SEEK_CUR, &n, &err));
+  check_uint_eq (10, n);
+
+  check (tr_sys_file_read_at (out, buf, sizeof (buf), 0, &n, &err));
+  check (err == NULL);
+  check_uint_eq (10, n);
+  check_int_eq (0, memcmp (buf, "0123456789", 10));
+
+  /* copying from the middle of a file over the middle of another */
+  check (tr_sys_file_seek (in, 2, TR_SEEK_SET, NULL, &err));
+  check (tr_sys_file_seek (out, 6, TR_SEEK_SET, NULL, &err));
+  check (tr_sys_file_copy (in, out, 3, &n, &err));
+  check (err == NULL);
+  check_uint_eq (3, n);
+
+  check (tr_sys_file_read_at (out, buf, sizeof (buf), 0, &n, &err));
+  check_uint_eq (10, n);
+  check_int_eq (0, memcmp (buf, "0123452349", 10));
+
+  tr_sys_file_close (in, NULL);
+
+#ifndef _WIN32
+
+  /* the kernel can't copy from a pipe, so this goes through read () and write () */
+  check_int_eq (0, pipe (pipefd));
+  check_int_eq (3, write (pipefd[1], "abc", 3));
+  close (pipefd[1]);
+
+  check (tr_sys_file_seek (out, 0, TR_SEEK_SET, NULL, &err));
+  check (tr_sys_file_copy (pipefd[0], out, sizeof (buf), &n, &err));
+  check (err == NULL);
+  check_uint_eq (3, n);
+
+  check (tr_sys_file_copy (pipefd[0], out, sizeof (buf), &n, &err));
+  check (err == NULL);
+  check_uint_eq (0, n);
+
+  close (pipefd[0]);
+
+  check (tr_sys_file_read_at (out, buf, sizeof (buf), 0, &n, &err));
+  check_uint_eq (10, n);
+  check_int_eq (0, memcmp (buf, "abc3452349", 10));
+
+#endif
+
+  tr_sys_file_close (out, NULL);
+
+  tr_sys_path_remove (path2, NULL);
+  tr_sys_path_remove (path1, NULL);
+
+  tr_free (path2);
+  tr_free (path1);
+
+  tr_free (test_dir);
+  return 0;
+}
+
 static int
 test_file_truncate (void)
 {
@@ -1537,6 +1634,7 @@ main (void)
       test_path_remove,
       test_file_open,
       test_file_read_write_seek,
+      test_file_copy,
       test_file_truncate,
       test_file_preallocate,
       test_file_map,
@@ -1008,6 +1008,45 @@ tr_sys_file_write_at (tr_sys_file_t    handle,
   return ret;
 }
 
+bool
+tr_sys_file_copy (tr_sys_file_t    in,
+                  tr_sys_file_t    out,
+                  uint64_t         size,
+                  uint64_t       * bytes_copied,
+                  tr_error      ** error)
+{
+  bool ret = false;
+  uint64_t bytes_read = 0;
+  const size_t buflen = MIN (size, 1024 * 128); /* 128 KiB buffer */
+  char * buf;
+
+  assert (in != TR_BAD_SYS_FILE);
+  assert (out != TR_BAD_SYS_FILE);
+
+  buf = tr_valloc (MAX (buflen, 1));
+
+  if (tr_sys_file_read (in, buf, buflen, &bytes_read, error))
+    {
+      uint64_t bytes_written = 0;
+
+      ret = true;
+
+      while (ret && bytes_written < bytes_read)
+        {
+          uint64_t n = 0;
+
+          ret = tr_sys_file_write (out, buf + bytes_written, bytes_read - bytes_written, &n, error);
+          bytes_written += n;
+        }
+    }
+
+  if (ret && bytes_copied != NULL)
+    *bytes_copied = bytes_read;
+
+  tr_free (buf);
+  return ret;
+}
+
 bool
 tr_sys_file_flush (tr_sys_file_t    handle,
                    tr_error      ** error)
@@ -444,6 +444,31 @@ bool            tr_sys_file_write_at        (tr_sys_file_t        handle,
                                              uint64_t           * bytes_written,
                                              struct tr_error   ** error);
 
+/**
+ * @brief Copy data from one file to another, at their current positions.
+ *
+ * Where the system provides `copy_file_range ()`, the data is copied by the
+ * kernel without passing through userspace (filesystems that support it may
+ * even share the blocks instead of duplicating them). Otherwise the data is
+ * read and written through a buffer.
+ *
+ * @param[in]  in           Valid file descriptor to read from.
+ * @param[in]  out          Valid file descriptor to write to.
+ * @param[in]  size         Maximum number of bytes to copy.
+ * @param[out] bytes_copied Number of bytes actually copied, which is zero at
+ *                          the end of `in`. Optional, pass `NULL` if you are
+ *                          not interested.
+ * @param[out] error        Pointer to error object. Optional, pass `NULL` if
+ *                          you are not interested in error details.
+ *
+ * @return `True` on success, `false` otherwise (with `error` set accordingly).
+ */
+bool            tr_sys_file_copy            (tr_sys_file_t        in,
+                                             tr_sys_file_t        out,
+                                             uint64_t             size,
+                                             uint64_t           * bytes_copied,
+                                             struct tr_error   ** error);
+
 /**
  * @brief Portability wrapper for `fsync ()`.
  *
@@ -137,6 +137,8 @@ readOrWriteBytes (tr_session       * session,
               tr_logAddTorErr (tor, "write failed for \"%s\": %s", file->name, error->message);
               tr_error_free (error);
             }
+
+          tr_torrentNoteFileWrite (tor, fileIndex, fileOffset, buflen);
         }
       else if (ioMode == TR_IO_PREFETCH)
         {
@@ -284,10 +286,16 @@ recalculateHash (tr_torrent * tor, tr_piece_index_t pieceIndex, uint8_t * setme)
   assert (buflen > 0);
   assert (setme != NULL);
 
-  sha = tr_sha1_init ();
   bytesLeft = tr_torPieceCountBytes (tor, pieceIndex);
 
-  tr_ioPrefetch (tor, pieceIndex, offset, bytesLeft);
+  /* if the blocks were hashed as they arrived, only read the rest */
+  if (tr_cacheTakePieceHash (tor->session->cache, tor, pieceIndex, &sha, &offset))
+    bytesLeft -= offset;
+  else
+    sha = tr_sha1_init ();
+
+  if (bytesLeft)
+    tr_ioPrefetch (tor, pieceIndex, offset, bytesLeft);
 
   while (bytesLeft)
     {
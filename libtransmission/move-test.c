@@ -15,6 +15,7 @@
 #include "transmission.h"
 #include "cache.h"
 #include "file.h"
+#include "inout.h"
 #include "resume.h"
 #include "trevent.h"
 #include "torrent.h" /* tr_isTorrent() */
@@ -208,6 +209,86 @@ test_set_location (void)
   return 0;
 }
 
+struct test_set_location_copy_data
+{
+  tr_torrent * tor;
+  bool done;
+};
+
+static void
+test_set_location_copy_threadfunc (void * vdata)
+{
+  struct test_set_location_copy_data * data = vdata;
+  const uint8_t buf[4] = { 1, 2, 3, 4 };
+
+  /* this lands in the old copy while the files are being copied */
+  tr_ioWrite (data->tor, 0, 0, sizeof (buf), buf);
+  data->done = true;
+}
+
+/* moving to another filesystem copies the files, and whatever gets
+   written during the copy has to make it to the new location too.
+   relocateByCopying makes it copy within the test's own filesystem */
+static int
+test_set_location_copy (void)
+{
+  int state;
+  double progress;
+  double lastProgress;
+  char * target_dir;
+  char * path;
+  uint8_t * contents;
+  size_t contents_len;
+  tr_torrent * tor;
+  tr_session * session;
+  struct test_set_location_copy_data data;
+  const time_t deadline = time(NULL) + 300;
+
+  session = libttest_session_init (NULL);
+  target_dir = tr_buildPath (tr_sessionGetConfigDir (session), "target", NULL);
+  tr_sys_dir_create (target_dir, TR_SYS_DIR_CREATE_PARENTS, 0777, NULL);
+
+  tor = libttest_zero_torrent_init (session);
+  libttest_zero_torrent_populate (tor, true);
+
+  /* copy the files even though they're on the same filesystem */
+  tor->relocateByCopying = true;
+
+  state = -1;
+  progress = lastProgress = 0;
+  tr_torrentSetLocation (tor, target_dir, true, &progress, &state);
+
+  data.tor = tor;
+  data.done = false;
+  tr_runInEventThread (session, test_set_location_copy_threadfunc, &data);
+
+  while ((!data.done || state==TR_LOC_MOVING) && (time(NULL)<=deadline))
+    {
+      /* progress never goes backwards */
+      check (progress >= lastProgress);
+      lastProgress = progress;
+      tr_wait_msec (10);
+    }
+  check_int_eq (TR_LOC_DONE, state);
+  check (progress >= 0.999);
+
+  /* the write made it to the new copy */
+  libttest_sync ();
+  check_file_location (tor, 0, tr_buildPath (target_dir, tor->info.files[0].name, NULL));
+  path = tr_torrentFindFile (tor, 0);
+  contents = tr_loadFile (path, &contents_len, NULL);
+  check (contents != NULL);
+  check_uint_eq (tor->info.files[0].length, contents_len);
+  check_int_eq (0, memcmp (contents, "\1\2\3\4", 4));
+  tr_free (contents);
+  tr_free (path);
+
+  tr_torrentRemove (tor, true, tr_sys_path_remove);
+  libttest_session_close (session);
+  tr_free (target_dir);
+  return 0;
+}
+
 /***
 ****
 ***/
@@ -216,7 +297,8 @@ int
 main (void)
 {
   const testFunc tests[] = { test_incomplete_dir,
-                             test_set_location };
+                             test_set_location,
+                             test_set_location_copy };
 
   return runTests (tests, NUM_TESTS (tests));
 }
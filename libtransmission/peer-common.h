@@ -121,6 +121,17 @@ typedef struct tr_peer
   struct tr_bitfield blame;
   struct tr_bitfield have;
 
+  /* how many pieces in 'have' we still want.
+     NOTE: private to peer-mgr.c */
+  size_t interestingPieceCount;
+
+  /* while super-seeding, the pieces we've told this peer we have,
+     the one we're waiting for them to pass on (or -1), and when we
+     told them about it. NOTE: only peer-mgr.c changes these */
+  struct tr_bitfield superSeedOffered;
+  int superSeedPiece;
+  time_t superSeedOfferedAt;
+
   /* the client name.
      For BitTorrent peers, this is the app name derived from the `v' string in LTEP's handshake dictionary */
   tr_quark client;
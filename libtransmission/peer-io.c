@@ -612,6 +612,7 @@ tr_peerIoNew (tr_session       * session,
     io->magicNumber = PEER_IO_MAGIC_NUMBER;
     io->refCount = 1;
     tr_cryptoConstruct (&io->crypto, torrentHash, isIncoming);
+    tr_cryptoSetKeyPool (&io->crypto, session->keyPool);
     io->session = session;
     io->addr = *addr;
     io->isSeed = isSeed;
@@ -0,0 +1,113 @@
+/*
+ * This file Copyright (C) 2016 Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include "transmission.h"
+#include "bitfield.h"
+#include "peer-common.h"
+#include "peer-mgr.h"
+#include "torrent.h"
+#include "utils.h" /* tr_wait_msec () */
+
+#include "libtransmission-test.h"
+
+/***
+****
+***/
+
+static int
+test_super_seed_pick (void)
+{
+  tr_bitfield have;
+  tr_bitfield offered;
+  const uint16_t replication[] = { 3, 2, 0, 2, 0, 5, 2, 2 };
+  const uint16_t offers[]      = { 0, 0, 1, 0, 0, 0, 0, 0 };
+  const tr_piece_index_t n = sizeof (replication) / sizeof (replication[0]);
+
+  tr_bitfieldConstruct (&have, n);
+  tr_bitfieldConstruct (&offered, n);
+  tr_bitfieldAdd (&have, 4);
+
+  /* piece 4 is the rarest, but the peer has it; piece 2 is next */
+  check_int_eq (2, tr_superSeedPickPiece (replication, offers, n, &have, &offered, 0));
+
+  /* once it's been offered, the ties are broken by where the scan starts */
+  tr_bitfieldAdd (&offered, 2);
+  check_int_eq (1, tr_superSeedPickPiece (replication, offers, n, &have, &offered, 0));
+  check_int_eq (6, tr_superSeedPickPiece (replication, offers, n, &have, &offered, 5));
+
+  /* nothing left to offer */
+  tr_bitfieldSetHasAll (&offered);
+  check_int_eq (-1, tr_superSeedPickPiece (replication, offers, n, &have, &offered, 0));
+
+  tr_bitfieldDestruct (&offered);
+  tr_bitfieldDestruct (&have);
+  return 0;
+}
+
+static int
+test_super_seed_requests (void)
+{
+  tr_peer peer;
+  tr_session * session = libttest_session_init (NULL);
+  tr_torrent * tor = libttest_zero_torrent_init (session);
+
+  libttest_zero_torrent_populate (tor, true);
+  check (!tr_peerMgrIsSuperSeeding (tor));
+
+  tr_peerConstruct (&peer, tor);
+  check (tr_peerMgrSuperSeedAllowsRequest (tor, &peer, 0));
+
+  /* only the pieces we've offered may be requested */
+  tr_torrentSetSuperSeeding (tor, true);
+  check (tr_peerMgrIsSuperSeeding (tor));
+  tr_bitfieldAdd (&peer.superSeedOffered, 1);
+  check (!tr_peerMgrSuperSeedAllowsRequest (tor, &peer, 0));
+  check (tr_peerMgrSuperSeedAllowsRequest (tor, &peer, 1));
+
+  tr_torrentSetSuperSeeding (tor, false);
+  check (!tr_peerMgrIsSuperSeeding (tor));
+  check (tr_peerMgrSuperSeedAllowsRequest (tor, &peer, 0));
+
+  tr_peerDestruct (&peer);
+  tr_torrentRemove (tor, false, NULL);
+  libttest_session_close (session);
+  return 0;
+}
+
+static int
+test_super_seed_resume (void)
+{
+  tr_session * session = libttest_session_init (NULL);
+  tr_torrent * tor = libttest_zero_torrent_init (session);
+
+  libttest_zero_torrent_populate (tor, true);
+  tr_torrentSetSuperSeeding (tor, true);
+
+  /* close the torrent and add it again, as if restarting */
+  tr_torrentFree (tor);
+  while (tr_sessionCountTorrents (session) > 0)
+    tr_wait_msec (10);
+  tor = libttest_zero_torrent_init (session);
+
+  check (tr_torrentGetSuperSeeding (tor));
+  check (tr_peerMgrIsSuperSeeding (tor));
+
+  tr_torrentRemove (tor, false, NULL);
+  libttest_session_close (session);
+  return 0;
+}
+
+int
+main (void)
+{
+  const testFunc tests[] = { test_super_seed_pick,
+                             test_super_seed_requests,
+                             test_super_seed_resume };
+
+  return runTests (tests, NUM_TESTS (tests));
+}
@@ -94,6 +94,9 @@ enum
 
   NO_BLOCKS_CANCEL_HISTORY = 120,
 
+  /* how long a swarm's PEX snapshot is reused before it's rebuilt */
+  PEX_SNAPSHOT_TTL_SECS = 15,
+
   CANCEL_HISTORY_SEC = 60
 };
 
@@ -116,16 +119,6 @@ const tr_swarm_stats TR_SWARM_STATS_INIT = { { 0, 0 }, 0, 0, { 0, 0, 0, 0, 0, 0,
  */
 struct peer_atom
 {
-  uint8_t     fromFirst;          /* where the peer was first found */
-  uint8_t     fromBest;           /* the "best" value of where the peer has been found */
-  uint8_t     flags;              /* these match the added_f flags */
-  uint8_t     flags2;             /* flags that aren't defined in added_f */
-  int8_t      seedProbability;    /* how likely is this to be a seed... [0..100] or -1 for unknown */
-  int8_t      blocklisted;        /* -1 for unknown, true for blocklisted, false for not blocklisted */
-
-  tr_port     port;
-  bool        utp_failed;         /* We recently failed to connect over uTP */
-  uint16_t    numFails;
   time_t      time;               /* when the peer's connection status last changed */
   time_t      piece_data_time;
 
@@ -137,6 +130,56 @@ struct peer_atom
   time_t      shelf_date;
   tr_peer   * peer;               /* will be NULL if not connected */
   tr_address  addr;
+
+  /* where this atom is in its swarm's candidate heaps, if it is */
+  int32_t     candidatePos;
+
+  /* the small fields are grouped at the end to keep padding down */
+  tr_port     port;
+  uint16_t    numFails;
+  uint8_t     fromFirst;          /* where the peer was first found */
+  uint8_t     fromBest;           /* the "best" value of where the peer has been found */
+  uint8_t     flags;              /* these match the added_f flags */
+  uint8_t     flags2;             /* flags that aren't defined in added_f */
+  int8_t      seedProbability;    /* how likely is this to be a seed... [0..100] or -1 for unknown */
+  int8_t      blocklisted;        /* -1 for unknown, true for blocklisted, false for not blocklisted */
+  bool        utp_failed;         /* We recently failed to connect over uTP */
+  uint8_t     candidateHeap;      /* CANDIDATES_NONE, _WAITING or _READY */
+};
+
+/* atoms are carved out of per-swarm slabs of this many */
+enum
+{
+  ATOM_SLAB_SIZE = 64
+};
+
+/* An atom that we might want to connect to is kept in one of two heaps:
+   "waiting" for its reconnect interval to pass, keyed by the time it does,
+   or "ready", keyed by its candidate score. */
+enum
+{
+  CANDIDATES_NONE,
+  CANDIDATES_WAITING,
+  CANDIDATES_READY
+};
+
+struct atom_heap_entry
+{
+  uint64_t key;
+  struct peer_atom * atom;
+};
+
+struct atom_heap
+{
+  struct atom_heap_entry * items;
+  int count;
+  int alloc;
+};
+
+struct peer_atom_slab
+{
+  struct peer_atom_slab * next;
+  struct peer_atom atoms[ATOM_SLAB_SIZE];
 };
 
 #ifdef NDEBUG
@@ -185,7 +228,7 @@ typedef struct tr_swarm
   tr_swarm_stats             stats;
 
   tr_ptrArray                outgoingHandshakes; /* tr_handshake */
-  tr_ptrArray                pool; /* struct peer_atom */
+  tr_ptrArray                pool; /* struct peer_atom, unsorted */
   tr_ptrArray                peers; /* tr_peerMsgs */
   tr_ptrArray                webseeds; /* tr_webseed */
 
@@ -213,6 +256,44 @@ typedef struct tr_swarm
   uint16_t                 * pieceReplication;
   size_t                     pieceReplicationSize;
 
+  /* Pieces that are neither DND nor complete. Each peer's
+     interestingPieceCount is the size of its intersection with the
+     peer's 'have' bitfield, so both are kept in step incrementally.
+     When wantedPiecesDirty is set they're rebuilt before the next use. */
+  tr_bitfield                wantedPieces;
+  bool                       wantedPiecesDirty;
+
+  /* True while tr_torrentIsSuperSeeding (). superSeedOffers counts,
+     for each piece, how many peers are waiting to pass it on. */
+  bool                       superSeeding;
+  uint16_t                 * superSeedOffers;
+
+  /* The pool's atoms live in atomSlabs; the most recent slab has
+     atomSlabUsed atoms handed out, and culled atoms wait in freeAtoms.
+     atomIndex is an open-addressed hash of the pool by address. */
+  struct peer_atom_slab    * atomSlabs;
+  int                        atomSlabUsed;
+  tr_ptrArray                freeAtoms; /* struct peer_atom */
+  struct peer_atom        ** atomIndex;
+  size_t                     atomIndexSize; /* zero or a power of two */
+
+  /* The pool's atoms that we might want to connect to, maintained as
+     atoms change state. When candidatesDirty is set or the resync
+     interval passes, they're rebuilt from the whole pool. */
+  struct atom_heap           candidatesWaiting;
+  struct atom_heap           candidatesReady;
+  bool                       candidatesDirty;
+  bool                       candidatesForSeed;
+  time_t                     candidatesSyncedAt;
+
+  /* The connected peers, sorted by tr_pexCompare (), that our peers
+     diff their last PEX message against. Index 0 is IPv4, 1 is IPv6.
+     pexSnapshotVersion changes whenever either list's contents do. */
+  tr_pex                   * pexSnapshot[2];
+  int                        pexSnapshotCount[2];
+  unsigned int               pexSnapshotVersion;
+  time_t                     pexSnapshotAt;
+
   int                        interestedCount;
   int                        maxPeers;
   time_t                     lastCancel;
@@ -233,6 +314,9 @@ struct tr_peerMgr
   struct event  * rechokeTimer;
   struct event  * refillUpkeepTimer;
   struct event  * atomTimer;
+
+  /* block requests sent to all peers that are still unanswered */
+  int             pendingRequestCount;
 };
 
 #define tordbg(t, ...) \
@@ -300,6 +384,8 @@ tr_peerConstruct (tr_peer * peer, const tr_torrent * tor)
   peer->swarm = tor->swarm;
   tr_bitfieldConstruct (&peer->have, tor->info.pieceCount);
   tr_bitfieldConstruct (&peer->blame, tor->blockCount);
+  tr_bitfieldConstruct (&peer->superSeedOffered, tor->info.pieceCount);
+  peer->superSeedPiece = -1;
 }
 
 static void peerDeclinedAllRequests (tr_swarm *, const tr_peer *);
@@ -314,6 +400,7 @@ tr_peerDestruct (tr_peer * peer)
 
   tr_bitfieldDestruct (&peer->have);
   tr_bitfieldDestruct (&peer->blame);
+  tr_bitfieldDestruct (&peer->superSeedOffered);
 
   if (peer->atom)
     peer->atom->peer = NULL;
@@ -384,24 +471,6 @@ getExistingHandshake (tr_ptrArray * handshakes, const tr_address * addr)
   return tr_ptrArrayFindSorted (handshakes, addr, handshakeCompareToAddr);
 }
 
-static int
-comparePeerAtomToAddress (const void * va, const void * vb)
-{
-  const struct peer_atom * a = va;
-
-  return tr_address_compare (&a->addr, vb);
-}
-
-static int
-compareAtomsByAddress (const void * va, const void * vb)
-{
-  const struct peer_atom * b = vb;
-
-  assert (tr_isAtom (b));
-
-  return comparePeerAtomToAddress (va, &b->addr);
-}
-
 /**
 ***
 **/
@@ -427,66 +496,632 @@ peerCompare (const void * a, const void * b)
   return tr_address_compare (tr_peerAddress (a), tr_peerAddress (b));
 }
 
-static struct peer_atom*
-getExistingAtom (const tr_swarm   * cswarm,
-                 const tr_address * addr)
+/***
+****  The atom pool's address index
+***/
+
+static size_t
+hashAddress (const tr_address * addr)
+{
+  size_t i;
+  size_t len;
+  const uint8_t * bytes;
+  uint32_t hash = 2166136261u; /* FNV-1a */
+
+  if (addr->type == TR_AF_INET)
+    {
+      bytes = (const uint8_t*) &addr->addr.addr4;
+      len = sizeof (addr->addr.addr4);
+    }
+  else
+    {
+      bytes = (const uint8_t*) &addr->addr.addr6;
+      len = sizeof (addr->addr.addr6);
+    }
+
+  for (i=0; i<len; ++i)
+    hash = (hash ^ bytes[i]) * 16777619u;
+
+  return hash ^ addr->type;
+}
+
+static struct peer_atom*
+getExistingAtom (const tr_swarm   * s,
+                 const tr_address * addr)
+{
+  size_t i;
+  const size_t mask = s->atomIndexSize - 1;
+
+  if (s->atomIndexSize == 0)
+    return NULL;
+
+  for (i=hashAddress (addr) & mask; s->atomIndex[i] != NULL; i=(i+1) & mask)
+    if (!tr_address_compare (&s->atomIndex[i]->addr, addr))
+      return s->atomIndex[i];
+
+  return NULL;
+}
+
+static void
+atomIndexPut (struct peer_atom ** index, size_t size, struct peer_atom * atom)
+{
+  size_t i;
+  const size_t mask = size - 1;
+
+  for (i=hashAddress (&atom->addr) & mask; index[i] != NULL; i=(i+1) & mask)
+    ;
+
+  index[i] = atom;
+}
+
+static void
+atomIndexAdd (tr_swarm * s, struct peer_atom * atom)
+{
+  const size_t count = tr_ptrArraySize (&s->pool);
+
+  /* keep the load factor at or below one half */
+  if ((count + 1) * 2 > s->atomIndexSize)
+    {
+      size_t i;
+      const size_t oldSize = s->atomIndexSize;
+      struct peer_atom ** oldIndex = s->atomIndex;
+
+      s->atomIndexSize = oldSize ? oldSize * 2 : 64;
+      s->atomIndex = tr_new0 (struct peer_atom*, s->atomIndexSize);
+
+      for (i=0; i<oldSize; ++i)
+        if (oldIndex[i] != NULL)
+          atomIndexPut (s->atomIndex, s->atomIndexSize, oldIndex[i]);
+
+      tr_free (oldIndex);
+    }
+
+  atomIndexPut (s->atomIndex, s->atomIndexSize, atom);
+}
+
+static void
+atomIndexRemove (tr_swarm * s, const struct peer_atom * atom)
+{
+  size_t i;
+  size_t j;
+  const size_t mask = s->atomIndexSize - 1;
+
+  for (i=hashAddress (&atom->addr) & mask; s->atomIndex[i] != atom; i=(i+1) & mask)
+    assert (s->atomIndex[i] != NULL);
+
+  /* linear probing: shift the rest of the cluster back into the hole */
+  s->atomIndex[i] = NULL;
+  for (j=(i+1) & mask; s->atomIndex[j] != NULL; j=(j+1) & mask)
+    {
+      const size_t home = hashAddress (&s->atomIndex[j]->addr) & mask;
+
+      /* move it if its home slot isn't cyclically in (i, j] */
+      if ((i <= j) ? ((home <= i) || (home > j)) : ((home <= i) && (home > j)))
+        {
+          s->atomIndex[i] = s->atomIndex[j];
+          s->atomIndex[j] = NULL;
+          i = j;
+        }
+    }
+}
+
+/***
+****  Indexed min-heaps of atoms for the connection candidates
+***/
+
+static inline struct atom_heap*
+candidateHeap (tr_swarm * s, int which)
+{
+  return which == CANDIDATES_READY ? &s->candidatesReady : &s->candidatesWaiting;
+}
+
+static inline void
+atomHeapSet (struct atom_heap * heap, int pos, struct atom_heap_entry entry)
+{
+  heap->items[pos] = entry;
+  entry.atom->candidatePos = pos;
+}
+
+static void
+atomHeapSiftUp (struct atom_heap * heap, int pos)
+{
+  const struct atom_heap_entry entry = heap->items[pos];
+
+  while (pos > 0)
+    {
+      const int parent = (pos - 1) / 2;
+
+      if (heap->items[parent].key <= entry.key)
+        break;
+
+      atomHeapSet (heap, pos, heap->items[parent]);
+      pos = parent;
+    }
+
+  atomHeapSet (heap, pos, entry);
+}
+
+static void
+atomHeapSiftDown (struct atom_heap * heap, int pos)
+{
+  const struct atom_heap_entry entry = heap->items[pos];
+
+  for (;;)
+    {
+      int child = pos * 2 + 1;
+
+      if (child >= heap->count)
+        break;
+
+      if ((child + 1 < heap->count) && (heap->items[child + 1].key < heap->items[child].key))
+        ++child;
+
+      if (entry.key <= heap->items[child].key)
+        break;
+
+      atomHeapSet (heap, pos, heap->items[child]);
+      pos = child;
+    }
+
+  atomHeapSet (heap, pos, entry);
+}
+
+static void
+candidatesPush (tr_swarm * s, int which, struct peer_atom * atom, uint64_t key)
+{
+  struct atom_heap * heap = candidateHeap (s, which);
+
+  assert (atom->candidateHeap == CANDIDATES_NONE);
+
+  if (heap->count == heap->alloc)
+    {
+      heap->alloc = heap->alloc ? heap->alloc * 2 : 16;
+      heap->items = tr_renew (struct atom_heap_entry, heap->items, heap->alloc);
+    }
+
+  heap->items[heap->count].key = key;
+  heap->items[heap->count].atom = atom;
+  atom->candidateHeap = which;
+  atomHeapSiftUp (heap, heap->count++);
+}
+
+static void
+candidatesRemove (tr_swarm * s, struct peer_atom * atom)
+{
+  int pos;
+  struct atom_heap * heap;
+
+  if (atom->candidateHeap == CANDIDATES_NONE)
+    return;
+
+  heap = candidateHeap (s, atom->candidateHeap);
+  pos = atom->candidatePos;
+  assert (pos < heap->count);
+  assert (heap->items[pos].atom == atom);
+
+  atom->candidateHeap = CANDIDATES_NONE;
+
+  if (pos != --heap->count)
+    {
+      const uint64_t oldKey = heap->items[pos].key;
+
+      atomHeapSet (heap, pos, heap->items[heap->count]);
+
+      if (heap->items[pos].key < oldKey)
+        atomHeapSiftUp (heap, pos);
+      else
+        atomHeapSiftDown (heap, pos);
+    }
+}
+
+static void
+candidatesClear (tr_swarm * s)
+{
+  int i;
+
+  for (i=0; i<s->candidatesWaiting.count; ++i)
+    s->candidatesWaiting.items[i].atom->candidateHeap = CANDIDATES_NONE;
+  for (i=0; i<s->candidatesReady.count; ++i)
+    s->candidatesReady.items[i].atom->candidateHeap = CANDIDATES_NONE;
+
+  s->candidatesWaiting.count = 0;
+  s->candidatesReady.count = 0;
+}
+
+static struct peer_atom*
+atomNew (tr_swarm * s)
+{
+  struct peer_atom * atom;
+
+  if (!tr_ptrArrayEmpty (&s->freeAtoms))
+    {
+      atom = tr_ptrArrayPop (&s->freeAtoms);
+    }
+  else
+    {
+      if (s->atomSlabs == NULL || s->atomSlabUsed == ATOM_SLAB_SIZE)
+        {
+          struct peer_atom_slab * slab = tr_new (struct peer_atom_slab, 1);
+          slab->next = s->atomSlabs;
+          s->atomSlabs = slab;
+          s->atomSlabUsed = 0;
+        }
+
+      atom = &s->atomSlabs->atoms[s->atomSlabUsed++];
+    }
+
+  memset (atom, 0, sizeof (struct peer_atom));
+  return atom;
+}
+
+static void
+atomFree (tr_swarm * s, struct peer_atom * atom)
+{
+  candidatesRemove (s, atom);
+  atomIndexRemove (s, atom);
+  tr_ptrArrayAppend (&s->freeAtoms, atom);
+}
+
+static void
+atomPoolFree (tr_swarm * s)
+{
+  while (s->atomSlabs != NULL)
+    {
+      struct peer_atom_slab * slab = s->atomSlabs;
+      s->atomSlabs = slab->next;
+      tr_free (slab);
+    }
+
+  tr_ptrArrayDestruct (&s->freeAtoms, NULL);
+  tr_free (s->candidatesWaiting.items);
+  tr_free (s->candidatesReady.items);
+  tr_free (s->atomIndex);
+  s->atomIndex = NULL;
+  s->atomIndexSize = 0;
+}
+
+static bool
+peerIsInUse (const tr_swarm * cs, const struct peer_atom * atom)
+{
+  tr_swarm * s = (tr_swarm*) cs;
+
+  assert (swarmIsLocked (s));
+
+  return (atom->peer != NULL)
+      || getExistingHandshake (&s->outgoingHandshakes, &atom->addr)
+      || getExistingHandshake (&s->manager->incomingHandshakes, &atom->addr);
+}
+
+static inline bool
+replicationExists (const tr_swarm * s)
+{
+  return s->pieceReplication != NULL;
+}
+
+static void
+replicationFree (tr_swarm * s)
+{
+  tr_free (s->pieceReplication);
+  s->pieceReplication = NULL;
+  s->pieceReplicationSize = 0;
+}
+
+static void
+replicationNew (tr_swarm * s)
+{
+  tr_piece_index_t piece_i;
+  const tr_piece_index_t piece_count = s->tor->info.pieceCount;
+  const int n = tr_ptrArraySize (&s->peers);
+
+  assert (!replicationExists (s));
+
+  s->pieceReplicationSize = piece_count;
+  s->pieceReplication = tr_new0 (uint16_t, piece_count);
+
+  for (piece_i=0; piece_i<piece_count; ++piece_i)
+    {
+      int peer_i;
+      uint16_t r = 0;
+
+      for (peer_i=0; peer_i<n; ++peer_i)
+        {
+          tr_peer * peer = tr_ptrArrayNth (&s->peers, peer_i);
+          if (tr_bitfieldHas (&peer->have, piece_i))
+            ++r;
+        }
+
+      s->pieceReplication[piece_i] = r;
+    }
+}
+
+/***
+****  Pieces we still want, and how many of them each peer has
+***/
+
+static void
+wantedPiecesRebuild (tr_swarm * s)
+{
+  int i;
+  const int n = tr_ptrArraySize (&s->peers);
+  const tr_torrent * tor = s->tor;
+  const tr_piece_index_t piece_count = tor->info.pieceCount;
+
+  tr_bitfieldDestruct (&s->wantedPieces);
+  tr_bitfieldConstruct (&s->wantedPieces, piece_count);
+
+  if (!tr_torrentIsSeed (tor) && tr_torrentHasMetadata (tor))
+    {
+      size_t byte_count;
+      tr_piece_index_t piece_i;
+      tr_bitfield have = TR_BITFIELD_INIT;
+      void * raw = tr_torrentCreatePieceBitfield (tor, &byte_count);
+
+      for (piece_i=0; piece_i<piece_count; ++piece_i)
+        if (!tor->info.pieces[piece_i].dnd)
+          tr_bitfieldAdd (&s->wantedPieces, piece_i);
+
+      /* then drop the pieces we have, a word at a time */
+      tr_bitfieldConstruct (&have, piece_count);
+      tr_bitfieldSetRaw (&have, raw, byte_count, true);
+      tr_bitfieldAndNot (&s->wantedPieces, &have);
+
+      tr_bitfieldDestruct (&have);
+      tr_free (raw);
+    }
+
+  for (i=0; i<n; ++i)
+    {
+      tr_peer * peer = tr_ptrArrayNth (&s->peers, i);
+      peer->interestingPieceCount = tr_bitfieldCountIntersection (&s->wantedPieces, &peer->have);
+    }
+
+  s->wantedPiecesDirty = false;
+}
+
+static inline void
+wantedPiecesInvalidate (tr_swarm * s)
+{
+  s->wantedPiecesDirty = true;
+}
+
+/* the peer's 'have' bitfield was replaced wholesale */
+static void
+wantedPiecesPeerGotBitfield (tr_swarm * s, tr_peer * peer)
+{
+  if (!s->wantedPiecesDirty)
+    peer->interestingPieceCount = tr_bitfieldCountIntersection (&s->wantedPieces, &peer->have);
+}
+
+static void
+wantedPiecesPeerGotHave (tr_swarm * s, tr_peer * peer, tr_piece_index_t piece)
+{
+  if (!s->wantedPiecesDirty && tr_bitfieldHas (&s->wantedPieces, piece))
+    ++peer->interestingPieceCount;
+}
+
+/***
+****  Super-seeding (BEP 16)
+****
+****  Rather than a bitfield, each peer is told about one piece at a time:
+****  the rarest one that the fewest other peers are already waiting on.
+****  The peer gets another piece once some other peer announces the one
+****  it was given, showing that it was passed on.
+***/
+
+enum
+{
+  /* if an offered piece hasn't been passed on by then, offer another */
+  SUPER_SEED_REOFFER_SECS = 90
+};
+
+static void
+superSeedSetPiece (tr_swarm * s, tr_peer * peer, int piece)
+{
+  if (peer->superSeedPiece >= 0)
+    {
+      assert (s->superSeedOffers[peer->superSeedPiece] > 0);
+      --s->superSeedOffers[peer->superSeedPiece];
+    }
+
+  peer->superSeedPiece = piece;
+  peer->superSeedOfferedAt = tr_time ();
+
+  if (piece >= 0)
+    ++s->superSeedOffers[piece];
+}
+
+int
+tr_superSeedPickPiece (const uint16_t    * replication,
+                       const uint16_t    * offers,
+                       tr_piece_index_t    pieceCount,
+                       const tr_bitfield * have,
+                       const tr_bitfield * offered,
+                       tr_piece_index_t    start)
+{
+  tr_piece_index_t i;
+  int best = -1;
+  unsigned int bestScore = UINT_MAX;
+
+  for (i=0; i<pieceCount; ++i)
+    {
+      const tr_piece_index_t piece = (i + start) % pieceCount;
+      unsigned int score;
+
+      if (tr_bitfieldHas (have, piece) || tr_bitfieldHas (offered, piece))
+        continue;
+
+      score = replication[piece] + offers[piece];
+      if (score < bestScore)
+        {
+          best = piece;
+          bestScore = score;
+        }
+    }
+
+  return best;
+}
+
+/* the piece to offer this peer next, or -1 if there's nothing left */
+static int
+superSeedPickPiece (tr_swarm * s, const tr_peer * peer)
+{
+  const tr_piece_index_t n = s->tor->info.pieceCount;
+
+  if (!replicationExists (s))
+    replicationNew (s);
+
+  /* start at a random piece so that ties are spread around */
+  return tr_superSeedPickPiece (s->pieceReplication, s->superSeedOffers, n,
+                                &peer->have, &peer->superSeedOffered,
+                                tr_rand_int_weak (n));
+}
+
+static void
+superSeedOffer (tr_swarm * s, tr_peer * peer)
+{
+  int piece;
+
+  /* seeds don't need anything, and peers from before we
+     started super-seeding already know about everything */
+  if (tr_peerIsSeed (peer) || tr_bitfieldHasAll (&peer->superSeedOffered))
+    {
+      superSeedSetPiece (s, peer, -1);
+      return;
+    }
+
+  piece = superSeedPickPiece (s, peer);
+  superSeedSetPiece (s, peer, piece);
+
+  if (piece >= 0)
+    {
+      tordbg (s, "super-seeding: offering piece %d to %s", piece, tr_atomAddrStr (peer->atom));
+      tr_bitfieldAdd (&peer->superSeedOffered, piece);
+      tr_peerMsgsHave (PEER_MSGS (peer), piece);
+    }
+}
+
+/* 'from' announced that it has 'piece' */
+static void
+superSeedPeerGotHave (tr_swarm * s, const tr_peer * from, tr_piece_index_t piece)
+{
+  int i;
+  const int n = tr_ptrArraySize (&s->peers);
+
+  if (s->superSeedOffers[piece] == 0)
+    return;
+
+  /* anyone who got this piece from us has now passed it on */
+  for (i=0; i<n; ++i)
+    {
+      tr_peer * peer = tr_ptrArrayNth (&s->peers, i);
+
+      if ((peer != from)
+          && (peer->superSeedPiece == (int)piece)
+          && tr_bitfieldHas (&peer->have, piece))
+        superSeedOffer (s, peer);
+    }
+}
+
+/* make first offers, and new ones to peers that are sitting on theirs */
+static void
+superSeedPulse (tr_swarm * s)
+{
+  int i;
+  const int n = tr_ptrArraySize (&s->peers);
+  const time_t too_old = tr_time () - SUPER_SEED_REOFFER_SECS;
+
+  for (i=0; i<n; ++i)
+    {
+      tr_peer * peer = tr_ptrArrayNth (&s->peers, i);
+
+      if ((peer->superSeedPiece < 0) || (peer->superSeedOfferedAt <= too_old))
+        superSeedOffer (s, peer);
+    }
+}
+
+static void
+superSeedStart (tr_swarm * s)
 {
-  tr_swarm * swarm = (tr_swarm*) cswarm;
-  return tr_ptrArrayFindSorted (&swarm->pool, addr, comparePeerAtomToAddress);
+  int i;
+  const int n = tr_ptrArraySize (&s->peers);
+
+  assert (s->superSeedOffers == NULL);
+
+  s->superSeeding = true;
+  s->superSeedOffers = tr_new0 (uint16_t, s->tor->info.pieceCount);
+
+  /* the peers we're already connected to have heard about everything */
+  for (i=0; i<n; ++i)
+    {
+      tr_peer * peer = tr_ptrArrayNth (&s->peers, i);
+      tr_bitfieldSetHasAll (&peer->superSeedOffered);
+      peer->superSeedPiece = -1;
+    }
 }
 
-static bool
-peerIsInUse (const tr_swarm * cs, const struct peer_atom * atom)
+static void
+superSeedStop (tr_swarm * s)
 {
-  tr_swarm * s = (tr_swarm*) cs;
+  int i;
+  const int n = tr_ptrArraySize (&s->peers);
+  const tr_torrent * tor = s->tor;
 
-  assert (swarmIsLocked (s));
+  /* tell the peers about everything we held back */
+  for (i=0; i<n; ++i)
+    {
+      tr_piece_index_t piece;
+      tr_peer * peer = tr_ptrArrayNth (&s->peers, i);
 
-  return (atom->peer != NULL)
-      || getExistingHandshake (&s->outgoingHandshakes, &atom->addr)
-      || getExistingHandshake (&s->manager->incomingHandshakes, &atom->addr);
+      if (!tr_bitfieldHasAll (&peer->superSeedOffered))
+        for (piece=0; piece<tor->info.pieceCount; ++piece)
+          if (!tr_bitfieldHas (&peer->superSeedOffered, piece)
+              && tr_torrentPieceIsComplete (tor, piece))
+            tr_peerMsgsHave (PEER_MSGS (peer), piece);
+
+      tr_bitfieldSetHasNone (&peer->superSeedOffered);
+      peer->superSeedPiece = -1;
+    }
+
+  s->superSeeding = false;
+  tr_free (s->superSeedOffers);
+  s->superSeedOffers = NULL;
 }
 
-static inline bool
-replicationExists (const tr_swarm * s)
+bool
+tr_peerMgrIsSuperSeeding (const tr_torrent * tor)
 {
-  return s->pieceReplication != NULL;
+  return tor->swarm->superSeeding;
 }
 
-static void
-replicationFree (tr_swarm * s)
+bool
+tr_peerMgrSuperSeedAllowsRequest (const tr_torrent * tor,
+                                  const tr_peer    * peer,
+                                  tr_piece_index_t   piece)
 {
-  tr_free (s->pieceReplication);
-  s->pieceReplication = NULL;
-  s->pieceReplicationSize = 0;
+  return !tr_peerMgrIsSuperSeeding (tor) || tr_bitfieldHas (&peer->superSeedOffered, piece);
 }
 
-static void
-replicationNew (tr_swarm * s)
+void
+tr_peerMgrOnSuperSeedingChanged (tr_torrent * tor)
 {
-  tr_piece_index_t piece_i;
-  const tr_piece_index_t piece_count = s->tor->info.pieceCount;
-  const int n = tr_ptrArraySize (&s->peers);
-
-  assert (!replicationExists (s));
+  tr_swarm * s = tor->swarm;
+  const bool superSeeding = tr_torrentIsSuperSeeding (tor);
 
-  s->pieceReplicationSize = piece_count;
-  s->pieceReplication = tr_new0 (uint16_t, piece_count);
+  swarmLock (s);
 
-  for (piece_i=0; piece_i<piece_count; ++piece_i)
+  if (superSeeding && !s->superSeeding)
     {
-      int peer_i;
-      uint16_t r = 0;
-
-      for (peer_i=0; peer_i<n; ++peer_i)
-        {
-          tr_peer * peer = tr_ptrArrayNth (&s->peers, peer_i);
-          if (tr_bitfieldHas (&peer->have, piece_i))
-            ++r;
-        }
-
-      s->pieceReplication[piece_i] = r;
+      tordbg (s, "super-seeding started");
+      superSeedStart (s);
+      superSeedPulse (s);
+    }
+  else if (!superSeeding && s->superSeeding)
+    {
+      tordbg (s, "super-seeding stopped");
+      superSeedStop (s);
     }
+
+  swarmUnlock (s);
 }
 
 static void
@@ -501,12 +1136,17 @@ swarmFree (void * vs)
   assert (tr_ptrArrayEmpty (&s->peers));
 
   tr_ptrArrayDestruct (&s->webseeds, (PtrArrayForeachFunc)tr_peerFree);
-  tr_ptrArrayDestruct (&s->pool, (PtrArrayForeachFunc)tr_free);
+  tr_ptrArrayDestruct (&s->pool, NULL);
+  atomPoolFree (s);
   tr_ptrArrayDestruct (&s->outgoingHandshakes, NULL);
   tr_ptrArrayDestruct (&s->peers, NULL);
   s->stats = TR_SWARM_STATS_INIT;
 
   replicationFree (s);
+  tr_bitfieldDestruct (&s->wantedPieces);
+  tr_free (s->superSeedOffers);
+  tr_free (s->pexSnapshot[0]);
+  tr_free (s->pexSnapshot[1]);
 
   tr_free (s->requests);
   tr_free (s->pieces);
@@ -543,9 +1183,13 @@ swarmNew (tr_peerMgr * manager, tr_torrent * tor)
   s->manager = manager;
   s->tor = tor;
   s->pool = TR_PTR_ARRAY_INIT;
+  s->freeAtoms = TR_PTR_ARRAY_INIT;
   s->peers = TR_PTR_ARRAY_INIT;
   s->webseeds = TR_PTR_ARRAY_INIT;
   s->outgoingHandshakes = TR_PTR_ARRAY_INIT;
+  s->wantedPieces = TR_BITFIELD_INIT;
+  s->wantedPiecesDirty = true;
+  s->candidatesDirty = true;
 
   rebuildWebseedArray (s, tor);
 
@@ -623,6 +1267,7 @@ tr_peerMgrOnBlocklistChanged (tr_peerMgr * mgr)
           struct peer_atom * atom = tr_ptrArrayNth (&s->pool, i);
           atom->blocklisted = -1;
         }
+      s->candidatesDirty = true;
     }
 }
 
@@ -777,6 +1422,7 @@ requestListAdd (tr_swarm * s, tr_block_index_t block, tr_peer * peer)
   if (peer != NULL)
     {
       ++peer->pendingReqsToPeer;
+      ++s->manager->pendingRequestCount;
       assert (peer->pendingReqsToPeer >= 0);
     }
 
@@ -826,11 +1472,14 @@ getBlockRequestPeers (tr_swarm * s, tr_block_index_t block,
 }
 
 static void
-decrementPendingReqCount (const struct block_request * b)
+decrementPendingReqCount (tr_swarm * s, const struct block_request * b)
 {
   if (b->peer != NULL)
     if (b->peer->pendingReqsToPeer > 0)
-      --b->peer->pendingReqsToPeer;
+      {
+        --b->peer->pendingReqsToPeer;
+        --s->manager->pendingRequestCount;
+      }
 }
 
 static void
@@ -843,7 +1492,7 @@ requestListRemove (tr_swarm * s, tr_block_index_t block, const tr_peer * peer)
       const int pos = b - s->requests;
       assert (pos < s->requestCount);
 
-      decrementPendingReqCount (b);
+      decrementPendingReqCount (s, b);
 
       tr_removeElementFromArray (s->requests,
                                  pos,
@@ -856,6 +1505,12 @@ requestListRemove (tr_swarm * s, tr_block_index_t block, const tr_peer * peer)
     }
 }
 
+int
+tr_peerMgrGetPendingRequestCount (const tr_peerMgr * mgr)
+{
+  return mgr->pendingRequestCount;
+}
+
 static int
 countActiveWebseeds (tr_swarm * s)
 {
@@ -1325,6 +1980,7 @@ tr_peerMgrRebuildRequests (tr_torrent * tor)
   assert (tr_isTorrent (tor));
 
   pieceListRebuild (tor->swarm);
+  wantedPiecesInvalidate (tor->swarm);
 }
 
 void
@@ -1548,7 +2204,7 @@ refillUpkeep (evutil_socket_t foo UNUSED, short bar UNUSED, void * vmgr)
                 {
                   tr_historyAdd (&it->peer->cancelsSentToPeer, now, 1);
                   tr_peerMsgsCancel (msgs, it->block);
-                  decrementPendingReqCount (it);
+                  decrementPendingReqCount (s, it);
                 }
             }
 
@@ -1682,6 +2338,28 @@ cancelAllRequestsForBlock (tr_swarm          * s,
   tr_ptrArrayDestruct (&peerArr, NULL);
 }
 
+void
+tr_peerMgrPieceLost (tr_torrent * tor, tr_piece_index_t p)
+{
+  int i;
+  tr_swarm * const s = tor->swarm;
+  const int n = tr_ptrArraySize (&s->peers);
+
+  if (s->wantedPiecesDirty || tor->info.pieces[p].dnd || tr_bitfieldHas (&s->wantedPieces, p))
+    return;
+
+  /* we want it again, so peers that have it are interesting again */
+  tr_bitfieldAdd (&s->wantedPieces, p);
+
+  for (i=0; i<n; ++i)
+    {
+      tr_peer * peer = tr_ptrArrayNth (&s->peers, i);
+
+      if (tr_bitfieldHas (&peer->have, p))
+        ++peer->interestingPieceCount;
+    }
+}
+
 void
 tr_peerMgrPieceCompleted (tr_torrent * tor, tr_piece_index_t p)
 {
@@ -1689,6 +2367,10 @@ tr_peerMgrPieceCompleted (tr_torrent * tor, tr_piece_index_t p)
   bool pieceCameFromPeers = false;
   tr_swarm * const s = tor->swarm;
   const int n = tr_ptrArraySize (&s->peers);
+  const bool wantPiece = !s->wantedPiecesDirty && tr_bitfieldHas (&s->wantedPieces, p);
+
+  if (wantPiece)
+    tr_bitfieldRem (&s->wantedPieces, p);
 
   /* walk through our peers */
   for (i=0; i<n; ++i)
@@ -1698,6 +2380,12 @@ tr_peerMgrPieceCompleted (tr_torrent * tor, tr_piece_index_t p)
       /* notify the peer that we now have this piece */
       tr_peerMsgsHave (PEER_MSGS(peer), p);
 
+      if (wantPiece && tr_bitfieldHas (&peer->have, p))
+        {
+          assert (peer->interestingPieceCount > 0);
+          --peer->interestingPieceCount;
+        }
+
       if (!pieceCameFromPeers)
         pieceCameFromPeers = tr_bitfieldHas (&peer->blame, p);
     }
@@ -1761,6 +2449,9 @@ peerCallbackFunc (tr_peer * peer, const tr_peer_event * e, void * vs)
             tr_incrReplicationOfPiece (s, e->pieceIndex);
             assertReplicationCountIsExact (s);
           }
+        wantedPiecesPeerGotHave (s, peer, e->pieceIndex);
+        if (s->superSeeding)
+          superSeedPeerGotHave (s, peer, e->pieceIndex);
         break;
 
       case TR_PEER_CLIENT_GOT_HAVE_ALL:
@@ -1769,10 +2460,13 @@ peerCallbackFunc (tr_peer * peer, const tr_peer_event * e, void * vs)
             tr_incrReplication (s);
             assertReplicationCountIsExact (s);
           }
+        wantedPiecesPeerGotBitfield (s, peer);
         break;
 
       case TR_PEER_CLIENT_GOT_HAVE_NONE:
-        /* noop */
+        wantedPiecesPeerGotBitfield (s, peer);
+        if (s->superSeeding && (peer->superSeedPiece < 0))
+          superSeedOffer (s, peer);
         break;
 
       case TR_PEER_CLIENT_GOT_BITFIELD:
@@ -1782,6 +2476,9 @@ peerCallbackFunc (tr_peer * peer, const tr_peer_event * e, void * vs)
             tr_incrReplicationFromBitfield (s, e->bitfield);
             assertReplicationCountIsExact (s);
           }
+        wantedPiecesPeerGotBitfield (s, peer);
+        if (s->superSeeding && (peer->superSeedPiece < 0))
+          superSeedOffer (s, peer);
         break;
 
       case TR_PEER_CLIENT_GOT_REJ:
@@ -1863,6 +2560,8 @@ getDefaultShelfLife (uint8_t from)
     }
 }
 
+static void candidatesUpdate (tr_swarm *, struct peer_atom *, const time_t);
+
 static void
 ensureAtomExists (tr_swarm          * s,
                   const tr_address  * addr,
@@ -1881,7 +2580,7 @@ ensureAtomExists (tr_swarm          * s,
   if (a == NULL)
     {
       const int jitter = tr_rand_int_weak (60*10);
-      a = tr_new0 (struct peer_atom, 1);
+      a = atomNew (s);
       a->addr = *addr;
       a->port = port;
       a->flags = flags;
@@ -1890,7 +2589,8 @@ ensureAtomExists (tr_swarm          * s,
       a->shelf_date = tr_time () + getDefaultShelfLife (from) + jitter;
       a->blocklisted = -1;
       atomSetSeedProbability (a, seedProbability);
-      tr_ptrArrayInsertSorted (&s->pool, a, compareAtomsByAddress);
+      atomIndexAdd (s, a);
+      tr_ptrArrayAppend (&s->pool, a);
 
       tordbg (s, "got a new atom: %s", tr_atomAddrStr (a));
     }
@@ -1904,6 +2604,8 @@ ensureAtomExists (tr_swarm          * s,
 
       a->flags |= flags;
     }
+
+  candidatesUpdate (s, a, tr_time ());
 }
 
 static int
@@ -2066,7 +2768,15 @@ myHandshakeDoneCB (tr_handshake  * handshake,
     }
 
   if (s != NULL)
-    swarmUnlock (s);
+    {
+      struct peer_atom * atom = getExistingAtom (s, addr);
+
+      /* the handshake is over, so the atom may be a candidate again */
+      if (atom != NULL)
+        candidatesUpdate (s, atom, tr_time ());
+
+      swarmUnlock (s);
+    }
 
   return success;
 }
@@ -2148,6 +2858,8 @@ tr_peerMgrMarkAllAsSeeds (tr_torrent * tor)
 
   while (it != end)
     atomSetSeed (s, *it++);
+
+  s->candidatesDirty = true;
 }
 
 tr_pex *
@@ -2388,6 +3100,74 @@ tr_peerMgrGetPeers (tr_torrent   * tor,
   return count;
 }
 
+static bool
+pexListsEqual (const tr_pex * a, int aCount, const tr_pex * b, int bCount)
+{
+  int i;
+
+  if (aCount != bCount)
+    return false;
+
+  for (i=0; i<aCount; ++i)
+    if (tr_pexCompare (a+i, b+i))
+      return false;
+
+  return true;
+}
+
+int
+tr_peerMgrGetPexSnapshot (tr_torrent     * tor,
+                          uint8_t          af,
+                          const tr_pex  ** setme_pex,
+                          unsigned int   * setme_version,
+                          time_t           now)
+{
+  int i;
+  tr_swarm * s;
+
+  assert (tr_isTorrent (tor));
+  assert (af==TR_AF_INET || af==TR_AF_INET6);
+
+  s = tor->swarm;
+  managerLock (s->manager);
+
+  if (!s->pexSnapshotVersion || (s->pexSnapshotAt + PEX_SNAPSHOT_TTL_SECS <= now))
+    {
+      bool changed = !s->pexSnapshotVersion;
+
+      for (i=0; i<2; ++i)
+        {
+          tr_pex * pex = NULL;
+          const int count = tr_peerMgrGetPeers (tor, &pex, i ? TR_AF_INET6 : TR_AF_INET,
+                                                TR_PEERS_CONNECTED, MAX_PEX_PEER_COUNT);
+
+          if (pexListsEqual (s->pexSnapshot[i], s->pexSnapshotCount[i], pex, count))
+            {
+              tr_free (pex);
+            }
+          else
+            {
+              tr_free (s->pexSnapshot[i]);
+              s->pexSnapshot[i] = pex;
+              s->pexSnapshotCount[i] = count;
+              changed = true;
+            }
+        }
+
+      if (changed && !++s->pexSnapshotVersion)
+        ++s->pexSnapshotVersion; /* zero means "never built" */
+
+      s->pexSnapshotAt = now;
+    }
+
+  i = af == TR_AF_INET6 ? 1 : 0;
+  *setme_pex = s->pexSnapshot[i];
+  *setme_version = s->pexSnapshotVersion;
+
+  managerUnlock (s->manager);
+  return s->pexSnapshotCount[i];
+}
+
 static void atomPulse      (evutil_socket_t, short, void *);
 static void bandwidthPulse (evutil_socket_t, short, void *);
 static void rechokePulse   (evutil_socket_t, short, void *);
@@ -2431,6 +3211,8 @@ tr_peerMgrStartTorrent (tr_torrent * tor)
   s->isRunning = true;
   s->maxPeers = tor->maxConnectedPeers;
   s->pieceSortState = PIECES_UNSORTED;
+  s->candidatesDirty = true;
+  wantedPiecesInvalidate (s);
 
   rechokePulse (0, 0, s->manager);
 }
@@ -2529,6 +3311,9 @@ tr_peerMgrOnTorrentGotMetainfo (tr_torrent * tor)
   /* the webseed list may have changed... */
   rebuildWebseedArray (tor->swarm, tor);
 
+  /* ...and we can finally tell which pieces we want */
+  wantedPiecesInvalidate (tor->swarm);
+
   /* some peer_msgs' progress fields may not be accurate if we
      didn't have the metadata before now... so refresh them all... */
   peerCount = tr_ptrArraySize (&tor->swarm->peers);
@@ -2749,6 +3534,9 @@ tr_peerMgrPeerStats (const tr_torrent * tor, int * setmeCount)
 
       stat->pendingReqsToPeer   = peer->pendingReqsToPeer;
       stat->pendingReqsToClient = peer->pendingReqsToClient;
+      stat->pipelineDepth       = tr_peerMsgsGetPipelineDepth (msgs);
+      stat->rttMsec             = tr_peerMsgsGetRttMsec (msgs);
+      stat->minRttMsec          = tr_peerMsgsGetMinRttMsec (msgs);
 
       pch = stat->flagStr;
       if (stat->isUTP) *pch++ = 'T';
@@ -2792,23 +3580,17 @@ tr_peerMgrClearInterest (tr_torrent * tor)
 /* does this peer have any pieces that we want? */
 static bool
 isPeerInteresting (tr_torrent     * const tor,
-                   const bool     * const piece_is_interesting,
                    const tr_peer  * const peer)
 {
-  tr_piece_index_t i, n;
-
   /* these cases should have already been handled by the calling code... */
   assert (!tr_torrentIsSeed (tor));
   assert (tr_torrentIsPieceTransferAllowed (tor, TR_PEER_TO_CLIENT));
+  assert (!tor->swarm->wantedPiecesDirty);
 
   if (tr_peerIsSeed (peer))
     return true;
 
-  for (i=0, n=tor->info.pieceCount; i<n; ++i)
-    if (piece_is_interesting[i] && tr_bitfieldHas (&peer->have, i))
-      return true;
-
-  return false;
+  return peer->interestingPieceCount > 0;
 }
 
 typedef enum
@@ -2926,21 +3708,15 @@ rechokeDownloads (tr_swarm * s)
 
   if (peerCount > 0)
     {
-      bool * piece_is_interesting;
-      const tr_torrent * const tor = s->tor;
-      const int n = tor->info.pieceCount;
-
-      /* build a bitfield of interesting pieces... */
-      piece_is_interesting = tr_new (bool, n);
-      for (i=0; i<n; i++)
-        piece_is_interesting[i] = !tor->info.pieces[i].dnd && !tr_torrentPieceIsComplete (tor, i);
+      if (s->wantedPiecesDirty)
+        wantedPiecesRebuild (s);
 
       /* decide WHICH peers to be interested in (based on their cancel-to-block ratio) */
       for (i=0; i<peerCount; ++i)
         {
           tr_peer * peer = tr_ptrArrayNth (&s->peers, i);
 
-          if (!isPeerInteresting (s->tor, piece_is_interesting, peer))
+          if (!isPeerInteresting (s->tor, peer))
             {
               tr_peerMsgsSetInterested (PEER_MSGS(peer), false);
             }
@@ -2971,8 +3747,6 @@ rechokeDownloads (tr_swarm * s)
             }
 
         }
-
-      tr_free (piece_is_interesting);
     }
 
   /* now that we know which & how many peers to be interested in... update the peer interest */
@@ -3192,6 +3966,9 @@ rechokePulse (evutil_socket_t foo UNUSED, short bar UNUSED, void * vmgr)
             {
               rechokeUploads (s, now);
               rechokeDownloads (s);
+
+              if (s->superSeeding)
+                superSeedPulse (s);
             }
         }
     }
@@ -3330,10 +4107,14 @@ removePeer (tr_swarm * s, tr_peer * peer)
   if (replicationExists (s))
     tr_decrReplicationFromBitfield (s, &peer->have);
 
+  if (s->superSeeding)
+    superSeedSetPiece (s, peer, -1);
+
   assert (s->stats.peerCount == tr_ptrArraySize (&s->peers));
   assert (s->stats.peerFromCount[atom->fromFirst] >= 0);
 
   tr_peerFree (peer);
+  candidatesUpdate (s, atom, atom->time);
 }
 
 static void
@@ -3673,18 +4454,6 @@ bandwidthPulse (evutil_socket_t foo UNUSED, short bar UNUSED, void * vmgr)
 ****
 ***/
 
-static int
-compareAtomPtrsByAddress (const void * va, const void *vb)
-{
-  const struct peer_atom * a = * (const struct peer_atom* const *) va;
-  const struct peer_atom * b = * (const struct peer_atom* const *) vb;
-
-  assert (tr_isAtom (a));
-  assert (tr_isAtom (b));
-
-  return tr_address_compare (&a->addr, &b->addr);
-}
-
 /* best come first, worst go last */
 static int
 compareAtomPtrsByShelfDate (const void * va, const void *vb)
@@ -3761,12 +4530,10 @@ atomPulse (evutil_socket_t foo UNUSED, short bar UNUSED, void * vmgr)
 
           /* free the culled atoms */
           while (i<testCount)
-            tr_free (test[i++]);
+            atomFree (s, test[i++]);
 
           /* rebuild Torrent.pool with what's left */
-          tr_ptrArrayDestruct (&s->pool, NULL);
-          s->pool = TR_PTR_ARRAY_INIT;
-          qsort (keep, keepCount, sizeof (struct peer_atom *), compareAtomPtrsByAddress);
+          tr_ptrArrayClear (&s->pool);
           for (i=0; i<keepCount; ++i)
             tr_ptrArrayAppend (&s->pool, keep[i]);
 
@@ -3822,6 +4589,16 @@ struct peer_candidate
   struct peer_atom * atom;
 };
 
+enum
+{
+  /* getTorrentCandidateScore ()'s width, and where it goes in the full score */
+  CANDIDATE_TORRENT_SCORE_BITS = 6,
+  CANDIDATE_TORRENT_SCORE_SHIFT = 1 + 8 + 4 + 8,
+
+  /* how often a swarm's candidate heaps are rebuilt from scratch anyway */
+  CANDIDATE_RESYNC_SECS = 120
+};
+
 static bool
 torrentWasRecentlyStarted (const tr_torrent * tor)
 {
@@ -3836,21 +4613,12 @@ addValToKey (uint64_t value, int width, uint64_t addme)
   return value;
 }
 
-/* smaller value is better */
+/* the torrent's part of a candidate score: see getPeerCandidateScore () */
 static uint64_t
-getPeerCandidateScore (const tr_torrent * tor, const struct peer_atom * atom, uint8_t salt)
+getTorrentCandidateScore (const tr_torrent * tor)
 {
   uint64_t i;
   uint64_t score = 0;
-  const bool failed = atom->lastConnectionAt < atom->lastConnectionAttemptAt;
-
-  /* prefer peers we've connected to, or never tried, over peers we failed to connect to. */
-  i = failed ? 1 : 0;
-  score = addValToKey (score, 1, i);
-
-  /* prefer the one we attempted least recently (to cycle through all peers) */
-  i = atom->lastConnectionAttemptAt;
-  score = addValToKey (score, 32, i);
 
   /* prefer peers belonging to a torrent of a higher priority */
   switch (tr_torrentGetPriority (tor))
@@ -3869,6 +4637,28 @@ getPeerCandidateScore (const tr_torrent * tor, const struct peer_atom * atom, ui
   i = tr_torrentIsSeed (tor) ? 1 : 0;
   score = addValToKey (score, 1, i);
 
+  return score;
+}
+
+/* the atom's part of a candidate score, with the torrent's bits left zero */
+static uint64_t
+getAtomCandidateScore (const struct peer_atom * atom, uint8_t salt)
+{
+  uint64_t i;
+  uint64_t score = 0;
+  const bool failed = atom->lastConnectionAt < atom->lastConnectionAttemptAt;
+
+  /* prefer peers we've connected to, or never tried, over peers we failed to connect to. */
+  i = failed ? 1 : 0;
+  score = addValToKey (score, 1, i);
+
+  /* prefer the one we attempted least recently (to cycle through all peers) */
+  i = atom->lastConnectionAttemptAt;
+  score = addValToKey (score, 32, i);
+
+  /* the torrent's bits go here */
+  score = addValToKey (score, CANDIDATE_TORRENT_SCORE_BITS, 0);
+
   /* prefer peers that are known to be connectible */
   i = (atom->flags & ADDED_F_CONNECTABLE) ? 0 : 1;
   score = addValToKey (score, 1, i);
@@ -3890,64 +4680,123 @@ getPeerCandidateScore (const tr_torrent * tor, const struct peer_atom * atom, ui
   return score;
 }
 
-static int
-comparePeerCandidates (const void * va, const void * vb)
+/* smaller value is better.
+   Since the torrent's bits are the same for all of a swarm's atoms,
+   each swarm can keep its atoms ordered by getAtomCandidateScore () alone. */
+static uint64_t
+getPeerCandidateScore (const tr_torrent * tor, uint64_t atomScore)
+{
+  return atomScore | (getTorrentCandidateScore (tor) << CANDIDATE_TORRENT_SCORE_SHIFT);
+}
+
+/* move the atom to whichever candidate heap it belongs in now, if any */
+static void
+candidatesUpdate (tr_swarm * s, struct peer_atom * atom, const time_t now)
 {
-  int ret;
-  const struct peer_candidate * a = va;
-  const struct peer_candidate * b = vb;
+  time_t dueAt;
+  const tr_torrent * tor = s->tor;
+
+  candidatesRemove (s, atom);
+
+  /* the same tests as isPeerCandidate (), except for the time */
+  if (tr_torrentIsSeed (tor) && atomIsSeed (atom))
+    return;
+  if (peerIsInUse (s, atom))
+    return;
+  if (isAtomBlocklisted (tor->session, atom))
+    return;
+  if (atom->flags2 & MYFLAG_BANNED)
+    return;
+
+  dueAt = atom->time + getReconnectIntervalSecs (atom, now);
 
-  if (a->score < b->score)
-    ret = -1;
-  else if (a->score > b->score)
-    ret = 1;
+  if (dueAt > now)
+    candidatesPush (s, CANDIDATES_WAITING, atom, dueAt);
   else
-    ret = 0;
+    candidatesPush (s, CANDIDATES_READY, atom, getAtomCandidateScore (atom, tr_rand_int_weak (256)));
+}
 
-  return ret;
+/* refile the best ready atoms that stopped being candidates since they were
+   pushed, e.g. because an incoming connection from them showed up */
+static void
+candidatesDropStale (tr_swarm * s, const time_t now)
+{
+  while (s->candidatesReady.count && !isPeerCandidate (s->tor, s->candidatesReady.items[0].atom, now))
+    candidatesUpdate (s, s->candidatesReady.items[0].atom, now);
 }
 
-/* Partial sorting -- selecting the k best candidates
-   Adapted from http://en.wikipedia.org/wiki/Selection_algorithm */
+/* bring the swarm's candidate heaps up to date for this pulse */
 static void
-selectPeerCandidates (struct peer_candidate * candidates, int candidate_count, int select_count)
+candidatesRefresh (tr_swarm * s, const time_t now)
 {
-  tr_quickfindFirstK (candidates,
-                      candidate_count,
-                      sizeof(struct peer_candidate),
-                      comparePeerCandidates,
-                      select_count);
+  const bool isSeed = tr_torrentIsSeed (s->tor);
+
+  if (s->candidatesDirty
+      || (s->candidatesForSeed != isSeed)
+      || (s->candidatesSyncedAt + CANDIDATE_RESYNC_SECS <= now))
+    {
+      int i;
+      const int n = tr_ptrArraySize (&s->pool);
+
+      candidatesClear (s);
+      for (i=0; i<n; ++i)
+        candidatesUpdate (s, tr_ptrArrayNth (&s->pool, i), now);
+
+      s->candidatesDirty = false;
+      s->candidatesForSeed = isSeed;
+      s->candidatesSyncedAt = now;
+    }
+
+  /* promote the atoms whose reconnect interval has passed */
+  while (s->candidatesWaiting.count && ((time_t)s->candidatesWaiting.items[0].key <= now))
+    candidatesUpdate (s, s->candidatesWaiting.items[0].atom, now);
+
+  candidatesDropStale (s, now);
 }
 
-#ifndef NDEBUG
-static bool
-checkBestScoresComeFirst (const struct peer_candidate * candidates, int n, int k)
+/* a swarm and the full score of its best ready candidate */
+struct swarm_top
 {
-  int i;
-  uint64_t worstFirstScore = 0;
-  const int x = MIN (n, k) - 1;
+  uint64_t score;
+  tr_swarm * swarm;
+};
+
+static void
+swarmTopSiftDown (struct swarm_top * tops, int count, int pos)
+{
+  const struct swarm_top entry = tops[pos];
+
+  for (;;)
+    {
+      int child = pos * 2 + 1;
 
-  for (i=0; i<x; i++)
-    if (worstFirstScore < candidates[i].score)
-      worstFirstScore = candidates[i].score;
+      if (child >= count)
+        break;
 
-  for (i=0; i<x; i++)
-    assert (candidates[i].score <= worstFirstScore);
+      if ((child + 1 < count) && (tops[child + 1].score < tops[child].score))
+        ++child;
 
-  for (i=x+1; i<n; i++)
-    assert (candidates[i].score >= worstFirstScore);
+      if (entry.score <= tops[child].score)
+        break;
 
-  return true;
+      tops[pos] = tops[child];
+      pos = child;
+    }
+
+  if (pos < count)
+    tops[pos] = entry;
 }
-#endif /* NDEBUG */
 
-/** @return an array of all the atoms we might want to connect to */
+/** @return up to `max' of the best atoms to connect to, best first */
 static struct peer_candidate*
 getPeerCandidates (tr_session * session, int * candidateCount, int max)
 {
-  int atomCount;
+  int i;
   int peerCount;
+  int swarmCount;
+  int torrentCount;
   tr_torrent * tor;
+  struct swarm_top * tops;
   struct peer_candidate * candidates;
   struct peer_candidate * walk;
   const time_t now = tr_time ();
@@ -3955,65 +4804,83 @@ getPeerCandidates (tr_session * session, int * candidateCount, int max)
   /* leave 5% of connection slots for incoming connections -- ticket #2609 */
   const int maxCandidates = tr_sessionGetPeerLimit (session) * 0.95;
 
-  /* count how many peers and atoms we've got */
+  /* count how many peers we've got */
   tor= NULL;
-  atomCount = 0;
   peerCount = 0;
+  torrentCount = 0;
   while ((tor = tr_torrentNext (session, tor)))
     {
-      atomCount += tr_ptrArraySize (&tor->swarm->pool);
       peerCount += tr_ptrArraySize (&tor->swarm->peers);
+      ++torrentCount;
     }
 
   /* don't start any new handshakes if we're full up */
-  if (maxCandidates <= peerCount)
+  if ((maxCandidates <= peerCount) || (max < 1))
     {
       *candidateCount = 0;
       return NULL;
     }
 
-  /* allocate an array of candidates */
-  walk = candidates = tr_new (struct peer_candidate, atomCount);
-
-  /* populate the candidate array */
+  /* find the swarms that want more peers, and the score of each one's best candidate */
+  swarmCount = 0;
+  tops = tr_new (struct swarm_top, torrentCount);
   tor = NULL;
   while ((tor = tr_torrentNext (session, tor)))
     {
-      int i, nAtoms;
-      struct peer_atom ** atoms;
+      tr_swarm * s = tor->swarm;
 
-      if (!tor->swarm->isRunning)
+      if (!s->isRunning)
         continue;
 
       /* if we've already got enough peers in this torrent... */
-      if (tr_torrentGetPeerLimit (tor) <= tr_ptrArraySize (&tor->swarm->peers))
+      if (tr_torrentGetPeerLimit (tor) <= tr_ptrArraySize (&s->peers))
         continue;
 
       /* if we've already got enough speed in this torrent... */
       if (tr_torrentIsSeed (tor) && isBandwidthMaxedOut (&tor->bandwidth, now_msec, TR_UP))
         continue;
 
-      atoms = (struct peer_atom**) tr_ptrArrayPeek (&tor->swarm->pool, &nAtoms);
-      for (i=0; i<nAtoms; ++i)
-        {
-          struct peer_atom * atom = atoms[i];
+      candidatesRefresh (s, now);
 
-          if (isPeerCandidate (tor, atom, now))
-            {
-              const uint8_t salt = tr_rand_int_weak (1024);
-              walk->tor = tor;
-              walk->atom = atom;
-              walk->score = getPeerCandidateScore (tor, atom, salt);
-              ++walk;
-            }
+      if (s->candidatesReady.count > 0)
+        {
+          tops[swarmCount].swarm = s;
+          tops[swarmCount].score = getPeerCandidateScore (tor, s->candidatesReady.items[0].key);
+          ++swarmCount;
         }
     }
 
+  /* heapify the swarms by their best candidate */
+  for (i=swarmCount/2-1; i>=0; --i)
+    swarmTopSiftDown (tops, swarmCount, i);
+
+  /* take the best of the swarms' best candidates, one at a time */
+  walk = candidates = tr_new (struct peer_candidate, max);
+  while ((walk - candidates < max) && (swarmCount > 0))
+    {
+      tr_swarm * s = tops[0].swarm;
+
+      walk->tor = s->tor;
+      walk->atom = s->candidatesReady.items[0].atom;
+      walk->score = tops[0].score;
+      ++walk;
+
+      /* it's spoken for; initiateConnection () will put it back if needed */
+      candidatesRemove (s, walk[-1].atom);
+
+      candidatesDropStale (s, now);
+
+      if (s->candidatesReady.count > 0)
+        tops[0].score = getPeerCandidateScore (s->tor, s->candidatesReady.items[0].key);
+      else
+        tops[0] = tops[--swarmCount];
+
+      swarmTopSiftDown (tops, swarmCount, 0);
+    }
+
   *candidateCount = walk - candidates;
-  if (walk != candidates)
-    selectPeerCandidates (candidates, walk-candidates, max);
 
-  assert (checkBestScoresComeFirst (candidates, *candidateCount, max));
+  tr_free (tops);
   return candidates;
 }
 
@@ -4065,6 +4932,7 @@ initiateConnection (tr_peerMgr * mgr, tr_swarm * s, struct peer_atom * atom)
 
   atom->lastConnectionAttemptAt = now;
   atom->time = now;
+  candidatesUpdate (s, atom, now);
 }
 
 static void
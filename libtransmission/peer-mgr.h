@@ -60,6 +60,12 @@ typedef struct tr_pex
 }
 tr_pex;
 
+enum
+{
+  /* max number of peers of each address type in a PEX message */
+  MAX_PEX_PEER_COUNT = 50
+};
+
 struct peer_atom;
 struct tr_peerIo;
 struct tr_peerMsgs;
@@ -96,6 +102,9 @@ void         tr_peerMgrGetNextRequests      (tr_torrent          * torrent,
                                              int                 * numgot,
                                              bool                  get_intervals);
 
+/** @brief how many block requests are outstanding across every peer in the session */
+int          tr_peerMgrGetPendingRequestCount (const tr_peerMgr  * manager);
+
 bool         tr_peerMgrDidPeerRequest       (const tr_torrent    * torrent,
                                              const tr_peer       * peer,
                                              tr_block_index_t      block);
@@ -146,6 +155,22 @@ int          tr_peerMgrGetPeers             (tr_torrent          * tor,
                                              uint8_t               peer_list_mode,
                                              int                   max_peer_count);
 
+/**
+ * @brief the connected peers of the given address type, for PEX messages.
+ *
+ * The list is shared by the whole swarm and sorted by tr_pexCompare ().
+ * It's rebuilt at most every few seconds; setme_version changes only when
+ * its contents do, so a peer that already sent that version can skip the
+ * diff. The list is owned by the swarm and is only valid until the next call.
+ * Pass the same `now' when fetching both address types, so that they come
+ * from the same build of the snapshot.
+ */
+int          tr_peerMgrGetPexSnapshot       (tr_torrent          * tor,
+                                             uint8_t               address_type,
+                                             const tr_pex       ** setme_pex,
+                                             unsigned int        * setme_version,
+                                             time_t                now);
+
 void         tr_peerMgrStartTorrent         (tr_torrent          * tor);
 
 void         tr_peerMgrStopTorrent          (tr_torrent          * tor);
@@ -165,6 +190,31 @@ void         tr_peerMgrOnTorrentGotMetainfo (tr_torrent         * tor);
 
 void         tr_peerMgrOnBlocklistChanged   (tr_peerMgr         * manager);
 
+/** @brief start or stop super-seeding to match tr_torrentIsSuperSeeding () */
+void         tr_peerMgrOnSuperSeedingChanged (tr_torrent        * tor);
+
+/** @brief true if the swarm is hiding pieces from its peers to super-seed */
+bool         tr_peerMgrIsSuperSeeding       (const tr_torrent   * tor);
+
+/** @brief false if we're super-seeding and haven't offered the peer this piece */
+bool         tr_peerMgrSuperSeedAllowsRequest (const tr_torrent * tor,
+                                               const tr_peer    * peer,
+                                               tr_piece_index_t   piece);
+
+/**
+ * @brief pick the next piece to offer a peer while super-seeding.
+ *
+ * The piece with the fewest copies in the swarm plus pending offers that
+ * the peer neither has nor has been offered. The scan begins at start,
+ * which spreads ties around. Returns -1 if there's no such piece.
+ */
+int          tr_superSeedPickPiece          (const uint16_t     * replication,
+                                             const uint16_t     * offers,
+                                             tr_piece_index_t     pieceCount,
+                                             const tr_bitfield  * have,
+                                             const tr_bitfield  * offered,
+                                             tr_piece_index_t     start);
+
 struct tr_peer_stat * tr_peerMgrPeerStats   (const tr_torrent   * tor,
                                              int                * setmeCount);
 
@@ -182,6 +232,10 @@ void         tr_peerMgrGotBadPiece          (tr_torrent         * tor,
 void         tr_peerMgrPieceCompleted       (tr_torrent         * tor,
                                              tr_piece_index_t     pieceIndex);
 
+/* a piece we had failed its check and has to be downloaded again */
+void         tr_peerMgrPieceLost            (tr_torrent         * tor,
+                                             tr_piece_index_t     pieceIndex);
+
 
 
 /* @} */
@@ -7,16 +7,18 @@
  */
 
 #include <stdio.h>
+#include <string.h> /* memset () */
 #include "transmission.h"
+#include "bitfield.h"
+#include "net.h" /* tr_address_from_string () */
 #include "peer-msgs.h"
 #include "utils.h"
 
 #include "libtransmission-test.h"
 
-int
-main (void)
+static int
+test_allowed_set (void)
 {
-#if 0
     uint32_t           i;
     uint8_t            infohash[SHA_DIGEST_LENGTH];
     struct tr_address  addr;
@@ -41,8 +43,123 @@ main (void)
     check (numgot == numwant);
     for (i=0; i<numgot; ++i)
         check (buf[i] == pieces[i]);
-#endif
 
     return 0;
 }
 
+static int
+test_pick_fast_set (void)
+{
+    tr_piece_index_t buf[3];
+    const tr_piece_index_t canonical[] = { 7, 3, 9, 1, 4 };
+    const tr_piece_index_t hot[] = { 100, 4, 9 };
+
+    /* cached pieces go first, but only ones from the canonical set */
+    check_uint_eq (3, tr_pickAllowedFastSet (buf, 3, canonical, 5, hot, 3));
+    check_uint_eq (9, buf[0]);
+    check_uint_eq (4, buf[1]);
+    check_uint_eq (7, buf[2]);
+
+    /* with nothing cached, it's the start of the canonical set */
+    check_uint_eq (3, tr_pickAllowedFastSet (buf, 3, canonical, 5, NULL, 0));
+    check_uint_eq (7, buf[0]);
+    check_uint_eq (3, buf[1]);
+    check_uint_eq (9, buf[2]);
+
+    /* never more than the canonical set has */
+    check_uint_eq (2, tr_pickAllowedFastSet (buf, 3, canonical, 2, hot, 3));
+    check_uint_eq (7, buf[0]);
+    check_uint_eq (3, buf[1]);
+
+    return 0;
+}
+
+static int
+test_suggestions (void)
+{
+    int i;
+    tr_bitfield have;
+    struct tr_suggest_history history;
+    tr_piece_index_t buf[MAX_SUGGESTS_PER_INTERVAL];
+    tr_piece_index_t hot[40];
+    time_t now = 1000;
+
+    memset (&history, 0, sizeof (history));
+    tr_bitfieldConstruct (&have, 64);
+    tr_bitfieldAdd (&have, 2);
+    for (i=0; i<6; ++i)
+        hot[i] = i + 1;
+
+    /* pieces the peer has are skipped */
+    check_int_eq (4, tr_pickSuggestions (&history, now, hot, 6, &have, buf));
+    check_uint_eq (1, buf[0]);
+    check_uint_eq (3, buf[1]);
+    check_uint_eq (4, buf[2]);
+    check_uint_eq (5, buf[3]);
+
+    /* throttled */
+    check_int_eq (0, tr_pickSuggestions (&history, now + SUGGEST_INTERVAL_SECS - 1, hot, 6, &have, buf));
+
+    /* pieces already suggested are skipped */
+    now += SUGGEST_INTERVAL_SECS;
+    check_int_eq (1, tr_pickSuggestions (&history, now, hot, 6, &have, buf));
+    check_uint_eq (6, buf[0]);
+    now += SUGGEST_INTERVAL_SECS;
+    check_int_eq (0, tr_pickSuggestions (&history, now, hot, 6, &have, buf));
+
+    /* the history only remembers the newest SUGGEST_HISTORY_SIZE */
+    memset (&history, 0, sizeof (history));
+    tr_bitfieldSetHasNone (&have);
+    for (i=0; i<40; ++i)
+        hot[i] = i;
+    for (i=0; i<=SUGGEST_HISTORY_SIZE/MAX_SUGGESTS_PER_INTERVAL; ++i)
+    {
+        now += SUGGEST_INTERVAL_SECS;
+        check_int_eq (MAX_SUGGESTS_PER_INTERVAL, tr_pickSuggestions (&history, now, hot, 40, &have, buf));
+        check_uint_eq (i * MAX_SUGGESTS_PER_INTERVAL, buf[0]);
+    }
+
+    /* that last round pushed the first pieces out, so they're suggested again */
+    now += SUGGEST_INTERVAL_SECS;
+    check_int_eq (MAX_SUGGESTS_PER_INTERVAL, tr_pickSuggestions (&history, now, hot, 40, &have, buf));
+    check_uint_eq (0, buf[0]);
+
+    tr_bitfieldDestruct (&have);
+    return 0;
+}
+
+static int
+test_keep_allowed_fast (void)
+{
+    struct peer_request reqs[] = { { 1, 0, 16384 },
+                                   { 5, 0, 16384 },
+                                   { 2, 16384, 16384 },
+                                   { 5, 16384, 16384 } };
+    const tr_piece_index_t fastset[] = { 5, 9 };
+
+    /* requests in the fast set survive a choke, in order;
+       the ones to reject are left after them */
+    check_int_eq (2, tr_peerRequestsKeepAllowedFast (reqs, 4, fastset, 2));
+    check_uint_eq (5, reqs[0].index);
+    check_uint_eq (0, reqs[0].offset);
+    check_uint_eq (5, reqs[1].index);
+    check_uint_eq (16384, reqs[1].offset);
+    check_uint_eq (1, reqs[2].index);
+    check_uint_eq (2, reqs[3].index);
+
+    check_int_eq (0, tr_peerRequestsKeepAllowedFast (reqs, 4, NULL, 0));
+    check_uint_eq (5, reqs[0].index);
+
+    return 0;
+}
+
+int
+main (void)
+{
+    const testFunc tests[] = { test_allowed_set,
+                               test_pick_fast_set,
+                               test_suggestions,
+                               test_keep_allowed_fast };
+
+    return runTests (tests, NUM_TESTS (tests));
+}
@@ -66,8 +66,6 @@ enum
   UT_PEX_ID               = 1,
   UT_METADATA_ID          = 3,
 
-  MAX_PEX_PEER_COUNT      = 50,
-
   MIN_CHOKE_PERIOD_SEC    = 10,
 
   /* idle seconds before we send a keepalive */
@@ -89,14 +87,35 @@ enum
   /* number of pieces we'll allow in our fast set */
   MAX_FAST_SET_SIZE = 3,
 
+  /* size of BEP 6's canonical set, which the fast set is picked from */
+  FAST_SET_CANDIDATES = 10,
+
+  /* the most cached pieces to consider for suggestions or the fast set */
+  MAX_HOT_PIECES = 64,
+
   /* how many blocks to keep prefetched per peer */
   PREFETCH_SIZE = 18,
 
-  /* when we're making requests from another peer,
-     batch them together to send enough requests to
-     meet our bandwidth goals for the next N seconds */
+  /* when we're speed limited, don't keep more than
+     N seconds' worth of the allowed rate requested */
   REQUEST_BUF_SECS = 10,
 
+  /* the fewest requests we keep in flight to a peer that's unchoked us */
+  REQUEST_WINDOW_FLOOR = 4,
+
+  /* once a peer's bandwidth-delay product is known,
+     keep about this many times that in flight */
+  REQUEST_WINDOW_BDP_GAIN = 2,
+
+  /* the most block requests in flight across the whole session */
+  SESSION_REQUEST_BUDGET = 4096,
+
+  /* give up on timing a request if it's unanswered this long */
+  RTT_PROBE_TIMEOUT_MSEC = (60 * 1000),
+
+  /* after a peer rejects a metadata request, leave it alone this long */
+  METADATA_REJECT_BACKOFF_SECS = 10,
+
   /* defined in BEP #9 */
   METADATA_MSG_TYPE_REQUEST = 0,
   METADATA_MSG_TYPE_DATA = 1,
@@ -123,13 +142,6 @@ encryption_preference_t;
 ***
 **/
 
-struct peer_request
-{
-  uint32_t index;
-  uint32_t offset;
-  uint32_t length;
-};
-
 static void
 blockToReq (const tr_torrent     * tor,
             tr_block_index_t       block,
@@ -192,10 +204,27 @@ struct tr_peerMsgs
   bool clientSentLtepHandshake;
   bool peerSentLtepHandshake;
 
-  /*bool haveFastSet;*/
+  bool haveFastSet;
 
   int desiredRequestCount;
 
+  /* how many requests we'd like in flight to this peer. It grows like
+   * TCP slow start while the peer keeps up, then settles at about
+   * REQUEST_WINDOW_BDP_GAIN times the peer's bandwidth-delay product */
+  int requestWindow;
+  int requestWindowAcked;
+  bool requestSlowStart;
+
+  /* round-trip timing of one request at a time, from when it's sent
+   * until its piece message starts arriving. srtt is smoothed; minRtt
+   * is the lowest seen, i.e. the delay without our requests queued */
+  bool rttProbeOnEmptyPipe;
+  tr_block_index_t rttProbeBlock;
+  uint64_t rttProbeSentAt;
+  int lastRttMsec;
+  int srttMsec;
+  int minRttMsec;
+
   int prefetchCount;
 
   int is_active[2];
@@ -211,15 +240,18 @@ struct tr_peerMsgs
   uint16_t        pexCount;
   uint16_t        pexCount6;
 
+  /* the swarm's PEX snapshot version that msgs->pex and pex6 reflect */
+  unsigned int    pexVersion;
+
   tr_port         dht_port;
 
   encryption_preference_t  encryption_preference;
 
   size_t                   metadata_size_hint;
-#if 0
   size_t                 fastsetSize;
   tr_piece_index_t       fastset[MAX_FAST_SET_SIZE];
-#endif
+
+  struct tr_suggest_history suggested;
 
   tr_torrent *           torrent;
 
@@ -228,6 +260,11 @@ struct tr_peerMsgs
 
   struct evbuffer *      outMessages; /* all the non-piece messages */
 
+  /* HAVE messages waiting to be appended to outMessages when it's flushed */
+  uint32_t *             pendingHaves;
+  int                    pendingHaveCount;
+  int                    pendingHaveAlloc;
+
   struct peer_request    peerAskedFor[REQQ];
 
   int peerAskedForMetadata[METADATA_REQQ];
@@ -241,6 +278,9 @@ struct tr_peerMsgs
 
   time_t chokeChangedAt;
 
+  /* when the peer last rejected one of our metadata requests */
+  time_t metadataRejectedAt;
+
   /* when we started batching the outMessages */
   time_t outMessagesBatchedAt;
 
@@ -399,34 +439,94 @@ protocolSendPort (tr_peerMsgs *msgs, uint16_t port)
 static void
 protocolSendHave (tr_peerMsgs * msgs, uint32_t index)
 {
-  struct evbuffer * out = msgs->outMessages;
+  /* a seed has no use for our HAVEs */
+  if (tr_peerIsSeed (&msgs->peer))
+    {
+      ++getSession (msgs)->perfStats.havesSuppressed;
+      return;
+    }
 
-  evbuffer_add_uint32 (out, sizeof (uint8_t) + sizeof (uint32_t));
-  evbuffer_add_uint8 (out, BT_HAVE);
-  evbuffer_add_uint32 (out, index);
+  if (msgs->pendingHaveCount == msgs->pendingHaveAlloc)
+    {
+      msgs->pendingHaveAlloc = msgs->pendingHaveAlloc ? msgs->pendingHaveAlloc * 2 : 8;
+      msgs->pendingHaves = tr_renew (uint32_t, msgs->pendingHaves, msgs->pendingHaveAlloc);
+    }
 
-  dbgmsg (msgs, "sending Have %u", index);
-  dbgOutMessageLen (msgs);
+  msgs->pendingHaves[msgs->pendingHaveCount++] = index;
+  ++getSession (msgs)->perfStats.havesQueued;
+
+  dbgmsg (msgs, "queueing Have %u", index);
   pokeBatchPeriod (msgs, LOW_PRIORITY_INTERVAL_SECS);
 }
 
-#if 0
+/* append the queued HAVEs to outMessages in a single write */
+static void
+flushPendingHaves (tr_peerMsgs * msgs)
+{
+  int i;
+  uint8_t * walk;
+  struct evbuffer_iovec iovec[1];
+  const size_t msglen = sizeof (uint32_t) + sizeof (uint8_t) + sizeof (uint32_t);
+  const size_t len = msglen * msgs->pendingHaveCount;
+  struct tr_perf_stats * stats = &getSession (msgs)->perfStats;
+
+  if (msgs->pendingHaveCount == 0)
+    return;
+
+  evbuffer_reserve_space (msgs->outMessages, len, iovec, 1);
+  walk = iovec[0].iov_base;
+  for (i=0; i<msgs->pendingHaveCount; ++i)
+    {
+      const uint32_t nl_len = htonl (sizeof (uint8_t) + sizeof (uint32_t));
+      const uint32_t nl_index = htonl (msgs->pendingHaves[i]);
+
+      memcpy (walk, &nl_len, sizeof (uint32_t)); walk += sizeof (uint32_t);
+      *walk++ = BT_HAVE;
+      memcpy (walk, &nl_index, sizeof (uint32_t)); walk += sizeof (uint32_t);
+    }
+  iovec[0].iov_len = len;
+  evbuffer_commit_space (msgs->outMessages, iovec, 1);
+
+  dbgmsg (msgs, "sending %d Haves", msgs->pendingHaveCount);
+  stats->havesSent += msgs->pendingHaveCount;
+  ++stats->batchesSent;
+  msgs->pendingHaveCount = 0;
+  dbgOutMessageLen (msgs);
+}
+
 static void
 protocolSendAllowedFast (tr_peerMsgs * msgs, uint32_t pieceIndex)
 {
-  tr_peerIo       * io  = msgs->io;
   struct evbuffer * out = msgs->outMessages;
 
   assert (tr_peerIoSupportsFEXT (msgs->io));
 
-  evbuffer_add_uint32 (io, out, sizeof (uint8_t) + sizeof (uint32_t));
-  evbuffer_add_uint8 (io, out, BT_FEXT_ALLOWED_FAST);
-  evbuffer_add_uint32 (io, out, pieceIndex);
+  evbuffer_add_uint32 (out, sizeof (uint8_t) + sizeof (uint32_t));
+  evbuffer_add_uint8 (out, BT_FEXT_ALLOWED_FAST);
+  evbuffer_add_uint32 (out, pieceIndex);
+  ++getSession (msgs)->perfStats.allowedFastSent;
 
   dbgmsg (msgs, "sending Allowed Fast %u...", pieceIndex);
   dbgOutMessageLen (msgs);
+  pokeBatchPeriod (msgs, HIGH_PRIORITY_INTERVAL_SECS);
+}
+
+static void
+protocolSendSuggest (tr_peerMsgs * msgs, uint32_t pieceIndex)
+{
+  struct evbuffer * out = msgs->outMessages;
+
+  assert (tr_peerIoSupportsFEXT (msgs->io));
+
+  evbuffer_add_uint32 (out, sizeof (uint8_t) + sizeof (uint32_t));
+  evbuffer_add_uint8 (out, BT_FEXT_SUGGEST);
+  evbuffer_add_uint32 (out, pieceIndex);
+  ++getSession (msgs)->perfStats.suggestsSent;
+
+  dbgmsg (msgs, "sending Suggest %u...", pieceIndex);
+  dbgOutMessageLen (msgs);
+  pokeBatchPeriod (msgs, LOW_PRIORITY_INTERVAL_SECS);
 }
-#endif
 
 static void
 protocolSendChoke (tr_peerMsgs * msgs, int choke)
@@ -606,7 +706,6 @@ fireClientGotHave (tr_peerMsgs * msgs, tr_piece_index_t index)
 ***  For explanation, see http://www.bittorrent.org/beps/bep_0006.html
 **/
 
-#if 0
 size_t
 tr_generateAllowedSet (tr_piece_index_t * setmePieces,
                        size_t             desiredSetSize,
@@ -661,21 +760,84 @@ tr_generateAllowedSet (tr_piece_index_t * setmePieces,
     return setSize;
 }
 
+static bool
+fastSetHas (const tr_peerMsgs * msgs, tr_piece_index_t piece)
+{
+    size_t i;
+
+    for (i=0; i<msgs->fastsetSize; ++i)
+        if (msgs->fastset[i] == piece)
+            return true;
+
+    return false;
+}
+
+size_t
+tr_pickAllowedFastSet (tr_piece_index_t        * setme,
+                       size_t                    setSize,
+                       const tr_piece_index_t  * canonical,
+                       size_t                    canonicalCount,
+                       const tr_piece_index_t  * hot,
+                       size_t                    hotCount)
+{
+    size_t i;
+    size_t j;
+    size_t n = 0;
+    bool picked[FAST_SET_CANDIDATES];
+
+    assert (canonicalCount <= FAST_SET_CANDIDATES);
+
+    /* pieces that are already in memory first, so that
+       serving a choked peer doesn't cost a disk seek */
+    for (i=0; i<canonicalCount; ++i)
+    {
+        picked[i] = false;
+
+        for (j=0; j<hotCount && n<setSize && !picked[i]; ++j)
+            if (hot[j] == canonical[i])
+                picked[i] = true;
+
+        if (picked[i])
+            setme[n++] = canonical[i];
+    }
+
+    for (i=0; i<canonicalCount && n<setSize; ++i)
+        if (!picked[i])
+            setme[n++] = canonical[i];
+
+    return n;
+}
+
 static void
-updateFastSet (tr_peerMsgs * msgs UNUSED)
+updateFastSet (tr_peerMsgs * msgs)
 {
+    tr_torrent * tor = msgs->torrent;
     const bool fext = tr_peerIoSupportsFEXT (msgs->io);
-    const int peerIsNeedy = msgs->peer->progress < 0.10;
+    const bool peerIsNeedy = msgs->peer.progress < 0.10;
 
-    if (fext && peerIsNeedy && !msgs->haveFastSet)
+    if (fext && peerIsNeedy && !msgs->haveFastSet
+        && tr_torrentHasMetadata (tor) && !tr_peerMgrIsSuperSeeding (tor))
     {
         size_t i;
+        size_t n;
+        size_t candidateCount = 0;
+        int hotCount;
+        tr_piece_index_t hot[MAX_HOT_PIECES];
+        tr_piece_index_t canonical[FAST_SET_CANDIDATES];
         const struct tr_address * addr = tr_peerIoGetAddress (msgs->io, NULL);
-        const tr_info * inf = &msgs->torrent->info;
-        const size_t numwant = MIN (MAX_FAST_SET_SIZE, inf->pieceCount);
+        const tr_info * inf = &tor->info;
+        const size_t numwant = MIN (FAST_SET_CANDIDATES, inf->pieceCount);
 
-        /* build the fast set */
-        msgs->fastsetSize = tr_generateAllowedSet (msgs->fastset, numwant, inf->pieceCount, inf->hash, addr);
+        /* only pick from BEP 6's canonical set for the peer's address,
+           so that reconnecting can't get a peer any more free pieces */
+        n = tr_generateAllowedSet (canonical, numwant, inf->pieceCount, inf->hash, addr);
+        for (i=0; i<n; ++i)
+            if (tr_torrentPieceIsComplete (tor, canonical[i]) && !tr_bitfieldHas (&msgs->peer.have, canonical[i]))
+                canonical[candidateCount++] = canonical[i];
+
+        hotCount = tr_cacheGetHotPieces (getSession (msgs)->cache, tor, hot, MAX_HOT_PIECES);
+        msgs->fastsetSize = tr_pickAllowedFastSet (msgs->fastset, MAX_FAST_SET_SIZE,
+                                                   canonical, candidateCount, hot, hotCount);
         msgs->haveFastSet = true;
 
         /* send it to the peer */
@@ -683,7 +845,76 @@ updateFastSet (tr_peerMsgs * msgs UNUSED)
             protocolSendAllowedFast (msgs, msgs->fastset[i]);
     }
 }
-#endif
+
+/***
+****  SUGGEST PIECE
+***/
+
+static bool
+wasSuggested (const struct tr_suggest_history * history, tr_piece_index_t piece)
+{
+    int i;
+    const int n = MIN (history->count, SUGGEST_HISTORY_SIZE);
+
+    for (i=0; i<n; ++i)
+        if (history->pieces[i] == piece)
+            return true;
+
+    return false;
+}
+
+int
+tr_pickSuggestions (struct tr_suggest_history  * history,
+                    time_t                       now,
+                    const tr_piece_index_t     * hot,
+                    int                          hotCount,
+                    const tr_bitfield          * peerHave,
+                    tr_piece_index_t           * setme)
+{
+    int i;
+    int n = 0;
+
+    if (history->lastAt + SUGGEST_INTERVAL_SECS > now)
+        return 0;
+
+    history->lastAt = now;
+
+    for (i=0; i<hotCount && n<MAX_SUGGESTS_PER_INTERVAL; ++i)
+    {
+        if (tr_bitfieldHas (peerHave, hot[i]) || wasSuggested (history, hot[i]))
+            continue;
+
+        history->pieces[history->count++ % SUGGEST_HISTORY_SIZE] = hot[i];
+        setme[n++] = hot[i];
+    }
+
+    return n;
+}
+
+/* point an interested peer at pieces we can upload from memory, so that
+   peers asking for random pieces don't send the disk seeking everywhere */
+static void
+updateSuggestions (tr_peerMsgs * msgs, time_t now)
+{
+    int i;
+    int n;
+    tr_piece_index_t hot[MAX_HOT_PIECES];
+    tr_piece_index_t pieces[MAX_SUGGESTS_PER_INTERVAL];
+    tr_torrent * tor = msgs->torrent;
+
+    if (!tr_peerIoSupportsFEXT (msgs->io)
+        || !msgs->peer_is_interested
+        || (msgs->suggested.lastAt + SUGGEST_INTERVAL_SECS > now)
+        || !tr_torrentHasMetadata (tor)
+        || tr_peerMgrIsSuperSeeding (tor)
+        || tr_peerIsSeed (&msgs->peer))
+        return;
+
+    n = tr_cacheGetHotPieces (getSession (msgs)->cache, tor, hot, MAX_HOT_PIECES);
+    n = tr_pickSuggestions (&msgs->suggested, now, hot, n, &msgs->peer.have, pieces);
+    for (i=0; i<n; ++i)
+        protocolSendSuggest (msgs, pieces[i]);
+}
 
 /***
 ****  ACTIVE
@@ -834,15 +1065,51 @@ popNextRequest (tr_peerMsgs * msgs, struct peer_request * setme)
   return true;
 }
 
+int
+tr_peerRequestsKeepAllowedFast (struct peer_request     * reqs,
+                                int                       n,
+                                const tr_piece_index_t  * fastset,
+                                size_t                    fastsetSize)
+{
+  int i;
+  int keep = 0;
+  int drop = 0;
+  struct peer_request * dropped = tr_new (struct peer_request, n);
+
+  for (i=0; i<n; ++i)
+    {
+      size_t j;
+
+      for (j=0; j<fastsetSize && fastset[j]!=reqs[i].index; )
+        ++j;
+
+      if (j < fastsetSize)
+        reqs[keep++] = reqs[i];
+      else
+        dropped[drop++] = reqs[i];
+    }
+
+  memcpy (reqs + keep, dropped, sizeof (struct peer_request) * drop);
+  tr_free (dropped);
+  return keep;
+}
+
 static void
 cancelAllRequestsToClient (tr_peerMsgs * msgs)
 {
-  struct peer_request req;
+  int i;
+  const int n = msgs->peer.pendingReqsToClient;
   const int mustSendCancel = tr_peerIoSupportsFEXT (msgs->io);
 
-  while (popNextRequest (msgs, &req))
-    if (mustSendCancel)
-      protocolSendReject (msgs, &req);
+  /* choking doesn't cancel requests for pieces in the allowed fast set */
+  const int keep = tr_peerRequestsKeepAllowedFast (msgs->peerAskedFor, n,
+                                                   msgs->fastset, msgs->fastsetSize);
+
+  if (mustSendCancel)
+    for (i=keep; i<n; ++i)
+      protocolSendReject (msgs, &msgs->peerAskedFor[i]);
+
+  msgs->peer.pendingReqsToClient = keep;
 }
 
 void
@@ -901,12 +1168,15 @@ requestIsValid (const tr_peerMsgs * msgs, const struct peer_request * req)
     return reqIsValid (msgs, req->index, req->offset, req->length);
 }
 
+static void rttProbeCancel (tr_peerMsgs * msgs, tr_block_index_t block);
+
 void
 tr_peerMsgsCancel (tr_peerMsgs * msgs, tr_block_index_t block)
 {
     struct peer_request req;
 /*fprintf (stderr, "SENDING CANCEL MESSAGE FOR BLOCK %zu\n\t\tFROM PEER %p ------------------------------------\n", (size_t)block, msgs->peer);*/
     blockToReq (msgs->torrent, block, &req);
+    rttProbeCancel (msgs, block);
     protocolSendCancel (msgs, &req);
 }
 
@@ -1112,7 +1382,9 @@ parseUtMetadata (tr_peerMsgs * msgs, uint32_t msglen, struct evbuffer * inbuf)
 
     if (msg_type == METADATA_MSG_TYPE_REJECT)
     {
-        /* NOOP */
+        /* let someone else have the piece, and give this peer a rest */
+        tr_torrentMetadataRequestFailed (msgs->torrent, msgs, piece);
+        msgs->metadataRejectedAt = tr_time ();
     }
 
     if ((msg_type == METADATA_MSG_TYPE_DATA)
@@ -1121,7 +1393,7 @@ parseUtMetadata (tr_peerMsgs * msgs, uint32_t msglen, struct evbuffer * inbuf)
         && (piece * METADATA_PIECE_SIZE + (msg_end - benc_end) <= total_size))
     {
         const int pieceLen = msg_end - benc_end;
-        tr_torrentSetMetadataPiece (msgs->torrent, piece, benc_end, pieceLen);
+        tr_torrentSetMetadataPiece (msgs->torrent, msgs, piece, benc_end, pieceLen);
     }
 
     if (msg_type == METADATA_MSG_TYPE_REQUEST)
@@ -1319,7 +1591,7 @@ updatePeerProgress (tr_peerMsgs * msgs)
 {
   tr_peerUpdateProgress (msgs->torrent, &msgs->peer);
 
-  /*updateFastSet (msgs);*/
+  updateFastSet (msgs);
   updateInterest (msgs);
 }
 
@@ -1356,7 +1628,9 @@ peerMadeRequest (tr_peerMsgs * msgs, const struct peer_request * req)
         dbgmsg (msgs, "rejecting an invalid request.");
     else if (!clientHasPiece)
         dbgmsg (msgs, "rejecting request for a piece we don't have.");
-    else if (peerIsChoked)
+    else if (!tr_peerMgrSuperSeedAllowsRequest (msgs->torrent, &msgs->peer, req->index))
+        dbgmsg (msgs, "rejecting request for a piece we haven't offered while super-seeding");
+    else if (peerIsChoked && !fastSetHas (msgs, req->index))
         dbgmsg (msgs, "rejecting request from choked peer");
     else if (msgs->peer.pendingReqsToClient + 1 >= REQQ)
         dbgmsg (msgs, "rejecting request ... reqq is full");
@@ -1421,6 +1695,137 @@ static int clientGotBlock (tr_peerMsgs *               msgs,
                            struct evbuffer *           block,
                            const struct peer_request * req);
 
+/**
+***  Request pipelining
+**/
+
+static void
+rttProbeStart (tr_peerMsgs * msgs, tr_block_index_t block, bool pipeIsEmpty, uint64_t now)
+{
+    /* only time one request at a time, like TCP without timestamps */
+    if (msgs->rttProbeSentAt && (msgs->rttProbeSentAt + RTT_PROBE_TIMEOUT_MSEC > now))
+        return;
+
+    msgs->rttProbeBlock = block;
+    msgs->rttProbeSentAt = now;
+    msgs->rttProbeOnEmptyPipe = pipeIsEmpty;
+}
+
+static void
+rttProbeCancel (tr_peerMsgs * msgs, tr_block_index_t block)
+{
+    if (msgs->rttProbeSentAt && (msgs->rttProbeBlock == block))
+        msgs->rttProbeSentAt = 0;
+}
+
+static void
+rttProbeFinish (tr_peerMsgs * msgs, tr_block_index_t block)
+{
+    uint64_t elapsed;
+    int sample;
+
+    if (!msgs->rttProbeSentAt || (msgs->rttProbeBlock != block))
+        return;
+
+    elapsed = tr_time_msec () - msgs->rttProbeSentAt;
+    sample = (int) MAX (1, MIN (elapsed, RTT_PROBE_TIMEOUT_MSEC));
+    msgs->rttProbeSentAt = 0;
+    msgs->lastRttMsec = sample;
+
+    if (!msgs->srttMsec)
+        msgs->srttMsec = sample;
+    else
+        msgs->srttMsec = (msgs->srttMsec * 7 + sample) / 8;
+
+    /* a request sent into an empty pipeline didn't wait behind any
+     * others, so it's a fresh reading of the path's delay even if
+     * it's higher than the old minimum (e.g. after a route change) */
+    if (!msgs->minRttMsec || (sample < msgs->minRttMsec) || msgs->rttProbeOnEmptyPipe)
+        msgs->minRttMsec = sample;
+
+    dbgmsg (msgs, "rtt sample %d msec; srtt %d, min %d", sample, msgs->srttMsec, msgs->minRttMsec);
+}
+
+/* The share of the window that's actually in the network is
+ * window * minRtt / rtt -- the rest is waiting in the peer's queue.
+ * That's our estimate of the bandwidth-delay product, in blocks.
+ * The newest sample is used too because srtt lags a growing window. */
+static int
+getRequestWindowTarget (const tr_peerMsgs * msgs)
+{
+    int64_t bdp;
+    int rtt;
+
+    if (!msgs->srttMsec) /* keep growing until we've got a sample */
+        return SESSION_REQUEST_BUDGET;
+
+    rtt = MAX (msgs->srttMsec, msgs->lastRttMsec);
+    bdp = (int64_t) msgs->requestWindow * MIN (msgs->minRttMsec, rtt) / rtt;
+    return (int) MIN (bdp * REQUEST_WINDOW_BDP_GAIN + REQUEST_WINDOW_FLOOR, SESSION_REQUEST_BUDGET);
+}
+
+static void
+requestWindowGotBlock (tr_peerMsgs * msgs)
+{
+    const int target = getRequestWindowTarget (msgs);
+
+    /* leave slow start as soon as a request has to wait in line */
+    if (msgs->requestSlowStart && msgs->lastRttMsec
+                               && (msgs->lastRttMsec > msgs->minRttMsec + msgs->minRttMsec / 2))
+        msgs->requestSlowStart = false;
+
+    if (msgs->requestWindow > target)
+    {
+        /* our requests are piling up at the peer, so back off */
+        msgs->requestWindow = MAX (REQUEST_WINDOW_FLOOR, msgs->requestWindow - 1);
+        msgs->requestSlowStart = false;
+    }
+    else if ((msgs->requestWindow < target)
+          && (msgs->desiredRequestCount >= msgs->requestWindow)
+          && (msgs->peer.pendingReqsToPeer >= msgs->desiredRequestCount / 2))
+    {
+        /* the window is what's holding us back, so open it up:
+         * by one block per block in slow start, which doubles it
+         * every round trip, or else by one block per round trip */
+        if (msgs->requestSlowStart)
+            ++msgs->requestWindow;
+        else if (++msgs->requestWindowAcked >= msgs->requestWindow)
+        {
+            msgs->requestWindowAcked = 0;
+            ++msgs->requestWindow;
+        }
+    }
+}
+
+static void
+requestWindowGotReject (tr_peerMsgs * msgs, tr_block_index_t block)
+{
+    rttProbeCancel (msgs, block);
+
+    /* a choke's rejects are just the peer clearing its queue */
+    if (!msgs->client_is_choked)
+    {
+        msgs->requestWindow = MAX (REQUEST_WINDOW_FLOOR, msgs->requestWindow / 2);
+        msgs->requestWindowAcked = 0;
+        msgs->requestSlowStart = false;
+    }
+}
+
+static void
+requestWindowGotChoke (tr_peerMsgs * msgs)
+{
+    msgs->rttProbeSentAt = 0;
+
+    /* like TCP after an idle period, ramp back up from half */
+    msgs->requestWindow = MAX (REQUEST_WINDOW_FLOOR, msgs->requestWindow / 2);
+    msgs->requestWindowAcked = 0;
+    msgs->requestSlowStart = true;
+}
+
+/**
+***
+**/
+
 static int
 readBtPiece (tr_peerMsgs      * msgs,
              struct evbuffer  * inbuf,
@@ -1441,6 +1846,7 @@ readBtPiece (tr_peerMsgs      * msgs,
         tr_peerIoReadUint32 (msgs->io, inbuf, &req->offset);
         req->length = msgs->incoming.length - 9;
         dbgmsg (msgs, "got incoming block header %u:%u->%u", req->index, req->offset, req->length);
+        rttProbeFinish (msgs, _tr_block (msgs->torrent, req->index, req->offset));
         return READ_NOW;
     }
     else
@@ -1513,6 +1919,7 @@ readBtMessage (tr_peerMsgs * msgs, struct evbuffer * inbuf, size_t inlen)
         case BT_CHOKE:
             dbgmsg (msgs, "got Choke");
             msgs->client_is_choked = true;
+            requestWindowGotChoke (msgs);
             if (!fext)
                 fireGotChoke (msgs);
             tr_peerMsgsUpdateActive (msgs, TR_PEER_TO_CLIENT);
@@ -1666,8 +2073,10 @@ assert (tr_bitfieldHasAll (&msgs->peer.have));
             tr_peerIoReadUint32 (msgs->io, inbuf, &r.index);
             tr_peerIoReadUint32 (msgs->io, inbuf, &r.offset);
             tr_peerIoReadUint32 (msgs->io, inbuf, &r.length);
-            if (fext)
+            if (fext) {
+                requestWindowGotReject (msgs, _tr_block (msgs->torrent, r.index, r.offset));
                 fireGotRej (msgs, &r);
+            }
             else {
                 fireError (msgs, EMSGSIZE);
                 return READ_ERR;
@@ -1737,6 +2146,7 @@ clientGotBlock (tr_peerMsgs                * msgs,
         return err;
 
     tr_bitfieldAdd (&msgs->peer.blame, req->index);
+    requestWindowGotBlock (msgs);
     fireGotBlock (msgs, req);
     return 0;
 }
@@ -1823,28 +2233,29 @@ updateDesiredRequestCount (tr_peerMsgs * msgs)
     }
     else
     {
-        int estimatedBlocksInPeriod;
-        unsigned int rate_Bps;
-        unsigned int irate_Bps;
-        const int floor = 4;
+        int count;
+        int budget;
+        unsigned int limit_Bps;
         const int seconds = REQUEST_BUF_SECS;
-        const uint64_t now = tr_time_msec ();
+        tr_session * session = torrent->session;
 
-        /* Get the rate limit we should use.
-         * FIXME: this needs to consider all the other peers as well... */
-        rate_Bps = tr_peerGetPieceSpeed_Bps (&msgs->peer, now, TR_PEER_TO_CLIENT);
-        if (tr_torrentUsesSpeedLimit (torrent, TR_PEER_TO_CLIENT))
-            rate_Bps = MIN (rate_Bps, tr_torrentGetSpeedLimit_Bps (torrent, TR_PEER_TO_CLIENT));
+        /* start with the pipeline depth this peer can keep busy */
+        count = msgs->requestWindow;
 
-        /* honor the session limits, if enabled */
+        /* when we're speed limited, there's no point in asking for
+         * more than we'd be allowed to download in REQUEST_BUF_SECS */
+        budget = SESSION_REQUEST_BUDGET;
+        if (tr_torrentUsesSpeedLimit (torrent, TR_PEER_TO_CLIENT))
+            count = MIN (count, (int)(((uint64_t)tr_torrentGetSpeedLimit_Bps (torrent, TR_PEER_TO_CLIENT) * seconds) / torrent->blockSize));
         if (tr_torrentUsesSessionLimits (torrent) &&
-            tr_sessionGetActiveSpeedLimit_Bps (torrent->session, TR_PEER_TO_CLIENT, &irate_Bps))
-                rate_Bps = MIN (rate_Bps, irate_Bps);
+            tr_sessionGetActiveSpeedLimit_Bps (session, TR_PEER_TO_CLIENT, &limit_Bps))
+                budget = MIN (budget, (int)(((uint64_t)limit_Bps * seconds) / torrent->blockSize));
 
-        /* use this desired rate to figure out how
-         * many requests we should send to this peer */
-        estimatedBlocksInPeriod = (rate_Bps * seconds) / torrent->blockSize;
-        msgs->desiredRequestCount = MAX (floor, estimatedBlocksInPeriod);
+        /* every peer gets the floor, but anything deeper than that
+         * comes out of what the rest of the session hasn't claimed */
+        budget -= tr_peerMgrGetPendingRequestCount (session->peerMgr) - msgs->peer.pendingReqsToPeer;
+        count = MIN (count, budget);
+        msgs->desiredRequestCount = MAX (REQUEST_WINDOW_FLOOR, count);
 
         /* honor the peer's maximum request count, if specified */
         if (msgs->reqq > 0)
@@ -1858,8 +2269,11 @@ updateMetadataRequests (tr_peerMsgs * msgs, time_t now)
 {
     int piece;
 
-    if (msgs->peerSupportsMetadataXfer
-        && tr_torrentGetNextMetadataRequest (msgs->torrent, now, &piece))
+    if (!msgs->peerSupportsMetadataXfer
+        || (msgs->metadataRejectedAt + METADATA_REJECT_BACKOFF_SECS > now))
+        return;
+
+    while (tr_torrentGetNextMetadataRequest (msgs->torrent, msgs, &piece))
     {
         tr_variant tmp;
         struct evbuffer * payload;
@@ -1898,6 +2312,7 @@ updateBlockRequests (tr_peerMsgs * msgs)
         int n;
         tr_block_index_t * blocks;
         const int numwant = msgs->desiredRequestCount - msgs->peer.pendingReqsToPeer;
+        const bool pipeIsEmpty = msgs->peer.pendingReqsToPeer == 0;
 
         assert (tr_peerMsgsIsClientInterested (msgs));
         assert (!tr_peerMsgsIsClientChoked (msgs));
@@ -1905,6 +2320,9 @@ updateBlockRequests (tr_peerMsgs * msgs)
         blocks = tr_new (tr_block_index_t, numwant);
         tr_peerMgrGetNextRequests (msgs->torrent, &msgs->peer, numwant, blocks, &n, false);
 
+        if (n > 0)
+            rttProbeStart (msgs, blocks[0], pipeIsEmpty, tr_time_msec ());
+
         for (i=0; i<n; ++i)
         {
             struct peer_request req;
@@ -1922,7 +2340,8 @@ fillOutputBuffer (tr_peerMsgs * msgs, time_t now)
     int piece;
     size_t bytesWritten = 0;
     struct peer_request req;
-    const bool haveMessages = evbuffer_get_length (msgs->outMessages) != 0;
+    const bool haveMessages = (evbuffer_get_length (msgs->outMessages) != 0)
+                           || (msgs->pendingHaveCount != 0);
     const bool fext = tr_peerIoSupportsFEXT (msgs->io);
 
     /**
@@ -1936,7 +2355,9 @@ fillOutputBuffer (tr_peerMsgs * msgs, time_t now)
     }
     else if (haveMessages && ((now - msgs->outMessagesBatchedAt) >= msgs->outMessagesBatchPeriod))
     {
-        const size_t len = evbuffer_get_length (msgs->outMessages);
+        size_t len;
+        flushPendingHaves (msgs);
+        len = evbuffer_get_length (msgs->outMessages);
         /* flush the protocol messages */
         dbgmsg (msgs, "flushing outMessages... to %p (length is %zu)", (void*)msgs->io, len);
         tr_peerIoWriteBuf (msgs->io, msgs->outMessages, false);
@@ -1953,16 +2374,16 @@ fillOutputBuffer (tr_peerMsgs * msgs, time_t now)
     if ((tr_peerIoGetWriteBufferSpace (msgs->io, now) >= METADATA_PIECE_SIZE)
         && popNextMetadataRequest (msgs, &piece))
     {
-        char * data;
-        size_t dataLen;
         bool ok = false;
+        struct evbuffer * data = evbuffer_new ();
 
-        data = tr_torrentGetMetadataPiece (msgs->torrent, piece, &dataLen);
-        if (data != NULL)
+        /* encryption happens in place, so encrypted peers get a copy */
+        if (tr_torrentGetMetadataPiece (msgs->torrent, piece, data, !tr_peerIoIsEncrypted (msgs->io)))
         {
             tr_variant tmp;
             struct evbuffer * payload;
             struct evbuffer * out = msgs->outMessages;
+            const size_t dataLen = evbuffer_get_length (data);
 
             /* build the data message */
             tr_variantInitDict (&tmp, 3);
@@ -1976,17 +2397,18 @@ fillOutputBuffer (tr_peerMsgs * msgs, time_t now)
             evbuffer_add_uint8 (out, BT_LTEP);
             evbuffer_add_uint8 (out, msgs->ut_metadata_id);
             evbuffer_add_buffer (out, payload);
-            evbuffer_add     (out, data, dataLen);
+            evbuffer_add_buffer (out, data);
             pokeBatchPeriod (msgs, HIGH_PRIORITY_INTERVAL_SECS);
             dbgOutMessageLen (msgs);
 
             evbuffer_free (payload);
             tr_variantFree (&tmp);
-            tr_free (data);
 
             ok = true;
         }
 
+        evbuffer_free (data);
+
         if (!ok) /* send a rejection message */
         {
             tr_variant tmp;
@@ -2025,6 +2447,7 @@ fillOutputBuffer (tr_peerMsgs * msgs, time_t now)
             && tr_torrentPieceIsComplete (msgs->torrent, req.index))
         {
             int err;
+            bool fromCache;
             const uint32_t msglen = 4 + 1 + 4 + 4 + req.length;
             struct evbuffer * out;
             struct evbuffer_iovec iovec[1];
@@ -2038,6 +2461,7 @@ fillOutputBuffer (tr_peerMsgs * msgs, time_t now)
             evbuffer_add_uint32 (out, req.offset);
 
             evbuffer_reserve_space (out, req.length, iovec, 1);
+            fromCache = tr_cacheHasBlock (getSession (msgs)->cache, msgs->torrent, req.index, req.offset);
             err = tr_cacheReadBlock (getSession (msgs)->cache, msgs->torrent, req.index, req.offset, req.length, iovec[0].iov_base);
             iovec[0].iov_len = req.length;
             evbuffer_commit_space (out, iovec, 1);
@@ -2061,6 +2485,11 @@ fillOutputBuffer (tr_peerMsgs * msgs, time_t now)
                 bytesWritten += n;
                 msgs->clientSentAnythingAt = now;
                 tr_historyAdd (&msgs->peer.blocksSentToPeer, tr_time (), 1);
+
+                if (fromCache)
+                    getSession (msgs)->perfStats.bytesFromCache += req.length;
+                else
+                    getSession (msgs)->perfStats.bytesFromDisk += req.length;
             }
 
             evbuffer_free (out);
@@ -2106,6 +2535,7 @@ peerPulse (void * vmsgs)
         updateDesiredRequestCount (msgs);
         updateBlockRequests (msgs);
         updateMetadataRequests (msgs, now);
+        updateSuggestions (msgs, now);
     }
 
     for (;;)
@@ -2157,7 +2587,13 @@ tellPeerWhatWeHave (tr_peerMsgs * msgs)
 {
     const bool fext = tr_peerIoSupportsFEXT (msgs->io);
 
-    if (fext && tr_torrentHasAll (msgs->torrent))
+    if (tr_peerMgrIsSuperSeeding (msgs->torrent))
+    {
+        /* pretend to have nothing; peer-mgr will offer pieces one by one */
+        if (fext)
+            protocolSendHaveNone (msgs);
+    }
+    else if (fext && tr_torrentHasAll (msgs->torrent))
     {
         protocolSendHaveAll (msgs);
     }
@@ -2300,10 +2736,18 @@ sendPex (tr_peerMsgs * msgs)
     {
         PexDiffs diffs;
         PexDiffs diffs6;
-        tr_pex * newPex = NULL;
-        tr_pex * newPex6 = NULL;
-        const int newCount = tr_peerMgrGetPeers (msgs->torrent, &newPex, TR_AF_INET, TR_PEERS_CONNECTED, MAX_PEX_PEER_COUNT);
-        const int newCount6 = tr_peerMgrGetPeers (msgs->torrent, &newPex6, TR_AF_INET6, TR_PEERS_CONNECTED, MAX_PEX_PEER_COUNT);
+        unsigned int version;
+        const tr_pex * newPex = NULL;
+        const tr_pex * newPex6 = NULL;
+        const time_t now = tr_time ();
+        const int newCount = tr_peerMgrGetPexSnapshot (msgs->torrent, TR_AF_INET, &newPex, &version, now);
+        const int newCount6 = tr_peerMgrGetPexSnapshot (msgs->torrent, TR_AF_INET6, &newPex6, &version, now);
+
+        /* nothing's changed since the last time we told this peer */
+        if (version == msgs->pexVersion)
+            return;
+
+        msgs->pexVersion = version;
 
         /* build the diffs */
         diffs.added = tr_new (tr_pex, newCount);
@@ -2356,49 +2800,50 @@ sendPex (tr_peerMsgs * msgs)
             msgs->pex6 = diffs6.elements;
             msgs->pexCount6 = diffs6.elementCount;
 
-            /* build the pex payload */
+            /* build the pex payload.
+             * one scratch buffer, big enough for the largest field, is
+             * reused for all of them since tr_variantDictAddRaw () copies */
+            tmp = tr_new (uint8_t, 18 * MAX (MAX (diffs.addedCount, diffs.droppedCount),
+                                             MAX (diffs6.addedCount, diffs6.droppedCount)));
             tr_variantInitDict (&val, 3); /* ipv6 support: left as 3:
                                          * speed vs. likelihood? */
 
             if (diffs.addedCount > 0)
             {
                 /* "added" */
-                tmp = walk = tr_new (uint8_t, diffs.addedCount * 6);
+                walk = tmp;
                 for (i = 0; i < diffs.addedCount; ++i) {
                     memcpy (walk, &diffs.added[i].addr.addr, 4); walk += 4;
                     memcpy (walk, &diffs.added[i].port, 2); walk += 2;
                 }
                 assert ((walk - tmp) == diffs.addedCount * 6);
                 tr_variantDictAddRaw (&val, TR_KEY_added, tmp, walk - tmp);
-                tr_free (tmp);
 
                 /* "added.f"
                  * unset each holepunch flag because we don't support it. */
-                tmp = walk = tr_new (uint8_t, diffs.addedCount);
+                walk = tmp;
                 for (i = 0; i < diffs.addedCount; ++i)
                     *walk++ = diffs.added[i].flags & ~ADDED_F_HOLEPUNCH;
                 assert ((walk - tmp) == diffs.addedCount);
                 tr_variantDictAddRaw (&val, TR_KEY_added_f, tmp, walk - tmp);
-                tr_free (tmp);
             }
 
             if (diffs.droppedCount > 0)
             {
                 /* "dropped" */
-                tmp = walk = tr_new (uint8_t, diffs.droppedCount * 6);
+                walk = tmp;
                 for (i = 0; i < diffs.droppedCount; ++i) {
                     memcpy (walk, &diffs.dropped[i].addr.addr, 4); walk += 4;
                     memcpy (walk, &diffs.dropped[i].port, 2); walk += 2;
                 }
                 assert ((walk - tmp) == diffs.droppedCount * 6);
                 tr_variantDictAddRaw (&val, TR_KEY_dropped, tmp, walk - tmp);
-                tr_free (tmp);
             }
 
             if (diffs6.addedCount > 0)
             {
                 /* "added6" */
-                tmp = walk = tr_new (uint8_t, diffs6.addedCount * 18);
+                walk = tmp;
                 for (i = 0; i < diffs6.addedCount; ++i) {
                     memcpy (walk, &diffs6.added[i].addr.addr.addr6.s6_addr, 16);
                     walk += 16;
@@ -2407,22 +2852,20 @@ sendPex (tr_peerMsgs * msgs)
                 }
                 assert ((walk - tmp) == diffs6.addedCount * 18);
                 tr_variantDictAddRaw (&val, TR_KEY_added6, tmp, walk - tmp);
-                tr_free (tmp);
 
                 /* "added6.f"
                  * unset each holepunch flag because we don't support it. */
-                tmp = walk = tr_new (uint8_t, diffs6.addedCount);
+                walk = tmp;
                 for (i = 0; i < diffs6.addedCount; ++i)
                     *walk++ = diffs6.added[i].flags & ~ADDED_F_HOLEPUNCH;
                 assert ((walk - tmp) == diffs6.addedCount);
                 tr_variantDictAddRaw (&val, TR_KEY_added6_f, tmp, walk - tmp);
-                tr_free (tmp);
             }
 
             if (diffs6.droppedCount > 0)
             {
                 /* "dropped6" */
-                tmp = walk = tr_new (uint8_t, diffs6.droppedCount * 18);
+                walk = tmp;
                 for (i = 0; i < diffs6.droppedCount; ++i) {
                     memcpy (walk, &diffs6.dropped[i].addr.addr.addr6.s6_addr, 16);
                     walk += 16;
@@ -2431,7 +2874,6 @@ sendPex (tr_peerMsgs * msgs)
                 }
                 assert ((walk - tmp) == diffs6.droppedCount * 18);
                 tr_variantDictAddRaw (&val, TR_KEY_dropped6, tmp, walk - tmp);
-                tr_free (tmp);
             }
 
             /* write the pex message */
@@ -2446,15 +2888,14 @@ sendPex (tr_peerMsgs * msgs)
 
             evbuffer_free (payload);
             tr_variantFree (&val);
+            tr_free (tmp);
         }
 
         /* cleanup */
         tr_free (diffs.added);
         tr_free (diffs.dropped);
-        tr_free (newPex);
         tr_free (diffs6.added);
         tr_free (diffs6.dropped);
-        tr_free (newPex6);
 
         /*msgs->clientSentPexAt = tr_time ();*/
     }
@@ -2505,6 +2946,9 @@ peermsgs_destruct (tr_peer * peer)
   tr_peerMsgsSetActive (msgs, TR_UP, false);
   tr_peerMsgsSetActive (msgs, TR_DOWN, false);
 
+  if (msgs->torrent != NULL)
+    tr_torrentMetadataRequestFailed (msgs->torrent, msgs, -1);
+
   if (msgs->pexTimer != NULL)
     event_free (msgs->pexTimer);
 
@@ -2518,6 +2962,7 @@ peermsgs_destruct (tr_peer * peer)
     }
 
   evbuffer_free (msgs->outMessages);
+  tr_free (msgs->pendingHaves);
   tr_free (msgs->pex6);
   tr_free (msgs->pex);
 
@@ -2600,6 +3045,30 @@ tr_peerMsgsIsIncomingConnection (const tr_peerMsgs * msgs)
   return tr_peerIoIsIncoming (msgs->io);
 }
 
+int
+tr_peerMsgsGetRttMsec (const tr_peerMsgs * msgs)
+{
+  assert (tr_isPeerMsgs (msgs));
+
+  return msgs->srttMsec;
+}
+
+int
+tr_peerMsgsGetMinRttMsec (const tr_peerMsgs * msgs)
+{
+  assert (tr_isPeerMsgs (msgs));
+
+  return msgs->minRttMsec;
+}
+
+int
+tr_peerMsgsGetPipelineDepth (const tr_peerMsgs * msgs)
+{
+  assert (tr_isPeerMsgs (msgs));
+
+  return msgs->desiredRequestCount;
+}
+
 /***
 ****
 ***/
@@ -2648,6 +3117,8 @@ tr_peerMsgsNew (struct tr_torrent    * torrent,
   m->outMessages = evbuffer_new ();
   m->outMessagesBatchedAt = 0;
   m->outMessagesBatchPeriod = LOW_PRIORITY_INTERVAL_SECS;
+  m->requestWindow = REQUEST_WINDOW_FLOOR;
+  m->requestSlowStart = true;
 
   if (tr_torrentAllowsPex (torrent))
     {
@@ -28,6 +28,31 @@ struct tr_torrent;
 
 typedef struct tr_peerMsgs tr_peerMsgs;
 
+enum
+{
+  /* how often we suggest cached pieces to a peer, and how many at a time */
+  SUGGEST_INTERVAL_SECS = 10,
+  MAX_SUGGESTS_PER_INTERVAL = 4,
+
+  /* how many of our suggestions to remember so that we don't repeat them */
+  SUGGEST_HISTORY_SIZE = 32
+};
+
+struct peer_request
+{
+  uint32_t index;
+  uint32_t offset;
+  uint32_t length;
+};
+
+/* the pieces we've most recently suggested to a peer, as a ring buffer */
+struct tr_suggest_history
+{
+  tr_piece_index_t pieces[SUGGEST_HISTORY_SIZE];
+  int count;
+  time_t lastAt;
+};
+
 #define PEER_MSGS(o) (tr_peerMsgsCast(o))
 
 bool         tr_isPeerMsgs                   (const void               * msgs);
@@ -61,6 +86,15 @@ bool         tr_peerMsgsIsEncrypted          (const tr_peerMsgs        * msgs);
 
 bool         tr_peerMsgsIsIncomingConnection (const tr_peerMsgs        * msgs);
 
+/** @brief smoothed round-trip time of our block requests, or 0 if not measured yet */
+int          tr_peerMsgsGetRttMsec           (const tr_peerMsgs        * msgs);
+
+/** @brief lowest round-trip time seen for our block requests, or 0 if not measured yet */
+int          tr_peerMsgsGetMinRttMsec        (const tr_peerMsgs        * msgs);
+
+/** @brief how many block requests we're trying to keep in flight to this peer */
+int          tr_peerMsgsGetPipelineDepth     (const tr_peerMsgs        * msgs);
+
 void         tr_peerMsgsSetChoke             (tr_peerMsgs              * msgs,
                                               bool                       peerIsChoked);
 
@@ -84,5 +118,31 @@ size_t       tr_generateAllowedSet           (tr_piece_index_t         * setmePi
                                               const uint8_t            * infohash,
                                               const struct tr_address  * addr);
 
+/** @brief pick up to `setSize' pieces from BEP 6's `canonical' set,
+           preferring the ones in `hot' */
+size_t       tr_pickAllowedFastSet           (tr_piece_index_t         * setme,
+                                              size_t                     setSize,
+                                              const tr_piece_index_t   * canonical,
+                                              size_t                     canonicalCount,
+                                              const tr_piece_index_t   * hot,
+                                              size_t                     hotCount);
+
+/** @brief pick up to MAX_SUGGESTS_PER_INTERVAL pieces from `hot' to suggest,
+           skipping ones the peer has or that we've suggested already.
+           Returns 0 if it's been less than SUGGEST_INTERVAL_SECS. */
+int          tr_pickSuggestions              (struct tr_suggest_history * history,
+                                              time_t                     now,
+                                              const tr_piece_index_t   * hot,
+                                              int                        hotCount,
+                                              const struct tr_bitfield * peerHave,
+                                              tr_piece_index_t         * setme);
+
+/** @brief move requests for pieces in the allowed fast set to the front,
+           in order, and return how many there are */
+int          tr_peerRequestsKeepAllowedFast  (struct peer_request      * reqs,
+                                              int                        n,
+                                              const tr_piece_index_t   * fastset,
+                                              size_t                     fastsetSize);
+
 
 /* @} */
@@ -78,5 +78,27 @@ void tr_lockUnlock (tr_lock *);
 /** @brief return nonzero if the specified lock is locked */
 bool tr_lockHave (const tr_lock *);
 
+/***
+****
+***/
+
+/* Atomic operations on pointers and ints shared between threads.
+   Loads acquire, stores release, and exchanges do both. */
+#if defined (__GNUC__)
+ #define tr_atomicExchangePtr(p,v) __atomic_exchange_n ((p), (v), __ATOMIC_ACQ_REL)
+ #define tr_atomicLoadPtr(p) __atomic_load_n ((p), __ATOMIC_ACQUIRE)
+ #define tr_atomicStorePtr(p,v) __atomic_store_n ((p), (v), __ATOMIC_RELEASE)
+ #define tr_atomicExchangeInt(p,v) __atomic_exchange_n ((p), (v), __ATOMIC_ACQ_REL)
+ #define tr_atomicAddInt(p,v) __atomic_add_fetch ((p), (v), __ATOMIC_RELAXED)
+#elif defined (_MSC_VER)
+ #define tr_atomicExchangePtr(p,v) InterlockedExchangePointer ((PVOID volatile *)(p), (v))
+ #define tr_atomicLoadPtr(p) InterlockedCompareExchangePointer ((PVOID volatile *)(p), NULL, NULL)
+ #define tr_atomicStorePtr(p,v) ((void) InterlockedExchangePointer ((PVOID volatile *)(p), (v)))
+ #define tr_atomicExchangeInt(p,v) InterlockedExchange ((LONG volatile *)(p), (v))
+ #define tr_atomicAddInt(p,v) (InterlockedExchangeAdd ((LONG volatile *)(p), (v)) + (v))
+#else
+ #error "libtransmission needs atomic operations for this compiler"
+#endif
+
 /* @} */
 
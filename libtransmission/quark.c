@@ -34,6 +34,8 @@ static const struct tr_key_struct my_static[] =
   { "added6.f", 8 },
   { "addedDate", 9 },
   { "address", 7 },
+  { "address-expires", 15 },
+  { "allowedFastSent", 15 },
   { "alt-speed-down", 14 },
   { "alt-speed-enabled", 17 },
   { "alt-speed-time-begin", 20 },
@@ -44,9 +46,11 @@ static const struct tr_key_struct my_static[] =
   { "announce", 8 },
   { "announce-list", 13 },
   { "announceState", 13 },
+  { "announcesQueued", 15 },
   { "arguments", 9 },
   { "bandwidth-priority", 18 },
   { "bandwidthPriority", 17 },
+  { "batchesSent", 11 },
   { "bind-address-ipv4", 17 },
   { "bind-address-ipv6", 17 },
   { "bitfield",  8 },
@@ -57,7 +61,10 @@ static const struct tr_key_struct my_static[] =
   { "blocklist-url", 13 },
   { "blocks", 6 },
   { "bytesCompleted", 14 },
+  { "bytesFromCache", 14 },
+  { "bytesFromDisk", 13 },
   { "cache-size-mb", 13 },
+  { "cancel", 6 },
   { "clientIsChoked", 14 },
   { "clientIsInterested", 18 },
   { "clientName", 10 },
@@ -66,6 +73,8 @@ static const struct tr_key_struct my_static[] =
   { "compact-view", 12 },
   { "complete", 8 },
   { "config-dir", 10 },
+  { "connection-expires", 18 },
+  { "connection-id", 13 },
   { "cookies", 7 },
   { "corrupt", 7 },
   { "corruptEver", 11 },
@@ -80,6 +89,7 @@ static const struct tr_key_struct my_static[] =
   { "delete-local-data", 17 },
   { "desiredAvailable", 16 },
   { "destination", 11 },
+  { "dh-key-pool-size", 16 },
   { "dht-enabled", 11 },
   { "display-name", 12 },
   { "dnd", 3 },
@@ -130,14 +140,19 @@ static const struct tr_key_struct my_static[] =
   { "fromLtep", 8 },
   { "fromPex", 7 },
   { "fromTracker", 11 },
+  { "group", 5 },
   { "hasAnnounced", 12 },
   { "hasScraped", 10 },
   { "hashString", 10 },
   { "have", 4 },
   { "haveUnchecked", 13 },
   { "haveValid", 9 },
+  { "havesQueued", 11 },
+  { "havesSent", 9 },
+  { "havesSuppressed", 15 },
   { "honorsSessionLimits", 19 },
   { "host", 4 },
+  { "hostLatency", 11 },
   { "id", 2 },
   { "idle-limit", 10 },
   { "idle-mode", 9 },
@@ -160,9 +175,16 @@ static const struct tr_key_struct my_static[] =
   { "isFinished", 10 },
   { "isIncoming", 10 },
   { "isPrivate", 9 },
+  { "isRelocating", 12 },
   { "isStalled", 9 },
   { "isUTP", 5 },
   { "isUploadingTo", 13 },
+  { "keyPoolSize", 11 },
+  { "keygenUsec", 10 },
+  { "keysAvailable", 13 },
+  { "keysFromPool", 12 },
+  { "keysInline", 10 },
+  { "keysPooled", 10 },
   { "lastAnnouncePeerCount", 21 },
   { "lastAnnounceResult", 18 },
   { "lastAnnounceStartTime", 21 },
@@ -191,6 +213,8 @@ static const struct tr_key_struct my_static[] =
   { "manualAnnounceTime", 18 },
   { "max-peers", 9 },
   { "maxConnectedPeers", 17 },
+  { "maxLatencyMsec", 14 },
+  { "maxQueueDepth", 13 },
   { "memory-bytes", 12 },
   { "memory-units", 12 },
   { "message-level", 13 },
@@ -199,6 +223,7 @@ static const struct tr_key_struct my_static[] =
   { "metainfo", 8 },
   { "method", 6 },
   { "min interval", 12 },
+  { "minRttMsec", 10 },
   { "min_request_interval", 20 },
   { "move", 4 },
   { "msg_type", 8 },
@@ -209,8 +234,12 @@ static const struct tr_key_struct my_static[] =
   { "nextScrapeTime", 14 },
   { "nodes", 5 },
   { "nodes6", 6 },
+  { "nodesDubious", 12 },
+  { "nodesGood", 9 },
   { "open-dialog-dir", 15 },
   { "p", 1 },
+  { "packetsReceived", 15 },
+  { "packetsSent", 11 },
   { "path", 4 },
   { "path.utf-8", 10 },
   { "paused", 6 },
@@ -232,16 +261,20 @@ static const struct tr_key_struct my_static[] =
   { "peers2-6", 8 },
   { "peers6", 6 },
   { "peersConnected", 14 },
+  { "peersFound", 10 },
   { "peersFrom", 9 },
   { "peersGettingFromUs", 18 },
   { "peersSendingToUs", 16 },
+  { "pendingRequests", 15 },
   { "percentDone", 11 },
+  { "perf-stats", 10 },
   { "pex-enabled", 11 },
   { "piece", 5 },
   { "piece length", 12 },
   { "pieceCount", 10 },
   { "pieceSize", 9 },
   { "pieces", 6 },
+  { "pipelineDepth", 13 },
   { "play-download-complete-sound", 28 },
   { "port", 4 },
   { "port-forwarding-enabled", 23 },
@@ -262,6 +295,7 @@ static const struct tr_key_struct my_static[] =
   { "queue-move-up", 13 },
   { "queue-stalled-enabled", 21 },
   { "queue-stalled-minutes", 21 },
+  { "queueDepth", 10 },
   { "queuePosition", 13 },
   { "rateDownload", 12 },
   { "rateToClient", 12 },
@@ -270,11 +304,13 @@ static const struct tr_key_struct my_static[] =
   { "ratio-limit", 11 },
   { "ratio-limit-enabled", 19 },
   { "ratio-mode", 10 },
+  { "receiveCalls", 12 },
   { "recent-download-dir-1", 21 },
   { "recent-download-dir-2", 21 },
   { "recent-download-dir-3", 21 },
   { "recent-download-dir-4", 21 },
   { "recheckProgress", 15 },
+  { "relocateProgress", 16 },
   { "remote-session-enabled", 22 },
   { "remote-session-host", 19 },
   { "remote-session-password", 23 },
@@ -296,15 +332,20 @@ static const struct tr_key_struct my_static[] =
   { "rpc-version-minimum", 19 },
   { "rpc-whitelist", 13 },
   { "rpc-whitelist-enabled", 21 },
+  { "rttMsec", 7 },
   { "scrape", 6 },
   { "scrape-paused-torrents-enabled", 30 },
   { "scrapeState", 11 },
   { "script-torrent-done-enabled", 27 },
   { "script-torrent-done-filename", 28 },
+  { "searchesActive", 14 },
+  { "searchesDone", 12 },
+  { "searchesStarted", 15 },
   { "seconds-active", 14 },
   { "secondsActive", 13 },
   { "secondsDownloading", 18 },
   { "secondsSeeding", 14 },
+  { "secretUsec", 10 },
   { "seed-queue-enabled", 18 },
   { "seed-queue-size", 15 },
   { "seedIdleLimit", 13 },
@@ -314,6 +355,7 @@ static const struct tr_key_struct my_static[] =
   { "seedRatioMode", 13 },
   { "seederCount", 11 },
   { "seeding-time-seconds", 20 },
+  { "sendCalls", 9 },
   { "sequential", 10  },
   { "session-count", 13 },
   { "session-id", 10 },
@@ -344,7 +386,10 @@ static const struct tr_key_struct my_static[] =
   { "startDate", 9 },
   { "status", 6 },
   { "statusbar-stats", 15 },
+  { "suggestsSent", 12 },
+  { "superSeeding", 12 },
   { "tag", 3 },
+  { "tasksRun", 8 },
   { "tier", 4 },
   { "time-checked", 12 },
   { "torrent-added", 13 },
@@ -361,6 +406,7 @@ static const struct tr_key_struct my_static[] =
   { "torrentCount", 12 },
   { "torrentFile", 11 },
   { "torrents", 8 },
+  { "totalLatencyMsec", 16 },
   { "totalSize", 9 },
   { "total_size", 10 },
   { "tracker id", 10 },
@@ -395,6 +441,7 @@ static const struct tr_key_struct my_static[] =
   { "utp-enabled", 11 },
   { "v", 1 },
   { "version", 7 },
+  { "wakeups", 7 },
   { "wanted", 6 },
   { "warning message", 15 },
   { "watch-dir", 9 },
@@ -35,6 +35,8 @@ enum
   TR_KEY_added6_f, /* pex */
   TR_KEY_addedDate, /* rpc */
   TR_KEY_address, /* rpc */
+  TR_KEY_address_expires,
+  TR_KEY_allowedFastSent,
   TR_KEY_alt_speed_down, /* rpc, settings */
   TR_KEY_alt_speed_enabled, /* rpc, settings */
   TR_KEY_alt_speed_time_begin, /* rpc, settings */
@@ -45,9 +47,11 @@ enum
   TR_KEY_announce, /* metainfo */
   TR_KEY_announce_list, /* metainfo */
   TR_KEY_announceState, /* rpc */
+  TR_KEY_announcesQueued,
   TR_KEY_arguments, /* rpc */
   TR_KEY_bandwidth_priority,
   TR_KEY_bandwidthPriority,
+  TR_KEY_batchesSent,
   TR_KEY_bind_address_ipv4,
   TR_KEY_bind_address_ipv6,
   TR_KEY_bitfield,
@@ -58,7 +62,10 @@ enum
   TR_KEY_blocklist_url,
   TR_KEY_blocks,
   TR_KEY_bytesCompleted,
+  TR_KEY_bytesFromCache,
+  TR_KEY_bytesFromDisk,
   TR_KEY_cache_size_mb,
+  TR_KEY_cancel,
   TR_KEY_clientIsChoked,
   TR_KEY_clientIsInterested,
   TR_KEY_clientName,
@@ -67,6 +74,8 @@ enum
   TR_KEY_compact_view,
   TR_KEY_complete,
   TR_KEY_config_dir,
+  TR_KEY_connection_expires,
+  TR_KEY_connection_id,
   TR_KEY_cookies,
   TR_KEY_corrupt,
   TR_KEY_corruptEver,
@@ -81,6 +90,7 @@ enum
   TR_KEY_delete_local_data,
   TR_KEY_desiredAvailable,
   TR_KEY_destination,
+  TR_KEY_dh_key_pool_size,
   TR_KEY_dht_enabled,
   TR_KEY_display_name,
   TR_KEY_dnd,
@@ -131,14 +141,19 @@ enum
   TR_KEY_fromLtep,
   TR_KEY_fromPex,
   TR_KEY_fromTracker,
+  TR_KEY_group,
   TR_KEY_hasAnnounced,
   TR_KEY_hasScraped,
   TR_KEY_hashString,
   TR_KEY_have,
   TR_KEY_haveUnchecked,
   TR_KEY_haveValid,
+  TR_KEY_havesQueued,
+  TR_KEY_havesSent,
+  TR_KEY_havesSuppressed,
   TR_KEY_honorsSessionLimits,
   TR_KEY_host,
+  TR_KEY_hostLatency,
   TR_KEY_id,
   TR_KEY_idle_limit,
   TR_KEY_idle_mode,
@@ -161,9 +176,16 @@ enum
   TR_KEY_isFinished,
   TR_KEY_isIncoming,
   TR_KEY_isPrivate,
+  TR_KEY_isRelocating,
   TR_KEY_isStalled,
   TR_KEY_isUTP,
   TR_KEY_isUploadingTo,
+  TR_KEY_keyPoolSize,
+  TR_KEY_keygenUsec,
+  TR_KEY_keysAvailable,
+  TR_KEY_keysFromPool,
+  TR_KEY_keysInline,
+  TR_KEY_keysPooled,
   TR_KEY_lastAnnouncePeerCount,
   TR_KEY_lastAnnounceResult,
   TR_KEY_lastAnnounceStartTime,
@@ -192,6 +214,8 @@ enum
   TR_KEY_manualAnnounceTime,
   TR_KEY_max_peers,
   TR_KEY_maxConnectedPeers,
+  TR_KEY_maxLatencyMsec,
+  TR_KEY_maxQueueDepth,
   TR_KEY_memory_bytes,
   TR_KEY_memory_units,
   TR_KEY_message_level,
@@ -200,6 +224,7 @@ enum
   TR_KEY_metainfo,
   TR_KEY_method,
   TR_KEY_min_interval,
+  TR_KEY_minRttMsec,
   TR_KEY_min_request_interval,
   TR_KEY_move,
   TR_KEY_msg_type,
@@ -210,8 +235,12 @@ enum
   TR_KEY_nextScrapeTime,
   TR_KEY_nodes,
   TR_KEY_nodes6,
+  TR_KEY_nodesDubious,
+  TR_KEY_nodesGood,
   TR_KEY_open_dialog_dir,
   TR_KEY_p,
+  TR_KEY_packetsReceived,
+  TR_KEY_packetsSent,
   TR_KEY_path,
   TR_KEY_path_utf_8,
   TR_KEY_paused,
@@ -233,16 +262,20 @@ enum
   TR_KEY_peers2_6,
   TR_KEY_peers6,
   TR_KEY_peersConnected,
+  TR_KEY_peersFound,
   TR_KEY_peersFrom,
   TR_KEY_peersGettingFromUs,
   TR_KEY_peersSendingToUs,
+  TR_KEY_pendingRequests,
   TR_KEY_percentDone,
+  TR_KEY_perf_stats,
   TR_KEY_pex_enabled,
   TR_KEY_piece,
   TR_KEY_piece_length,
   TR_KEY_pieceCount,
   TR_KEY_pieceSize,
   TR_KEY_pieces,
+  TR_KEY_pipelineDepth,
   TR_KEY_play_download_complete_sound,
   TR_KEY_port,
   TR_KEY_port_forwarding_enabled,
@@ -263,6 +296,7 @@ enum
   TR_KEY_queue_move_up,
   TR_KEY_queue_stalled_enabled,
   TR_KEY_queue_stalled_minutes,
+  TR_KEY_queueDepth,
   TR_KEY_queuePosition,
   TR_KEY_rateDownload,
   TR_KEY_rateToClient,
@@ -271,11 +305,13 @@ enum
   TR_KEY_ratio_limit,
   TR_KEY_ratio_limit_enabled,
   TR_KEY_ratio_mode,
+  TR_KEY_receiveCalls,
   TR_KEY_recent_download_dir_1,
   TR_KEY_recent_download_dir_2,
   TR_KEY_recent_download_dir_3,
   TR_KEY_recent_download_dir_4,
   TR_KEY_recheckProgress,
+  TR_KEY_relocateProgress,
   TR_KEY_remote_session_enabled,
   TR_KEY_remote_session_host,
   TR_KEY_remote_session_password,
@@ -297,15 +333,20 @@ enum
   TR_KEY_rpc_version_minimum,
   TR_KEY_rpc_whitelist,
   TR_KEY_rpc_whitelist_enabled,
+  TR_KEY_rttMsec,
   TR_KEY_scrape,
   TR_KEY_scrape_paused_torrents_enabled,
   TR_KEY_scrapeState,
   TR_KEY_script_torrent_done_enabled,
   TR_KEY_script_torrent_done_filename,
+  TR_KEY_searchesActive,
+  TR_KEY_searchesDone,
+  TR_KEY_searchesStarted,
   TR_KEY_seconds_active,
   TR_KEY_secondsActive,
   TR_KEY_secondsDownloading,
   TR_KEY_secondsSeeding,
+  TR_KEY_secretUsec,
   TR_KEY_seed_queue_enabled,
   TR_KEY_seed_queue_size,
   TR_KEY_seedIdleLimit,
@@ -315,6 +356,7 @@ enum
   TR_KEY_seedRatioMode,
   TR_KEY_seederCount,
   TR_KEY_seeding_time_seconds,
+  TR_KEY_sendCalls,
   TR_KEY_sequentialDownload,
   TR_KEY_session_count,
   TR_KEY_session_id,
@@ -345,7 +387,10 @@ enum
   TR_KEY_startDate,
   TR_KEY_status,
   TR_KEY_statusbar_stats,
+  TR_KEY_suggestsSent,
+  TR_KEY_superSeeding,
   TR_KEY_tag,
+  TR_KEY_tasksRun,
   TR_KEY_tier,
   TR_KEY_time_checked,
   TR_KEY_torrent_added,
@@ -362,6 +407,7 @@ enum
   TR_KEY_torrentCount,
   TR_KEY_torrentFile,
   TR_KEY_torrents,
+  TR_KEY_totalLatencyMsec,
   TR_KEY_totalSize,
   TR_KEY_total_size,
   TR_KEY_tracker_id,
@@ -396,6 +442,7 @@ enum
   TR_KEY_utp_enabled,
   TR_KEY_v,
   TR_KEY_version,
+  TR_KEY_wakeups,
   TR_KEY_wanted,
   TR_KEY_warning_message,
   TR_KEY_watch_dir,
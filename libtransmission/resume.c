@@ -675,6 +675,9 @@ tr_torrentSaveResume (tr_torrent * tor)
   tr_variantDictAddInt (&top, TR_KEY_bandwidth_priority, tr_torrentGetPriority (tor));
   tr_variantDictAddBool (&top, TR_KEY_paused, !tor->isRunning && !tor->isQueued);
   tr_variantDictAddBool (&top, TR_KEY_sequentialDownload, tor->sequentialDownload);
+  tr_variantDictAddBool (&top, TR_KEY_superSeeding, tor->superSeeding);
+  if (tor->bandwidthGroup != NULL)
+    tr_variantDictAddStr (&top, TR_KEY_group, tor->bandwidthGroup->name);
   savePeers (&top, tor);
   if (tr_torrentHasMetadata (tor))
     {
@@ -833,6 +836,21 @@ loadFromFile (tr_torrent * tor, uint64_t fieldsToLoad)
       fieldsLoaded |= TR_FR_SEQUENTIAL;
     }
 
+  if ((fieldsToLoad & TR_FR_SUPER_SEEDING)
+      && tr_variantDictFindBool (&top, TR_KEY_superSeeding, &boolVal))
+    {
+      tor->superSeeding = boolVal;
+      fieldsLoaded |= TR_FR_SUPER_SEEDING;
+    }
+
+  if ((fieldsToLoad & TR_FR_GROUP)
+      && tr_variantDictFindStr (&top, TR_KEY_group, &str, &len)
+      && str && *str)
+    {
+      tr_torrentSetGroup (tor, str);
+      fieldsLoaded |= TR_FR_GROUP;
+    }
+
   if (fieldsToLoad & TR_FR_PEERS)
     fieldsLoaded |= loadPeers (&top, tor);
 
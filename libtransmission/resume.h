@@ -37,6 +37,8 @@ enum
   TR_FR_FILENAMES           = (1 << 20),
   TR_FR_NAME                = (1 << 21),
   TR_FR_SEQUENTIAL          = (1 << 22),
+  TR_FR_GROUP               = (1 << 23),
+  TR_FR_SUPER_SEEDING       = (1 << 24),
 };
 
 /**
@@ -7,7 +7,10 @@
  */
 
 #include "transmission.h"
+#include "crypto.h" /* tr_dhPoolGetSize () */
 #include "rpcimpl.h"
+#include "session.h"
+#include "torrent.h"
 #include "utils.h"
 #include "variant.h"
 
@@ -155,6 +158,138 @@ test_session_get_and_set (void)
   return 0;
 }
 
+static int
+test_bandwidth_groups (void)
+{
+  size_t len;
+  int64_t i;
+  bool b;
+  const char * str;
+  tr_session * session;
+  tr_variant request;
+  tr_variant response;
+  tr_variant * args;
+  tr_variant * list;
+  tr_variant * d;
+  tr_torrent * tor;
+
+  session = libttest_session_init (NULL);
+  tor = libttest_zero_torrent_init (session);
+  check (tor != NULL);
+  check_int_eq (0, tr_sessionCountGroups (session));
+
+  /* create a group */
+  tr_variantInitDict (&request, 2);
+  tr_variantDictAddStr (&request, TR_KEY_method, "group-set");
+  args = tr_variantDictAddDict (&request, TR_KEY_arguments, 3);
+  tr_variantDictAddStr (args, TR_KEY_name, "tracker-a");
+  tr_variantDictAddInt (args, TR_KEY_speed_limit_up, 42);
+  tr_variantDictAddBool (args, TR_KEY_speed_limit_up_enabled, true);
+  tr_rpc_request_exec_json (session, &request, rpc_response_func, &response);
+  tr_variantFree (&request);
+  check (tr_variantDictFindStr (&response, TR_KEY_result, &str, NULL));
+  check_streq ("success", str);
+  tr_variantFree (&response);
+  check_int_eq (1, tr_sessionCountGroups (session));
+  check_streq ("tracker-a", tr_sessionGetGroupName (session, 0));
+
+  /* put the torrent in it */
+  tr_variantInitDict (&request, 2);
+  tr_variantDictAddStr (&request, TR_KEY_method, "torrent-set");
+  args = tr_variantDictAddDict (&request, TR_KEY_arguments, 2);
+  tr_variantDictAddInt (args, TR_KEY_ids, tr_torrentId (tor));
+  tr_variantDictAddStr (args, TR_KEY_group, "tracker-a");
+  tr_rpc_request_exec_json (session, &request, rpc_response_func, &response);
+  tr_variantFree (&request);
+  tr_variantFree (&response);
+  check_streq ("tracker-a", tr_torrentGetGroup (tor));
+  check_ptr_eq (&tor->bandwidthGroup->bandwidth, tor->bandwidth.parent);
+  check_ptr_eq (&session->bandwidth, tor->bandwidthGroup->bandwidth.parent);
+
+  /* read the group back */
+  tr_variantInitDict (&request, 2);
+  tr_variantDictAddStr (&request, TR_KEY_method, "group-get");
+  args = tr_variantDictAddDict (&request, TR_KEY_arguments, 1);
+  tr_variantDictAddStr (args, TR_KEY_group, "tracker-a");
+  tr_rpc_request_exec_json (session, &request, rpc_response_func, &response);
+  tr_variantFree (&request);
+  check (tr_variantDictFindDict (&response, TR_KEY_arguments, &args));
+  check (tr_variantDictFindList (args, TR_KEY_group, &list));
+  check_uint_eq (1, tr_variantListSize (list));
+  d = tr_variantListChild (list, 0);
+  check (tr_variantDictFindStr (d, TR_KEY_name, &str, &len));
+  check_streq ("tracker-a", str);
+  check (tr_variantDictFindInt (d, TR_KEY_speed_limit_up, &i));
+  check_int_eq (42, i);
+  check (tr_variantDictFindBool (d, TR_KEY_speed_limit_up_enabled, &b));
+  check (b);
+  check (tr_variantDictFindBool (d, TR_KEY_speed_limit_down_enabled, &b));
+  check (!b);
+  tr_variantFree (&response);
+
+  /* removing the group puts the torrent back under the session */
+  tr_variantInitDict (&request, 2);
+  tr_variantDictAddStr (&request, TR_KEY_method, "group-remove");
+  args = tr_variantDictAddDict (&request, TR_KEY_arguments, 1);
+  tr_variantDictAddStr (args, TR_KEY_name, "tracker-a");
+  tr_rpc_request_exec_json (session, &request, rpc_response_func, &response);
+  tr_variantFree (&request);
+  tr_variantFree (&response);
+  check_int_eq (0, tr_sessionCountGroups (session));
+  check (tr_torrentGetGroup (tor) == NULL);
+  check_ptr_eq (&session->bandwidth, tor->bandwidth.parent);
+
+  /* cleanup */
+  tr_torrentRemove (tor, false, NULL);
+  libttest_session_close (session);
+  return 0;
+}
+
+static int
+test_session_stats (void)
+{
+  size_t n;
+  int64_t i;
+  tr_quark key;
+  tr_variant * v;
+  tr_variant * args;
+  tr_variant * perf;
+  tr_variant request;
+  tr_variant response;
+  tr_session * session = libttest_session_init (NULL);
+
+  session->perfStats.havesSent = 7;
+  session->perfStats.bytesFromCache = 1234;
+
+  tr_variantInitDict (&request, 1);
+  tr_variantDictAddStr (&request, TR_KEY_method, "session-stats");
+  tr_rpc_request_exec_json (session, &request, rpc_response_func, &response);
+  tr_variantFree (&request);
+
+  check (tr_variantDictFindDict (&response, TR_KEY_arguments, &args));
+  check (tr_variantDictFindDict (args, TR_KEY_perf_stats, &perf));
+
+  /* every counter in struct tr_perf_stats gets written out */
+  n = 0;
+  while (tr_variantDictChild (perf, n, &key, &v))
+    {
+      check (tr_variantIsInt (v));
+      ++n;
+    }
+  check_uint_eq (32, n);
+
+  check (tr_variantDictFindInt (perf, TR_KEY_havesSent, &i));
+  check_int_eq (7, i);
+  check (tr_variantDictFindInt (perf, TR_KEY_bytesFromCache, &i));
+  check_int_eq (1234, i);
+  check (tr_variantDictFindInt (perf, TR_KEY_keyPoolSize, &i));
+  check_int_eq (tr_dhPoolGetSize (session->keyPool), i);
+  tr_variantFree (&response);
+
+  libttest_session_close (session);
+  return 0;
+}
+
 /***
 ****
 ***/
@@ -163,7 +298,9 @@ int
 main (void)
 {
   const testFunc tests[] = { test_list,
-                             test_session_get_and_set };
+                             test_session_get_and_set,
+                             test_bandwidth_groups,
+                             test_session_stats };
 
   return runTests (tests, NUM_TESTS (tests));
 }
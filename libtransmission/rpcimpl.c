@@ -33,7 +33,7 @@
 #include "version.h"
 #include "web.h"
 
-#define RPC_VERSION     16
+#define RPC_VERSION     17
 #define RPC_VERSION_MIN 1
 
 #define RECENTLY_ACTIVE_SECONDS 60
@@ -505,13 +505,14 @@ addTrackerStats (const tr_tracker_stat * st, int n, tr_variant * list)
   for (i=0; i<n; ++i)
     {
       const tr_tracker_stat * s = &st[i];
-      tr_variant * d = tr_variantListAddDict (list, 26);
+      tr_variant * d = tr_variantListAddDict (list, 27);
       tr_variantDictAddStr  (d, TR_KEY_announce, s->announce);
       tr_variantDictAddInt  (d, TR_KEY_announceState, s->announceState);
       tr_variantDictAddInt  (d, TR_KEY_downloadCount, s->downloadCount);
       tr_variantDictAddBool (d, TR_KEY_hasAnnounced, s->hasAnnounced);
       tr_variantDictAddBool (d, TR_KEY_hasScraped, s->hasScraped);
       tr_variantDictAddStr  (d, TR_KEY_host, s->host);
+      tr_variantDictAddInt  (d, TR_KEY_hostLatency, s->hostLatencyMsec);
       tr_variantDictAddInt  (d, TR_KEY_id, s->id);
       tr_variantDictAddBool (d, TR_KEY_isBackup, s->isBackup);
       tr_variantDictAddInt  (d, TR_KEY_lastAnnouncePeerCount, s->lastAnnouncePeerCount);
@@ -546,7 +547,7 @@ addPeers (tr_torrent * tor, tr_variant * list)
 
   for (i=0; i<peerCount; ++i)
     {
-      tr_variant * d = tr_variantListAddDict (list, 16);
+      tr_variant * d = tr_variantListAddDict (list, 20);
       const tr_peer_stat * peer = peers + i;
       tr_variantDictAddStr  (d, TR_KEY_address, peer->addr);
       tr_variantDictAddStr  (d, TR_KEY_clientName, peer->client);
@@ -564,6 +565,10 @@ addPeers (tr_torrent * tor, tr_variant * list)
       tr_variantDictAddReal (d, TR_KEY_progress, peer->progress);
       tr_variantDictAddInt  (d, TR_KEY_rateToClient, toSpeedBytes (peer->rateToClient_KBps));
       tr_variantDictAddInt  (d, TR_KEY_rateToPeer, toSpeedBytes (peer->rateToPeer_KBps));
+      tr_variantDictAddInt  (d, TR_KEY_pendingRequests, peer->pendingReqsToPeer);
+      tr_variantDictAddInt  (d, TR_KEY_pipelineDepth, peer->pipelineDepth);
+      tr_variantDictAddInt  (d, TR_KEY_rttMsec, peer->rttMsec);
+      tr_variantDictAddInt  (d, TR_KEY_minRttMsec, peer->minRttMsec);
     }
 
   tr_torrentPeersFree (peers, peerCount);
@@ -656,6 +661,13 @@ addField (tr_torrent       * const tor,
         tr_variantDictAddStr (d, key, tor->info.hashString);
         break;
 
+      case TR_KEY_group:
+        {
+          const char * group = tr_torrentGetGroup (tor);
+          tr_variantDictAddStr (d, key, group != NULL ? group : "");
+          break;
+        }
+
       case TR_KEY_haveUnchecked:
         tr_variantDictAddInt (d, key, st->haveUnchecked);
         break;
@@ -680,6 +692,10 @@ addField (tr_torrent       * const tor,
         tr_variantDictAddBool (d, key, tr_torrentIsPrivate (tor));
         break;
 
+      case TR_KEY_isRelocating:
+        tr_variantDictAddBool (d, key, st->isRelocating);
+        break;
+
       case TR_KEY_isStalled:
         tr_variantDictAddBool (d, key, st->isStalled);
         break;
@@ -801,6 +817,10 @@ addField (tr_torrent       * const tor,
         tr_variantDictAddReal (d, key, st->recheckProgress);
         break;
 
+      case TR_KEY_relocateProgress:
+        tr_variantDictAddReal (d, key, st->relocateProgress);
+        break;
+
       case TR_KEY_seedIdleLimit:
         tr_variantDictAddInt (d, key, tr_torrentGetIdleLimit (tor));
         break;
@@ -833,6 +853,10 @@ addField (tr_torrent       * const tor,
         tr_variantDictAddInt (d, key, st->activity);
         break;
 
+      case TR_KEY_superSeeding:
+        tr_variantDictAddBool (d, key, tr_torrentGetSuperSeeding (tor));
+        break;
+
       case TR_KEY_secondsDownloading:
         tr_variantDictAddInt (d, key, st->secondsDownloading);
         break;
@@ -1262,6 +1286,7 @@ torrentSet (tr_session               * session,
       tr_variant * files;
       tr_variant * trackers;
       bool boolVal;
+      const char * str;
       tr_torrent * tor;
 
       tor = torrents[i];
@@ -1297,6 +1322,9 @@ torrentSet (tr_session               * session,
       if (tr_variantDictFindBool (args_in, TR_KEY_honorsSessionLimits, &boolVal))
         tr_torrentUseSessionLimits (tor, boolVal);
 
+      if (tr_variantDictFindStr (args_in, TR_KEY_group, &str, NULL))
+        tr_torrentSetGroup (tor, str);
+
       if (tr_variantDictFindInt (args_in, TR_KEY_uploadLimit, &tmp))
         tr_torrentSetSpeedLimit_KBps (tor, TR_UP, tmp);
 
@@ -1321,6 +1349,9 @@ torrentSet (tr_session               * session,
       if (tr_variantDictFindBool (args_in, TR_KEY_sequentialDownload, &boolVal))
         tr_torrentSetSequentialDownload (tor, boolVal);
 
+      if (tr_variantDictFindBool (args_in, TR_KEY_superSeeding, &boolVal))
+        tr_torrentSetSuperSeeding (tor, boolVal);
+
       if (!errmsg && tr_variantDictFindList (args_in, TR_KEY_trackerAdd, &trackers))
         errmsg = addTrackerUrls (tor, trackers);
 
@@ -1343,10 +1374,23 @@ torrentSetLocation (tr_session               * session,
                     tr_variant               * args_out UNUSED,
                     struct tr_rpc_idle_data  * idle_data UNUSED)
 {
+  bool cancel;
   const char * location = NULL;
 
   assert (idle_data == NULL);
 
+  if (tr_variantDictFindBool (args_in, TR_KEY_cancel, &cancel) && cancel)
+    {
+      int i, torrentCount;
+      tr_torrent ** torrents = getTorrents (session, args_in, &torrentCount);
+
+      for (i=0; i<torrentCount; ++i)
+        tr_torrentCancelSetLocation (torrents[i]);
+
+      tr_free (torrents);
+      return NULL;
+    }
+
   if (!tr_variantDictFindStr (args_in, TR_KEY_location, &location, NULL))
     return "no location";
 
@@ -1998,6 +2042,52 @@ sessionSet (tr_session               * session,
   return NULL;
 }
 
+static void
+addPerfStats (tr_session * session, tr_variant * d)
+{
+  struct tr_perf_stats st;
+
+  tr_sessionGetPerfStats (session, &st);
+
+  tr_variantDictAddInt (d, TR_KEY_packetsReceived, st.packetsReceived);
+  tr_variantDictAddInt (d, TR_KEY_receiveCalls, st.receiveCalls);
+  tr_variantDictAddInt (d, TR_KEY_packetsSent, st.packetsSent);
+  tr_variantDictAddInt (d, TR_KEY_sendCalls, st.sendCalls);
+
+  tr_variantDictAddInt (d, TR_KEY_searchesStarted, st.searchesStarted);
+  tr_variantDictAddInt (d, TR_KEY_searchesDone, st.searchesDone);
+  tr_variantDictAddInt (d, TR_KEY_searchesActive, st.searchesActive);
+  tr_variantDictAddInt (d, TR_KEY_announcesQueued, st.announcesQueued);
+  tr_variantDictAddInt (d, TR_KEY_peersFound, st.peersFound);
+  tr_variantDictAddInt (d, TR_KEY_nodesGood, st.nodesGood);
+  tr_variantDictAddInt (d, TR_KEY_nodesDubious, st.nodesDubious);
+
+  tr_variantDictAddInt (d, TR_KEY_tasksRun, st.tasksRun);
+  tr_variantDictAddInt (d, TR_KEY_wakeups, st.wakeups);
+  tr_variantDictAddInt (d, TR_KEY_queueDepth, st.queueDepth);
+  tr_variantDictAddInt (d, TR_KEY_maxQueueDepth, st.maxQueueDepth);
+  tr_variantDictAddInt (d, TR_KEY_totalLatencyMsec, st.totalLatencyMsec);
+  tr_variantDictAddInt (d, TR_KEY_maxLatencyMsec, st.maxLatencyMsec);
+
+  tr_variantDictAddInt (d, TR_KEY_havesQueued, st.havesQueued);
+  tr_variantDictAddInt (d, TR_KEY_havesSent, st.havesSent);
+  tr_variantDictAddInt (d, TR_KEY_havesSuppressed, st.havesSuppressed);
+  tr_variantDictAddInt (d, TR_KEY_batchesSent, st.batchesSent);
+
+  tr_variantDictAddInt (d, TR_KEY_bytesFromCache, st.bytesFromCache);
+  tr_variantDictAddInt (d, TR_KEY_bytesFromDisk, st.bytesFromDisk);
+  tr_variantDictAddInt (d, TR_KEY_suggestsSent, st.suggestsSent);
+  tr_variantDictAddInt (d, TR_KEY_allowedFastSent, st.allowedFastSent);
+
+  tr_variantDictAddInt (d, TR_KEY_keyPoolSize, st.keyPoolSize);
+  tr_variantDictAddInt (d, TR_KEY_keysAvailable, st.keysAvailable);
+  tr_variantDictAddInt (d, TR_KEY_keysPooled, st.keysPooled);
+  tr_variantDictAddInt (d, TR_KEY_keysFromPool, st.keysFromPool);
+  tr_variantDictAddInt (d, TR_KEY_keysInline, st.keysInline);
+  tr_variantDictAddInt (d, TR_KEY_keygenUsec, st.keygenUsec);
+  tr_variantDictAddInt (d, TR_KEY_secretUsec, st.secretUsec);
+}
+
 static const char*
 sessionStats (tr_session               * session,
               tr_variant               * args_in UNUSED,
@@ -2037,6 +2127,8 @@ sessionStats (tr_session               * session,
   tr_variantDictAddInt (d, TR_KEY_sessionCount, cumulativeStats.sessionCount);
   tr_variantDictAddInt (d, TR_KEY_uploadedBytes, cumulativeStats.uploadedBytes);
 
+  addPerfStats (session, tr_variantDictAddDict (args_out, TR_KEY_perf_stats, 32));
+
   d = tr_variantDictAddDict (args_out, TR_KEY_current_stats, 5);
   tr_variantDictAddInt (d, TR_KEY_downloadedBytes, currentStats.downloadedBytes);
   tr_variantDictAddInt (d, TR_KEY_filesAdded, currentStats.filesAdded);
@@ -2349,6 +2441,129 @@ freeSpace (tr_session               * session,
 ****
 ***/
 
+static void
+addGroupInfo (tr_session * session, const char * name, tr_variant * list)
+{
+  tr_variant * d = tr_variantListAddDict (list, 9);
+
+  tr_variantDictAddStr  (d, TR_KEY_name, name);
+  tr_variantDictAddInt  (d, TR_KEY_bandwidthPriority, tr_sessionGetGroupPriority (session, name));
+  tr_variantDictAddBool (d, TR_KEY_honorsSessionLimits, tr_sessionGroupUsesSessionLimits (session, name));
+  tr_variantDictAddInt  (d, TR_KEY_rateDownload, toSpeedBytes (tr_sessionGetGroupRawSpeed_KBps (session, name, TR_DOWN)));
+  tr_variantDictAddInt  (d, TR_KEY_rateUpload, toSpeedBytes (tr_sessionGetGroupRawSpeed_KBps (session, name, TR_UP)));
+  tr_variantDictAddInt  (d, TR_KEY_speed_limit_down, tr_sessionGetGroupSpeedLimit_KBps (session, name, TR_DOWN));
+  tr_variantDictAddBool (d, TR_KEY_speed_limit_down_enabled, tr_sessionIsGroupSpeedLimited (session, name, TR_DOWN));
+  tr_variantDictAddInt  (d, TR_KEY_speed_limit_up, tr_sessionGetGroupSpeedLimit_KBps (session, name, TR_UP));
+  tr_variantDictAddBool (d, TR_KEY_speed_limit_up_enabled, tr_sessionIsGroupSpeedLimited (session, name, TR_UP));
+}
+
+static const char*
+groupGet (tr_session               * session,
+          tr_variant               * args_in,
+          tr_variant               * args_out,
+          struct tr_rpc_idle_data  * idle_data UNUSED)
+{
+  int i;
+  size_t len;
+  const char * str;
+  tr_variant * names;
+  tr_variant * list;
+
+  assert (idle_data == NULL);
+
+  list = tr_variantDictAddList (args_out, TR_KEY_group, tr_sessionCountGroups (session));
+
+  if (tr_variantDictFindStr (args_in, TR_KEY_group, &str, NULL))
+    {
+      if (tr_sessionFindBandwidthGroup (session, str) != NULL)
+        addGroupInfo (session, str, list);
+    }
+  else if (tr_variantDictFindList (args_in, TR_KEY_group, &names))
+    {
+      const size_t n = tr_variantListSize (names);
+
+      for (i=0; i<(int)n; ++i)
+        if (tr_variantGetStr (tr_variantListChild (names, i), &str, &len)
+              && tr_sessionFindBandwidthGroup (session, str) != NULL)
+          addGroupInfo (session, str, list);
+    }
+  else
+    {
+      const int n = tr_sessionCountGroups (session);
+
+      for (i=0; i<n; ++i)
+        addGroupInfo (session, tr_sessionGetGroupName (session, i), list);
+    }
+
+  return NULL;
+}
+
+static const char*
+groupSet (tr_session               * session,
+          tr_variant               * args_in,
+          tr_variant               * args_out UNUSED,
+          struct tr_rpc_idle_data  * idle_data UNUSED)
+{
+  int64_t i;
+  bool boolVal;
+  const char * name = NULL;
+
+  assert (idle_data == NULL);
+
+  if (!tr_variantDictFindStr (args_in, TR_KEY_name, &name, NULL) || *name == '\0')
+    return "no group name";
+
+  /* setters create the group if it doesn't exist yet */
+  tr_sessionGetBandwidthGroup (session, name);
+
+  if (tr_variantDictFindInt (args_in, TR_KEY_speed_limit_down, &i))
+    tr_sessionSetGroupSpeedLimit_KBps (session, name, TR_DOWN, i);
+
+  if (tr_variantDictFindBool (args_in, TR_KEY_speed_limit_down_enabled, &boolVal))
+    tr_sessionLimitGroupSpeed (session, name, TR_DOWN, boolVal);
+
+  if (tr_variantDictFindInt (args_in, TR_KEY_speed_limit_up, &i))
+    tr_sessionSetGroupSpeedLimit_KBps (session, name, TR_UP, i);
+
+  if (tr_variantDictFindBool (args_in, TR_KEY_speed_limit_up_enabled, &boolVal))
+    tr_sessionLimitGroupSpeed (session, name, TR_UP, boolVal);
+
+  if (tr_variantDictFindBool (args_in, TR_KEY_honorsSessionLimits, &boolVal))
+    tr_sessionGroupUseSessionLimits (session, name, boolVal);
+
+  if (tr_variantDictFindInt (args_in, TR_KEY_bandwidthPriority, &i) && tr_isPriority (i))
+    tr_sessionSetGroupPriority (session, name, i);
+
+  notify (session, TR_RPC_SESSION_CHANGED, NULL);
+  return NULL;
+}
+
+static const char*
+groupRemove (tr_session               * session,
+             tr_variant               * args_in,
+             tr_variant               * args_out UNUSED,
+             struct tr_rpc_idle_data  * idle_data UNUSED)
+{
+  const char * name = NULL;
+
+  assert (idle_data == NULL);
+
+  if (!tr_variantDictFindStr (args_in, TR_KEY_name, &name, NULL))
+    return "no group name";
+
+  if (tr_sessionFindBandwidthGroup (session, name) == NULL)
+    return "no such group";
+
+  tr_sessionRemoveGroup (session, name);
+
+  notify (session, TR_RPC_SESSION_CHANGED, NULL);
+  return NULL;
+}
+
+/***
+****
+***/
+
 static const char*
 sessionClose (tr_session               * session,
               tr_variant               * args_in UNUSED,
@@ -2376,6 +2591,9 @@ methods[] =
   { "port-test",             false, portTest            },
   { "blocklist-update",      false, blocklistUpdate     },
   { "free-space",            true,  freeSpace           },
+  { "group-get",             true,  groupGet            },
+  { "group-remove",          true,  groupRemove         },
+  { "group-set",             true,  groupSet            },
   { "session-close",         true,  sessionClose        },
   { "session-get",           true,  sessionGet          },
   { "session-set",           true,  sessionSet          },
@@ -10,9 +10,13 @@
 #include <stdlib.h>
 #include <string.h>
 #include "transmission.h"
+#include "crypto.h"
+#include "platform.h" /* tr_threadNew () */
 #include "session.h"
 #include "session-id.h"
+#include "torrent.h"
 #include "utils.h"
+#include "variant.h"
 #include "version.h"
 
 #undef VERBOSE
@@ -131,11 +135,157 @@ test_session_id (void)
   return 0;
 }
 
+struct snapshot_reader_data
+{
+  tr_session * session;
+  int id;
+  volatile bool stop;
+  volatile bool done;
+  int reads;
+  int inconsistent;
+};
+
+static void
+snapshot_reader_threadfunc (void * vdata)
+{
+  struct snapshot_reader_data * data = vdata;
+
+  while (!data->stop)
+    {
+      tr_stat st;
+
+      if (tr_torrentStatSnapshot (data->session, data->id, &st))
+        {
+          ++data->reads;
+
+          if (st.id != data->id || st.haveValid + st.haveUnchecked + st.leftUntilDone != st.sizeWhenDone)
+            ++data->inconsistent;
+        }
+    }
+
+  data->done = true;
+}
+
+static int
+test_stat_snapshot (void)
+{
+  int id;
+  int ids[3];
+  tr_stat st[3];
+  tr_torrent * tor;
+  tr_session * session;
+  struct snapshot_reader_data data;
+  const time_t deadline = time (NULL) + 10;
+
+  session = libttest_session_init (NULL);
+  tor = libttest_zero_torrent_init (session);
+  libttest_zero_torrent_populate (tor, false);
+  id = tr_torrentId (tor);
+
+  /* snapshots get published by the session's once-a-second timer,
+     and catch up with the verify that populating the torrent did */
+  while ((!tr_torrentStatSnapshot (session, id, &st[0]) || st[0].leftUntilDone != tor->info.pieceSize)
+         && time (NULL) <= deadline)
+    tr_wait_msec (50);
+  check_int_eq (id, st[0].id);
+  check_uint_eq (tor->info.pieceSize, st[0].leftUntilDone);
+
+  /* unknown ids are skipped, and repeated ones are copied each time */
+  ids[0] = id + 1;
+  ids[1] = id;
+  ids[2] = id;
+  check_int_eq (2, tr_torrentStatSnapshots (session, ids, 3, st));
+  check_int_eq (-1, st[0].id);
+  check_int_eq (id, st[1].id);
+  check_int_eq (id, st[2].id);
+
+  /* read from another thread while the torrent goes away */
+  data.session = session;
+  data.id = id;
+  data.stop = false;
+  data.done = false;
+  data.reads = 0;
+  data.inconsistent = 0;
+  tr_threadNew (snapshot_reader_threadfunc, &data);
+  tr_wait_msec (1500);
+  tr_torrentRemove (tor, false, NULL);
+  while (tr_sessionCountTorrents (session) > 0)
+    tr_wait_msec (10);
+  check (!tr_torrentStatSnapshot (session, id, &st[0]));
+  data.stop = true;
+  while (!data.done)
+    tr_wait_msec (10);
+  check (data.reads > 0);
+  check_int_eq (0, data.inconsistent);
+
+  libttest_session_close (session);
+  return 0;
+}
+
+static int
+test_key_pool (void)
+{
+  int i;
+  tr_crypto a;
+  tr_crypto b;
+  tr_variant settings;
+  tr_session * session;
+  tr_dh_pool_stats stats;
+  uint8_t hash[SHA_DIGEST_LENGTH];
+  uint8_t secret_a[SHA_DIGEST_LENGTH];
+  uint8_t secret_b[SHA_DIGEST_LENGTH];
+
+  for (i = 0; i < SHA_DIGEST_LENGTH; ++i)
+    hash[i] = (uint8_t)i;
+
+  tr_variantInitDict (&settings, 1);
+  tr_variantDictAddInt (&settings, TR_KEY_dh_key_pool_size, 4);
+  session = libttest_session_init (&settings);
+  tr_variantFree (&settings);
+
+  /* wait for the worker to fill the pool */
+  for (i = 0; i < 500; ++i)
+    {
+      tr_dhPoolGetStats (session->keyPool, &stats);
+      if (stats.available == 4)
+        break;
+      tr_wait_msec (10);
+    }
+  check_int_eq (4, stats.available);
+
+  /* a key from the pool works with one generated inline */
+  tr_cryptoConstruct (&a, hash, false);
+  tr_cryptoSetKeyPool (&a, session->keyPool);
+  tr_cryptoConstruct (&b, hash, true);
+  check (tr_cryptoComputeSecret (&a, tr_cryptoGetMyPublicKey (&b, &i)));
+  check (tr_cryptoComputeSecret (&b, tr_cryptoGetMyPublicKey (&a, &i)));
+  check (tr_cryptoSecretKeySha1 (&a, "x", 1, NULL, 0, secret_a));
+  check (tr_cryptoSecretKeySha1 (&b, "x", 1, NULL, 0, secret_b));
+  check (memcmp (secret_a, secret_b, SHA_DIGEST_LENGTH) == 0);
+
+  tr_dhPoolGetStats (session->keyPool, &stats);
+  check_int_eq (1, stats.keysFromPool);
+  check_int_eq (0, stats.keysGeneratedInline);
+
+  /* shrinking the pool drops its spare keys */
+  tr_dhPoolSetSize (session->keyPool, 0);
+  tr_dhPoolGetStats (session->keyPool, &stats);
+  check_int_eq (0, stats.available);
+
+  tr_cryptoDestruct (&b);
+  tr_cryptoDestruct (&a);
+
+  libttest_session_close (session);
+  return 0;
+}
+
 int
 main (void)
 {
   const testFunc tests[] = { testPeerId,
-                             test_session_id };
+                             test_session_id,
+                             test_stat_snapshot,
+                             test_key_pool };
 
   return runTests (tests, NUM_TESTS (tests));
 }
@@ -30,6 +30,7 @@
 #include "bandwidth.h"
 #include "blocklist.h"
 #include "cache.h"
+#include "crypto.h" /* tr_dhPoolNew () */
 #include "crypto-utils.h"
 #include "error.h"
 #include "error-types.h"
@@ -48,6 +49,7 @@
 #include "session-id.h"
 #include "stats.h"
 #include "torrent.h"
+#include "torrent-magnet.h" /* tr_torrentFreeInfoDictCache () */
 #include "tr-dht.h" /* tr_dhtUpkeep () */
 #include "tr-udp.h"
 #include "tr-utp.h"
@@ -64,9 +66,11 @@ enum
 #ifdef TR_LIGHTWEIGHT
   DEFAULT_CACHE_SIZE_MB = 2,
   DEFAULT_PREFETCH_ENABLED = false,
+  DEFAULT_DH_KEY_POOL_SIZE = 4,
 #else
   DEFAULT_CACHE_SIZE_MB = 4,
   DEFAULT_PREFETCH_ENABLED = true,
+  DEFAULT_DH_KEY_POOL_SIZE = 32,
 #endif
   SAVE_INTERVAL_SECS = 360
 };
@@ -317,11 +321,12 @@ tr_sessionGetDefaultSettings (tr_variant * d)
 {
   assert (tr_variantIsDict (d));
 
-  tr_variantDictReserve (d, 63);
+  tr_variantDictReserve (d, 64);
   tr_variantDictAddBool (d, TR_KEY_blocklist_enabled,               false);
   tr_variantDictAddStr  (d, TR_KEY_blocklist_url,                   "http://www.example.com/blocklist");
   tr_variantDictAddInt  (d, TR_KEY_cache_size_mb,                   DEFAULT_CACHE_SIZE_MB);
   tr_variantDictAddBool (d, TR_KEY_dht_enabled,                     true);
+  tr_variantDictAddInt  (d, TR_KEY_dh_key_pool_size,                DEFAULT_DH_KEY_POOL_SIZE);
   tr_variantDictAddBool (d, TR_KEY_utp_enabled,                     true);
   tr_variantDictAddBool (d, TR_KEY_lpd_enabled,                     false);
   tr_variantDictAddStr  (d, TR_KEY_download_dir,                    tr_getDefaultDownloadDir ());
@@ -388,11 +393,12 @@ tr_sessionGetSettings (tr_session * s, tr_variant * d)
 {
   assert (tr_variantIsDict (d));
 
-  tr_variantDictReserve (d, 63);
+  tr_variantDictReserve (d, 64);
   tr_variantDictAddBool (d, TR_KEY_blocklist_enabled,            tr_blocklistIsEnabled (s));
   tr_variantDictAddStr  (d, TR_KEY_blocklist_url,                tr_blocklistGetURL (s));
   tr_variantDictAddInt  (d, TR_KEY_cache_size_mb,                tr_sessionGetCacheLimit_MB (s));
   tr_variantDictAddBool (d, TR_KEY_dht_enabled,                  s->isDHTEnabled);
+  tr_variantDictAddInt  (d, TR_KEY_dh_key_pool_size,             tr_dhPoolGetSize (s->keyPool));
   tr_variantDictAddBool (d, TR_KEY_utp_enabled,                  s->isUTPEnabled);
   tr_variantDictAddBool (d, TR_KEY_lpd_enabled,                  s->isLPDEnabled);
   tr_variantDictAddStr  (d, TR_KEY_download_dir,                 tr_sessionGetDownloadDir (s));
@@ -497,6 +503,8 @@ tr_sessionLoadSettings (tr_variant * dict, const char * configDir, const char *
   return success;
 }
 
+static void saveBandwidthGroups (tr_session * session, const char * configDir);
+
 void
 tr_sessionSaveSettings (tr_session       * session,
                         const char       * configDir,
@@ -533,6 +541,7 @@ tr_sessionSaveSettings (tr_session       * session,
 
   /* save the result */
   tr_variantToFile (&settings, TR_VARIANT_FMT_JSON, filename);
+  saveBandwidthGroups (session, configDir);
 
   /* cleanup */
   tr_free (filename);
@@ -558,7 +567,10 @@ onSaveTimer (evutil_socket_t foo UNUSED, short bar UNUSED, void * vsession)
     tr_logAddError ("Error while flushing completed pieces from cache");
 
   while ((tor = tr_torrentNext (session, tor)))
-    tr_torrentSave (tor);
+    {
+      tr_torrentSave (tor);
+      tr_torrentFreeInfoDictCache (tor, SAVE_INTERVAL_SECS);
+    }
 
   tr_statsSaveDirty (session);
 
@@ -570,6 +582,7 @@ onSaveTimer (evutil_socket_t foo UNUSED, short bar UNUSED, void * vsession)
 ***/
 
 static void tr_sessionInitImpl (void *);
+static void loadBandwidthGroups (tr_session * session);
 
 struct init_data
 {
@@ -598,10 +611,14 @@ tr_sessionInit (const char * configDir,
   session->udp_socket = TR_BAD_SOCKET;
   session->udp6_socket = TR_BAD_SOCKET;
   session->lock = tr_lockNew ();
+  session->statTableLock = tr_lockNew ();
   session->cache = tr_cacheNew (1024*1024*2);
+  session->keyPool = tr_dhPoolNew (0);
   session->magicNumber = SESSION_MAGIC_NUMBER;
   session->session_id = tr_session_id_new ();
   tr_bandwidthConstruct (&session->bandwidth, session, NULL);
+  session->bandwidthGroups = TR_PTR_ARRAY_INIT;
+  session->torrentsByHash = TR_PTR_ARRAY_INIT;
   tr_variantInitList (&session->removedTorrents, 0);
 
   /* nice to start logging at the very beginning */
@@ -664,6 +681,8 @@ onNowTimer (evutil_socket_t foo UNUSED, short bar UNUSED, void * vsession)
         }
     }
 
+  tr_torrentsPublishStats (session);
+
   /**
   ***  Set the timer
   **/
@@ -712,6 +731,8 @@ tr_sessionInitImpl (void * vdata)
 
   tr_setConfigDir (session, data->configDir);
 
+  loadBandwidthGroups (session);
+
   session->peerMgr = tr_peerMgrNew (session);
 
   session->shared = tr_sharedInit (session);
@@ -792,6 +813,8 @@ sessionSetImpl (void * vdata)
     tr_sessionSetPexEnabled (session, boolVal);
   if (tr_variantDictFindBool (settings, TR_KEY_dht_enabled, &boolVal))
     tr_sessionSetDHTEnabled (session, boolVal);
+  if (tr_variantDictFindInt (settings, TR_KEY_dh_key_pool_size, &i))
+    tr_dhPoolSetSize (session->keyPool, i);
   if (tr_variantDictFindBool (settings, TR_KEY_utp_enabled, &boolVal))
     tr_sessionSetUTPEnabled (session, boolVal);
   if (tr_variantDictFindBool (settings, TR_KEY_lpd_enabled, &boolVal))
@@ -1475,6 +1498,265 @@ tr_sessionIsSpeedLimited (const tr_session * s, tr_direction d)
   return s->speedLimitEnabled[d];
 }
 
+/***
+****  Bandwidth groups
+***/
+
+static int
+compareBandwidthGroups (const void * va, const void * vb)
+{
+  const struct tr_bandwidth_group * a = va;
+  const struct tr_bandwidth_group * b = vb;
+
+  return strcmp (a->name, b->name);
+}
+
+static void
+bandwidthGroupFree (void * vgroup)
+{
+  struct tr_bandwidth_group * group = vgroup;
+
+  tr_bandwidthDestruct (&group->bandwidth);
+  tr_free (group->name);
+  tr_free (group);
+}
+
+struct tr_bandwidth_group *
+tr_sessionFindBandwidthGroup (const tr_session * session, const char * name)
+{
+  struct tr_bandwidth_group key;
+
+  assert (tr_isSession (session));
+
+  if (name == NULL || *name == '\0')
+    return NULL;
+
+  key.name = (char*) name;
+  return tr_ptrArrayFindSorted ((tr_ptrArray*) &session->bandwidthGroups, &key, compareBandwidthGroups);
+}
+
+struct tr_bandwidth_group *
+tr_sessionGetBandwidthGroup (tr_session * session, const char * name)
+{
+  struct tr_bandwidth_group * group;
+
+  assert (tr_isSession (session));
+  assert (name != NULL && *name != '\0');
+
+  group = tr_sessionFindBandwidthGroup (session, name);
+
+  if (group == NULL)
+    {
+      group = tr_new0 (struct tr_bandwidth_group, 1);
+      group->name = tr_strdup (name);
+      tr_bandwidthConstruct (&group->bandwidth, session, &session->bandwidth);
+      tr_ptrArrayInsertSorted (&session->bandwidthGroups, group, compareBandwidthGroups);
+      dbgmsg ("created bandwidth group \"%s\"", name);
+    }
+
+  return group;
+}
+
+void
+tr_sessionSetGroupSpeedLimit_KBps (tr_session * s, const char * group, tr_direction d, unsigned int KBps)
+{
+  assert (tr_isDirection (d));
+
+  tr_bandwidthSetDesiredSpeed_Bps (&tr_sessionGetBandwidthGroup (s, group)->bandwidth, d, toSpeedBytes (KBps));
+}
+
+unsigned int
+tr_sessionGetGroupSpeedLimit_KBps (const tr_session * s, const char * group, tr_direction d)
+{
+  const struct tr_bandwidth_group * g = tr_sessionFindBandwidthGroup (s, group);
+
+  assert (tr_isDirection (d));
+
+  return g != NULL ? toSpeedKBps (tr_bandwidthGetDesiredSpeed_Bps (&g->bandwidth, d)) : 0;
+}
+
+void
+tr_sessionLimitGroupSpeed (tr_session * s, const char * group, tr_direction d, bool b)
+{
+  assert (tr_isDirection (d));
+
+  tr_bandwidthSetLimited (&tr_sessionGetBandwidthGroup (s, group)->bandwidth, d, b);
+}
+
+bool
+tr_sessionIsGroupSpeedLimited (const tr_session * s, const char * group, tr_direction d)
+{
+  const struct tr_bandwidth_group * g = tr_sessionFindBandwidthGroup (s, group);
+
+  assert (tr_isDirection (d));
+
+  return g != NULL && tr_bandwidthIsLimited (&g->bandwidth, d);
+}
+
+void
+tr_sessionGroupUseSessionLimits (tr_session * s, const char * group, bool b)
+{
+  struct tr_bandwidth_group * g = tr_sessionGetBandwidthGroup (s, group);
+
+  tr_bandwidthHonorParentLimits (&g->bandwidth, TR_UP, b);
+  tr_bandwidthHonorParentLimits (&g->bandwidth, TR_DOWN, b);
+}
+
+bool
+tr_sessionGroupUsesSessionLimits (const tr_session * s, const char * group)
+{
+  const struct tr_bandwidth_group * g = tr_sessionFindBandwidthGroup (s, group);
+
+  return g == NULL || tr_bandwidthAreParentLimitsHonored (&g->bandwidth, TR_UP);
+}
+
+void
+tr_sessionSetGroupPriority (tr_session * s, const char * group, tr_priority_t priority)
+{
+  assert (tr_isPriority (priority));
+
+  tr_sessionGetBandwidthGroup (s, group)->bandwidth.priority = priority;
+}
+
+tr_priority_t
+tr_sessionGetGroupPriority (const tr_session * s, const char * group)
+{
+  const struct tr_bandwidth_group * g = tr_sessionFindBandwidthGroup (s, group);
+
+  return g != NULL ? g->bandwidth.priority : TR_PRI_NORMAL;
+}
+
+double
+tr_sessionGetGroupRawSpeed_KBps (const tr_session * s, const char * group, tr_direction d)
+{
+  const struct tr_bandwidth_group * g = tr_sessionFindBandwidthGroup (s, group);
+
+  assert (tr_isDirection (d));
+
+  return g != NULL ? toSpeedKBps (tr_bandwidthGetRawSpeed_Bps (&g->bandwidth, 0, d)) : 0;
+}
+
+int
+tr_sessionCountGroups (const tr_session * s)
+{
+  assert (tr_isSession (s));
+
+  return tr_ptrArraySize (&s->bandwidthGroups);
+}
+
+const char *
+tr_sessionGetGroupName (const tr_session * s, int n)
+{
+  assert (tr_isSession (s));
+
+  if (n < 0 || n >= tr_ptrArraySize (&s->bandwidthGroups))
+    return NULL;
+
+  return ((struct tr_bandwidth_group*) tr_ptrArrayNth ((tr_ptrArray*) &s->bandwidthGroups, n))->name;
+}
+
+void
+tr_sessionRemoveGroup (tr_session * s, const char * group)
+{
+  tr_torrent * tor = NULL;
+  struct tr_bandwidth_group * g = tr_sessionFindBandwidthGroup (s, group);
+
+  if (g == NULL)
+    return;
+
+  while ((tor = tr_torrentNext (s, tor)))
+    if (tor->bandwidthGroup == g)
+      tr_torrentSetGroup (tor, NULL);
+
+  tr_ptrArrayRemoveSortedPointer (&s->bandwidthGroups, g, compareBandwidthGroups);
+  bandwidthGroupFree (g);
+}
+
+static char *
+getBandwidthGroupsFilename (const char * configDir)
+{
+  return tr_buildPath (configDir, "bandwidth-groups.json", NULL);
+}
+
+static void
+loadBandwidthGroups (tr_session * session)
+{
+  size_t i;
+  tr_variant top;
+  char * filename = getBandwidthGroupsFilename (session->configDir);
+
+  if (tr_variantFromFile (&top, TR_VARIANT_FMT_JSON, filename, NULL))
+    {
+      tr_quark key;
+      tr_variant * d;
+
+      for (i=0; tr_variantDictChild (&top, i, &key, &d); ++i)
+        {
+          int64_t intVal;
+          bool boolVal;
+          const char * name = tr_quark_get_string (key, NULL);
+
+          if (!tr_variantIsDict (d) || *name == '\0')
+            continue;
+
+          tr_sessionGetBandwidthGroup (session, name);
+
+          if (tr_variantDictFindInt (d, TR_KEY_speed_limit_up, &intVal))
+            tr_sessionSetGroupSpeedLimit_KBps (session, name, TR_UP, intVal);
+          if (tr_variantDictFindBool (d, TR_KEY_speed_limit_up_enabled, &boolVal))
+            tr_sessionLimitGroupSpeed (session, name, TR_UP, boolVal);
+          if (tr_variantDictFindInt (d, TR_KEY_speed_limit_down, &intVal))
+            tr_sessionSetGroupSpeedLimit_KBps (session, name, TR_DOWN, intVal);
+          if (tr_variantDictFindBool (d, TR_KEY_speed_limit_down_enabled, &boolVal))
+            tr_sessionLimitGroupSpeed (session, name, TR_DOWN, boolVal);
+          if (tr_variantDictFindBool (d, TR_KEY_use_global_speed_limit, &boolVal))
+            tr_sessionGroupUseSessionLimits (session, name, boolVal);
+          if (tr_variantDictFindInt (d, TR_KEY_bandwidth_priority, &intVal) && tr_isPriority (intVal))
+            tr_sessionSetGroupPriority (session, name, intVal);
+        }
+
+      tr_variantFree (&top);
+    }
+
+  tr_free (filename);
+}
+
+static void
+saveBandwidthGroups (tr_session * session, const char * configDir)
+{
+  int i;
+  const int n = tr_sessionCountGroups (session);
+  char * filename = getBandwidthGroupsFilename (configDir);
+
+  if (n == 0)
+    {
+      tr_sys_path_remove (filename, NULL);
+    }
+  else
+    {
+      tr_variant top;
+
+      tr_variantInitDict (&top, n);
+
+      for (i=0; i<n; ++i)
+        {
+          const char * name = tr_sessionGetGroupName (session, i);
+          tr_variant * d = tr_variantDictAddDict (&top, tr_quark_new (name, TR_BAD_SIZE), 6);
+          tr_variantDictAddInt  (d, TR_KEY_speed_limit_up,           tr_sessionGetGroupSpeedLimit_KBps (session, name, TR_UP));
+          tr_variantDictAddBool (d, TR_KEY_speed_limit_up_enabled,   tr_sessionIsGroupSpeedLimited (session, name, TR_UP));
+          tr_variantDictAddInt  (d, TR_KEY_speed_limit_down,         tr_sessionGetGroupSpeedLimit_KBps (session, name, TR_DOWN));
+          tr_variantDictAddBool (d, TR_KEY_speed_limit_down_enabled, tr_sessionIsGroupSpeedLimited (session, name, TR_DOWN));
+          tr_variantDictAddBool (d, TR_KEY_use_global_speed_limit,   tr_sessionGroupUsesSessionLimits (session, name));
+          tr_variantDictAddInt  (d, TR_KEY_bandwidth_priority,       tr_sessionGetGroupPriority (session, name));
+        }
+
+      tr_variantToFile (&top, TR_VARIANT_FMT_JSON, filename);
+      tr_variantFree (&top);
+    }
+
+  tr_free (filename);
+}
+
 /***
 ****  Alternative speed limits that are used during scheduled times
 ***/
@@ -1743,6 +2025,26 @@ tr_sessionCountTorrents (const tr_session * session)
   return tr_isSession (session) ? session->torrentCount : 0;
 }
 
+void
+tr_sessionGetPerfStats (tr_session * session, struct tr_perf_stats * setme)
+{
+  tr_dh_pool_stats keyPoolStats;
+
+  assert (tr_isSession (session));
+
+  *setme = session->perfStats;
+  setme->queueDepth = tr_atomicAddInt (&session->perfStats.queueDepth, 0);
+
+  tr_dhPoolGetStats (session->keyPool, &keyPoolStats);
+  setme->keyPoolSize = keyPoolStats.size;
+  setme->keysAvailable = keyPoolStats.available;
+  setme->keysPooled = keyPoolStats.keysPooled;
+  setme->keysFromPool = keyPoolStats.keysFromPool;
+  setme->keysInline = keyPoolStats.keysGeneratedInline;
+  setme->keygenUsec = keyPoolStats.keygenUsec;
+  setme->secretUsec = keyPoolStats.secretUsec;
+}
+
 tr_torrent **
 tr_sessionGetTorrents (tr_session * session, int * setme_n)
 {
@@ -1953,11 +2255,19 @@ tr_sessionClose (tr_session * session)
         }
     }
 
+  /* handshakes use the key pool, and the libtransmission
+     thread is the only place they run */
+  tr_dhPoolFree (session->keyPool);
+
   /* free the session memory */
   tr_variantFree (&session->removedTorrents);
+  tr_ptrArrayDestruct (&session->bandwidthGroups, bandwidthGroupFree);
+  tr_ptrArrayDestruct (&session->torrentsByHash, NULL);
   tr_bandwidthDestruct (&session->bandwidth);
   tr_bitfieldDestruct (&session->turtle.minutes);
   tr_session_id_free (session->session_id);
+  tr_torrentsFreeStats (session);
+  tr_lockFree (session->statTableLock);
   tr_lockFree (session->lock);
   if (session->metainfoLookup)
     {
@@ -53,6 +53,7 @@ struct tr_bindsockets;
 struct tr_cache;
 struct tr_fdInfo;
 struct tr_device_info;
+struct tr_dh_pool;
 
 struct tr_turtle_info
 {
@@ -93,6 +94,66 @@ struct tr_turtle_info
     tr_auto_switch_state_t autoTurtleState;
 };
 
+/* performance counters, returned by session-stats as "perf-stats".
+   Each field is kept by the code it counts, except the key pool's,
+   which tr_sessionGetPerfStats () copies in from the pool itself. */
+struct tr_perf_stats
+{
+    /* datagram and syscall counts on the session's UDP sockets */
+    uint64_t packetsReceived;
+    uint64_t receiveCalls;
+    uint64_t packetsSent;
+    uint64_t sendCalls;
+
+    /* DHT announce scheduling and routing table counts */
+    uint64_t searchesStarted;
+    uint64_t searchesDone;
+    uint64_t peersFound;
+    int searchesActive;
+    int announcesQueued;
+    int nodesGood;
+    int nodesDubious;
+
+    /* work run in the libevent thread on behalf of tr_runInEventThread () */
+    uint64_t tasksRun;
+    uint64_t wakeups;
+    uint64_t totalLatencyMsec;
+    uint64_t maxLatencyMsec;
+    int queueDepth;
+    int maxQueueDepth;
+
+    /* HAVE messages queued by peers and written out in batches */
+    uint64_t havesQueued;
+    uint64_t havesSent;
+    uint64_t havesSuppressed;
+    uint64_t batchesSent;
+
+    /* where uploaded blocks were read from, and the SUGGEST_PIECE and
+       ALLOWED_FAST messages sent to steer peers toward cached pieces */
+    uint64_t bytesFromCache;
+    uint64_t bytesFromDisk;
+    uint64_t suggestsSent;
+    uint64_t allowedFastSent;
+
+    /* DH keypairs for MSE handshakes; see tr_dh_pool_stats */
+    int keyPoolSize;
+    int keysAvailable;
+    uint64_t keysPooled;
+    uint64_t keysFromPool;
+    uint64_t keysInline;
+    uint64_t keygenUsec;
+    uint64_t secretUsec;
+};
+
+/* a named set of torrents that share one speed limit */
+struct tr_bandwidth_group
+{
+    char * name;
+
+    /* child of the session's bandwidth; parent of its torrents' */
+    struct tr_bandwidth bandwidth;
+};
+
 /** @brief handle to an active libtransmission session */
 struct tr_session
 {
@@ -175,6 +236,9 @@ struct tr_session
     int                          torrentCount;
     tr_torrent *                 torrentList;
 
+    /* the same torrents, sorted by info hash for lookups */
+    tr_ptrArray                  torrentsByHash;
+
     char *                       torrentDoneScript;
 
     char *                       configDir;
@@ -192,8 +256,16 @@ struct tr_session
 
     struct tr_cache *            cache;
 
+    /* DH keypairs generated ahead of time for MSE handshakes */
+    struct tr_dh_pool *          keyPool;
+
     struct tr_lock *             lock;
 
+    /* the torrents' published stat snapshots, and the lock that's held
+       while swapping or taking a reference to them */
+    struct tr_stat_table *       statTable;
+    struct tr_lock *             statTableLock;
+
     struct tr_web *              web;
 
     struct tr_session_id       * session_id;
@@ -211,9 +283,14 @@ struct tr_session
     struct event               * nowTimer;
     struct event               * saveTimer;
 
+    struct tr_perf_stats         perfStats;
+
     /* monitors the "global pool" speeds */
     struct tr_bandwidth          bandwidth;
 
+    /* struct tr_bandwidth_group, sorted by name */
+    tr_ptrArray                  bandwidthGroups;
+
     float                        desiredRatio;
 
     uint16_t                     idleLimitMinutes;
@@ -257,8 +334,16 @@ struct tr_bindsockets * tr_sessionGetBindSockets (tr_session *);
 
 int tr_sessionCountTorrents (const tr_session * session);
 
+void tr_sessionGetPerfStats (tr_session * session, struct tr_perf_stats * setme);
+
 tr_torrent ** tr_sessionGetTorrents (tr_session * session, int * setme_n);
 
+struct tr_bandwidth_group * tr_sessionFindBandwidthGroup (const tr_session * session,
+                                                          const char       * name);
+
+struct tr_bandwidth_group * tr_sessionGetBandwidthGroup (tr_session * session,
+                                                         const char * name);
+
 enum
 {
     SESSION_MAGIC_NUMBER = 3845,
@@ -7,6 +7,7 @@
  */
 
 #include <assert.h>
+#include <stdlib.h> /* bsearch () */
 #include <string.h> /* memcpy (), memset (), memcmp () */
 
 #include <event2/buffer.h>
@@ -38,14 +39,29 @@
 
 enum
 {
-  /* don't ask for the same metadata piece more than this often */
-  MIN_REPEAT_INTERVAL_SECS = 3
+  /* how many metadata pieces we ask one peer for at a time */
+  MAX_REQUESTS_PER_PEER = 8,
+
+  /* in endgame, how many peers we ask for the same piece */
+  MAX_REQUESTS_PER_PIECE = 2,
+
+  /* a request times out after a few round trips, within these bounds */
+  MIN_REQUEST_TIMEOUT_MSEC = 1000,
+  MAX_REQUEST_TIMEOUT_MSEC = 10000,
+  INITIAL_RTT_MSEC = 750
+};
+
+struct metadata_request
+{
+  const void * peer;
+  uint64_t requestedAt;
 };
 
 struct metadata_node
 {
-  time_t requestedAt;
   int piece;
+  int requestCount;
+  struct metadata_request requests[MAX_REQUESTS_PER_PIECE];
 };
 
 struct tr_incomplete_metadata
@@ -54,19 +70,92 @@ struct tr_incomplete_metadata
   int metadata_size;
   int pieceCount;
 
-  /** sorted from least to most recently requested */
+  /** the pieces we don't have yet, sorted by piece index */
   struct metadata_node * piecesNeeded;
   int piecesNeededCount;
+
+  /** smoothed round-trip time of a piece request */
+  uint64_t rttMsec;
+
+  /** the leading pieces are hashed as they arrive */
+  tr_sha1_ctx_t sha;
+  int piecesHashed;
 };
 
+static void
+incompleteMetadataReset (struct tr_incomplete_metadata * m)
+{
+  int i;
+
+  for (i=0; i<m->pieceCount; ++i)
+    {
+      m->piecesNeeded[i].piece = i;
+      m->piecesNeeded[i].requestCount = 0;
+    }
+
+  m->piecesNeededCount = m->pieceCount;
+
+  if (m->sha != NULL)
+    tr_sha1_final (m->sha, NULL);
+  m->sha = tr_sha1_init ();
+  m->piecesHashed = 0;
+}
+
 static void
 incompleteMetadataFree (struct tr_incomplete_metadata * m)
 {
+  if (m->sha != NULL)
+    tr_sha1_final (m->sha, NULL);
+
   tr_free (m->metadata);
   tr_free (m->piecesNeeded);
   tr_free (m);
 }
 
+static int
+compareMetadataNodeToPiece (const void * va, const void * vb)
+{
+  const int a = *(const int *) va;
+  const int b = ((const struct metadata_node *) vb)->piece;
+
+  return a < b ? -1 : (a > b ? 1 : 0);
+}
+
+static struct metadata_node *
+findPieceNeeded (struct tr_incomplete_metadata * m, int piece)
+{
+  return bsearch (&piece, m->piecesNeeded, m->piecesNeededCount,
+                  sizeof (struct metadata_node), compareMetadataNodeToPiece);
+}
+
+static void
+removeRequest (struct metadata_node * node, int i)
+{
+  tr_removeElementFromArray (node->requests, i,
+                             sizeof (struct metadata_request),
+                             node->requestCount--);
+}
+
+static int
+findRequest (const struct metadata_node * node, const void * peer)
+{
+  int i;
+
+  for (i=0; i<node->requestCount; ++i)
+    if (node->requests[i].peer == peer)
+      return i;
+
+  return -1;
+}
+
+static uint64_t
+getRequestTimeout (const struct tr_incomplete_metadata * m)
+{
+  const uint64_t timeout = m->rttMsec * 4;
+
+  return MAX (MIN_REQUEST_TIMEOUT_MSEC, MIN (MAX_REQUEST_TIMEOUT_MSEC, timeout));
+}
+
 bool
 tr_torrentSetMetadataSizeHint (tr_torrent * tor, int64_t size)
 {
@@ -93,6 +182,8 @@ tr_torrentSetMetadataSizeHint (tr_torrent * tor, int64_t size)
   m->metadata_size = size;
   m->piecesNeededCount = n;
   m->piecesNeeded = tr_new (struct metadata_node, n);
+  m->rttMsec = INITIAL_RTT_MSEC;
+  m->sha = NULL;
 
   if (m->metadata == NULL || m->piecesNeeded == NULL)
     {
@@ -100,11 +191,7 @@ tr_torrentSetMetadataSizeHint (tr_torrent * tor, int64_t size)
       return false;
     }
 
-  for (int i = 0; i < n; ++i)
-    {
-      m->piecesNeeded[i].piece = i;
-      m->piecesNeeded[i].requestedAt = 0;
-    }
+  incompleteMetadataReset (m);
 
   tor->incompleteMetadata = m;
   return true;
@@ -156,18 +243,38 @@ ensureInfoDictOffsetIsCached (tr_torrent * tor)
     }
 }
 
-void*
-tr_torrentGetMetadataPiece (tr_torrent * tor, int piece, size_t * len)
+/* a reference-counted copy of the info dict. The torrent holds one
+   reference and every evbuffer chain that points into it holds another. */
+struct tr_info_dict_cache
 {
-  char * ret = NULL;
+  int refCount;
+  size_t length;
+  char * bytes;
+};
 
-  assert (tr_isTorrent (tor));
-  assert (piece >= 0);
-  assert (len != NULL);
+static void
+infoDictCacheUnref (struct tr_info_dict_cache * cache)
+{
+  if (--cache->refCount == 0)
+    {
+      tr_free (cache->bytes);
+      tr_free (cache);
+    }
+}
 
-  if (tr_torrentHasMetadata (tor))
+static void
+onInfoDictReferenceFreed (const void * data UNUSED, size_t datalen UNUSED, void * vcache)
+{
+  infoDictCacheUnref (vcache);
+}
+
+static struct tr_info_dict_cache *
+getInfoDictCache (tr_torrent * tor)
+{
+  if (tor->infoDictCache == NULL)
     {
       tr_sys_file_t fd;
+      char * buf = NULL;
 
       ensureInfoDictOffsetIsCached (tor);
 
@@ -176,42 +283,89 @@ tr_torrentGetMetadataPiece (tr_torrent * tor, int piece, size_t * len)
       fd = tr_sys_file_open (tor->info.torrent, TR_SYS_FILE_READ, 0, NULL);
       if (fd != TR_BAD_SYS_FILE)
         {
-          const size_t o = piece * METADATA_PIECE_SIZE;
+          uint64_t n;
 
-          if (tr_sys_file_seek (fd, tor->infoDictOffset + o, TR_SEEK_SET, NULL, NULL))
+          buf = tr_new (char, tor->infoDictLength);
+          if (!tr_sys_file_read_at (fd, buf, tor->infoDictLength, tor->infoDictOffset, &n, NULL)
+              || n != tor->infoDictLength)
             {
-              const size_t l = o + METADATA_PIECE_SIZE <= tor->infoDictLength
-                             ? METADATA_PIECE_SIZE
-                             : tor->infoDictLength - o;
-
-              if (0<l && l<=METADATA_PIECE_SIZE)
-                {
-                  char * buf = tr_new (char, l);
-                  uint64_t n;
-                  if (tr_sys_file_read (fd, buf, l, &n, NULL) && n == l)
-                    {
-                      *len = l;
-                      ret = buf;
-                      buf = NULL;
-                    }
-
-                  tr_free (buf);
-                }
+              tr_free (buf);
+              buf = NULL;
             }
 
           tr_sys_file_close (fd, NULL);
         }
+
+      if (buf != NULL)
+        {
+          struct tr_info_dict_cache * cache = tr_new (struct tr_info_dict_cache, 1);
+          cache->refCount = 1;
+          cache->length = tor->infoDictLength;
+          cache->bytes = buf;
+          tor->infoDictCache = cache;
+        }
+    }
+
+  tor->infoDictCacheUsedAt = tr_time ();
+  return tor->infoDictCache;
+}
+
+void
+tr_torrentFreeInfoDictCache (tr_torrent * tor, int idle_secs)
+{
+  if (tor->infoDictCache != NULL && tor->infoDictCacheUsedAt + idle_secs <= tr_time ())
+    {
+      infoDictCacheUnref (tor->infoDictCache);
+      tor->infoDictCache = NULL;
     }
+}
 
-  assert (ret == NULL || *len > 0);
+bool
+tr_torrentGetMetadataPiece (tr_torrent       * tor,
+                            int                piece,
+                            struct evbuffer  * out,
+                            bool               share)
+{
+  struct tr_info_dict_cache * cache;
 
-  return ret;
+  assert (tr_isTorrent (tor));
+  assert (piece >= 0);
+  assert (out != NULL);
+
+  if (tr_torrentHasMetadata (tor) && ((cache = getInfoDictCache (tor))))
+    {
+      const size_t o = piece * METADATA_PIECE_SIZE;
+
+      if (o < cache->length)
+        {
+          const size_t l = MIN (METADATA_PIECE_SIZE, cache->length - o);
+
+          if (!share)
+            {
+              evbuffer_add (out, cache->bytes + o, l);
+            }
+          else
+            {
+              ++cache->refCount;
+              evbuffer_add_reference (out, cache->bytes + o, l, onInfoDictReferenceFreed, cache);
+            }
+
+          return true;
+        }
+    }
+
+  return false;
 }
 
 void
-tr_torrentSetMetadataPiece (tr_torrent  * tor, int piece, const void  * data, int len)
+tr_torrentSetMetadataPiece (tr_torrent  * tor,
+                            const void  * peer,
+                            int           piece,
+                            const void  * data,
+                            int           len)
 {
   int i;
+  struct metadata_node * node;
   struct tr_incomplete_metadata * m;
   const int offset = piece * METADATA_PIECE_SIZE;
 
@@ -238,18 +392,31 @@ tr_torrentSetMetadataPiece (tr_torrent  * tor, int piece, const void  * data, in
     return;
 
   /* do we need this piece? */
-  for (i=0; i<m->piecesNeededCount; ++i)
-    if (m->piecesNeeded[i].piece == piece)
-      break;
-  if (i==m->piecesNeededCount)
+  if ((node = findPieceNeeded (m, piece)) == NULL)
     return;
 
+  /* use the request's round trip to adapt our timeout */
+  if ((i = findRequest (node, peer)) != -1)
+    {
+      const uint64_t now = tr_time_msec ();
+      const uint64_t rtt = now > node->requests[i].requestedAt ? now - node->requests[i].requestedAt : 0;
+      m->rttMsec = (m->rttMsec * 7 + rtt) / 8;
+    }
+
   memcpy (m->metadata + offset, data, len);
 
-  tr_removeElementFromArray (m->piecesNeeded, i,
+  tr_removeElementFromArray (m->piecesNeeded, node - m->piecesNeeded,
                              sizeof (struct metadata_node),
                              m->piecesNeededCount--);
 
+  /* hash whatever now continues the leading run of pieces */
+  while (m->piecesHashed < m->pieceCount && findPieceNeeded (m, m->piecesHashed) == NULL)
+    {
+      const int o = m->piecesHashed * METADATA_PIECE_SIZE;
+      tr_sha1_update (m->sha, m->metadata + o, MIN (METADATA_PIECE_SIZE, m->metadata_size - o));
+      ++m->piecesHashed;
+    }
+
   dbgmsg (tor, "saving metainfo piece %d... %d remain", piece, m->piecesNeededCount);
 
   /* are we done? */
@@ -262,7 +429,9 @@ tr_torrentSetMetadataPiece (tr_torrent  * tor, int piece, const void  * data, in
 
       /* we've got a complete set of metainfo... see if it passes the checksum test */
       dbgmsg (tor, "metainfo piece %d was the last one", piece);
-      tr_sha1 (sha1, m->metadata, m->metadata_size, NULL);
+      assert (m->piecesHashed == m->pieceCount);
+      tr_sha1_final (m->sha, sha1);
+      m->sha = NULL;
       if ((checksumPassed = memcmp (sha1, tor->info.hash, SHA_DIGEST_LENGTH) == 0))
         {
           /* checksum passed; now try to parse it as benc */
@@ -328,14 +497,8 @@ tr_torrentSetMetadataPiece (tr_torrent  * tor, int piece, const void  * data, in
         }
         else /* drat. */
         {
-          const int n = m->pieceCount;
-          for (i=0; i<n; ++i)
-            {
-              m->piecesNeeded[i].piece = i;
-              m->piecesNeeded[i].requestedAt = 0;
-            }
-          m->piecesNeededCount = n;
-          dbgmsg (tor, "metadata error; trying again. %d pieces left", n);
+          incompleteMetadataReset (m);
+          dbgmsg (tor, "metadata error; trying again. %d pieces left", m->pieceCount);
 
           tr_logAddError ("magnet status: checksum passed %d, metainfo parsed %d",
                   (int)checksumPassed, (int)metainfoParsed);
@@ -344,35 +507,97 @@ tr_torrentSetMetadataPiece (tr_torrent  * tor, int piece, const void  * data, in
 }
 
 bool
-tr_torrentGetNextMetadataRequest (tr_torrent * tor, time_t now, int * setme_piece)
+tr_torrentGetNextMetadataRequest (tr_torrent * tor, const void * peer, int * setme_piece)
 {
-  bool have_request = false;
+  int i, j;
+  int peerRequestCount = 0;
+  uint64_t oldest = UINT64_MAX;
+  struct metadata_node * best = NULL;
   struct tr_incomplete_metadata * m;
+  uint64_t now, timeout;
 
   assert (tr_isTorrent (tor));
 
   m = tor->incompleteMetadata;
+  if (m == NULL)
+    return false;
+
+  now = tr_time_msec ();
+  timeout = getRequestTimeout (m);
 
-  if ((m != NULL) && (m->piecesNeededCount > 0)
-                  && (m->piecesNeeded[0].requestedAt + MIN_REPEAT_INTERVAL_SECS < now))
+  /* forget requests that have timed out, and see how busy this peer is */
+  for (i=0; i<m->piecesNeededCount; ++i)
     {
-      int i;
-      const int piece = m->piecesNeeded[0].piece;
+      struct metadata_node * node = &m->piecesNeeded[i];
 
-      tr_removeElementFromArray (m->piecesNeeded, 0,
-                                 sizeof (struct metadata_node),
-                                 m->piecesNeededCount--);
+      for (j=0; j<node->requestCount; )
+        {
+          if (node->requests[j].requestedAt + timeout <= now)
+            removeRequest (node, j);
+          else if (node->requests[j++].peer == peer)
+            ++peerRequestCount;
+        }
+    }
 
-      i = m->piecesNeededCount++;
-      m->piecesNeeded[i].piece = piece;
-      m->piecesNeeded[i].requestedAt = now;
+  if (peerRequestCount >= MAX_REQUESTS_PER_PEER)
+    return false;
 
-      dbgmsg (tor, "next piece to request: %d", piece);
-      *setme_piece = piece;
-      have_request = true;
+  /* ask for the first piece that nobody's been asked for... */
+  for (i=0; best==NULL && i<m->piecesNeededCount; ++i)
+    if (m->piecesNeeded[i].requestCount == 0)
+      best = &m->piecesNeeded[i];
+
+  /* ...or in endgame, help out with the longest-outstanding one */
+  for (i=0; best==NULL && i<m->piecesNeededCount; ++i)
+    {
+      struct metadata_node * node = &m->piecesNeeded[i];
+
+      if (node->requestCount < MAX_REQUESTS_PER_PIECE
+          && findRequest (node, peer) == -1
+          && node->requests[0].requestedAt < oldest)
+        {
+          oldest = node->requests[0].requestedAt;
+          best = node;
+        }
     }
 
-  return have_request;
+  if (best == NULL)
+    return false;
+
+  best->requests[best->requestCount].peer = peer;
+  best->requests[best->requestCount].requestedAt = now;
+  ++best->requestCount;
+
+  dbgmsg (tor, "next piece to request: %d", best->piece);
+  *setme_piece = best->piece;
+  return true;
+}
+
+void
+tr_torrentMetadataRequestFailed (tr_torrent * tor, const void * peer, int piece)
+{
+  struct tr_incomplete_metadata * m = tor->incompleteMetadata;
+
+  if (m != NULL)
+    {
+      int i;
+
+      if (piece >= 0)
+        {
+          struct metadata_node * node = findPieceNeeded (m, piece);
+
+          if (node != NULL && (i = findRequest (node, peer)) != -1)
+            removeRequest (node, i);
+        }
+      else for (i=0; i<m->piecesNeededCount; ++i)
+        {
+          int j;
+          struct metadata_node * node = &m->piecesNeeded[i];
+
+          if ((j = findRequest (node, peer)) != -1)
+            removeRequest (node, j);
+        }
+    }
 }
 
 double
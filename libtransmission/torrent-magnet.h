@@ -21,11 +21,34 @@ enum
     METADATA_PIECE_SIZE = (1024 * 16)
 };
 
-void* tr_torrentGetMetadataPiece (tr_torrent * tor, int piece, size_t * len);
+struct evbuffer;
 
-void tr_torrentSetMetadataPiece (tr_torrent * tor, int piece, const void * data, int len);
+/**
+ * Append a piece of the info dict to `out`.
+ *
+ * If `share` is true, the bytes are added by reference to the torrent's
+ * in-memory copy of the info dict rather than copied, so the caller must
+ * not modify them in place (e.g. by encrypting them).
+ */
+bool tr_torrentGetMetadataPiece (tr_torrent       * tor,
+                                 int                piece,
+                                 struct evbuffer  * out,
+                                 bool               share);
+
+/* free the in-memory copy of the info dict if it's been unused for `idle_secs` */
+void tr_torrentFreeInfoDictCache (tr_torrent * tor, int idle_secs);
+
+void tr_torrentSetMetadataPiece (tr_torrent  * tor,
+                                 const void  * peer,
+                                 int           piece,
+                                 const void  * data,
+                                 int           len);
+
+/* pick a metadata piece to ask `peer` for, if it isn't already busy */
+bool tr_torrentGetNextMetadataRequest (tr_torrent * tor, const void * peer, int * setme);
 
-bool tr_torrentGetNextMetadataRequest (tr_torrent * tor, time_t now, int * setme);
+/* `peer` rejected a request for `piece`, or went away if `piece` is -1 */
+void tr_torrentMetadataRequestFailed (tr_torrent * tor, const void * peer, int piece);
 
 bool tr_torrentSetMetadataSizeHint (tr_torrent * tor, int64_t metadata_size);
 
@@ -23,6 +23,7 @@
 #include <stdlib.h> /* qsort */
 #include <limits.h> /* INT_MAX */
 
+#include <event2/event.h> /* evtimer_new () */
 #include <event2/util.h> /* evutil_vsnprintf () */
 
 #include "transmission.h"
@@ -46,6 +47,7 @@
 #include "session.h"
 #include "torrent.h"
 #include "torrent-magnet.h"
+#include "tr-dht.h" /* tr_dhtTorrentStarted () */
 #include "trevent.h" /* tr_runInEventThread () */
 #include "utils.h"
 #include "variant.h"
@@ -92,29 +94,41 @@ tr_torrentFindFromId (tr_session * session, int id)
   return NULL;
 }
 
+/* tr_session.torrentsByHash is sorted by info hash */
+static int
+compareTorrentByHash (const void * va, const void * vb)
+{
+  const tr_torrent * a = va;
+  const tr_torrent * b = vb;
+
+  return memcmp (a->info.hash, b->info.hash, SHA_DIGEST_LENGTH);
+}
+
+static int
+compareTorrentToHash (const void * vtor, const void * vhash)
+{
+  const tr_torrent * tor = vtor;
+
+  return memcmp (tor->info.hash, vhash, SHA_DIGEST_LENGTH);
+}
+
 tr_torrent*
 tr_torrentFindFromHashString (tr_session *  session, const char * str)
 {
-  tr_torrent * tor = NULL;
+  uint8_t hash[SHA_DIGEST_LENGTH];
 
-  while ((tor = tr_torrentNext (session, tor)))
-    if (!evutil_ascii_strcasecmp (str, tor->info.hashString))
-      return tor;
+  if (strlen (str) != SHA_DIGEST_LENGTH * 2
+      || strspn (str, "0123456789abcdefABCDEF") != SHA_DIGEST_LENGTH * 2)
+    return NULL;
 
-  return NULL;
+  tr_hex_to_sha1 (hash, str);
+  return tr_torrentFindFromHash (session, hash);
 }
 
 tr_torrent*
 tr_torrentFindFromHash (tr_session * session, const uint8_t * torrentHash)
 {
-  tr_torrent * tor = NULL;
-
-  while ((tor = tr_torrentNext (session, tor)))
-    if (*tor->info.hash == *torrentHash)
-      if (memcmp (tor->info.hash, torrentHash, SHA_DIGEST_LENGTH) == 0)
-        return tor;
-
-  return NULL;
+  return tr_ptrArrayFindSorted (&session->torrentsByHash, torrentHash, compareTorrentToHash);
 }
 
 tr_torrent*
@@ -145,6 +159,8 @@ tr_torrentFindFromObfuscatedHash (tr_session * session,
   return NULL;
 }
 
+static bool relocationIsHoldingWrites (const tr_torrent * tor);
+
 bool
 tr_torrentIsPieceTransferAllowed (const tr_torrent  * tor,
                                   tr_direction        direction)
@@ -155,6 +171,9 @@ tr_torrentIsPieceTransferAllowed (const tr_torrent  * tor,
   assert (tr_isTorrent (tor));
   assert (tr_isDirection (direction));
 
+  if (direction == TR_PEER_TO_CLIENT && relocationIsHoldingWrites (tor))
+    allowed = false;
+
   if (tr_torrentUsesSpeedLimit (tor, direction))
     if (tr_torrentGetSpeedLimit_Bps (tor, direction) <= 0)
       allowed = false;
@@ -288,6 +307,33 @@ tr_torrentUsesSessionLimits (const tr_torrent * tor)
   return tr_bandwidthAreParentLimitsHonored (&tor->bandwidth, TR_UP);
 }
 
+void
+tr_torrentSetGroup (tr_torrent * tor, const char * group)
+{
+  struct tr_bandwidth_group * g = NULL;
+
+  assert (tr_isTorrent (tor));
+
+  if (group != NULL && *group != '\0')
+    g = tr_sessionGetBandwidthGroup (tor->session, group);
+
+  if (tor->bandwidthGroup != g)
+    {
+      tor->bandwidthGroup = g;
+      tr_bandwidthSetParent (&tor->bandwidth, g != NULL ? &g->bandwidth
+                                                        : &tor->session->bandwidth);
+      tr_torrentSetDirty (tor);
+    }
+}
+
+const char *
+tr_torrentGetGroup (const tr_torrent * tor)
+{
+  assert (tr_isTorrent (tor));
+
+  return tor->bandwidthGroup != NULL ? tor->bandwidthGroup->name : NULL;
+}
+
 /***
 ****
 ***/
@@ -900,6 +946,8 @@ torrentInit (tr_torrent * tor, const tr_ctor * ctor)
   torrentInitFromInfo (tor);
   loaded = tr_torrentLoadResume (tor, ~0, ctor);
   tor->completeness = tr_cpGetStatus (&tor->completion);
+  if (tor->superSeeding)
+    tr_peerMgrOnSuperSeedingChanged (tor);
   setLocalErrorIfFilesDisappeared (tor);
 
   tr_ctorInitTorrentPriorities (ctor, tor);
@@ -944,6 +992,7 @@ torrentInit (tr_torrent * tor, const tr_ctor * ctor)
         it = it->next;
       it->next = tor;
     }
+  tr_ptrArrayInsertSorted (&session->torrentsByHash, tor, compareTorrentByHash);
 
   /* if we don't have a local .torrent file already, assume the torrent is new */
   isNewTorrent = !tr_sys_path_exists (tor->info.torrent, NULL);
@@ -1242,6 +1291,8 @@ getVerifyProgress (const tr_torrent * tor)
   return d;
 }
 
+static float getRelocateProgress (const tr_torrent * tor);
+
 const tr_stat *
 tr_torrentStat (tr_torrent * tor)
 {
@@ -1295,6 +1346,8 @@ tr_torrentStat (tr_torrent * tor)
   s->leftUntilDone       = tr_torrentGetLeftUntilDone (tor);
   s->sizeWhenDone        = tr_cpSizeWhenDone (&tor->completion);
   s->recheckProgress     = s->activity == TR_STATUS_CHECK ? getVerifyProgress (tor) : 0;
+  s->isRelocating        = tor->relocation != NULL;
+  s->relocateProgress    = s->isRelocating ? getRelocateProgress (tor) : 0;
   s->activityDate        = tor->activityDate;
   s->addedDate           = tor->addedDate;
   s->doneDate            = tor->doneDate;
@@ -1394,49 +1447,221 @@ tr_torrentStat (tr_torrent * tor)
 }
 
 /***
-****
+****  Stat snapshots
 ***/
 
-static uint64_t
-countFileBytesCompleted (const tr_torrent * tor, tr_file_index_t index)
+/* tr_torrentStat () isn't cheap, so a torrent's snapshot is only refreshed
+   when something that shows up in it has changed, or once it's this old */
+#define STAT_SNAPSHOT_MAX_AGE_SECS 5
+
+/* an immutable copy of every torrent's snapshot, sorted by id. readers
+   take a reference to it and publishing swaps in a new table, so no one
+   has to hold the session lock to read it. */
+struct tr_stat_table
+{
+  int refCount;
+  int count;
+  tr_stat * stats;
+};
+
+static inline bool
+speedChanged (double KBps, unsigned int Bps)
+{
+  return fabs (KBps - toSpeedKBps (Bps)) >= 0.001;
+}
+
+static bool
+statSnapshotIsStale (const tr_torrent * tor, time_t now)
+{
+  struct tr_swarm_stats swarm_stats;
+  const uint64_t now_msec = tr_time_msec ();
+  const tr_stat * s = &tor->statSnapshot;
+
+  if (!tor->hasStatSnapshot
+      || tor->statSnapshotAt + STAT_SNAPSHOT_MAX_AGE_SECS <= now
+      || s->activity != tr_torrentGetActivity (tor)
+      || s->error != tor->error
+      || s->queuePosition != tor->queuePosition
+      || s->haveValid + s->haveUnchecked != tr_cpHaveTotal (&tor->completion))
+    return true;
+
+  if (speedChanged (s->rawUploadSpeed_KBps, tr_bandwidthGetRawSpeed_Bps (&tor->bandwidth, now_msec, TR_UP))
+      || speedChanged (s->rawDownloadSpeed_KBps, tr_bandwidthGetRawSpeed_Bps (&tor->bandwidth, now_msec, TR_DOWN)))
+    return true;
+
+  if (tor->swarm != NULL)
+    tr_swarmGetStats (tor->swarm, &swarm_stats);
+  else
+    swarm_stats = TR_SWARM_STATS_INIT;
+
+  return s->peersConnected != swarm_stats.peerCount
+      || s->peersSendingToUs != swarm_stats.activePeerCount[TR_DOWN]
+      || s->peersGettingFromUs != swarm_stats.activePeerCount[TR_UP]
+      || s->webseedsSendingToUs != swarm_stats.activeWebseedCount;
+}
+
+static int
+compareStatById (const void * va, const void * vb)
 {
-  uint64_t total = 0;
-  const tr_file * f = &tor->info.files[index];
+  const tr_stat * a = va;
+  const tr_stat * b = vb;
+
+  if (a->id < b->id)
+    return -1;
+  if (a->id > b->id)
+    return 1;
+  return 0;
+}
 
-  if (f->length)
+static void
+statTableUnref (struct tr_stat_table * table)
+{
+  if ((table != NULL) && (tr_atomicAddInt (&table->refCount, -1) == 0))
     {
-      tr_block_index_t first;
-      tr_block_index_t last;
-      tr_torGetFileBlockRange (tor, index, &first, &last);
+      tr_free (table->stats);
+      tr_free (table);
+    }
+}
+
+/* the lock only guards taking the reference, not the table's contents */
+static struct tr_stat_table *
+statTableRef (tr_session * session)
+{
+  struct tr_stat_table * table;
+
+  tr_lockLock (session->statTableLock);
+  table = session->statTable;
+  if (table != NULL)
+    tr_atomicAddInt (&table->refCount, 1);
+  tr_lockUnlock (session->statTableLock);
+
+  return table;
+}
+
+static const tr_stat *
+statTableFind (const struct tr_stat_table * table, int torrentId)
+{
+  tr_stat key;
+
+  if (table == NULL)
+    return NULL;
+
+  key.id = torrentId;
+  return bsearch (&key, table->stats, table->count, sizeof (tr_stat), compareStatById);
+}
+
+/* swap in a table of the torrents' current snapshots */
+static void
+statTablePublish (tr_session * session)
+{
+  int n = 0;
+  tr_torrent * tor = NULL;
+  struct tr_stat_table * table;
+  struct tr_stat_table * old;
+
+  table = tr_new (struct tr_stat_table, 1);
+  table->refCount = 1;
+  table->stats = tr_new (tr_stat, session->torrentCount);
+  while ((tor = tr_torrentNext (session, tor)))
+    if (tor->hasStatSnapshot)
+      table->stats[n++] = tor->statSnapshot;
+  table->count = n;
+  qsort (table->stats, n, sizeof (tr_stat), compareStatById);
+
+  tr_lockLock (session->statTableLock);
+  old = session->statTable;
+  session->statTable = table;
+  tr_lockUnlock (session->statTableLock);
+
+  statTableUnref (old);
+}
+
+void
+tr_torrentsPublishStats (tr_session * session)
+{
+  int count = 0;
+  bool changed = false;
+  tr_torrent * tor = NULL;
+  const time_t now = tr_time ();
 
-      if (first == last)
+  assert (tr_isSession (session));
+
+  while ((tor = tr_torrentNext (session, tor)))
+    {
+      if (statSnapshotIsStale (tor, now))
         {
-          if (tr_torrentBlockIsComplete (tor, first))
-            total = f->length;
+          tor->statSnapshot = *tr_torrentStat (tor);
+          tor->statSnapshotAt = now;
+          tor->hasStatSnapshot = true;
+          changed = true;
         }
-      else
-        {
-          /* the first block */
-          if (tr_torrentBlockIsComplete (tor, first))
-            total += tor->blockSize - (f->offset % tor->blockSize);
 
-          /* the middle blocks */
-          if (first + 1 < last)
-            {
-              uint64_t u = tr_bitfieldCountRange (&tor->completion.blockBitfield, first+1, last);
-              u *= tor->blockSize;
-              total += u;
-            }
+      ++count;
+    }
+
+  /* torrents that were removed are already gone from the table */
+  if (changed || session->statTable == NULL || session->statTable->count != count)
+    statTablePublish (session);
+}
+
+void
+tr_torrentsFreeStats (tr_session * session)
+{
+  statTableUnref (session->statTable);
+  session->statTable = NULL;
+}
+
+bool
+tr_torrentStatSnapshot (tr_session * session, int torrentId, tr_stat * setme)
+{
+  const tr_stat * st;
+  struct tr_stat_table * table;
+
+  assert (tr_isSession (session));
+
+  table = statTableRef (session);
+
+  if ((st = statTableFind (table, torrentId)) != NULL)
+    *setme = *st;
+
+  statTableUnref (table);
+  return st != NULL;
+}
+
+int
+tr_torrentStatSnapshots (tr_session * session, const int * torrentIds, int n, tr_stat * setme)
+{
+  int i;
+  int count = 0;
+  struct tr_stat_table * table;
+
+  assert (tr_isSession (session));
+
+  table = statTableRef (session);
+
+  for (i=0; i<n; ++i)
+    {
+      const tr_stat * st = statTableFind (table, torrentIds[i]);
 
-          /* the last block */
-          if (tr_torrentBlockIsComplete (tor, last))
-            total += (f->offset + f->length) - ((uint64_t)tor->blockSize * last);
+      if (st != NULL)
+        {
+          setme[i] = *st;
+          ++count;
+        }
+      else
+        {
+          setme[i].id = -1;
         }
     }
 
-  return total;
+  statTableUnref (table);
+  return count;
 }
 
+/***
+****
+***/
+
 tr_file_stat *
 tr_torrentFiles (const tr_torrent * tor,
                  tr_file_index_t  * fileCount)
@@ -1445,13 +1670,12 @@ tr_torrentFiles (const tr_torrent * tor,
   const tr_file_index_t n = tor->info.fileCount;
   tr_file_stat * files = tr_new0 (tr_file_stat, n);
   tr_file_stat * walk = files;
-  const bool isSeed = tor->completeness == TR_SEED;
 
   assert (tr_isTorrent (tor));
 
   for (i=0; i<n; ++i, ++walk)
     {
-      const uint64_t b = isSeed ? tor->info.files[i].length : countFileBytesCompleted (tor, i);
+      const uint64_t b = tr_cpFileBytesCompleted (&tor->completion, i);
       walk->bytesCompleted = b;
       walk->progress = tor->info.files[i].length > 0 ? ((float)b / tor->info.files[i].length) : 1.0f;
     }
@@ -1550,9 +1774,20 @@ tr_torrentSetHasPiece (tr_torrent *     tor,
   assert (pieceIndex < tor->info.pieceCount);
 
   if (has)
-    tr_cpPieceAdd (&tor->completion, pieceIndex);
+    {
+      tr_cpPieceAdd (&tor->completion, pieceIndex);
+    }
+  else if (tr_torrentPieceIsComplete (tor, pieceIndex))
+    {
+      tr_cpPieceRem (&tor->completion, pieceIndex);
+
+      if (tor->swarm != NULL)
+        tr_peerMgrPieceLost (tor, pieceIndex);
+    }
   else
-    tr_cpPieceRem (&tor->completion, pieceIndex);
+    {
+      tr_cpPieceRem (&tor->completion, pieceIndex);
+    }
 }
 
 /***
@@ -1563,6 +1798,8 @@ tr_torrentSetHasPiece (tr_torrent *     tor,
 static bool queueIsSequenced (tr_session *);
 #endif
 
+static void relocationAbort (tr_torrent * tor);
+
 static void
 freeTorrent (tr_torrent * tor)
 {
@@ -1575,6 +1812,11 @@ freeTorrent (tr_torrent * tor)
 
   tr_sessionLock (session);
 
+  if (tor->relocation != NULL)
+    relocationAbort (tor);
+
+  tr_torrentFreeInfoDictCache (tor, 0);
+
   tr_peerMgrRemoveTorrent (tor);
 
   tr_announcerRemoveTorrent (session->announcer, tor);
@@ -1596,11 +1838,16 @@ freeTorrent (tr_torrent * tor)
           break;
         }
     }
+  tr_ptrArrayRemoveSortedPointer (&session->torrentsByHash, tor, compareTorrentByHash);
 
   /* decrement the torrent count */
   assert (session->torrentCount >= 1);
   session->torrentCount--;
 
+  /* readers shouldn't find it after this returns */
+  if (!session->isClosing)
+    statTablePublish (session);
+
   /* resequence the queue positions */
   t = NULL;
   while ((t = tr_torrentNext (session, t)))
@@ -1650,8 +1897,7 @@ torrentStartImpl (void * vtor)
 
   tr_torrentResetTransferStats (tor);
   tr_announcerTorrentStarted (tor);
-  tor->dhtAnnounceAt = now + tr_rand_int_weak (20);
-  tor->dhtAnnounce6At = now + tr_rand_int_weak (20);
+  tr_dhtTorrentStarted (tor);
   tor->lpdAnnounceAt = now;
   tr_peerMgrStartTorrent (tor);
 
@@ -1864,6 +2110,7 @@ stopTorrent (void * vtor)
   tr_peerMgrStopTorrent (tor);
   tr_announcerTorrentStopped (tor);
   tr_cacheFlushTorrent (tor->session->cache, tor);
+  tr_torrentFreeInfoDictCache (tor, 0);
 
   tr_fdTorrentClose (tor->session, tor->uniqueId);
 
@@ -2221,6 +2468,9 @@ tr_torrentRecheckCompleteness (tr_torrent * tor)
       tor->completeness = completeness;
       tr_fdTorrentClose (tor->session, tor->uniqueId);
 
+      if (tor->superSeeding)
+        tr_peerMgrOnSuperSeedingChanged (tor);
+
       if (tr_torrentIsSeed (tor))
         {
           if (recentChange)
@@ -2388,15 +2638,15 @@ setFileDND (tr_torrent * tor, tr_file_index_t fileIndex, int doDownload)
 
   if (firstPiece == lastPiece)
     {
-      tor->info.pieces[firstPiece].dnd = firstPieceDND && lastPieceDND;
+      tr_cpSetPieceDND (&tor->completion, firstPiece, firstPieceDND && lastPieceDND);
     }
   else
     {
       tr_piece_index_t pp;
-      tor->info.pieces[firstPiece].dnd = firstPieceDND;
-      tor->info.pieces[lastPiece].dnd = lastPieceDND;
+      tr_cpSetPieceDND (&tor->completion, firstPiece, firstPieceDND);
+      tr_cpSetPieceDND (&tor->completion, lastPiece, lastPieceDND);
       for (pp=firstPiece+1; pp<lastPiece; ++pp)
-        tor->info.pieces[pp].dnd = dnd;
+        tr_cpSetPieceDND (&tor->completion, pp, dnd);
     }
 }
 
@@ -2416,8 +2666,6 @@ tr_torrentInitFileDLs (tr_torrent             * tor,
     if (files[i] < tor->info.fileCount)
       setFileDND (tor, files[i], doDownload);
 
-  tr_cpInvalidateDND (&tor->completion);
-
   tr_torrentUnlock (tor);
 }
 
@@ -2486,6 +2734,32 @@ tr_torrentSetSequentialDownload (tr_torrent * tor, bool sequential)
     }
 }
 
+bool
+tr_torrentGetSuperSeeding (const tr_torrent * tor)
+{
+  assert (tr_isTorrent (tor));
+
+  return tor->superSeeding;
+}
+
+void
+tr_torrentSetSuperSeeding (tr_torrent * tor, bool superSeeding)
+{
+  assert (tr_isTorrent (tor));
+
+  if (tor->superSeeding != superSeeding)
+    {
+      const bool wasActive = tr_torrentIsSuperSeeding (tor);
+
+      tor->superSeeding = superSeeding;
+
+      if (wasActive != tr_torrentIsSuperSeeding (tor))
+        tr_peerMgrOnSuperSeedingChanged (tor);
+
+      tr_torrentSetDirty (tor);
+    }
+}
+
 /***
 ****
 ***/
@@ -3115,6 +3389,10 @@ tr_torrentDeleteLocalData (tr_torrent * tor, tr_fileFunc func)
   if (func == NULL)
     func = tr_sys_path_remove;
 
+  /* stop moving the files, and put back the ones already moved */
+  if (tor->relocation != NULL)
+    relocationAbort (tor);
+
   /* close all the files because we're about to delete them */
   tr_cacheFlushTorrent (tor->session->cache, tor);
   tr_fdTorrentClose (tor->session, tor->uniqueId);
@@ -3126,6 +3404,711 @@ tr_torrentDeleteLocalData (tr_torrent * tor, tr_fileFunc func)
 ****
 ***/
 
+/* When a torrent's data has to be copied to another filesystem,
+ * the copying happens in a worker thread so that peers, RPC and the
+ * DHT don't stall. The torrent keeps using its files in the old location
+ * until everything has been copied. Blocks that get written to in the
+ * meantime are copied again, and since each pass only catches up on what
+ * was written during the one before it, the passes get shorter. If the
+ * torrent keeps writing faster than we copy, it stops downloading until
+ * the move is done. The last pass is small, and runs on the libtransmission
+ * thread, where no writes can sneak in between it and the switch-over. */
+
+#define RELOCATE_CHUNK_SIZE (1024 * 1024 * 4)
+#define RELOCATE_CHUNK_PAUSE_MSEC 5
+#define RELOCATE_POLL_MSEC 200
+
+/* catch up in the libtransmission thread once there's this little left.
+   after this many passes in the worker, stop downloading so that we can */
+#define RELOCATE_SYNC_BYTES RELOCATE_CHUNK_SIZE
+#define RELOCATE_MAX_PASSES 8
+
+enum
+{
+  RELOCATE_FILE_NOT_MOVED,
+  RELOCATE_FILE_RENAMED,
+  RELOCATE_FILE_COPIED
+};
+
+/* one part of a file to copy. whole files are copied from scratch;
+   catch-up spans are copied over a previous copy */
+struct relocate_span
+{
+  char * oldpath;
+  char * newpath;
+  bool isWholeFile;
+  uint64_t offset;
+  uint64_t length;
+};
+
+/* a batch of file copies, shared between the libtransmission thread and a worker */
+struct relocate_job
+{
+  /* set before the worker starts; read-only afterwards */
+  int count;
+  struct relocate_span * spans;
+
+  /* these are protected by the lock */
+  tr_lock * lock;
+  int refCount;
+  bool isCancelled;
+  bool isDone;
+  bool removeCopiesOnExit;
+  uint64_t bytesCopied;
+  tr_error * error;
+};
+
+struct tr_relocation
+{
+  char * location;
+  volatile double * setme_progress;
+  volatile int * setme_state;
+
+  /* per-file RELOCATE_FILE_* state, and where the file was moved from and to */
+  int * fileState;
+  char ** fileOldPath;
+  char ** fileNewPath;
+
+  /* blocks written since they were last copied */
+  tr_bitfield dirtyBlocks;
+  int passCount;
+
+  /* true when we've stopped downloading so that the copy can catch up */
+  bool isHoldingWrites;
+
+  /* each file's length is counted once, when it's first renamed or copied */
+  uint64_t bytesTotal;
+  uint64_t bytesDone;
+  float progress;
+
+  struct relocate_job * job;
+  struct event * timer;
+};
+
+static void
+relocateJobFree (struct relocate_job * job)
+{
+  int i;
+
+  for (i=0; i<job->count; ++i)
+    {
+      tr_free (job->spans[i].oldpath);
+      tr_free (job->spans[i].newpath);
+    }
+
+  tr_error_free (job->error);
+  if (job->lock != NULL)
+    tr_lockFree (job->lock);
+  tr_free (job->spans);
+  tr_free (job);
+}
+
+static void
+relocateJobUnref (struct relocate_job * job)
+{
+  int refCount;
+
+  tr_lockLock (job->lock);
+  refCount = --job->refCount;
+  tr_lockUnlock (job->lock);
+
+  if (refCount == 0)
+    relocateJobFree (job);
+}
+
+static bool
+relocateJobIsCancelled (struct relocate_job * job)
+{
+  bool isCancelled;
+
+  tr_lockLock (job->lock);
+  isCancelled = job->isCancelled;
+  tr_lockUnlock (job->lock);
+
+  return isCancelled;
+}
+
+/* job is NULL when copying in the libtransmission thread */
+static bool
+relocateCopySpan (struct relocate_job          * job,
+                  const struct relocate_span   * span,
+                  tr_error                    ** error)
+{
+  bool ok;
+  int flags;
+  tr_sys_file_t in;
+  tr_sys_file_t out;
+  char * newdir;
+  uint64_t bytesLeft = span->isWholeFile ? UINT64_MAX : span->length;
+
+  newdir = tr_sys_path_dirname (span->newpath, error);
+  ok = newdir != NULL && tr_sys_dir_create (newdir, TR_SYS_DIR_CREATE_PARENTS, 0777, error);
+  tr_free (newdir);
+  if (!ok)
+    return false;
+
+  in = tr_sys_file_open (span->oldpath, TR_SYS_FILE_READ | TR_SYS_FILE_SEQUENTIAL, 0, error);
+  if (in == TR_BAD_SYS_FILE)
+    return false;
+
+  flags = TR_SYS_FILE_WRITE | TR_SYS_FILE_CREATE;
+  if (span->isWholeFile)
+    flags |= TR_SYS_FILE_TRUNCATE;
+  out = tr_sys_file_open (span->newpath, flags, 0666, error);
+  if (out == TR_BAD_SYS_FILE)
+    {
+      tr_sys_file_close (in, NULL);
+      return false;
+    }
+
+  ok = span->offset == 0
+    || (tr_sys_file_seek (in, span->offset, TR_SEEK_SET, NULL, error)
+        && tr_sys_file_seek (out, span->offset, TR_SEEK_SET, NULL, error));
+
+  /* copy in chunks so that we notice cancellation quickly,
+     and pause between them so that peers' disk I/O can get in */
+  while (ok && bytesLeft > 0)
+    {
+      uint64_t bytesCopied = 0;
+
+      if (job != NULL && relocateJobIsCancelled (job))
+        {
+          ok = false;
+          break;
+        }
+
+      ok = tr_sys_file_copy (in, out, MIN (bytesLeft, RELOCATE_CHUNK_SIZE), &bytesCopied, error);
+      if (!ok || bytesCopied == 0)
+        break;
+
+      bytesLeft -= bytesCopied;
+
+      if (job != NULL)
+        {
+          /* catch-up copies don't count toward the progress */
+          if (span->isWholeFile)
+            {
+              tr_lockLock (job->lock);
+              job->bytesCopied += bytesCopied;
+              tr_lockUnlock (job->lock);
+            }
+
+          tr_wait_msec (RELOCATE_CHUNK_PAUSE_MSEC);
+        }
+    }
+
+  tr_sys_file_close (out, NULL);
+  tr_sys_file_close (in, NULL);
+  return ok;
+}
+
+/* error is left unset if the copying was cancelled */
+static bool
+relocateCopySpans (struct relocate_job         * job,
+                   const struct relocate_span  * spans,
+                   int                           count,
+                   tr_error                   ** error)
+{
+  int i;
+
+  for (i=0; i<count; ++i)
+    {
+      tr_error * my_error = NULL;
+
+      if (!relocateCopySpan (job, &spans[i], &my_error))
+        {
+          if (my_error != NULL)
+            tr_error_propagate_prefixed (error, &my_error, "error copying \"%s\" to \"%s\": ",
+                                         spans[i].oldpath, spans[i].newpath);
+          return false;
+        }
+    }
+
+  return true;
+}
+
+static void
+relocateThreadFunc (void * vjob)
+{
+  int i;
+  bool removeCopies;
+  tr_error * error = NULL;
+  struct relocate_job * job = vjob;
+
+  relocateCopySpans (job, job->spans, job->count, &error);
+
+  tr_lockLock (job->lock);
+  job->error = error;
+  job->isDone = true;
+  removeCopies = job->removeCopiesOnExit;
+  tr_lockUnlock (job->lock);
+
+  /* nobody's waiting for us anymore, so clean up after ourselves */
+  if (removeCopies)
+    for (i=0; i<job->count; ++i)
+      tr_sys_path_remove (job->spans[i].newpath, NULL);
+
+  relocateJobUnref (job);
+}
+
+static void
+relocationFree (tr_torrent * tor)
+{
+  tr_file_index_t i;
+  struct tr_relocation * r = tor->relocation;
+
+  for (i=0; i<tor->info.fileCount; ++i)
+    {
+      tr_free (r->fileOldPath[i]);
+      tr_free (r->fileNewPath[i]);
+    }
+
+  if (r->timer != NULL)
+    event_free (r->timer);
+
+  tr_free (r->fileOldPath);
+  tr_free (r->fileNewPath);
+  tr_free (r->fileState);
+  tr_bitfieldDestruct (&r->dirtyBlocks);
+  tr_free (r->location);
+  tr_free (r);
+
+  tor->relocation = NULL;
+}
+
+/* put everything back where it was */
+static void
+relocationAbort (tr_torrent * tor)
+{
+  tr_file_index_t i;
+  struct tr_relocation * r = tor->relocation;
+
+  if (r->job != NULL)
+    {
+      tr_lockLock (r->job->lock);
+      r->job->isCancelled = true;
+      r->job->removeCopiesOnExit = true;
+      tr_lockUnlock (r->job->lock);
+
+      relocateJobUnref (r->job);
+      r->job = NULL;
+    }
+
+  for (i=0; i<tor->info.fileCount; ++i)
+    {
+      if (r->fileState[i] == RELOCATE_FILE_RENAMED)
+        {
+          tr_error * error = NULL;
+
+          if (!tr_sys_path_rename (r->fileNewPath[i], r->fileOldPath[i], &error))
+            {
+              tr_logAddTorErr (tor, "error moving \"%s\" back to \"%s\": %s",
+                               r->fileNewPath[i], r->fileOldPath[i], error->message);
+              tr_error_free (error);
+            }
+        }
+      else if (r->fileState[i] == RELOCATE_FILE_COPIED)
+        {
+          tr_sys_path_remove (r->fileNewPath[i], NULL);
+        }
+    }
+
+  if (r->setme_state != NULL)
+    *r->setme_state = TR_LOC_ERROR;
+
+  relocationFree (tor);
+}
+
+static void
+relocationFinish (tr_torrent * tor)
+{
+  struct tr_relocation * r = tor->relocation;
+  char * location = r->location;
+  volatile double * setme_progress = r->setme_progress;
+  volatile int * setme_state = r->setme_state;
+
+  r->location = NULL;
+  relocationFree (tor);
+
+  /* blow away the old copies and the leftover subdirectories */
+  tr_torrentDeleteLocalData (tor, tr_sys_path_remove);
+
+  /* set the new location */
+  tr_torrentSetDownloadDir (tor, location);
+  tr_free (tor->incompleteDir);
+  tor->incompleteDir = NULL;
+  tor->currentDir = tor->downloadDir;
+
+  tr_free (location);
+
+  /* only now that the torrent is using the new location */
+  if (setme_progress != NULL)
+    *setme_progress = 1.0;
+  if (setme_state != NULL)
+    *setme_state = TR_LOC_DONE;
+}
+
+static void onRelocateTimer (evutil_socket_t, short, void *);
+
+static void
+relocateSpanAdd (struct relocate_job  * job,
+                 const char           * oldpath,
+                 const char           * newpath,
+                 bool                   isWholeFile,
+                 uint64_t               offset,
+                 uint64_t               length)
+{
+  struct relocate_span * span;
+
+  job->spans = tr_renew (struct relocate_span, job->spans, job->count + 1);
+  span = &job->spans[job->count++];
+  span->oldpath = tr_strdup (oldpath);
+  span->newpath = tr_strdup (newpath);
+  span->isWholeFile = isWholeFile;
+  span->offset = offset;
+  span->length = length;
+}
+
+/* queue the dirty parts of a file that's already been copied.
+   returns the number of bytes queued */
+static uint64_t
+relocateSpanAddDirty (tr_torrent           * tor,
+                      struct relocate_job  * job,
+                      tr_file_index_t        fileIndex)
+{
+  tr_block_index_t b;
+  tr_block_index_t first;
+  tr_block_index_t last;
+  uint64_t bytesQueued = 0;
+  const tr_file * file = &tor->info.files[fileIndex];
+  const tr_bitfield * dirty = &tor->relocation->dirtyBlocks;
+
+  if (file->length == 0)
+    return 0;
+
+  first = file->offset / tor->blockSize;
+  last = (file->offset + file->length - 1) / tor->blockSize;
+
+  for (b=first; b<=last; ++b)
+    {
+      uint64_t begin;
+      uint64_t end;
+      tr_block_index_t runEnd;
+
+      if (!tr_bitfieldHas (dirty, b))
+        continue;
+
+      for (runEnd=b+1; runEnd<=last && tr_bitfieldHas (dirty, runEnd); )
+        ++runEnd;
+
+      /* clip the run of blocks to the file */
+      begin = MAX ((uint64_t)b * tor->blockSize, file->offset) - file->offset;
+      end = MIN ((uint64_t)runEnd * tor->blockSize, file->offset + file->length) - file->offset;
+      relocateSpanAdd (job, tor->relocation->fileOldPath[fileIndex],
+                       tor->relocation->fileNewPath[fileIndex],
+                       false, begin, end - begin);
+      bytesQueued += end - begin;
+
+      b = runEnd;
+    }
+
+  return bytesQueued;
+}
+
+/* copy whatever isn't in the new location yet, and finish when that's done */
+static void
+relocationStep (tr_torrent * tor)
+{
+  tr_file_index_t i;
+  struct tr_relocation * r = tor->relocation;
+  struct relocate_job * job;
+  bool hasWholeFiles = false;
+  uint64_t dirtyBytes = 0;
+
+  assert (r->job == NULL);
+
+  /* write pending blocks now, so that they get marked dirty */
+  tr_cacheFlushTorrent (tor->session->cache, tor);
+
+  job = tr_new0 (struct relocate_job, 1);
+
+  for (i=0; i<tor->info.fileCount; ++i)
+    {
+      char * sub;
+      char * oldpath;
+      char * newpath;
+      const char * base;
+
+      if (r->fileState[i] == RELOCATE_FILE_RENAMED)
+        continue;
+
+      if (!tr_torrentFindFile2 (tor, i, &base, &sub, NULL))
+        continue;
+
+      if (base == r->location)
+        {
+          tr_free (sub);
+          continue;
+        }
+
+      oldpath = tr_buildPath (base, sub, NULL);
+      newpath = tr_buildPath (r->location, sub, NULL);
+      tr_free (sub);
+
+      if (tr_sys_path_is_same (oldpath, newpath, NULL))
+        {
+          tr_free (newpath);
+          tr_free (oldpath);
+          continue;
+        }
+
+      if (r->fileState[i] == RELOCATE_FILE_COPIED && strcmp (newpath, r->fileNewPath[i]) == 0)
+        {
+          dirtyBytes += relocateSpanAddDirty (tor, job, i);
+          tr_free (newpath);
+          tr_free (oldpath);
+          continue;
+        }
+
+      /* if the file got renamed (e.g. it lost its ".part" suffix),
+         the copy under its old name is stale */
+      if (r->fileState[i] == RELOCATE_FILE_COPIED)
+        tr_sys_path_remove (r->fileNewPath[i], NULL);
+      else
+        r->bytesTotal += tor->info.files[i].length;
+
+      tr_logAddTorInfo (tor, "copying \"%s\" to \"%s\"", oldpath, newpath);
+
+      tr_free (r->fileOldPath[i]);
+      tr_free (r->fileNewPath[i]);
+      r->fileOldPath[i] = oldpath;
+      r->fileNewPath[i] = newpath;
+      r->fileState[i] = RELOCATE_FILE_COPIED;
+
+      relocateSpanAdd (job, oldpath, newpath, true, 0, 0);
+      hasWholeFiles = true;
+    }
+
+  /* everything that was dirty has been queued */
+  tr_bitfieldSetHasNone (&r->dirtyBlocks);
+  ++r->passCount;
+
+  if (!hasWholeFiles && dirtyBytes <= RELOCATE_SYNC_BYTES)
+    {
+      tr_error * error = NULL;
+
+      /* we're in the libtransmission thread, so nothing can
+         write to the torrent between this copy and the switch-over */
+      if (relocateCopySpans (NULL, job->spans, job->count, &error))
+        {
+          relocationFinish (tor);
+        }
+      else
+        {
+          tr_logAddTorErr (tor, "%s", error->message);
+          tr_error_free (error);
+          relocationAbort (tor);
+        }
+
+      relocateJobFree (job);
+      return;
+    }
+
+  /* the torrent is writing faster than we can copy it, so stop
+     requesting blocks. the next passes only have to catch up
+     on the requests that were already in flight. */
+  if (r->passCount >= RELOCATE_MAX_PASSES && !r->isHoldingWrites)
+    {
+      tr_logAddTorInfo (tor, "Pausing downloads until the move to \"%s\" is done", r->location);
+      r->isHoldingWrites = true;
+    }
+
+  /* one reference for us, one for the worker */
+  job->lock = tr_lockNew ();
+  job->refCount = 2;
+  r->job = job;
+  tr_threadNew (relocateThreadFunc, job);
+
+  if (r->timer == NULL)
+    r->timer = evtimer_new (tor->session->event_base, onRelocateTimer, tor);
+  tr_timerAddMsec (r->timer, RELOCATE_POLL_MSEC);
+}
+
+static void
+onRelocateTimer (evutil_socket_t foo UNUSED, short bar UNUSED, void * vtor)
+{
+  bool isDone;
+  bool isCancelled;
+  uint64_t bytesCopied;
+  tr_error * error;
+  tr_torrent * tor = vtor;
+  struct tr_relocation * r = tor->relocation;
+  struct relocate_job * job = r->job;
+
+  tr_torrentLock (tor);
+
+  tr_lockLock (job->lock);
+  isDone = job->isDone;
+  isCancelled = job->isCancelled;
+  bytesCopied = job->bytesCopied;
+  error = job->error;
+  job->error = NULL;
+  tr_lockUnlock (job->lock);
+
+  if (r->bytesTotal > 0)
+    r->progress = MIN (1.0, (double)(r->bytesDone + bytesCopied) / r->bytesTotal);
+  if (r->setme_progress != NULL)
+    *r->setme_progress = r->progress;
+
+  if (!isDone)
+    {
+      tr_timerAddMsec (r->timer, RELOCATE_POLL_MSEC);
+    }
+  else
+    {
+      r->bytesDone += bytesCopied;
+      relocateJobUnref (job);
+      r->job = NULL;
+
+      if (error != NULL)
+        {
+          tr_logAddTorErr (tor, "%s", error->message);
+          relocationAbort (tor);
+        }
+      else if (isCancelled)
+        {
+          tr_logAddTorInfo (tor, "Cancelled moving to \"%s\"", r->location);
+          relocationAbort (tor);
+        }
+      else
+        {
+          relocationStep (tor);
+        }
+
+      tr_error_free (error);
+    }
+
+  tr_torrentUnlock (tor);
+}
+
+static void
+relocationStart (tr_torrent       * tor,
+                 const char       * location,
+                 volatile double  * setme_progress,
+                 volatile int     * setme_state)
+{
+  tr_file_index_t i;
+  struct tr_relocation * r;
+  const tr_file_index_t n = tor->info.fileCount;
+
+  r = tr_new0 (struct tr_relocation, 1);
+  r->location = tr_strdup (location);
+  r->setme_progress = setme_progress;
+  r->setme_state = setme_state;
+  r->fileState = tr_new0 (int, n);
+  tr_bitfieldConstruct (&r->dirtyBlocks, tor->blockCount);
+  r->fileOldPath = tr_new0 (char *, n);
+  r->fileNewPath = tr_new0 (char *, n);
+  tor->relocation = r;
+
+  tr_cacheFlushTorrent (tor->session->cache, tor);
+
+  /* if the new location is on the same filesystem, renaming is instant.
+     anything that can't be renamed will be copied in the background. */
+  for (i=0; i<n; ++i)
+    {
+      char * sub;
+      const char * base;
+
+      if (tr_torrentFindFile2 (tor, i, &base, &sub, NULL))
+        {
+          char * oldpath = tr_buildPath (base, sub, NULL);
+          char * newpath = tr_buildPath (location, sub, NULL);
+          char * newdir = tr_sys_path_dirname (newpath, NULL);
+
+          tr_logAddDebug ("Found file #%d: %s", (int)i, oldpath);
+
+          if (!tor->relocateByCopying
+              && !tr_sys_path_is_same (oldpath, newpath, NULL)
+              && newdir != NULL
+              && tr_sys_dir_create (newdir, TR_SYS_DIR_CREATE_PARENTS, 0777, NULL)
+              && tr_sys_path_rename (oldpath, newpath, NULL))
+            {
+              tr_logAddTorInfo (tor, "moved \"%s\" to \"%s\"", oldpath, newpath);
+              r->fileState[i] = RELOCATE_FILE_RENAMED;
+              r->fileOldPath[i] = oldpath;
+              r->fileNewPath[i] = newpath;
+              r->bytesTotal += tor->info.files[i].length;
+              r->bytesDone += tor->info.files[i].length;
+            }
+          else
+            {
+              tr_free (newpath);
+              tr_free (oldpath);
+            }
+
+          tr_free (newdir);
+          tr_free (sub);
+        }
+    }
+
+  relocationStep (tor);
+}
+
+static bool
+relocationIsHoldingWrites (const tr_torrent * tor)
+{
+  return tor->relocation != NULL && tor->relocation->isHoldingWrites;
+}
+
+static float
+getRelocateProgress (const tr_torrent * tor)
+{
+  return tor->relocation->progress;
+}
+
+void
+tr_torrentNoteFileWrite (tr_torrent       * tor,
+                         tr_file_index_t    fileIndex,
+                         uint64_t           fileOffset,
+                         uint64_t           length)
+{
+  if (tor->relocation != NULL && length > 0)
+    {
+      const uint64_t offset = tor->info.files[fileIndex].offset + fileOffset;
+
+      tr_bitfieldAddRange (&tor->relocation->dirtyBlocks,
+                           offset / tor->blockSize,
+                           (offset + length - 1) / tor->blockSize + 1);
+    }
+}
+
+static void
+cancelSetLocation (void * vtor)
+{
+  tr_torrent * tor = vtor;
+
+  tr_torrentLock (tor);
+
+  /* the worker notices within a chunk; onRelocateTimer () cleans up */
+  if (tor->relocation != NULL && tor->relocation->job != NULL)
+    {
+      tr_lockLock (tor->relocation->job->lock);
+      tor->relocation->job->isCancelled = true;
+      tr_lockUnlock (tor->relocation->job->lock);
+    }
+
+  tr_torrentUnlock (tor);
+}
+
+void
+tr_torrentCancelSetLocation (tr_torrent * tor)
+{
+  assert (tr_isTorrent (tor));
+
+  tr_runInEventThread (tor->session, cancelSetLocation, tor);
+}
+
 struct LocationData
 {
   bool move_from_old_location;
@@ -3138,12 +4121,10 @@ struct LocationData
 static void
 setLocation (void * vdata)
 {
-  bool err = false;
   struct LocationData * data = vdata;
   tr_torrent * tor = data->tor;
   const bool do_move = data->move_from_old_location;
   const char * location = data->location;
-  double bytesHandled = 0;
   tr_torrentLock (tor);
 
   assert (tr_isTorrent (tor));
@@ -3153,75 +4134,42 @@ setLocation (void * vdata)
 
   tr_sys_dir_create (location, TR_SYS_DIR_CREATE_PARENTS, 0777, NULL);
 
-  if (!tr_sys_path_is_same (location, tor->currentDir, NULL))
+  if (tor->relocation != NULL)
     {
-      tr_file_index_t i;
+      tr_logAddTorErr (tor, "Can't move to \"%s\" while still moving to \"%s\"",
+                       location, tor->relocation->location);
 
+      if (data->setme_state != NULL)
+        *data->setme_state = TR_LOC_ERROR;
+    }
+  else if (do_move && !tr_sys_path_is_same (location, tor->currentDir, NULL))
+    {
       /* bad idea to move files while they're being verified... */
       tr_verifyRemove (tor);
 
-      /* try to move the files.
-       * FIXME: there are still all kinds of nasty cases, like what
-       * if the target directory runs out of space halfway through... */
-      for (i=0; !err && i<tor->info.fileCount; ++i)
+      relocationStart (tor, location, data->setme_progress, data->setme_state);
+    }
+  else
+    {
+      if (!tr_sys_path_is_same (location, tor->currentDir, NULL))
         {
-          char * sub;
-          const char * oldbase;
-          const tr_file * f = &tor->info.files[i];
-
-          if (tr_torrentFindFile2 (tor, i, &oldbase, &sub, NULL))
-            {
-              char * oldpath = tr_buildPath (oldbase, sub, NULL);
-              char * newpath = tr_buildPath (location, sub, NULL);
-
-              tr_logAddDebug ("Found file #%d: %s", (int)i, oldpath);
-
-              if (do_move && !tr_sys_path_is_same (oldpath, newpath, NULL))
-                {
-                  tr_error * error = NULL;
-
-                  tr_logAddTorInfo (tor, "moving \"%s\" to \"%s\"", oldpath, newpath);
-                  if (!tr_moveFile (oldpath, newpath, &error))
-                    {
-                      err = true;
-                      tr_logAddTorErr (tor, "error moving \"%s\" to \"%s\": %s",
-                                       oldpath, newpath, error->message);
-                      tr_error_free (error);
-                    }
-                }
-
-              tr_free (newpath);
-              tr_free (oldpath);
-              tr_free (sub);
-            }
-
-          if (data->setme_progress != NULL)
-            {
-              bytesHandled += f->length;
-              *data->setme_progress = bytesHandled / tor->info.totalSize;
-            }
+          tr_verifyRemove (tor);
+          tr_torrentSetDownloadDir (tor, location);
         }
 
-      if (!err)
+      if (do_move)
         {
-          /* blow away the leftover subdirectories in the old location */
-          if (do_move)
-            tr_torrentDeleteLocalData (tor, tr_sys_path_remove);
-
-          /* set the new location and reverify */
-          tr_torrentSetDownloadDir (tor, location);
+          tr_free (tor->incompleteDir);
+          tor->incompleteDir = NULL;
+          tor->currentDir = tor->downloadDir;
         }
-    }
 
-  if (!err && do_move)
-    {
-      tr_free (tor->incompleteDir);
-      tor->incompleteDir = NULL;
-      tor->currentDir = tor->downloadDir;
-    }
+      if (data->setme_progress != NULL)
+        *data->setme_progress = 1.0;
 
-  if (data->setme_state != NULL)
-    *data->setme_state = err ? TR_LOC_ERROR : TR_LOC_DONE;
+      if (data->setme_state != NULL)
+        *data->setme_state = TR_LOC_DONE;
+    }
 
   /* cleanup */
   tr_torrentUnlock (tor);
@@ -3369,6 +4317,40 @@ tr_torrentGotBlock (tr_torrent * tor, tr_block_index_t block)
 ****
 ***/
 
+/* look for a file, or its .part file, in the location it's being moved to */
+static void
+relocationFindFile (const tr_torrent  * tor,
+                    const tr_file     * file,
+                    const char       ** setme_base,
+                    const char       ** setme_subpath,
+                    char             ** part,
+                    tr_sys_path_info  * file_info)
+{
+  const char * location = tor->relocation->location;
+  char * filename = tr_buildPath (location, file->name, NULL);
+
+  if (tr_sys_path_get_info (filename, 0, file_info, NULL))
+    {
+      *setme_base = location;
+      *setme_subpath = file->name;
+    }
+  else
+    {
+      if (*part == NULL)
+        *part = tr_torrentBuildPartial (tor, file - tor->info.files);
+
+      tr_free (filename);
+      filename = tr_buildPath (location, *part, NULL);
+      if (tr_sys_path_get_info (filename, 0, file_info, NULL))
+        {
+          *setme_base = location;
+          *setme_subpath = *part;
+        }
+    }
+
+  tr_free (filename);
+}
+
 bool
 tr_torrentFindFile2 (const tr_torrent * tor, tr_file_index_t fileNum,
                      const char ** base, char ** subpath, time_t * mtime)
@@ -3384,6 +4366,11 @@ tr_torrentFindFile2 (const tr_torrent * tor, tr_file_index_t fileNum,
 
   file = &tor->info.files[fileNum];
 
+  /* a file that a running move already renamed is only in the new location.
+     look there first, so that writes don't recreate it in the old one */
+  if ((tor->relocation != NULL) && (tor->relocation->fileState[fileNum] == RELOCATE_FILE_RENAMED))
+    relocationFindFile (tor, file, &b, &s, &part, &file_info);
+
   /* look in the download dir... */
   if (b == NULL)
     {
@@ -3408,7 +4395,7 @@ tr_torrentFindFile2 (const tr_torrent * tor, tr_file_index_t fileNum,
       tr_free (filename);
     }
 
-  if (b == NULL)
+  if ((b == NULL) && (part == NULL))
     part = tr_torrentBuildPartial (tor, fileNum);
 
   /* look for a .part file in the incomplete dir... */
@@ -3435,6 +4422,10 @@ tr_torrentFindFile2 (const tr_torrent * tor, tr_file_index_t fileNum,
       tr_free (filename);
     }
 
+  /* if the torrent is being moved, look where it's being moved to... */
+  if ((b == NULL) && (tor->relocation != NULL))
+    relocationFindFile (tor, file, &b, &s, &part, &file_info);
+
   /* return the results */
   if (base != NULL)
     *base = b;
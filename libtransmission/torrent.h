@@ -19,6 +19,8 @@
 
 struct tr_torrent_tiers;
 struct tr_magnet_info;
+struct tr_relocation;
+struct tr_info_dict_cache;
 
 /**
 ***  Package-visible ctor API
@@ -177,6 +179,13 @@ struct tr_torrent
      * This pointer will be equal to downloadDir or incompleteDir */
     const char * currentDir;
 
+    /* Non-NULL while the files are being moved by tr_torrentSetLocation () */
+    struct tr_relocation * relocation;
+
+    /* If true, tr_torrentSetLocation () copies files even when it could
+     * rename them. The tests use this to move by copying on one filesystem */
+    bool relocateByCopying;
+
     /* How many bytes we ask for per request */
     uint32_t                   blockSize;
     tr_block_index_t           blockCount;
@@ -249,6 +258,10 @@ struct tr_torrent
 
     bool                       infoDictOffsetIsCached;
 
+    /* the raw info dict, kept in memory while we're serving it to magnet peers */
+    struct tr_info_dict_cache * infoDictCache;
+    time_t                     infoDictCacheUsedAt;
+
     uint16_t                   maxConnectedPeers;
 
     tr_verify_state            verifyState;
@@ -256,12 +269,21 @@ struct tr_torrent
     time_t                     lastStatTime;
     tr_stat                    stats;
 
+    /* the copy of `stats' that was last published for other threads,
+       and when. only used in the libtransmission thread */
+    tr_stat                    statSnapshot;
+    time_t                     statSnapshotAt;
+    bool                       hasStatSnapshot;
+
     tr_torrent *               next;
 
     int                        uniqueId;
 
     struct tr_bandwidth        bandwidth;
 
+    /* the group whose bandwidth is this torrent's parent, or NULL */
+    struct tr_bandwidth_group * bandwidthGroup;
+
     struct tr_swarm          * swarm;
 
     float                      desiredRatio;
@@ -272,6 +294,9 @@ struct tr_torrent
     bool                       finishedSeedingByIdle;
 
     bool                       sequentialDownload;
+
+    /* BEP 16. Only takes effect while we're a seed; see tr_torrentIsSuperSeeding () */
+    bool                       superSeeding;
 };
 
 static inline tr_torrent*
@@ -393,6 +418,22 @@ uint32_t tr_getBlockSize (uint32_t pieceSize);
  */
 void tr_torrentGotBlock (tr_torrent * tor, tr_block_index_t blockIndex);
 
+/**
+ * Tell the tr_torrent that part of one of its files was written to,
+ * in case it needs copying again to where the torrent is being moved
+ */
+void tr_torrentNoteFileWrite (tr_torrent       * tor,
+                              tr_file_index_t    fileIndex,
+                              uint64_t           fileOffset,
+                              uint64_t           length);
+
+/* refresh the torrents' stale snapshots and publish them for
+   tr_torrentStatSnapshot (). called once a second */
+void tr_torrentsPublishStats (tr_session * session);
+
+/* drop the published snapshots when the session closes */
+void tr_torrentsFreeStats (tr_session * session);
+
 
 
 /**
@@ -462,6 +503,13 @@ tr_torrentHasNone (const tr_torrent * tor)
   return tr_cpHasNone (&tor->completion);
 }
 
+/* super-seeding only makes sense when we've got every piece to hand out */
+static inline bool
+tr_torrentIsSuperSeeding (const tr_torrent * tor)
+{
+  return tor->superSeeding && tr_torrentHasAll (tor);
+}
+
 static inline bool
 tr_torrentPieceIsComplete (const tr_torrent * tor, tr_piece_index_t i)
 {
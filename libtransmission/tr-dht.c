@@ -54,6 +54,7 @@
 #include "file.h"
 #include "log.h"
 #include "net.h"
+#include "peer-common.h" /* tr_swarmGetStats () */
 #include "peer-mgr.h" /* tr_peerMgrCompactToPex () */
 #include "platform.h" /* tr_threadNew () */
 #include "session.h"
@@ -69,6 +70,60 @@ static tr_session *session = NULL;
 
 static void timer_callback (evutil_socket_t s, short type, void *ignore);
 
+enum
+{
+    /* most DHT searches we'll run at once, per address family */
+    DHT_MAX_ACTIVE_SEARCHES = 16,
+
+    /* forget a search that never reported back after this long */
+    DHT_SEARCH_TIMEOUT_SECS = 10 * 60,
+
+    /* a torrent with fewer connected peers than this is poorly connected */
+    DHT_FEW_PEERS = 10
+};
+
+struct dht_announce
+{
+    /* matches tor->dhtAnnounceAt or dhtAnnounce6At while still wanted */
+    time_t dueAt;
+
+    /* downloading or poorly-connected torrents go first among the due ones */
+    bool isHighPriority;
+
+    int torrentId;
+};
+
+struct dht_heap
+{
+    struct dht_announce * items;
+    int count;
+    int alloc;
+
+    /* order by priority before due time */
+    bool byPriority;
+};
+
+struct dht_search
+{
+    unsigned char hash[SHA_DIGEST_LENGTH];
+    time_t startedAt;
+};
+
+/* one per address family. Torrents waiting to announce are kept in a
+   min-heap so that upkeep only has to look at the ones that are due.
+   Those move to a second heap, where priority decides which go first
+   when there are more than we can search for at once. */
+struct dht_scheduler
+{
+    struct dht_heap waiting;
+    struct dht_heap due;
+
+    struct dht_search active[DHT_MAX_ACTIVE_SEARCHES];
+    int activeCount;
+};
+
+static struct dht_scheduler schedulers[2];
+
 struct bootstrap_closure {
     tr_session *session;
     uint8_t *nodes;
@@ -270,6 +325,7 @@ tr_dhtInit (tr_session *ss)
     const uint8_t * raw;
     size_t len, len6;
     struct bootstrap_closure * cl;
+    tr_torrent * tor;
 
     if (session) /* already initialized */
         return -1;
@@ -316,6 +372,8 @@ tr_dhtInit (tr_session *ss)
         goto fail;
 
     session = ss;
+    schedulers[0].due.byPriority = true;
+    schedulers[1].due.byPriority = true;
 
     cl = tr_new (struct bootstrap_closure, 1);
     cl->session = session;
@@ -328,6 +386,11 @@ tr_dhtInit (tr_session *ss)
     dht_timer = evtimer_new (session->event_base, timer_callback, session);
     tr_timerAdd (dht_timer, 0, tr_rand_int_weak (1000000));
 
+    tor = NULL;
+    while ((tor = tr_torrentNext (session, tor)))
+        if (tor->isRunning)
+            tr_dhtTorrentStarted (tor);
+
     tr_logAddNamedDbg ("DHT", "DHT initialized");
 
     return 1;
@@ -392,6 +455,11 @@ tr_dhtUninit (tr_session *ss)
     }
 
     dht_uninit ();
+    tr_free (schedulers[0].waiting.items);
+    tr_free (schedulers[0].due.items);
+    tr_free (schedulers[1].waiting.items);
+    tr_free (schedulers[1].due.items);
+    memset (schedulers, 0, sizeof (schedulers));
     tr_logAddNamedDbg ("DHT", "Done uninitializing DHT");
 
     session = NULL;
@@ -512,6 +580,137 @@ tr_dhtPrintableStatus (int status)
     }
 }
 
+/***
+****  Announce scheduling
+***/
+
+static struct dht_scheduler *
+getScheduler (int af)
+{
+    return &schedulers[af == AF_INET6 ? 1 : 0];
+}
+
+static time_t *
+getAnnounceAt (tr_torrent * tor, int af)
+{
+    return af == AF_INET6 ? &tor->dhtAnnounce6At : &tor->dhtAnnounceAt;
+}
+
+static bool
+heapIsBefore (const struct dht_heap * h, int a, int b)
+{
+    const struct dht_announce * aa = &h->items[a];
+    const struct dht_announce * bb = &h->items[b];
+
+    if (h->byPriority && aa->isHighPriority != bb->isHighPriority)
+        return aa->isHighPriority;
+
+    return aa->dueAt < bb->dueAt;
+}
+
+static void
+heapSwap (struct dht_heap * h, int a, int b)
+{
+    const struct dht_announce tmp = h->items[a];
+    h->items[a] = h->items[b];
+    h->items[b] = tmp;
+}
+
+static void
+heapPush (struct dht_heap * h, const struct dht_announce * a)
+{
+    int i;
+
+    if (h->count == h->alloc) {
+        h->alloc = h->alloc ? h->alloc * 2 : 64;
+        h->items = tr_renew (struct dht_announce, h->items, h->alloc);
+    }
+
+    i = h->count++;
+    h->items[i] = *a;
+
+    while (i > 0 && heapIsBefore (h, i, (i-1)/2)) {
+        heapSwap (h, i, (i-1)/2);
+        i = (i-1)/2;
+    }
+}
+
+static void
+heapPop (struct dht_heap * h, struct dht_announce * setme)
+{
+    int i = 0;
+
+    assert (h->count > 0);
+
+    *setme = h->items[0];
+    h->items[0] = h->items[--h->count];
+
+    for (;;) {
+        const int left = i*2 + 1;
+        const int right = left + 1;
+        int first = i;
+
+        if (left < h->count && heapIsBefore (h, left, first))
+            first = left;
+        if (right < h->count && heapIsBefore (h, right, first))
+            first = right;
+        if (first == i)
+            break;
+
+        heapSwap (h, i, first);
+        i = first;
+    }
+}
+
+static bool
+isHighPriority (const tr_torrent * tor)
+{
+    tr_swarm_stats stats;
+
+    if (!tr_torrentIsSeed (tor))
+        return true;
+
+    tr_swarmGetStats (tor->swarm, &stats);
+    return stats.peerCount < DHT_FEW_PEERS;
+}
+
+static void
+scheduleAnnounce (tr_torrent * tor, int af, time_t dueAt)
+{
+    struct dht_announce a;
+
+    *getAnnounceAt (tor, af) = dueAt;
+
+    a.dueAt = dueAt;
+    a.isHighPriority = false;
+    a.torrentId = tor->uniqueId;
+    heapPush (&getScheduler (af)->waiting, &a);
+}
+
+static struct dht_search *
+findActiveSearch (struct dht_scheduler * s, const unsigned char * hash)
+{
+    int i;
+
+    for (i=0; i<s->activeCount; ++i)
+        if (memcmp (s->active[i].hash, hash, SHA_DIGEST_LENGTH) == 0)
+            return &s->active[i];
+
+    return NULL;
+}
+
+static void
+removeActiveSearch (struct dht_scheduler * s, struct dht_search * search)
+{
+    tr_removeElementFromArray (s->active, search - s->active,
+                               sizeof (struct dht_search),
+                               s->activeCount--);
+}
+
+/***
+****
+***/
+
 static void
 callback (void *ignore UNUSED, int event,
           const unsigned char *info_hash, const void *data, size_t data_len)
@@ -531,6 +730,7 @@ callback (void *ignore UNUSED, int event,
             for (i=0; i<n; ++i)
                 tr_peerMgrAddPex (tor, TR_PEER_FROM_DHT, pex+i, -1);
             tr_free (pex);
+            session->perfStats.peersFound += n;
             tr_logAddTorDbg (tor, "Learned %d %s peers from DHT",
                     (int)n,
                       event == DHT_EVENT_VALUES6 ? "IPv6" : "IPv4");
@@ -538,7 +738,14 @@ callback (void *ignore UNUSED, int event,
         tr_sessionUnlock (session);
     } else if (event == DHT_EVENT_SEARCH_DONE ||
                event == DHT_EVENT_SEARCH_DONE6) {
+        const int af = event == DHT_EVENT_SEARCH_DONE ? AF_INET : AF_INET6;
+        struct dht_scheduler * s = getScheduler (af);
+        struct dht_search * search = findActiveSearch (s, info_hash);
         tr_torrent * tor = tr_torrentFindFromHash (session, info_hash);
+        if (search != NULL) {
+            removeActiveSearch (s, search);
+            ++session->perfStats.searchesDone;
+        }
         if (tor) {
             if (event == DHT_EVENT_SEARCH_DONE) {
                 tr_logAddTorInfo (tor, "%s", "IPv4 DHT announce done");
@@ -552,76 +759,128 @@ callback (void *ignore UNUSED, int event,
 }
 
 static int
-tr_dhtAnnounce (tr_torrent *tor, int af, bool announce)
+tr_dhtAnnounce (tr_torrent *tor, int af, int status, int numnodes, bool announce)
 {
-    int rc, status, numnodes, ret = 0;
-
-    if (!tr_torrentAllowsDHT (tor))
-        return -1;
-
-    status = tr_dhtStatus (tor->session, af, &numnodes);
-
-    if (status == TR_DHT_STOPPED) {
-        /* Let the caller believe everything is all right. */
-        return 1;
-    }
+    int rc;
 
-    if (status >= TR_DHT_POOR) {
-        rc = dht_search (tor->info.hash,
-                         announce ? tr_sessionGetPeerPort (session) : 0,
-                         af, callback, NULL);
-        if (rc >= 1) {
-            tr_logAddTorInfo (tor, "Starting %s DHT announce (%s, %d nodes)",
-                      af == AF_INET6 ? "IPv6" : "IPv4",
-                      tr_dhtPrintableStatus (status), numnodes);
-            if (af == AF_INET)
-                tor->dhtAnnounceInProgress = true;
-            else
-                tor->dhtAnnounce6InProgress = true;
-            ret = 1;
-        } else {
-            tr_logAddTorErr (tor, "%s DHT announce failed (%s, %d nodes): %s",
-                      af == AF_INET6 ? "IPv6" : "IPv4",
-                      tr_dhtPrintableStatus (status), numnodes,
-                      tr_strerror (errno));
-        }
-    } else {
-        tr_logAddTorDbg (tor, "%s DHT not ready (%s, %d nodes)",
+    rc = dht_search (tor->info.hash,
+                     announce ? tr_sessionGetPeerPort (session) : 0,
+                     af, callback, NULL);
+    if (rc >= 1) {
+        struct dht_scheduler * s = getScheduler (af);
+        struct dht_search * search = &s->active[s->activeCount++];
+        memcpy (search->hash, tor->info.hash, SHA_DIGEST_LENGTH);
+        search->startedAt = tr_time ();
+        ++session->perfStats.searchesStarted;
+        tr_logAddTorInfo (tor, "Starting %s DHT announce (%s, %d nodes)",
                   af == AF_INET6 ? "IPv6" : "IPv4",
                   tr_dhtPrintableStatus (status), numnodes);
+        if (af == AF_INET)
+            tor->dhtAnnounceInProgress = true;
+        else
+            tor->dhtAnnounce6InProgress = true;
+        return 1;
     }
 
-    return ret;
+    tr_logAddTorErr (tor, "%s DHT announce failed (%s, %d nodes): %s",
+              af == AF_INET6 ? "IPv6" : "IPv4",
+              tr_dhtPrintableStatus (status), numnodes,
+              tr_strerror (errno));
+    return 0;
 }
 
 void
-tr_dhtUpkeep (tr_session * session)
+tr_dhtTorrentStarted (tr_torrent * tor)
 {
-    tr_torrent * tor = NULL;
     const time_t now = tr_time ();
 
-    while ((tor = tr_torrentNext (session, tor)))
+    if (!tr_dhtEnabled (tor->session))
+        return;
+
+    scheduleAnnounce (tor, AF_INET, now + tr_rand_int_weak (20));
+    scheduleAnnounce (tor, AF_INET6, now + tr_rand_int_weak (20));
+}
+
+static void
+upkeepAf (tr_session * session, int af, time_t now)
+{
+    int i, numnodes;
+    struct dht_scheduler * s = getScheduler (af);
+    const int status = tr_dhtStatus (session, af, &numnodes);
+
+    /* searches that never reported back don't count against the cap forever */
+    for (i=0; i<s->activeCount; )
+        if (s->active[i].startedAt + DHT_SEARCH_TIMEOUT_SECS <= now)
+            removeActiveSearch (s, &s->active[i]);
+        else
+            ++i;
+
+    /* until the DHT is ready, the due announces just wait in the heap */
+    if (status < TR_DHT_POOR)
+        return;
+
+    /* priority only decides the order among the announces that are due */
+    while (s->waiting.count > 0 && s->waiting.items[0].dueAt <= now)
     {
-        if (!tor->isRunning || !tr_torrentAllowsDHT (tor))
+        struct dht_announce a;
+        tr_torrent * tor;
+
+        heapPop (&s->waiting, &a);
+
+        tor = tr_torrentFindFromId (session, a.torrentId);
+        if (tor == NULL || *getAnnounceAt (tor, af) != a.dueAt)
             continue;
 
-        if (tor->dhtAnnounceAt <= now)
-        {
-            const int rc = tr_dhtAnnounce (tor, AF_INET, 1);
+        a.isHighPriority = isHighPriority (tor);
+        heapPush (&s->due, &a);
+    }
 
-            tor->dhtAnnounceAt = now + ((rc == 0)
-                                     ? 5 + tr_rand_int_weak (5)
-                                     : 25 * 60 + tr_rand_int_weak (3*60));
-        }
+    while (s->due.count > 0 && s->activeCount < DHT_MAX_ACTIVE_SEARCHES)
+    {
+        struct dht_announce a;
+        tr_torrent * tor;
 
-        if (tor->dhtAnnounce6At <= now)
-        {
-            const int rc = tr_dhtAnnounce (tor, AF_INET6, 1);
+        heapPop (&s->due, &a);
 
-            tor->dhtAnnounce6At = now + ((rc == 0)
-                                      ? 5 + tr_rand_int_weak (5)
-                                      : 25 * 60 + tr_rand_int_weak (3*60));
-        }
+        /* skip announces for torrents that were removed, stopped,
+           or rescheduled since this one was queued */
+        tor = tr_torrentFindFromId (session, a.torrentId);
+        if (tor == NULL || !tor->isRunning || !tr_torrentAllowsDHT (tor)
+                        || *getAnnounceAt (tor, af) != a.dueAt)
+            continue;
+
+        if (findActiveSearch (s, tor->info.hash) != NULL)
+            scheduleAnnounce (tor, af, now + 25 * 60 + tr_rand_int_weak (3*60));
+        else if (tr_dhtAnnounce (tor, af, status, numnodes, true))
+            scheduleAnnounce (tor, af, now + 25 * 60 + tr_rand_int_weak (3*60));
+        else
+            scheduleAnnounce (tor, af, now + 5 + tr_rand_int_weak (5));
+    }
+}
+
+void
+tr_dhtUpkeep (tr_session * session)
+{
+    struct tr_perf_stats * stats = &session->perfStats;
+    const time_t now = tr_time ();
+
+    if (!tr_dhtEnabled (session))
+        return;
+
+    if (session->udp_socket != TR_BAD_SOCKET)
+        upkeepAf (session, AF_INET, now);
+    if (session->udp6_socket != TR_BAD_SOCKET)
+        upkeepAf (session, AF_INET6, now);
+
+    stats->searchesActive = schedulers[0].activeCount + schedulers[1].activeCount;
+    stats->announcesQueued = schedulers[0].waiting.count + schedulers[0].due.count
+                           + schedulers[1].waiting.count + schedulers[1].due.count;
+    dht_nodes (AF_INET, &stats->nodesGood, &stats->nodesDubious, NULL, NULL);
+    if (session->udp6_socket != TR_BAD_SOCKET) {
+        int good, dubious;
+        dht_nodes (AF_INET6, &good, &dubious, NULL, NULL);
+        stats->nodesGood += good;
+        stats->nodesDubious += dubious;
     }
 }
 
@@ -23,6 +23,7 @@ THE SOFTWARE.
 /* ansi */
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h> /* qsort () */
 #include <string.h> /* strlen (), strncpy (), strstr (), memset () */
 
 /* posix */
@@ -80,7 +81,8 @@ static tr_port lpd_port;
 static tr_torrent* lpd_torStaticType UNUSED; /* just a helper for static type analysis */
 static tr_session* session;
 
-enum { lpd_maxDatagramLength = 200 }; /**<the size an LPD datagram must not exceed */
+enum { lpd_maxDatagramLength = 1400 }; /**<the size an LPD datagram must not exceed;
+                                          room for a couple dozen infohashes below a typical MTU */
 const char lpd_mcastGroup[] = "239.192.152.143"; /**<LPD multicast group */
 const int lpd_mcastPort = 6771; /**<LPD source and destination UPD port */
 static struct sockaddr_in lpd_mcastAddr; /**<initialized from the above constants in tr_lpdInit */
@@ -102,7 +104,8 @@ enum lpd_enumTimeToLive {
 
 enum {
     lpd_announceInterval = 4 * 60, /**<4 min announce interval per torrent */
-    lpd_announceScope = lpd_ttlSameSubnet /**<the maximum scope for LPD datagrams */
+    lpd_announceScope = lpd_ttlSameSubnet, /**<the maximum scope for LPD datagrams */
+    lpd_maxDatagramsPerUpkeep = 4 /**<how many announce datagrams to send per interval */
 };
 
 
@@ -203,14 +206,18 @@ static const char* lpd_extractHeader (const char* s, struct lpd_protocolVersion*
 * @param[in] name Name of parameter to extract
 * @param[in] n Maximum available storage for value to return
 * @param[out] val Output parameter for the actual value
-* @return Returns 1 if value could be copied successfully
+* @return Returns a pointer to the "\r\n" ending the value if it could be copied
+*         successfully, or NULL otherwise
 *
 * Extracts the associated value of a named parameter from a HTTP-style header by
 * performing the following steps:
 *   - assemble search string "\r\nName: " and locate position
 *   - copy back value from end to next "\r\n"
+*
+* Passing the returned pointer back in as str finds the next value of a parameter
+* that occurs more than once, such as "Infohash".
 */
-static bool lpd_extractParam (const char* const str, const char* const name, int n, char* const val)
+static const char* lpd_extractParam (const char* const str, const char* const name, int n, char* const val)
 {
     /* configure maximum length of search string here */
     enum { maxLength = 30 };
@@ -221,33 +228,37 @@ static bool lpd_extractParam (const char* const str, const char* const name, int
     assert (val != NULL);
 
     if (strlen (name) > maxLength - strlen (CRLF ": "))
-        return false;
+        return NULL;
 
     /* compose the string token to search for */
     tr_snprintf (sstr, maxLength, CRLF "%s: ", name);
 
     pos = strstr (str, sstr);
     if (pos == NULL)
-        return false; /* search was not successful */
+        return NULL; /* search was not successful */
 
     {
         const char* const beg = pos + strlen (sstr);
         const char* const new_line = strstr (beg, CRLF);
 
         /* the value is delimited by the next CRLF */
-        int len = new_line - beg;
+        int len;
+
+        if (new_line == NULL)
+            return NULL;
 
         /* if value string hits the length limit n,
          * leave space for a trailing '\0' character */
+        len = new_line - beg;
         if (len < n--)
             n = len;
 
         strncpy (val, beg, n);
         val[n] = 0;
-    }
 
-    /* we successfully returned the value string */
-    return true;
+        /* we successfully returned the value string */
+        return new_line;
+    }
 }
 
 /**
@@ -422,57 +433,69 @@ lpd_consistencyCheck (void)
 */
 
 /**
-* @brief Announce the given torrent on the local network
+* @brief Announce the given torrents on the local network
 *
-* @param[in] t Torrent to announce
-* @return Returns true on success
+* @param[in] torrents Torrents to announce
+* @param[in] torrentCount Number of torrents in the array
+* @return Returns how many of the torrents were announced, or 0 on failure
 *
-* Send a query for torrent t out to the LPD multicast group (or the LAN, for that
-* matter). A listening client on the same network might react by adding us to his
-* peer pool for torrent t.
+* Send a query for as many of the given torrents as fit into one datagram out to
+* the LPD multicast group (or the LAN, for that matter). BEP 14 allows one
+* "Infohash" header per torrent. A listening client on the same network might
+* react by adding us to his peer pool for these torrents.
 */
-bool
-tr_lpdSendAnnounce (const tr_torrent* t)
+int
+tr_lpdSendAnnounce (const tr_torrent** torrents, int torrentCount)
 {
     size_t i;
+    int n, len;
     const char fmt[] =
         "BT-SEARCH * HTTP/%u.%u" CRLF
         "Host: %s:%u" CRLF
-        "Port: %u" CRLF
-        "Infohash: %s" CRLF
-        CRLF
-        CRLF;
+        "Port: %u" CRLF;
+    const char trailer[] = CRLF CRLF;
 
-    char hashString[lengthof (t->info.hashString)];
+    char hashString[lengthof (torrents[0]->info.hashString)];
     char query[lpd_maxDatagramLength + 1] = { 0 };
 
-    if (t == NULL)
-        return false;
-
-    /* make sure the hash string is normalized, just in case */
-    for (i = 0; i < sizeof hashString; i++)
-        hashString[i] = toupper (t->info.hashString[i]);
+    if (torrents == NULL || torrentCount < 1)
+        return 0;
 
     /* prepare a zero-terminated announce message */
-    tr_snprintf (query, lpd_maxDatagramLength + 1, fmt, 1, 1,
-                 lpd_mcastGroup, lpd_mcastPort, lpd_port, hashString);
+    len = tr_snprintf (query, lpd_maxDatagramLength + 1, fmt, 1, 1,
+                       lpd_mcastGroup, lpd_mcastPort, lpd_port);
 
-    /* actually send the query out using [lpd_socket2] */
+    for (n = 0; n < torrentCount; n++)
     {
-        const int len = strlen (query);
+        const size_t need = strlen ("Infohash: " CRLF) + sizeof hashString - 1;
+
+        if (len + need + strlen (trailer) > lpd_maxDatagramLength)
+            break;
+
+        /* make sure the hash string is normalized, just in case */
+        for (i = 0; i < sizeof hashString; i++)
+            hashString[i] = toupper (torrents[n]->info.hashString[i]);
 
+        len += tr_snprintf (query + len, lpd_maxDatagramLength + 1 - len,
+                            "Infohash: %s" CRLF, hashString);
+    }
+
+    len += tr_snprintf (query + len, lpd_maxDatagramLength + 1 - len, "%s", trailer);
+
+    /* actually send the query out using [lpd_socket2] */
+    {
         /* destination address info has already been set up in tr_lpdInit (),
          * so we refrain from preparing another sockaddr_in here */
         int res = sendto (lpd_socket2, (const void *) query, len, 0,
           (const struct sockaddr*) &lpd_mcastAddr, sizeof lpd_mcastAddr);
 
         if (res != len)
-            return false;
+            return 0;
     }
 
-    tr_logAddTorDbg (t, "LPD announce message away");
+    tr_logAddNamedDbg ("LPD", "LPD announce message away for %d torrents", n);
 
-    return true;
+    return n;
 }
 
 /**
@@ -482,8 +505,8 @@ tr_lpdSendAnnounce (const tr_torrent* t)
 * @param[in,out] peer Adress information of the peer to add
 * @param[in] msg The announcement message to consider
 * @return Returns 0 if any input parameter or the announce was invalid, 1 if the peer
-* was successfully added, -1 if not; a non-null return value indicates a side-effect to
-* the peer in/out parameter.
+* was successfully added to at least one torrent, -1 if not; a non-null return value
+* indicates a side-effect to the peer in/out parameter.
 *
 * @note The port information gets added to the peer structure if tr_lpdConsiderAnnounce
 * is able to extract the necessary information from the announce message. That is, if
@@ -504,7 +527,7 @@ static int tr_lpdConsiderAnnounce (tr_pex* peer, const char* const msg)
 
     if (peer != NULL && msg != NULL)
     {
-        tr_torrent* tor = NULL;
+        const char* pos;
 
         const char* params = lpd_extractHeader (msg, &ver);
         if (params == NULL || ver.major != 1) /* allow messages of protocol v1 */
@@ -512,7 +535,7 @@ static int tr_lpdConsiderAnnounce (tr_pex* peer, const char* const msg)
 
         /* save the effort to check Host, which seems to be optional anyway */
 
-        if (!lpd_extractParam (params, "Port", maxValueLen, value))
+        if (lpd_extractParam (params, "Port", maxValueLen, value) == NULL)
             return 0;
 
         /* determine announced peer port, refuse if value too large */
@@ -522,24 +545,26 @@ static int tr_lpdConsiderAnnounce (tr_pex* peer, const char* const msg)
         peer->port = htons (peerPort);
         res = -1; /* signal caller side-effect to peer->port via return != 0 */
 
-        if (!lpd_extractParam (params, "Infohash", maxHashLen, hashString))
-            return res;
-
-        tor = tr_torrentFindFromHashString (session, hashString);
-
-        if (tr_isTorrent (tor) && tr_torrentAllowsLPD (tor))
+        /* one announce may carry several Infohash headers */
+        pos = params;
+        while ((pos = lpd_extractParam (pos, "Infohash", maxHashLen, hashString)) != NULL)
         {
-            /* we found a suitable peer, add it to the torrent */
-            tr_peerMgrAddPex (tor, TR_PEER_FROM_LPD, peer, -1);
-            tr_logAddTorDbg (tor, "Learned %d local peer from LPD (%s:%u)",
-                1, tr_address_to_string (&peer->addr), peerPort);
+            tr_torrent* tor = tr_torrentFindFromHashString (session, hashString);
+
+            if (tr_isTorrent (tor) && tr_torrentAllowsLPD (tor))
+            {
+                /* we found a suitable peer, add it to the torrent */
+                tr_peerMgrAddPex (tor, TR_PEER_FROM_LPD, peer, -1);
+                tr_logAddTorDbg (tor, "Learned %d local peer from LPD (%s:%u)",
+                    1, tr_address_to_string (&peer->addr), peerPort);
 
-            /* periodic reconnectPulse () deals with the rest... */
+                /* periodic reconnectPulse () deals with the rest... */
 
-            return 1;
+                res = 1;
+            }
+            else
+                tr_logAddNamedDbg ("LPD", "Cannot serve torrent #%s", hashString);
         }
-        else
-            tr_logAddNamedDbg ("LPD", "Cannot serve torrent #%s", hashString);
     }
 
     return res;
@@ -558,6 +583,28 @@ static int tr_lpdConsiderAnnounce (tr_pex* peer, const char* const msg)
 * most of the previous paragraph isn't true anymore... we weren't using that functionality
 * before. are there cases where we should? if not, should we remove the bells & whistles?
 */
+struct lpd_candidate
+{
+    tr_torrent* tor;
+    int announcePrio;
+};
+
+/* downloads before seeds; then whoever has waited longest */
+static int
+lpd_compareCandidates (const void* va, const void* vb)
+{
+    const struct lpd_candidate* a = va;
+    const struct lpd_candidate* b = vb;
+
+    if (a->announcePrio != b->announcePrio)
+        return a->announcePrio < b->announcePrio ? -1 : 1;
+
+    if (a->tor->lpdAnnounceAt != b->tor->lpdAnnounceAt)
+        return a->tor->lpdAnnounceAt < b->tor->lpdAnnounceAt ? -1 : 1;
+
+    return 0;
+}
+
 static int
 tr_lpdAnnounceMore (const time_t now, const int interval)
 {
@@ -567,10 +614,13 @@ tr_lpdAnnounceMore (const time_t now, const int interval)
     if (!tr_isSession (session))
         return -1;
 
-    while ((tor = tr_torrentNext (session, tor))
-          && tr_sessionAllowsLPD (session))
+    if (tr_sessionAllowsLPD (session))
     {
-        if (tr_isTorrent (tor))
+        int i, n = 0, datagrams = 0;
+        struct lpd_candidate* candidates = tr_new (struct lpd_candidate, session->torrentCount);
+        const tr_torrent** torrents = tr_new (const tr_torrent*, session->torrentCount);
+
+        while ((tor = tr_torrentNext (session, tor)))
         {
             int announcePrio = 0;
 
@@ -592,15 +642,35 @@ tr_lpdAnnounceMore (const time_t now, const int interval)
 
             if (announcePrio > 0 && tor->lpdAnnounceAt <= now)
             {
-                if (tr_lpdSendAnnounce (tor))
-                    announcesSent++;
+                candidates[n].tor = tor;
+                candidates[n].announcePrio = announcePrio;
+                ++n;
+            }
+        }
+
+        qsort (candidates, n, sizeof (struct lpd_candidate), lpd_compareCandidates);
+        for (i = 0; i < n; i++)
+            torrents[i] = candidates[i].tor;
+
+        /* pack as many due torrents into each datagram as will fit */
+        while (announcesSent < n && datagrams++ < lpd_maxDatagramsPerUpkeep)
+        {
+            const int sent = tr_lpdSendAnnounce (torrents + announcesSent, n - announcesSent);
 
-                tor->lpdAnnounceAt = now +
-                    lpd_announceInterval * announcePrio;
+            if (sent < 1)
+                break;
 
-                break; /* that's enough; for this interval */
+            for (i = announcesSent; i < announcesSent + sent; i++)
+            {
+                tor = candidates[i].tor;
+                tor->lpdAnnounceAt = now + lpd_announceInterval * candidates[i].announcePrio;
             }
+
+            announcesSent += sent;
         }
+
+        tr_free (torrents);
+        tr_free (candidates);
     }
 
     /* perform housekeeping for the flood protection mechanism */
@@ -29,7 +29,7 @@ THE SOFTWARE.
 int  tr_lpdInit (tr_session*, tr_address*);
 void tr_lpdUninit (tr_session*);
 bool tr_lpdEnabled (const tr_session*);
-bool tr_lpdSendAnnounce (const tr_torrent*);
+int tr_lpdSendAnnounce (const tr_torrent** torrents, int torrentCount);
 
 /**
 * @defgroup Preproc Helper macros
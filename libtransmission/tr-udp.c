@@ -21,6 +21,10 @@ THE SOFTWARE.
 
 */
 
+#if (defined (HAVE_RECVMMSG) || defined (HAVE_SENDMMSG)) && !defined (_GNU_SOURCE)
+ #define _GNU_SOURCE /* glibc's sys/socket.h needs this to pick up recvmmsg () and sendmmsg () */
+#endif
+
 #include <assert.h>
 #include <string.h> /* memcmp (), memcpy (), memset () */
 #include <stdlib.h> /* malloc (), free () */
@@ -29,6 +33,7 @@ THE SOFTWARE.
  #include <io.h> /* dup2 () */
 #else
  #include <unistd.h> /* dup2 () */
+ #include <sys/socket.h> /* recvmmsg (), sendmmsg () */
 #endif
 
 #include <event2/event.h>
@@ -195,48 +200,222 @@ rebind_ipv6 (tr_session *ss, bool force)
     }
 }
 
-static void
-event_callback (evutil_socket_t s, short type UNUSED, void *sv)
-{
-    int rc;
-    socklen_t fromlen;
-    unsigned char buf[4096];
-    struct sockaddr_storage from;
-    tr_session *ss = sv;
-
-    assert (tr_isSession (sv));
-    assert (type == EV_READ);
+/* How many datagrams we read or write per syscall when the
+   platform has recvmmsg () and sendmmsg (). */
 
-    fromlen = sizeof (from);
-    rc = recvfrom (s, (void *) buf, 4096 - 1, 0,
-                (struct sockaddr*)&from, &fromlen);
+#define UDP_BATCH_SIZE 32
+#define UDP_MAX_BATCHES_PER_WAKEUP 8
+#define UDP_PACKET_BUFFER_SIZE 4096
 
-    /* Since most packets we receive here are ÂµTP, make quick inline
+static void
+handle_packet (tr_session *ss, unsigned char *buf, int rc,
+               struct sockaddr *from, socklen_t fromlen)
+{
+    /* Since most packets we receive here are µTP, make quick inline
        checks for the other protocols.  The logic is as follows:
        - all DHT packets start with 'd';
        - all UDP tracker packets start with a 32-bit (!) "action", which
          is between 0 and 3;
-       - the above cannot be ÂµTP packets, since these start with a 4-bit
+       - the above cannot be µTP packets, since these start with a 4-bit
          version number (1). */
-    if (rc > 0) {
-        if (buf[0] == 'd') {
-            if (tr_sessionAllowsDHT (ss)) {
-                buf[rc] = '\0'; /* required by the DHT code */
-                tr_dhtCallback (buf, rc, (struct sockaddr*)&from, fromlen, sv);
-            }
-        } else if (rc >= 8 &&
-                   buf[0] == 0 && buf[1] == 0 && buf[2] == 0 && buf[3] <= 3) {
-            rc = tau_handle_message (ss, buf, rc);
+    if (buf[0] == 'd') {
+        if (tr_sessionAllowsDHT (ss)) {
+            buf[rc] = '\0'; /* required by the DHT code */
+            tr_dhtCallback (buf, rc, from, fromlen, ss);
+        }
+    } else if (rc >= 8 &&
+               buf[0] == 0 && buf[1] == 0 && buf[2] == 0 && buf[3] <= 3) {
+        rc = tau_handle_message (ss, buf, rc);
+        if (!rc)
+            tr_logAddNamedDbg ("UDP", "Couldn't parse UDP tracker packet.");
+    } else {
+        if (tr_sessionIsUTPEnabled (ss)) {
+            rc = tr_utpPacket (buf, rc, from, fromlen, ss);
             if (!rc)
-                tr_logAddNamedDbg ("UDP", "Couldn't parse UDP tracker packet.");
-        } else {
-            if (tr_sessionIsUTPEnabled (ss)) {
-                rc = tr_utpPacket (buf, rc, (struct sockaddr*)&from, fromlen, ss);
-                if (!rc)
-                    tr_logAddNamedDbg ("UDP", "Unexpected UDP packet");
+                tr_logAddNamedDbg ("UDP", "Unexpected UDP packet");
+        }
+    }
+}
+
+/* Outgoing µTP datagrams are queued while a batch is open
+   and then handed to the kernel together by sendmmsg (). */
+
+#ifdef HAVE_SENDMMSG
+
+struct udp_outgoing
+{
+    tr_socket_t sock;
+    size_t buflen;
+    socklen_t tolen;
+    struct sockaddr_storage to;
+    unsigned char buf[UDP_PACKET_BUFFER_SIZE];
+};
+
+static struct udp_outgoing outgoing[UDP_BATCH_SIZE];
+static int outgoing_count = 0;
+static int batch_depth = 0;
+
+static void
+flush_outgoing (tr_session *ss)
+{
+    int i = 0;
+
+    while (i < outgoing_count) {
+        int j, n, rc;
+        struct mmsghdr msgs[UDP_BATCH_SIZE];
+        struct iovec iovs[UDP_BATCH_SIZE];
+        const tr_socket_t sock = outgoing[i].sock;
+
+        /* sendmmsg () takes a single socket, so send runs of
+           datagrams that share one */
+        for (n=0; i+n < outgoing_count && outgoing[i+n].sock == sock; ++n) {
+            struct udp_outgoing *o = &outgoing[i+n];
+            iovs[n].iov_base = o->buf;
+            iovs[n].iov_len = o->buflen;
+            memset (&msgs[n], 0, sizeof (msgs[n]));
+            msgs[n].msg_hdr.msg_name = &o->to;
+            msgs[n].msg_hdr.msg_namelen = o->tolen;
+            msgs[n].msg_hdr.msg_iov = &iovs[n];
+            msgs[n].msg_hdr.msg_iovlen = 1;
+        }
+
+        for (j=0; j<n; j+=rc) {
+            rc = sendmmsg (sock, msgs + j, n - j, 0);
+            ++ss->perfStats.sendCalls;
+            if (rc <= 0)
+                break; /* UDP is lossy anyway; drop the rest of this run */
+            ss->perfStats.packetsSent += rc;
+        }
+
+        i += n;
+    }
+
+    outgoing_count = 0;
+}
+
+void
+tr_udpBatchBegin (tr_session *ss UNUSED)
+{
+    ++batch_depth;
+}
+
+void
+tr_udpBatchEnd (tr_session *ss)
+{
+    assert (batch_depth > 0);
+
+    if (--batch_depth == 0)
+        flush_outgoing (ss);
+}
+
+#else
+
+void
+tr_udpBatchBegin (tr_session *ss UNUSED)
+{
+}
+
+void
+tr_udpBatchEnd (tr_session *ss UNUSED)
+{
+}
+
+#endif
+
+void
+tr_udpSendTo (tr_session *ss, tr_socket_t sock,
+              const void *buf, size_t buflen,
+              const struct sockaddr *to, socklen_t tolen)
+{
+#ifdef HAVE_SENDMMSG
+    if (batch_depth > 0 && buflen <= UDP_PACKET_BUFFER_SIZE
+                        && tolen <= sizeof (struct sockaddr_storage)) {
+        struct udp_outgoing *o;
+
+        if (outgoing_count == UDP_BATCH_SIZE)
+            flush_outgoing (ss);
+
+        o = &outgoing[outgoing_count++];
+        o->sock = sock;
+        o->buflen = buflen;
+        o->tolen = tolen;
+        memcpy (&o->to, to, tolen);
+        memcpy (o->buf, buf, buflen);
+        return;
+    }
+#endif
+
+    ++ss->perfStats.sendCalls;
+    if (sendto (sock, buf, buflen, 0, to, tolen) >= 0)
+        ++ss->perfStats.packetsSent;
+}
+
+static void
+event_callback (evutil_socket_t s, short type UNUSED, void *sv)
+{
+    tr_session *ss = sv;
+
+    assert (tr_isSession (sv));
+    assert (type == EV_READ);
+
+    tr_udpBatchBegin (ss);
+
+#ifdef HAVE_RECVMMSG
+    {
+        int i, n, round;
+        static unsigned char bufs[UDP_BATCH_SIZE][UDP_PACKET_BUFFER_SIZE];
+        struct sockaddr_storage froms[UDP_BATCH_SIZE];
+        struct iovec iovs[UDP_BATCH_SIZE];
+        struct mmsghdr msgs[UDP_BATCH_SIZE];
+
+        /* Drain the socket, but don't starve the rest of the event loop */
+        for (round=0; round<UDP_MAX_BATCHES_PER_WAKEUP; ++round) {
+            for (i=0; i<UDP_BATCH_SIZE; ++i) {
+                iovs[i].iov_base = bufs[i];
+                iovs[i].iov_len = UDP_PACKET_BUFFER_SIZE - 1;
+                memset (&msgs[i], 0, sizeof (msgs[i]));
+                msgs[i].msg_hdr.msg_name = &froms[i];
+                msgs[i].msg_hdr.msg_namelen = sizeof (froms[i]);
+                msgs[i].msg_hdr.msg_iov = &iovs[i];
+                msgs[i].msg_hdr.msg_iovlen = 1;
             }
+
+            n = recvmmsg (s, msgs, UDP_BATCH_SIZE, MSG_DONTWAIT, NULL);
+            ++ss->perfStats.receiveCalls;
+            if (n <= 0)
+                break;
+
+            ss->perfStats.packetsReceived += n;
+            for (i=0; i<n; ++i)
+                if (msgs[i].msg_len > 0)
+                    handle_packet (ss, bufs[i], msgs[i].msg_len,
+                                   (struct sockaddr*)&froms[i],
+                                   msgs[i].msg_hdr.msg_namelen);
+
+            if (n < UDP_BATCH_SIZE)
+                break;
         }
     }
+#else
+    {
+        int rc;
+        socklen_t fromlen;
+        unsigned char buf[UDP_PACKET_BUFFER_SIZE];
+        struct sockaddr_storage from;
+
+        fromlen = sizeof (from);
+        rc = recvfrom (s, (void *) buf, UDP_PACKET_BUFFER_SIZE - 1, 0,
+                       (struct sockaddr*)&from, &fromlen);
+        ++ss->perfStats.receiveCalls;
+
+        if (rc > 0) {
+            ++ss->perfStats.packetsReceived;
+            handle_packet (ss, buf, rc, (struct sockaddr*)&from, fromlen);
+        }
+    }
+#endif
+
+    tr_udpBatchEnd (ss);
 }
 
 void
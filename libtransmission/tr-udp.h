@@ -31,6 +31,15 @@ void tr_udpInit (tr_session *);
 void tr_udpUninit (tr_session *);
 void tr_udpSetSocketBuffers (tr_session *);
 
+/* Sends a datagram on one of the session's UDP sockets.
+   Between tr_udpBatchBegin () and tr_udpBatchEnd (), datagrams may be
+   queued and sent together when the outermost batch ends. */
+void tr_udpSendTo (tr_session *, tr_socket_t sock,
+                   const void *buf, size_t buflen,
+                   const struct sockaddr *to, socklen_t tolen);
+void tr_udpBatchBegin (tr_session *);
+void tr_udpBatchEnd (tr_session *);
+
 bool tau_handle_message (tr_session * session,
                          const uint8_t  * msg, size_t msglen);
 
@@ -574,6 +574,42 @@ void  tr_sessionLimitSpeed       (tr_session *, tr_direction, bool);
 bool  tr_sessionIsSpeedLimited   (const tr_session *, tr_direction);
 
 
+/***
+****  Bandwidth groups
+****
+****  A bandwidth group is a named speed limit shared by every torrent
+****  assigned to it. Groups sit between the session and its torrents,
+****  so a group's torrents obey their own limits, the group's limits,
+****  and (unless told otherwise) the session's limits.
+****
+****  Groups are created the first time they're named by one of the
+****  setters below or by tr_torrentSetGroup ().
+***/
+
+void          tr_sessionSetGroupSpeedLimit_KBps (tr_session *, const char * group, tr_direction, unsigned int KBps);
+unsigned int  tr_sessionGetGroupSpeedLimit_KBps (const tr_session *, const char * group, tr_direction);
+
+void          tr_sessionLimitGroupSpeed         (tr_session *, const char * group, tr_direction, bool);
+bool          tr_sessionIsGroupSpeedLimited     (const tr_session *, const char * group, tr_direction);
+
+void          tr_sessionGroupUseSessionLimits   (tr_session *, const char * group, bool);
+bool          tr_sessionGroupUsesSessionLimits  (const tr_session *, const char * group);
+
+void          tr_sessionSetGroupPriority        (tr_session *, const char * group, tr_priority_t);
+tr_priority_t tr_sessionGetGroupPriority        (const tr_session *, const char * group);
+
+double        tr_sessionGetGroupRawSpeed_KBps   (const tr_session *, const char * group, tr_direction);
+
+/** @brief the number of bandwidth groups in the session */
+int           tr_sessionCountGroups             (const tr_session *);
+
+/** @brief the name of the nth bandwidth group, or NULL if n is out of range */
+const char *  tr_sessionGetGroupName            (const tr_session *, int n);
+
+/** @brief remove a bandwidth group. Its torrents go back to using only their own and the session's limits. */
+void          tr_sessionRemoveGroup             (tr_session *, const char * group);
+
+
 /***
 ****  Alternative speed limits that are used during scheduled times
 ***/
@@ -661,6 +697,17 @@ void            tr_torrentSetPriority (tr_torrent *, tr_priority_t);
 bool       tr_torrentGetSequentialDownload (const tr_torrent *);
 void       tr_torrentSetSequentialDownload (tr_torrent *, bool);
 
+/**
+ * @brief BEP 16 super-seeding.
+ *
+ * While we have every piece, advertise them to each peer one at a time
+ * instead of sending a full bitfield, and only advertise another once
+ * the last one's been passed on to other peers. This gets a new torrent
+ * into the swarm while uploading little more than one copy of it.
+ */
+bool       tr_torrentGetSuperSeeding (const tr_torrent *);
+void       tr_torrentSetSuperSeeding (tr_torrent *, bool);
+
 /***
 ****
 ****  Torrent Queueing
@@ -1158,6 +1205,14 @@ void tr_torrentSetLocation (tr_torrent       * torrent,
                             volatile double  * setme_progress,
                             volatile int     * setme_state);
 
+/**
+ * @brief Stop a tr_torrentSetLocation () that's still copying files.
+ *
+ * The torrent keeps its files in their old location,
+ * and tr_torrentSetLocation ()'s setme_state is set to TR_LOC_ERROR.
+ */
+void tr_torrentCancelSetLocation (tr_torrent * torrent);
+
 uint64_t tr_torrentGetBytesLeftToAllocate (const tr_torrent * torrent);
 
 /**
@@ -1209,6 +1264,12 @@ bool         tr_torrentUsesSpeedLimit     (const tr_torrent *, tr_direction);
 void         tr_torrentUseSessionLimits   (tr_torrent *, bool);
 bool         tr_torrentUsesSessionLimits  (const tr_torrent *);
 
+/** @brief put the torrent in a bandwidth group, or take it out of its group if the name is NULL or empty */
+void         tr_torrentSetGroup           (tr_torrent *, const char * group);
+
+/** @return the name of the torrent's bandwidth group, or NULL if it's not in one */
+const char * tr_torrentGetGroup           (const tr_torrent *);
+
 
 /****
 *****  Ratio Limits
@@ -1539,6 +1600,13 @@ typedef struct tr_peer_stat
 
     /* how many requests we've made and are currently awaiting a response for */
     int      pendingReqsToPeer;
+
+    /* how many requests we're trying to keep in flight to this peer */
+    int      pipelineDepth;
+
+    /* smoothed and lowest round-trip times of our requests; 0 if unknown */
+    int      rttMsec;
+    int      minRttMsec;
 }
 tr_peer_stat;
 
@@ -1585,6 +1653,10 @@ typedef struct
     /* human-readable string identifying the tracker */
     char host[1024];
 
+    /* how many milliseconds the tracker's host took to answer the most
+     * recent announce sent to it by any torrent, or -1 if unknown */
+    int hostLatencyMsec;
+
     /* the full announce URL */
     char announce[1024];
 
@@ -1887,6 +1959,14 @@ typedef struct tr_stat
         @see tr_stat.activity */
     float recheckProgress;
 
+    /** True while tr_torrentSetLocation () is copying this torrent's
+        files to their new location in the background */
+    bool isRelocating;
+
+    /** When isRelocating is true, how much of the files has been moved.
+        Range is [0..1] */
+    float relocateProgress;
+
     /** How much has been downloaded of the entire torrent.
         Range is [0..1] */
     float percentComplete;
@@ -2040,6 +2120,23 @@ const tr_stat * tr_torrentStat (tr_torrent * torrent);
     reduce the CPU load if you're calling tr_torrentStat () frequently. */
 const tr_stat * tr_torrentStatCached (tr_torrent * torrent);
 
+/** Copy the most recently published statistics of the torrent with
+    the given id into `setme'. Once a second, libtransmission publishes
+    a read-only copy of every torrent's statistics, refreshing those whose
+    state, speeds or peers have changed. Reading it doesn't take the
+    session lock or recalculate anything, so this is much cheaper than
+    tr_torrentStat () and can be called from any thread. Returns false if
+    there's no such torrent, or if nothing's been published for it yet. */
+bool tr_torrentStatSnapshot (tr_session * session, int torrentId, tr_stat * setme);
+
+/** Like tr_torrentStatSnapshot (), for `n' torrents at once, all from
+    the same published copy. Torrents with no snapshot get an id of -1
+    in `setme'. Returns how many snapshots were copied. */
+int tr_torrentStatSnapshots (tr_session  * session,
+                             const int   * torrentIds,
+                             int           n,
+                             tr_stat     * setme);
+
 /** @deprecated */
 TR_DEPRECATED void tr_torrentSetAddedDate (tr_torrent * torrent,
                                            time_t       addedDate);
@@ -18,6 +18,10 @@
  #include <unistd.h> /* read (), write (), pipe () */
 #endif
 
+#ifdef HAVE_SYS_EVENTFD_H
+ #include <sys/eventfd.h>
+#endif
+
 #include <event2/dns.h>
 #include <event2/event.h>
 
@@ -27,7 +31,7 @@
 #include "session.h"
 
 #include "transmission.h"
-#include "platform.h" /* tr_lockLock () */
+#include "platform.h" /* tr_amInThread () */
 #include "trevent.h"
 #include "utils.h"
 
@@ -134,28 +138,47 @@ typedef int tr_pipe_end_t;
 #define pipewrite(a,b,c) write (a,b,c)
 #endif
 
+
 /***
 ****
 ***/
 
+struct tr_run_data
+{
+    void  (*func)(void *);
+    void *  user_data;
+
+    /* when tr_runInEventThread () queued it */
+    uint64_t queuedAt;
+
+    struct tr_run_data * volatile next;
+};
+
+/**
+ * Work for the libevent thread is passed through an intrusive
+ * multi-producer, single-consumer queue: producers swap themselves
+ * into `head' and then link the previous head to themselves, while
+ * the libevent thread pops from `tail'. `stub' keeps the queue from
+ * ever being empty, so neither side needs a lock.
+ */
 typedef struct tr_event_handle
 {
-    uint8_t      die;
+    volatile uint8_t die;
     tr_pipe_end_t fds[2];
-    tr_lock *    lock;
     tr_session *  session;
     tr_thread *  thread;
     struct event_base * base;
     struct event * pipeEvent;
+
+    struct tr_run_data * volatile head;
+    struct tr_run_data * tail;
+    struct tr_run_data stub;
+
+    /* nonzero while a wakeup is on its way to the libevent thread */
+    volatile int wakeupPending;
 }
 tr_event_handle;
 
-struct tr_run_data
-{
-    void  (*func)(void *);
-    void *  user_data;
-};
-
 #define dbgmsg(...) \
     do { \
         if (tr_logGetDeepEnabled ()) \
@@ -163,55 +186,138 @@ struct tr_run_data
     } while (0)
 
 static void
-readFromPipe (evutil_socket_t   fd,
+queuePush (tr_event_handle * eh, struct tr_run_data * data)
+{
+    struct tr_run_data * prev;
+
+    data->next = NULL;
+    prev = tr_atomicExchangePtr (&eh->head, data);
+    tr_atomicStorePtr (&prev->next, data);
+}
+
+/* returns NULL if the queue is empty, or if a producer is halfway
+   through a push -- it will send another wakeup when it's done */
+static struct tr_run_data *
+queuePop (tr_event_handle * eh)
+{
+    struct tr_run_data * tail = eh->tail;
+    struct tr_run_data * next = tr_atomicLoadPtr (&tail->next);
+
+    if (tail == &eh->stub)
+    {
+        if (next == NULL)
+            return NULL;
+
+        eh->tail = tail = next;
+        next = tr_atomicLoadPtr (&next->next);
+    }
+
+    if (next != NULL)
+    {
+        eh->tail = next;
+        return tail;
+    }
+
+    if (tail != tr_atomicLoadPtr (&eh->head))
+        return NULL;
+
+    queuePush (eh, &eh->stub);
+
+    next = tr_atomicLoadPtr (&tail->next);
+    if (next != NULL)
+    {
+        eh->tail = next;
+        return tail;
+    }
+
+    return NULL;
+}
+
+static void
+sendWakeup (tr_event_handle * eh)
+{
+    ev_ssize_t res;
+
+#ifdef HAVE_SYS_EVENTFD_H
+    const uint64_t one = 1;
+    res = write (eh->fds[1], &one, sizeof (one));
+#else
+    const char ch = 'r';
+    res = pipewrite (eh->fds[1], &ch, 1);
+#endif
+
+    if (res == -1)
+        tr_logAddError ("Unable to write to libtransmisison event queue: %s", tr_strerror(errno));
+}
+
+static void
+clearWakeup (tr_event_handle * eh)
+{
+#ifdef HAVE_SYS_EVENTFD_H
+    uint64_t count;
+    while (read (eh->fds[0], &count, sizeof (count)) > 0)
+        ;
+#else
+    char buf[64];
+    while (piperead (eh->fds[0], buf, sizeof (buf)) > 0)
+        ;
+#endif
+}
+
+static void
+closeWakeup (tr_event_handle * eh)
+{
+    tr_netCloseSocket (eh->fds[0]);
+    if (eh->fds[1] != eh->fds[0])
+        tr_netCloseSocket (eh->fds[1]);
+}
+
+static void
+readFromPipe (evutil_socket_t   fd UNUSED,
               short             eventType,
               void            * veh)
 {
-    char              ch;
-    int               ret;
+    int depth;
+    uint64_t now;
+    struct tr_run_data * data;
     tr_event_handle * eh = veh;
+    struct tr_perf_stats * stats = &eh->session->perfStats;
 
     dbgmsg ("readFromPipe: eventType is %hd", eventType);
 
-    /* read the command type */
-    ch = '\0';
-    do
+    /* reset the wakeup before draining, so that anything queued
+       after we've looked will send a new one */
+    clearWakeup (eh);
+    tr_atomicExchangeInt (&eh->wakeupPending, 0);
+    ++stats->wakeups;
+
+    if (eh->die)
     {
-        ret = piperead (fd, &ch, 1);
+        dbgmsg ("shutting down... removing event listener");
+        event_free (eh->pipeEvent);
+        closeWakeup (eh);
+        event_base_loopexit (eh->base, NULL);
+        return;
     }
-    while (!eh->die && ret < 0 && errno == EAGAIN);
 
-    dbgmsg ("command is [%c], ret is %d, errno is %d", ch, ret, (int)errno);
+    depth = tr_atomicAddInt (&stats->queueDepth, 0);
+    if (stats->maxQueueDepth < depth)
+        stats->maxQueueDepth = depth;
 
-    switch (ch)
+    now = tr_time_msec ();
+    while (!eh->die && (data = queuePop (eh)) != NULL)
     {
-        case 'r': /* run in libevent thread */
-        {
-            struct tr_run_data data;
-            const size_t       nwant = sizeof (data);
-            const ev_ssize_t   ngot = piperead (fd, &data, nwant);
-            if (!eh->die && (ngot == (ev_ssize_t) nwant))
-            {
-                dbgmsg ("invoking function in libevent thread");
-              (data.func)(data.user_data);
-            }
-            break;
-        }
+        const uint64_t latency = now > data->queuedAt ? now - data->queuedAt : 0;
 
-        case '\0': /* eof */
-        {
-            dbgmsg ("pipe eof reached... removing event listener");
-            event_free (eh->pipeEvent);
-            tr_netCloseSocket (eh->fds[0]);
-            event_base_loopexit (eh->base, NULL);
-            break;
-        }
+        tr_atomicAddInt (&stats->queueDepth, -1);
+        ++stats->tasksRun;
+        stats->totalLatencyMsec += latency;
+        if (stats->maxLatencyMsec < latency)
+            stats->maxLatencyMsec = latency;
 
-        default:
-        {
-            assert (0 && "unhandled command type!");
-            break;
-        }
+        dbgmsg ("invoking function in libevent thread");
+        (data->func)(data->user_data);
+        tr_free (data);
     }
 }
 
@@ -244,7 +350,7 @@ libeventThreadFunc (void * veh)
     eh->session->evdns_base = evdns_base_new (base, true);
     eh->session->events = eh;
 
-    /* listen to the pipe's read fd */
+    /* listen for wakeups */
     eh->pipeEvent = event_new (base, eh->fds[0], EV_READ | EV_PERSIST, readFromPipe, veh);
     event_add (eh->pipeEvent, NULL);
     event_set_log_callback (logFunc);
@@ -254,7 +360,11 @@ libeventThreadFunc (void * veh)
         event_base_dispatch (base);
 
     /* shut down the thread */
-    tr_lockFree (eh->lock);
+    {
+        struct tr_run_data * data;
+        while ((data = queuePop (eh)) != NULL)
+            tr_free (data);
+    }
     event_base_free (base);
     eh->session->events = NULL;
     tr_free (eh);
@@ -269,9 +379,15 @@ tr_eventInit (tr_session * session)
     session->events = NULL;
 
     eh = tr_new0 (tr_event_handle, 1);
-    eh->lock = tr_lockNew ();
+    eh->head = eh->tail = &eh->stub;
+#ifdef HAVE_SYS_EVENTFD_H
+    if ((eh->fds[0] = eh->fds[1] = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1)
+      tr_logAddError ("Unable to create eventfd() in libtransmission: %s", tr_strerror(errno));
+#else
     if (pipe (eh->fds) == -1)
       tr_logAddError ("Unable to write to pipe() in libtransmission: %s", tr_strerror(errno));
+    evutil_make_socket_nonblocking (eh->fds[0]);
+#endif
     eh->session = session;
     eh->thread = tr_threadNew (libeventThreadFunc, eh);
 
@@ -290,7 +406,7 @@ tr_eventClose (tr_session * session)
 
     session->events->die = true;
     tr_logAddDeep (__FILE__, __LINE__, NULL, "closing trevent pipe");
-    tr_netCloseSocket (session->events->fds[1]);
+    sendWakeup (session->events);
 }
 
 /**
@@ -323,26 +439,18 @@ tr_runInEventThread (tr_session * session,
     }
   else
     {
-      tr_pipe_end_t fd;
-      char ch;
-      ev_ssize_t res_1;
-      ev_ssize_t res_2;
       tr_event_handle * e = session->events;
-      struct tr_run_data data;
-
-      tr_lockLock (e->lock);
+      struct tr_run_data * data = tr_new (struct tr_run_data, 1);
 
-      fd = e->fds[1];
-      ch = 'r';
-      res_1 = pipewrite (fd, &ch, 1);
+      data->func = func;
+      data->user_data = user_data;
+      data->queuedAt = tr_time_msec ();
 
-      data.func = func;
-      data.user_data = user_data;
-      res_2 = pipewrite (fd, &data, sizeof (data));
+      tr_atomicAddInt (&session->perfStats.queueDepth, 1);
+      queuePush (e, data);
 
-      tr_lockUnlock (e->lock);
-
-      if ((res_1 == -1) || (res_2 == -1))
-        tr_logAddError ("Unable to write to libtransmisison event queue: %s", tr_strerror(errno));
+      /* only the first producer since the last drain needs to wake it up */
+      if (tr_atomicExchangeInt (&e->wakeupPending, 1) == 0)
+        sendWakeup (e);
     }
 }
@@ -1458,10 +1458,8 @@ tr_moveFile (const char * oldpath, const char * newpath, tr_error ** error)
 {
   tr_sys_file_t in;
   tr_sys_file_t out;
-  char * buf = NULL;
   tr_sys_path_info info;
   uint64_t bytesLeft;
-  const size_t buflen = 1024 * 128; /* 128 KiB buffer */
 
   /* make sure the old file exists */
   if (!tr_sys_path_get_info (oldpath, 0, &info, error))
@@ -1507,28 +1505,24 @@ tr_moveFile (const char * oldpath, const char * newpath, tr_error ** error)
       return false;
     }
 
-  buf = tr_valloc (buflen);
   bytesLeft = info.size;
   while (bytesLeft > 0)
     {
-      const uint64_t bytesThisPass = MIN (bytesLeft, buflen);
-      uint64_t numRead, bytesWritten;
-      if (!tr_sys_file_read (in, buf, bytesThisPass, &numRead, error))
+      uint64_t bytesCopied;
+      if (!tr_sys_file_copy (in, out, bytesLeft, &bytesCopied, error) || bytesCopied == 0)
         break;
-      if (!tr_sys_file_write (out, buf, numRead, &bytesWritten, error))
-        break;
-      assert (numRead == bytesWritten);
-      assert (bytesWritten <= bytesLeft);
-      bytesLeft -= bytesWritten;
+      assert (bytesCopied <= bytesLeft);
+      bytesLeft -= bytesCopied;
     }
 
   /* cleanup */
-  tr_free (buf);
   tr_sys_file_close (out, NULL);
   tr_sys_file_close (in, NULL);
 
   if (bytesLeft != 0)
     {
+      if (error != NULL && *error == NULL)
+        tr_error_set_literal (error, TR_ERROR_EINVAL, "Old file is shorter than expected.");
       tr_error_prefix (error, "Unable to read/write: ");
       return false;
     }
@@ -7,17 +7,19 @@
  */
 
 #include <assert.h>
+#include <errno.h>
 #include <string.h> /* strlen (), strstr () */
 
 #ifdef _WIN32
   #include <ws2tcpip.h>
 #else
-  #include <sys/select.h>
+  #include <sys/socket.h> /* AF_UNIX */
 #endif
 
 #include <curl/curl.h>
 
 #include <event2/buffer.h>
+#include <event2/event.h>
 
 #include "transmission.h"
 #include "file.h"
@@ -36,9 +38,36 @@
  #define USE_LIBCURL_SOCKOPT
 #endif
 
+#if LIBCURL_VERSION_NUM >= 0x071900 /* CURLOPT_TCP_KEEPALIVE was added in 7.25.0 */
+ #define USE_LIBCURL_TCP_KEEPALIVE
+#endif
+
+#if LIBCURL_VERSION_NUM >= 0x071E00 /* CURLMOPT_MAX_HOST_CONNECTIONS was added in 7.30.0 */
+ #define USE_LIBCURL_MAX_HOST_CONNECTIONS
+#endif
+
+#ifdef _WIN32
+ #define WAKEUP_SOCKETPAIR_AF AF_INET
+#else
+ #define WAKEUP_SOCKETPAIR_AF AF_UNIX
+#endif
+
 enum
 {
-  THREADFUNC_MAX_SLEEP_MSEC = 200,
+  /* how long to wait before retrying webseed transfers that were
+     paused because their torrent ran out of bandwidth */
+  UNPAUSE_INTERVAL_MSEC = 100,
+
+  /* how many finished easy handles to keep around for reuse.
+     a recycled handle keeps its DNS and TLS session caches */
+  MAX_IDLE_EASY_HANDLES = 32,
+
+  /* how many idle keep-alive connections the multi handle may cache */
+  MAX_CACHED_CONNECTIONS = 64,
+
+  /* how many connections we open to a single host at once.
+     tasks beyond this wait in libcurl for a connection to free up */
+  MAX_HOST_CONNECTIONS = 6
 };
 
 #if 0
@@ -104,6 +133,22 @@ struct tr_web
   struct tr_web_task * tasks;
   tr_lock * taskLock;
   char * cookie_filename;
+
+  /* finished easy handles waiting to be reused. only touched by the web thread */
+  tr_list * idle_easy_handles;
+  int idle_easy_handle_count;
+
+  /* the web thread runs its own libevent loop, and libcurl tells it
+     which sockets to watch and when to time out */
+  CURLM * multi;
+  struct event_base * base;
+  struct event * timer_event;
+  struct event * unpause_event;
+  int taskCount; /* tasks currently in the multi handle */
+
+  /* other threads write a byte here when they add a task or close */
+  evutil_socket_t wakeup_fds[2];
+  struct event * wakeup_event;
 };
 
 /***
@@ -123,7 +168,11 @@ writeFunc (void * ptr, size_t size, size_t nmemb, void * vtask)
 
       if (tor && !tr_bandwidthClamp (&tor->bandwidth, TR_DOWN, nmemb))
         {
+          struct event * unpause_event = task->session->web->unpause_event;
+
           tr_list_append (&paused_easy_handles, task->curl_easy);
+          if (!evtimer_pending (unpause_event, NULL))
+            tr_timerAddMsec (unpause_event, UNPAUSE_INTERVAL_MSEC);
           return CURL_WRITEFUNC_PAUSE;
         }
     }
@@ -174,7 +223,19 @@ createEasy (tr_session * s, struct tr_web * web, struct tr_web_task * task)
 {
   bool is_default_value;
   const tr_address * addr;
-  CURL * e = task->curl_easy = curl_easy_init ();
+  CURL * e = tr_list_pop_front (&web->idle_easy_handles);
+
+  if (e != NULL)
+    {
+      --web->idle_easy_handle_count;
+      curl_easy_reset (e);
+    }
+  else
+    {
+      e = curl_easy_init ();
+    }
+
+  task->curl_easy = e;
 
   task->timeout_secs = getTimeoutFromURL (task);
 
@@ -187,6 +248,9 @@ createEasy (tr_session * s, struct tr_web * web, struct tr_web_task * task)
 #ifdef USE_LIBCURL_SOCKOPT
   curl_easy_setopt (e, CURLOPT_SOCKOPTFUNCTION, sockoptfunction);
   curl_easy_setopt (e, CURLOPT_SOCKOPTDATA, task);
+#endif
+#ifdef USE_LIBCURL_TCP_KEEPALIVE
+  curl_easy_setopt (e, CURLOPT_TCP_KEEPALIVE, 1L);
 #endif
   if (web->curl_ssl_verify)
     {
@@ -225,6 +289,20 @@ createEasy (tr_session * s, struct tr_web * web, struct tr_web_task * task)
   return e;
 }
 
+static void
+recycleEasy (struct tr_web * web, CURL * e)
+{
+  if (web->idle_easy_handle_count < MAX_IDLE_EASY_HANDLES)
+    {
+      tr_list_prepend (&web->idle_easy_handles, e);
+      ++web->idle_easy_handle_count;
+    }
+  else
+    {
+      curl_easy_cleanup (e);
+    }
+}
+
 /***
 ****
 ***/
@@ -253,6 +331,14 @@ task_finish_func (void * vtask)
 
 static void tr_webThreadFunc (void * vsession);
 
+static void
+wakeupWebThread (struct tr_web * web)
+{
+  /* if this fails because the socket's full, a wakeup is already pending */
+  const char ch = '\0';
+  send (web->wakeup_fds[1], &ch, 1, 0);
+}
+
 static struct tr_web_task *
 tr_webRunImpl (tr_session         * session,
                int                  torrentId,
@@ -290,6 +376,8 @@ tr_webRunImpl (tr_session         * session,
       task->next = session->web->tasks;
       session->web->tasks = task;
       tr_lockUnlock (session->web->taskLock);
+
+      wakeupWebThread (session->web);
     }
 
   return task;
@@ -333,48 +421,189 @@ tr_webRunWebseed (tr_torrent        * tor,
                         buffer);
 }
 
-/**
- * Portability wrapper for select ().
- *
- * http://msdn.microsoft.com/en-us/library/ms740141%28VS.85%29.aspx
- * On win32, any two of the parameters, readfds, writefds, or exceptfds,
- * can be given as null. At least one must be non-null, and any non-null
- * descriptor set must contain at least one handle to a socket.
- */
+/***
+****  The web thread's event loop
+***/
+
 static void
-tr_select (int nfds,
-           fd_set * r_fd_set, fd_set * w_fd_set, fd_set * c_fd_set,
-           struct timeval  * t)
+maybeStopWhenIdle (struct tr_web * web)
 {
-#ifdef _WIN32
-  (void) nfds;
+  if ((web->close_mode == TR_WEB_CLOSE_WHEN_IDLE) && (web->tasks == NULL) && (web->taskCount == 0))
+    event_base_loopbreak (web->base);
+}
+
+static void
+processFinishedTasks (struct tr_web * web)
+{
+  int unused;
+  CURLMsg * msg;
 
-  if (!r_fd_set->fd_count && !w_fd_set->fd_count && !c_fd_set->fd_count)
+  while ((msg = curl_multi_info_read (web->multi, &unused)))
     {
-      const long int msec = t->tv_sec*1000 + t->tv_usec/1000;
-      tr_wait_msec (msec);
+      if ((msg->msg == CURLMSG_DONE) && (msg->easy_handle != NULL))
+        {
+          double total_time;
+          struct tr_web_task * task;
+          long req_bytes_sent;
+          CURL * e = msg->easy_handle;
+          curl_easy_getinfo (e, CURLINFO_PRIVATE, (void*)&task);
+          assert (e == task->curl_easy);
+          curl_easy_getinfo (e, CURLINFO_RESPONSE_CODE, &task->code);
+          curl_easy_getinfo (e, CURLINFO_REQUEST_SIZE, &req_bytes_sent);
+          curl_easy_getinfo (e, CURLINFO_TOTAL_TIME, &total_time);
+          task->did_connect = task->code>0 || req_bytes_sent>0;
+          task->did_timeout = !task->code && (total_time >= task->timeout_secs);
+          curl_multi_remove_handle (web->multi, e);
+          tr_list_remove_data (&paused_easy_handles, e);
+          recycleEasy (web, e);
+          tr_runInEventThread (task->session, task_finish_func, task);
+          --web->taskCount;
+        }
     }
-  else if (select (0, r_fd_set->fd_count ? r_fd_set : NULL,
-                      w_fd_set->fd_count ? w_fd_set : NULL,
-                      c_fd_set->fd_count ? c_fd_set : NULL, t) < 0)
+
+  maybeStopWhenIdle (web);
+}
+
+static void
+onSocketEvent (evutil_socket_t fd, short what, void * vweb)
+{
+  int unused;
+  int action = 0;
+  struct tr_web * web = vweb;
+
+  if (what & EV_READ)
+    action |= CURL_CSELECT_IN;
+  if (what & EV_WRITE)
+    action |= CURL_CSELECT_OUT;
+
+  curl_multi_socket_action (web->multi, fd, action, &unused);
+  processFinishedTasks (web);
+}
+
+static void
+onTimer (evutil_socket_t fd UNUSED, short what UNUSED, void * vweb)
+{
+  int unused;
+  struct tr_web * web = vweb;
+
+  curl_multi_socket_action (web->multi, CURL_SOCKET_TIMEOUT, 0, &unused);
+  processFinishedTasks (web);
+}
+
+static void
+onUnpauseTimer (evutil_socket_t fd UNUSED, short what UNUSED, void * vweb)
+{
+  CURL * handle;
+  tr_list * tmp;
+  struct tr_web * web = vweb;
+
+  /* swap paused_easy_handles to prevent oscillation
+     between writeFunc and this loop */
+  tmp = paused_easy_handles;
+  paused_easy_handles = NULL;
+
+  while ((handle = tr_list_pop_front (&tmp)))
+    curl_easy_pause (handle, CURLPAUSE_CONT);
+
+  processFinishedTasks (web);
+}
+
+/* libcurl's CURLMOPT_SOCKETFUNCTION callback */
+static int
+curlSocketFunc (CURL           * easy UNUSED,
+                curl_socket_t    sockfd,
+                int              what,
+                void           * vweb,
+                void           * vevent)
+{
+  struct tr_web * web = vweb;
+  struct event * ev = vevent;
+
+  if (what == CURL_POLL_REMOVE)
     {
-      char errstr[512];
-      const int e = EVUTIL_SOCKET_ERROR ();
-      tr_net_strerror (errstr, sizeof (errstr), e);
-      dbgmsg ("Error: select (%d) %s", e, errstr);
+      if (ev != NULL)
+        event_free (ev);
     }
-#else
-  select (nfds, r_fd_set, w_fd_set, c_fd_set, t);
-#endif
+  else
+    {
+      short events = EV_PERSIST;
+
+      if (what & CURL_POLL_IN)
+        events |= EV_READ;
+      if (what & CURL_POLL_OUT)
+        events |= EV_WRITE;
+
+      if (ev == NULL)
+        {
+          ev = event_new (web->base, sockfd, events, onSocketEvent, web);
+          curl_multi_assign (web->multi, sockfd, ev);
+        }
+      else
+        {
+          event_del (ev);
+          event_assign (ev, web->base, sockfd, events, onSocketEvent, web);
+        }
+
+      event_add (ev, NULL);
+    }
+
+  return 0;
+}
+
+/* libcurl's CURLMOPT_TIMERFUNCTION callback */
+static int
+curlTimerFunc (CURLM * multi UNUSED, long timeout_msec, void * vweb)
+{
+  struct tr_web * web = vweb;
+
+  if (timeout_msec < 0)
+    evtimer_del (web->timer_event);
+  else
+    tr_timerAddMsec (web->timer_event, timeout_msec);
+
+  return 0;
+}
+
+static void
+onWakeup (evutil_socket_t fd, short what UNUSED, void * vweb)
+{
+  char buf[64];
+  struct tr_web * web = vweb;
+  struct tr_web_task * task;
+
+  /* drain the socket */
+  while (recv (fd, buf, sizeof (buf), 0) > 0)
+    ;
+
+  if (web->close_mode == TR_WEB_CLOSE_NOW)
+    {
+      event_base_loopbreak (web->base);
+      return;
+    }
+
+  /* add tasks from the queue */
+  tr_lockLock (web->taskLock);
+  while (web->tasks != NULL)
+    {
+      /* pop the task */
+      task = web->tasks;
+      web->tasks = task->next;
+      task->next = NULL;
+
+      dbgmsg ("adding task to curl: [%s]", task->url);
+      curl_multi_add_handle (web->multi, createEasy (task->session, web, task));
+      ++web->taskCount;
+    }
+  tr_lockUnlock (web->taskLock);
+
+  maybeStopWhenIdle (web);
 }
 
 static void
 tr_webThreadFunc (void * vsession)
 {
   char * str;
-  CURLM * multi;
   struct tr_web * web;
-  int taskCount = 0;
   struct tr_web_task * task;
   tr_session * session = vsession;
 
@@ -403,110 +632,31 @@ tr_webThreadFunc (void * vsession)
     web->cookie_filename = tr_strdup (str);
   tr_free (str);
 
-  multi = curl_multi_init ();
+  if (evutil_socketpair (WAKEUP_SOCKETPAIR_AF, SOCK_STREAM, 0, web->wakeup_fds) == -1)
+    tr_logAddNamedError ("web", "Couldn't create the web thread's wakeup socket: %s",
+                         tr_strerror (errno));
+  evutil_make_socket_nonblocking (web->wakeup_fds[0]);
+  evutil_make_socket_nonblocking (web->wakeup_fds[1]);
+
+  web->base = event_base_new ();
+  web->timer_event = evtimer_new (web->base, onTimer, web);
+  web->unpause_event = evtimer_new (web->base, onUnpauseTimer, web);
+  web->wakeup_event = event_new (web->base, web->wakeup_fds[0], EV_READ | EV_PERSIST, onWakeup, web);
+  event_add (web->wakeup_event, NULL);
+
+  web->multi = curl_multi_init ();
+  curl_multi_setopt (web->multi, CURLMOPT_MAXCONNECTS, (long)MAX_CACHED_CONNECTIONS);
+#ifdef USE_LIBCURL_MAX_HOST_CONNECTIONS
+  curl_multi_setopt (web->multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long)MAX_HOST_CONNECTIONS);
+#endif
+  curl_multi_setopt (web->multi, CURLMOPT_SOCKETFUNCTION, curlSocketFunc);
+  curl_multi_setopt (web->multi, CURLMOPT_SOCKETDATA, web);
+  curl_multi_setopt (web->multi, CURLMOPT_TIMERFUNCTION, curlTimerFunc);
+  curl_multi_setopt (web->multi, CURLMOPT_TIMERDATA, web);
   session->web = web;
 
-  for (;;)
-    {
-      long msec;
-      int unused;
-      CURLMsg * msg;
-      CURLMcode mcode;
-
-      if (web->close_mode == TR_WEB_CLOSE_NOW)
-        break;
-      if ((web->close_mode == TR_WEB_CLOSE_WHEN_IDLE) && (web->tasks == NULL))
-        break;
-
-      /* add tasks from the queue */
-      tr_lockLock (web->taskLock);
-      while (web->tasks != NULL)
-        {
-          /* pop the task */
-          task = web->tasks;
-          web->tasks = task->next;
-          task->next = NULL;
-
-          dbgmsg ("adding task to curl: [%s]", task->url);
-          curl_multi_add_handle (multi, createEasy (session, web, task));
-          /*fprintf (stderr, "adding a task.. taskCount is now %d\n", taskCount);*/
-          ++taskCount;
-        }
-      tr_lockUnlock (web->taskLock);
-
-      /* unpause any paused curl handles */
-      if (paused_easy_handles != NULL)
-        {
-          CURL * handle;
-          tr_list * tmp;
-
-          /* swap paused_easy_handles to prevent oscillation
-             between writeFunc this while loop */
-          tmp = paused_easy_handles;
-          paused_easy_handles = NULL;
-
-          while ((handle = tr_list_pop_front (&tmp)))
-            curl_easy_pause (handle, CURLPAUSE_CONT);
-        }
-
-      /* maybe wait a little while before calling curl_multi_perform () */
-      msec = 0;
-      curl_multi_timeout (multi, &msec);
-      if (msec < 0)
-        msec = THREADFUNC_MAX_SLEEP_MSEC;
-      if (session->isClosed)
-        msec = 100; /* on shutdown, call perform () more frequently */
-      if (msec > 0)
-        {
-          int usec;
-          int max_fd;
-          struct timeval t;
-          fd_set r_fd_set, w_fd_set, c_fd_set;
-
-          max_fd = 0;
-          FD_ZERO (&r_fd_set);
-          FD_ZERO (&w_fd_set);
-          FD_ZERO (&c_fd_set);
-          curl_multi_fdset (multi, &r_fd_set, &w_fd_set, &c_fd_set, &max_fd);
-
-          if (msec > THREADFUNC_MAX_SLEEP_MSEC)
-            msec = THREADFUNC_MAX_SLEEP_MSEC;
-
-          usec = msec * 1000;
-          t.tv_sec =  usec / 1000000;
-          t.tv_usec = usec % 1000000;
-          tr_select (max_fd+1, &r_fd_set, &w_fd_set, &c_fd_set, &t);
-        }
-
-      /* call curl_multi_perform () */
-      do
-        mcode = curl_multi_perform (multi, &unused);
-      while (mcode == CURLM_CALL_MULTI_PERFORM);
-
-      /* pump completed tasks from the multi */
-      while ((msg = curl_multi_info_read (multi, &unused)))
-        {
-          if ((msg->msg == CURLMSG_DONE) && (msg->easy_handle != NULL))
-            {
-              double total_time;
-              struct tr_web_task * task;
-              long req_bytes_sent;
-              CURL * e = msg->easy_handle;
-              curl_easy_getinfo (e, CURLINFO_PRIVATE, (void*)&task);
-              assert (e == task->curl_easy);
-              curl_easy_getinfo (e, CURLINFO_RESPONSE_CODE, &task->code);
-              curl_easy_getinfo (e, CURLINFO_REQUEST_SIZE, &req_bytes_sent);
-              curl_easy_getinfo (e, CURLINFO_TOTAL_TIME, &total_time);
-              task->did_connect = task->code>0 || req_bytes_sent>0;
-              task->did_timeout = !task->code && (total_time >= task->timeout_secs);
-              curl_multi_remove_handle (multi, e);
-              tr_list_remove_data (&paused_easy_handles, e);
-              curl_easy_cleanup (e);
-              tr_runInEventThread (task->session, task_finish_func, task);
-              --taskCount;
-            }
-        }
-    }
+  /* sleep until libcurl or another thread has something for us to do */
+  event_base_dispatch (web->base);
 
   /* Discard any remaining tasks.
    * This is rare, but can happen on shutdown with unresponsive trackers. */
@@ -520,7 +670,14 @@ tr_webThreadFunc (void * vsession)
 
   /* cleanup */
   tr_list_free (&paused_easy_handles, NULL);
-  curl_multi_cleanup (multi);
+  tr_list_free (&web->idle_easy_handles, (TrListForeachFunc)curl_easy_cleanup);
+  curl_multi_cleanup (web->multi);
+  event_free (web->wakeup_event);
+  event_free (web->unpause_event);
+  event_free (web->timer_event);
+  event_base_free (web->base);
+  evutil_closesocket (web->wakeup_fds[0]);
+  evutil_closesocket (web->wakeup_fds[1]);
   tr_lockFree (web->taskLock);
   tr_free (web->curl_ca_bundle);
   tr_free (web->cookie_filename);
@@ -535,6 +692,7 @@ tr_webClose (tr_session * session, tr_web_close_mode close_mode)
   if (session->web != NULL)
     {
       session->web->close_mode = close_mode;
+      wakeupWebThread (session->web);
 
       if (close_mode == TR_WEB_CLOSE_NOW)
         while (session->web != NULL)
@@ -323,7 +323,8 @@ on_idle (tr_webseed * w)
       w->retry_challenge = running_tasks + w->idle_connections + 1;
     }
 
-  if (tor && tor->isRunning && !tr_torrentIsSeed (tor) && (want > 0))
+  if (tor && tor->isRunning && !tr_torrentIsSeed (tor) && (want > 0)
+      && tr_torrentIsPieceTransferAllowed (tor, TR_PEER_TO_CLIENT))
     {
       int i;
       int got = 0;